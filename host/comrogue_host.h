@@ -0,0 +1,87 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#ifndef __COMROGUE_HOST_H_INCLUDED
+#define __COMROGUE_HOST_H_INCLUDED
+
+#include <comrogue/types.h>
+#include <comrogue/compiler_macros.h>
+#include <comrogue/allocator.h>
+#include <comrogue/mutex.h>
+#include <comrogue/threadlocal.h>
+#include <comrogue/heap.h>
+
+/*-----------------------------------------------------------------------------------------------------------
+ * Host (Linux) stand-ins for the system interfaces the heap needs, so that kernel/lib can be built and
+ * exercised in a user process.  Chunks come from mmap(), mutexes are futex-based, and thread-local values live
+ * in per-thread blocks.  The host layer also supplies the process entry point, threads, a clock, and console
+ * output, all built directly on Linux system calls.  A program linked against it provides HostMain() in place
+ * of main().
+ *
+ * The chunk allocator and the two factories returned here are static; AddRef and Release on them are no-ops.
+ *-----------------------------------------------------------------------------------------------------------
+ */
+
+/* Host thread function and handle */
+typedef INT32 (*PFNHOSTTHREAD)(PVOID);
+typedef struct tagHOSTTHREAD *PHOSTTHREAD;
+
+/* Running totals kept by the host chunk allocator */
+typedef struct tagHOSTCHUNKSTATS {
+  SIZE_T cbMapped;           /* bytes currently mapped as chunks */
+  UINT64 cbUnmapped;         /* total bytes of chunks freed */
+  UINT64 cbPurged;           /* total bytes purged */
+  UINT32 cChunkAllocs;       /* number of chunk allocations */
+} HOSTCHUNKSTATS, *PHOSTCHUNKSTATS;
+
+CDECL_BEGIN
+
+/* Supplied by the program */
+extern INT32 HostMain(void);
+
+/* System interface stand-ins */
+extern IChunkAllocator *HostGetChunkAllocator(void);
+extern void HostGetChunkStats(PHOSTCHUNKSTATS pStats);
+extern IMutexFactory *HostGetMutexFactory(void);
+extern IThreadLocalFactory *HostGetThreadLocalFactory(void);
+extern HRESULT HostCreateHeap(PRAWHEAPDATA prhd, UINT32 uiFlags, UINT32 cArenas, IMalloc **ppMalloc);
+
+/* Threads, time, and output */
+extern HRESULT HostThreadCreate(PFNHOSTTHREAD pfnThread, PVOID pvArg, PHOSTTHREAD *ppthr);
+extern INT32 HostThreadJoin(PHOSTTHREAD pthr);
+extern void HostThreadYield(void);
+extern UINT64 HostTimeNs(void);
+extern void HostPrintf(PCSTR pszFormat, ...);
+extern void HostExit(INT32 nExitCode);
+
+CDECL_END
+
+#endif /* __COMROGUE_HOST_H_INCLUDED */
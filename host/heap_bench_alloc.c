@@ -0,0 +1,202 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include <comrogue/scode.h>
+#include <comrogue/allocator.h>
+#include <comrogue/heap.h>
+#include "comrogue_host.h"
+
+/*-------------------------------------------------------------------------------------------------------------
+ * Single-threaded throughput benchmark of the heap's Alloc/Free path on the host stand-ins.  For each size, it
+ * times alloc/free pairs (each block freed right after it is allocated) and batches (a run of blocks allocated,
+ * then all of them freed), with and without the thread cache, and reports nanoseconds per Alloc+Free.  Next to
+ * each timing, it reports how many kilobytes the heap purged during that run, and at the end of the line how many
+ * chunks it mapped during both, since either one means system calls and page faults are part of what was measured.
+ *-------------------------------------------------------------------------------------------------------------
+ */
+
+#define MAX_BATCH  256    /* largest number of blocks held at once by the batch pattern */
+
+typedef struct tagBENCHSIZE {
+  SIZE_T cb;           /* block size */
+  UINT32 nOps;         /* number of Alloc+Free pairs to time */
+  UINT32 nBatch;       /* number of blocks per batch */
+} BENCHSIZE, *PBENCHSIZE;
+
+/* Small, large, and huge sizes; the big sizes run fewer, smaller batches to bound the memory in use. */
+static const BENCHSIZE SEG_RODATA s_absSizes[] = {
+  { 8,       400000, MAX_BATCH },
+  { 48,      400000, MAX_BATCH },
+  { 256,     400000, MAX_BATCH },
+  { 1024,    200000, MAX_BATCH },
+  { 3584,    200000, MAX_BATCH },
+  { 8192,    100000, MAX_BATCH },
+  { 65536,   50000,  MAX_BATCH },
+  { 1048576, 5000,   16 },
+  { 8388608, 1000,   4 }
+};
+#define NSIZES  (sizeof(s_absSizes) / sizeof(BENCHSIZE))
+
+static RAWHEAPDATA g_rhd;              /* heap data for the heap being measured */
+static PVOID g_apvBatch[MAX_BATCH];    /* blocks held by the batch pattern */
+static BOOL g_fFailed = FALSE;         /* did an allocation fail? */
+
+/*
+ * Times alloc/free pairs of a single size.
+ *
+ * Parameters:
+ * - pMalloc = Heap being measured.
+ * - cb = Block size.
+ * - nOps = Number of pairs to time.
+ *
+ * Returns:
+ * Tenths of a nanosecond per pair.
+ */
+static UINT32 bench_pair(IMalloc *pMalloc, SIZE_T cb, UINT32 nOps)
+{
+  UINT64 tmStart;   /* starting time */
+  PVOID pv;         /* block pointer */
+  UINT32 i;         /* loop counter */
+
+  tmStart = HostTimeNs();
+  for (i = 0; i < nOps; i++)
+  {
+    pv = IMalloc_Alloc(pMalloc, cb);
+    if (!pv)
+    {
+      g_fFailed = TRUE;
+      return 0;
+    }
+    *((PBYTE)pv) = (BYTE)i;
+    IMalloc_Free(pMalloc, pv);
+  }
+  return (UINT32)(((HostTimeNs() - tmStart) * 10) / nOps);
+}
+
+/*
+ * Times batches of allocations of a single size, each batch freed in allocation order.
+ *
+ * Parameters:
+ * - pMalloc = Heap being measured.
+ * - cb = Block size.
+ * - nOps = Number of Alloc+Free pairs to time; rounded down to a whole number of batches.
+ * - nBatch = Number of blocks per batch.
+ *
+ * Returns:
+ * Tenths of a nanosecond per Alloc+Free pair.
+ */
+static UINT32 bench_batch(IMalloc *pMalloc, SIZE_T cb, UINT32 nOps, UINT32 nBatch)
+{
+  UINT32 nRounds = nOps / nBatch;   /* number of batches */
+  UINT64 tmStart;                   /* starting time */
+  UINT32 i, j;                      /* loop counters */
+
+  tmStart = HostTimeNs();
+  for (i = 0; i < nRounds; i++)
+  {
+    for (j = 0; j < nBatch; j++)
+    {
+      g_apvBatch[j] = IMalloc_Alloc(pMalloc, cb);
+      if (!(g_apvBatch[j]))
+      {
+	g_fFailed = TRUE;
+	return 0;
+      }
+      *((PBYTE)(g_apvBatch[j])) = (BYTE)j;
+    }
+    for (j = 0; j < nBatch; j++)
+      IMalloc_Free(pMalloc, g_apvBatch[j]);
+  }
+  return (UINT32)(((HostTimeNs() - tmStart) * 10) / (nRounds * nBatch));
+}
+
+/*
+ * Runs every size against one heap configuration and prints a line per size.
+ *
+ * Parameters:
+ * - pszName = Name of the configuration.
+ * - uiFlags = Flags to create the heap with.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void bench_config(PCSTR pszName, UINT32 uiFlags)
+{
+  IMalloc *pMalloc;           /* heap being measured */
+  HOSTCHUNKSTATS csStart;     /* chunk statistics before the timed runs */
+  HOSTCHUNKSTATS csPair;      /* chunk statistics after the pair run */
+  HOSTCHUNKSTATS csBatch;     /* chunk statistics after the batch run */
+  UINT32 nPair;               /* pair result */
+  UINT32 nBatch;              /* batch result */
+  UINT32 i;                   /* loop counter */
+
+  if (FAILED(HostCreateHeap(&g_rhd, uiFlags, 1, &pMalloc)))
+  {
+    HostPrintf("heap_bench_alloc: cannot create heap\n");
+    g_fFailed = TRUE;
+    return;
+  }
+  for (i = 0; (i < NSIZES) && !g_fFailed; i++)
+  {
+    /* one untimed batch first, so the run starts with the heap's chunks and caches in place */
+    bench_batch(pMalloc, s_absSizes[i].cb, s_absSizes[i].nBatch, s_absSizes[i].nBatch);
+    HostGetChunkStats(&csStart);
+    nPair = bench_pair(pMalloc, s_absSizes[i].cb, s_absSizes[i].nOps);
+    HostGetChunkStats(&csPair);
+    nBatch = bench_batch(pMalloc, s_absSizes[i].cb, s_absSizes[i].nOps, s_absSizes[i].nBatch);
+    HostGetChunkStats(&csBatch);
+    HostPrintf("%8s %8u %8u.%u %10u %8u.%u %10u %8u\n", pszName, s_absSizes[i].cb, nPair / 10, nPair % 10,
+	       (UINT32)((csPair.cbPurged - csStart.cbPurged) >> 10), nBatch / 10, nBatch % 10,
+	       (UINT32)((csBatch.cbPurged - csPair.cbPurged) >> 10), csBatch.cChunkAllocs - csStart.cChunkAllocs);
+  }
+  IUnknown_Release(pMalloc);
+}
+
+/*
+ * Runs the benchmark.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * 0 if every allocation succeeded, 1 if not.
+ */
+INT32 HostMain(void)
+{
+  HostPrintf("heap_bench_alloc: ns per Alloc+Free, KiB purged during each run, chunks mapped\n");
+  HostPrintf("%8s %8s %10s %10s %10s %10s %8s\n", "config", "size", "pair", "purged", "batch", "purged", "chunks");
+  bench_config("tcache", 0);
+  bench_config("notcache", PHDFLAGS_NOTCACHE);
+  if (g_fFailed)
+    HostPrintf("heap_bench_alloc: allocation failed\n");
+  return g_fFailed ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include <comrogue/intlib.h>
+#include "comrogue_host.h"
+#include "heap_internals.h"
+
+/*-------------------------------------------------------------------------------------------------------------
+ * Microbenchmark of the bit-manipulation functions in intlib.h and the heap bitmap built on them, on the host
+ * stand-ins.  Each function is timed inline over a table of inputs, once with random values and once with values
+ * that have a single bit set, and the cost per call is reported.  For comparison, the shift-and-test IntFirstSet
+ * loop and the or-shift power-of-2 ceiling the inline versions replaced are timed as out-of-line functions, as
+ * they were.  Call costs of a nanosecond or so are at the limit of what this can resolve.
+ *-------------------------------------------------------------------------------------------------------------
+ */
+
+#define NVALUES      4096          /* number of inputs in each table */
+#define BENCH_REPS   2000          /* number of passes over the table */
+#define BITMAP_BITS  RUN_MAXREGS   /* size of the bitmap timed */
+#define BITMAP_REPS  2000          /* number of times the bitmap is filled */
+
+static UINT32 g_auiRandom[NVALUES];    /* random inputs */
+static UINT32 g_auiOneBit[NVALUES];    /* inputs with a single bit set */
+static UINT32 volatile g_uiSink;       /* results go here, so the work can't be discarded */
+static BITMAPINFO g_binfo;             /* bitmap information */
+static BITMAP g_abitmap[2 * (BITMAP_BITS / BITMAP_GROUP_NBITS)];   /* bitmap being timed */
+
+/*
+ * The IntFirstSet loop that the inline version replaced.
+ */
+static __attribute__((noinline)) INT32 old_first_set(INT32 nMask)
+{
+  register INT32 nBit;  /* bit index to return */
+  if (nMask)
+  {
+    for (nBit = 1; !(nMask & 1); nBit++)
+      nMask = ((UINT32)nMask) >> 1;
+    return nBit;
+  }
+  else
+    return 0;
+}
+
+/*
+ * The _HeapPow2Ceiling that IntPow2Ceiling replaced.
+ */
+static __attribute__((noinline)) SIZE_T old_pow2_ceiling(SIZE_T x)
+{
+  x--;
+  x |= (x >> 1);
+  x |= (x >> 2);
+  x |= (x >> 4);
+  x |= (x >> 8);
+  x |= (x >> 16);
+  return ++x;
+}
+
+/*
+ * Defines a function that times an expression in x over a table of inputs, returning hundredths of a
+ * nanosecond per evaluation.  The empty asm keeps the compiler from folding passes over the table together.
+ */
+#define BENCH_FUNCTION(name, expr) \
+static UINT32 name(const UINT32 *pauiValues) \
+{ \
+  UINT64 tmStart = HostTimeNs(); \
+  UINT32 uiAcc = 0; \
+  UINT32 x; \
+  UINT32 r, i; \
+  for (r = 0; r < BENCH_REPS; r++) \
+  { \
+    __asm__ volatile ("" : : "r" (pauiValues) : "memory"); \
+    for (i = 0; i < NVALUES; i++) \
+    { \
+      x = pauiValues[i]; \
+      uiAcc += (UINT32)(expr); \
+    } \
+  } \
+  g_uiSink += uiAcc; \
+  return (UINT32)(((HostTimeNs() - tmStart) * 100) / ((UINT64)BENCH_REPS * NVALUES)); \
+}
+
+BENCH_FUNCTION(bench_baseline, x)
+BENCH_FUNCTION(bench_first_set, IntFirstSet((INT32)x))
+BENCH_FUNCTION(bench_old_first_set, old_first_set((INT32)x))
+BENCH_FUNCTION(bench_last_set, IntLastSet(x))
+BENCH_FUNCTION(bench_clz, IntCountLeadingZeros(x))
+BENCH_FUNCTION(bench_popcount, IntPopCount(x))
+BENCH_FUNCTION(bench_pow2_ceiling, IntPow2Ceiling(x >> 1))
+BENCH_FUNCTION(bench_old_pow2_ceiling, old_pow2_ceiling(x >> 1))
+BENCH_FUNCTION(bench_pow2_floor, IntPow2Floor(x))
+
+typedef UINT32 (*PFNBENCH)(const UINT32 *);
+
+typedef struct tagBENCHFUNC {
+  PCSTR pszName;        /* name of the function timed */
+  PFNBENCH pfnBench;    /* timing function */
+} BENCHFUNC;
+
+static const BENCHFUNC SEG_RODATA s_abf[] = {
+  { "(loop overhead)", bench_baseline },
+  { "IntFirstSet", bench_first_set },
+  { "IntFirstSet, old loop", bench_old_first_set },
+  { "IntLastSet", bench_last_set },
+  { "IntCountLeadingZeros", bench_clz },
+  { "IntPopCount", bench_popcount },
+  { "IntPow2Ceiling", bench_pow2_ceiling },
+  { "IntPow2Ceiling, old or-shift", bench_old_pow2_ceiling },
+  { "IntPow2Floor", bench_pow2_floor }
+};
+#define NFUNCS  (sizeof(s_abf) / sizeof(BENCHFUNC))
+
+/*
+ * Times _HeapBitmapSetFirstUnset by filling a bitmap of the largest size a run uses, over and over.  The time
+ * includes reinitializing the bitmap before each fill, which is small next to the fill.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * Hundredths of a nanosecond per call.
+ */
+static UINT32 bench_bitmap(void)
+{
+  UINT64 tmStart;      /* starting time */
+  SIZE_T nAcc = 0;     /* sum of bit indexes returned */
+  UINT32 r, i;         /* loop counters */
+
+  tmStart = HostTimeNs();
+  for (r = 0; r < BITMAP_REPS; r++)
+  {
+    _HeapBitmapInit(g_abitmap, &g_binfo);
+    for (i = 0; i < BITMAP_BITS; i++)
+      nAcc += _HeapBitmapSetFirstUnset(g_abitmap, &g_binfo);
+  }
+  g_uiSink += (UINT32)nAcc;
+  return (UINT32)(((HostTimeNs() - tmStart) * 100) / ((UINT64)BITMAP_REPS * BITMAP_BITS));
+}
+
+/*
+ * Prints a time in hundredths of a nanosecond.
+ *
+ * Parameters:
+ * - n = Time to print.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void print_time(UINT32 n)
+{
+  HostPrintf(" %6u.%02u", n / 100, n % 100);
+}
+
+/*
+ * Runs the benchmark.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * 0 if the bitmap fits the static buffer, 1 if not.
+ */
+INT32 HostMain(void)
+{
+  UINT32 uiRand = 1;   /* pseudo-random state */
+  UINT32 i;            /* loop counter */
+
+  for (i = 0; i < NVALUES; i++)
+  {
+    uiRand = uiRand * 1103515245 + 12345;
+    g_auiRandom[i] = (uiRand & 0xFFFF0000) | ((uiRand * 1103515245 + 12345) >> 16);
+    g_auiOneBit[i] = 1U << ((uiRand >> 16) & 31);
+  }
+  _HeapBitmapInfoInit(&g_binfo, BITMAP_BITS);
+  if (_HeapBitmapSize(BITMAP_BITS) > sizeof(g_abitmap))
+  {
+    HostPrintf("heap_bench_bits: bitmap buffer too small\n");
+    return 1;
+  }
+
+  HostPrintf("heap_bench_bits: ns per call\n");
+  HostPrintf("%9s %9s  %s\n", "random", "one bit", "function");
+  for (i = 0; i < NFUNCS; i++)
+  {
+    print_time((*(s_abf[i].pfnBench))(g_auiRandom));
+    print_time((*(s_abf[i].pfnBench))(g_auiOneBit));
+    HostPrintf("  %s\n", s_abf[i].pszName);
+  }
+  print_time(bench_bitmap());
+  HostPrintf(" %9s  _HeapBitmapSetFirstUnset, %u-bit bitmap\n", "", BITMAP_BITS);
+  return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include <comrogue/scode.h>
+#include <comrogue/allocator.h>
+#include <comrogue/heap.h>
+#include "comrogue_host.h"
+
+/*-------------------------------------------------------------------------------------------------------------
+ * Fragmentation benchmark of the heap's large-run allocator on the host stand-ins.  It replays a fixed,
+ * pseudo-random trace of large allocations (4 Kb up to 2 Mb) and frees, with a bounded number of blocks live
+ * at once.  At intervals it reports the bytes requested by live blocks, the bytes in active pages, and the bytes
+ * mapped in chunks.  The active/requested ratio is the cost of page rounding and large size classes; the
+ * mapped/active ratio is the cost of free runs stranded between live ones.  At the end, three blocks in four are
+ * freed, to show how much coalescing gives back.
+ *-------------------------------------------------------------------------------------------------------------
+ */
+
+#define LIVE_SLOTS       512       /* number of blocks live at once */
+#define TRACE_STEPS      200000    /* number of free/allocate steps in the trace */
+#define REPORT_INTERVAL  20000     /* steps between reports */
+
+static RAWHEAPDATA g_rhd;               /* heap data for the heap being measured */
+static PVOID g_apvLive[LIVE_SLOTS];     /* live blocks */
+static SIZE_T g_acbLive[LIVE_SLOTS];    /* requested sizes of live blocks */
+static UINT32 g_uiRand = 1;             /* pseudo-random state */
+
+/*
+ * Returns the next pseudo-random number of the trace.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * A 16-bit pseudo-random number.
+ */
+static UINT32 trace_rand(void)
+{
+  g_uiRand = g_uiRand * 1103515245 + 12345;
+  return (g_uiRand >> 16) & 0xFFFF;
+}
+
+/*
+ * Returns the next size in the trace: mostly driver-buffer sizes of a few pages, some up to 256 Kb, and a few up
+ * to 2 Mb.  Half the sizes are whole pages, half are not.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * The size to allocate.
+ */
+static SIZE_T trace_size(void)
+{
+  UINT32 uiClass = trace_rand() % 10;   /* which range to use */
+  SIZE_T cb;                            /* size to allocate */
+
+  if (uiClass < 6)
+    cb = 4096 + (trace_rand() % 28672);
+  else if (uiClass < 9)
+    cb = 32768 + ((trace_rand() << 2) % 229376);
+  else
+    cb = 262144 + ((trace_rand() << 5) % 1835008);
+  if (trace_rand() & 1)
+    cb = (cb + 4095) & ~4095;
+  return cb;
+}
+
+/*
+ * Returns a ratio in tenths of a percent.
+ *
+ * Parameters:
+ * - cbNum = Numerator.
+ * - cbDenom = Denominator.
+ *
+ * Returns:
+ * 1000 * cbNum / cbDenom, or 0 if cbDenom is 0.
+ */
+static UINT32 ratio_tenths(UINT64 cbNum, UINT64 cbDenom)
+{
+  return cbDenom ? (UINT32)((cbNum * 1000) / cbDenom) : 0;
+}
+
+/*
+ * Prints one line of the report.
+ *
+ * Parameters:
+ * - pStats = Heap statistics interface.
+ * - pszLabel = Label for the line, or NULL to label it with the step number.
+ * - nStep = Step number of the trace.
+ * - cbRequested = Bytes requested by live blocks.
+ * - pcbPeakMapped = Pointer to the peak mapped byte count, updated.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void report(IHeapStatistics *pStats, PCSTR pszLabel, UINT32 nStep, SIZE_T cbRequested,
+		   SIZE_T *pcbPeakMapped)
+{
+  HEAPSTATS hs;        /* heap statistics */
+  UINT32 nActive;      /* active/requested ratio */
+  UINT32 nMapped;      /* mapped/active ratio */
+
+  IHeapStatistics_Refresh(pStats);
+  IHeapStatistics_GetHeapStats(pStats, &hs);
+  if (hs.cbMapped > *pcbPeakMapped)
+    *pcbPeakMapped = hs.cbMapped;
+  nActive = ratio_tenths(hs.cbActive, cbRequested);
+  nMapped = ratio_tenths(hs.cbMapped, hs.cbActive);
+  if (pszLabel)
+    HostPrintf("%8s", pszLabel);
+  else
+    HostPrintf("%8u", nStep);
+  HostPrintf(" %10u %10u %10u %6u.%u%% %6u.%u%%\n", cbRequested >> 10, hs.cbActive >> 10, hs.cbMapped >> 10,
+	     nActive / 10, nActive % 10, nMapped / 10, nMapped % 10);
+}
+
+/*
+ * Runs the benchmark.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * 0 if every allocation succeeded, 1 if not.
+ */
+INT32 HostMain(void)
+{
+  IMalloc *pMalloc;            /* heap being measured */
+  IHeapStatistics *pStats;     /* statistics interface */
+  IHeapConfiguration *pConfig; /* configuration interface */
+  SIZE_T cbRequested = 0;      /* bytes requested by live blocks */
+  SIZE_T cbPeakRequested = 0;  /* peak of cbRequested */
+  SIZE_T cbPeakMapped = 0;     /* peak mapped bytes */
+  SIZE_T cbReleased;           /* bytes released by Minimize */
+  UINT32 i, ndx;               /* loop counter and slot index */
+  BOOL fFailed = FALSE;        /* did an allocation fail? */
+
+  /* no thread cache and one arena, so every large free goes straight back to the arena */
+  if (FAILED(HostCreateHeap(&g_rhd, PHDFLAGS_NOTCACHE, 1, &pMalloc)))
+  {
+    HostPrintf("heap_bench_frag: cannot create heap\n");
+    return 1;
+  }
+  IUnknown_QueryInterface(pMalloc, &IID_IHeapStatistics, (PPVOID)(&pStats));
+  IUnknown_QueryInterface(pMalloc, &IID_IHeapConfiguration, (PPVOID)(&pConfig));
+
+  HostPrintf("heap_bench_frag: Kb requested, active, and mapped; active/requested and mapped/active\n");
+  HostPrintf("%8s %10s %10s %10s %8s %8s\n", "step", "requested", "active", "mapped", "act/req", "map/act");
+  for (i = 1; (i <= TRACE_STEPS) && !fFailed; i++)
+  {
+    ndx = trace_rand() % LIVE_SLOTS;
+    if (g_apvLive[ndx])
+    {
+      IMalloc_Free(pMalloc, g_apvLive[ndx]);
+      cbRequested -= g_acbLive[ndx];
+    }
+    g_acbLive[ndx] = trace_size();
+    g_apvLive[ndx] = IMalloc_Alloc(pMalloc, g_acbLive[ndx]);
+    if (!(g_apvLive[ndx]))
+    {
+      fFailed = TRUE;
+      break;
+    }
+    *((PBYTE)(g_apvLive[ndx])) = (BYTE)i;
+    cbRequested += g_acbLive[ndx];
+    if (cbRequested > cbPeakRequested)
+      cbPeakRequested = cbRequested;
+    if (i % REPORT_INTERVAL == 0)
+      report(pStats, NULL, i, cbRequested, &cbPeakMapped);
+  }
+
+  /* free three blocks in four; the survivors pin chunks, but the holes between them should coalesce */
+  for (i = 0; i < LIVE_SLOTS; i++)
+    if ((i % 4 != 0) && g_apvLive[i])
+    {
+      IMalloc_Free(pMalloc, g_apvLive[i]);
+      cbRequested -= g_acbLive[i];
+      g_apvLive[i] = NULL;
+    }
+  report(pStats, "3/4 free", 0, cbRequested, &cbPeakMapped);
+  IHeapConfiguration_Minimize(pConfig, &cbReleased);
+  report(pStats, "minimize", 0, cbRequested, &cbPeakMapped);
+  HostPrintf("peak requested %u Kb, peak mapped %u Kb, peak mapped/peak requested %u%%\n", cbPeakRequested >> 10,
+	     cbPeakMapped >> 10, ratio_tenths(cbPeakMapped, cbPeakRequested) / 10);
+
+  for (i = 0; i < LIVE_SLOTS; i++)
+    IMalloc_Free(pMalloc, g_apvLive[i]);
+  IUnknown_Release(pConfig);
+  IUnknown_Release(pStats);
+  IUnknown_Release(pMalloc);
+  if (fFailed)
+    HostPrintf("heap_bench_frag: allocation failed\n");
+  return fFailed ? 1 : 0;
+}
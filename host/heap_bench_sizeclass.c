@@ -0,0 +1,195 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include <comrogue/scode.h>
+#include <comrogue/allocator.h>
+#include <comrogue/heap.h>
+#include "comrogue_host.h"
+
+/*-------------------------------------------------------------------------------------------------------------
+ * Internal fragmentation benchmark of the heap's size classes on the host stand-ins.  The Makefile links this
+ * program once per size-class configuration, against a build of the heap with that configuration's generated
+ * heap_size_classes.h forced in (which also supplies NBINS, LG_QUANTUM and SMALL_MAXCLASS here).  Each trace is
+ * allocated in full, and the bytes requested are compared with the bytes GetSize reports; the difference is what
+ * the size classes waste.
+ *-------------------------------------------------------------------------------------------------------------
+ */
+
+#ifndef SIZECLASS_CONFIG
+#error SIZECLASS_CONFIG must name the size-class configuration
+#endif
+
+#define TRACE_LENGTH  4000    /* number of allocations in each trace */
+
+/* Object sizes typical of kernel structures: interface objects, list and tree nodes, small descriptors. */
+static const SIZE_T SEG_RODATA s_acbObjects[] = { 12, 16, 20, 24, 28, 36, 40, 44, 52, 60, 68, 72, 84, 100, 116, 132,
+						  148, 164, 196, 212, 260, 292, 356, 420, 516, 660 };
+#define NOBJECTS  (sizeof(s_acbObjects) / sizeof(SIZE_T))
+
+typedef SIZE_T (*PFNTRACESIZE)(UINT32 i);
+
+typedef struct tagTRACE {
+  PCSTR pszName;            /* name of the trace */
+  PFNTRACESIZE pfnSize;     /* returns the size of the trace's i'th allocation */
+} TRACE;
+
+static RAWHEAPDATA g_rhd;                      /* heap data for the heap being measured */
+static PVOID g_apvBlocks[TRACE_LENGTH];        /* blocks allocated by the trace */
+static UINT32 g_uiRand;                        /* pseudo-random state */
+
+/*
+ * Returns the next pseudo-random number for a trace.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * A 16-bit pseudo-random number.
+ */
+static UINT32 trace_rand(void)
+{
+  g_uiRand = g_uiRand * 1103515245 + 12345;
+  return (g_uiRand >> 16) & 0xFFFF;
+}
+
+/*
+ * Object trace: kernel structure sizes, the smaller ones more often.
+ */
+static SIZE_T trace_objects(UINT32 i)
+{
+  UINT32 n = trace_rand() % NOBJECTS;   /* first pick */
+  UINT32 n2 = trace_rand() % NOBJECTS;  /* second pick */
+
+  return s_acbObjects[(n < n2) ? n : n2];
+}
+
+/*
+ * String trace: lengths from 1 to 256 bytes, weighted toward the short end, plus the terminator.
+ */
+static SIZE_T trace_strings(UINT32 i)
+{
+  return (trace_rand() % (1 + (trace_rand() % 256))) + 2;
+}
+
+/*
+ * Buffer trace: I/O and driver buffers, a mix of powers of two, whole pages, and odd sizes up to 16 Kb.
+ */
+static SIZE_T trace_buffers(UINT32 i)
+{
+  switch (trace_rand() % 3)
+  {
+    case 0:
+      return (SIZE_T)64 << (trace_rand() % 9);
+    case 1:
+      return (SIZE_T)4096 * (1 + (trace_rand() % 4));
+    default:
+      return 32 + (trace_rand() % 16352);
+  }
+}
+
+static const TRACE SEG_RODATA s_atrace[] = {
+  { "objects", trace_objects },
+  { "strings", trace_strings },
+  { "buffers", trace_buffers }
+};
+#define NTRACES  (sizeof(s_atrace) / sizeof(TRACE))
+
+/*
+ * Allocates a whole trace and measures its internal fragmentation.
+ *
+ * Parameters:
+ * - pMalloc = Heap being measured.
+ * - ptrace = Trace to run.
+ * - pfFailed = Set to TRUE if an allocation failed.
+ *
+ * Returns:
+ * Internal fragmentation, as tenths of a percent of the bytes allocated.
+ */
+static UINT32 run_trace(IMalloc *pMalloc, const TRACE *ptrace, BOOL *pfFailed)
+{
+  UINT64 cbRequested = 0;   /* bytes requested */
+  UINT64 cbUsable = 0;      /* bytes allocated */
+  SIZE_T cb;                /* size of allocation */
+  UINT32 i;                 /* loop counter */
+
+  g_uiRand = 1;
+  for (i = 0; i < TRACE_LENGTH; i++)
+  {
+    cb = (*(ptrace->pfnSize))(i);
+    g_apvBlocks[i] = IMalloc_Alloc(pMalloc, cb);
+    if (!(g_apvBlocks[i]))
+    {
+      *pfFailed = TRUE;
+      break;
+    }
+    cbRequested += cb;
+    cbUsable += IMalloc_GetSize(pMalloc, g_apvBlocks[i]);
+  }
+  while (i > 0)
+    IMalloc_Free(pMalloc, g_apvBlocks[--i]);
+  return cbUsable ? (UINT32)(((cbUsable - cbRequested) * 1000) / cbUsable) : 0;
+}
+
+/*
+ * Runs the benchmark.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * 0 if every allocation succeeded, 1 if not.
+ */
+INT32 HostMain(void)
+{
+  IMalloc *pMalloc;        /* heap being measured */
+  BOOL fFailed = FALSE;    /* did an allocation fail? */
+  UINT32 nFrag;            /* fragmentation of one trace */
+  UINT32 i;                /* loop counter */
+
+  if (FAILED(HostCreateHeap(&g_rhd, 0, 1, &pMalloc)))
+  {
+    HostPrintf("heap_bench_sizeclass %s: cannot create heap\n", SIZECLASS_CONFIG);
+    return 1;
+  }
+  HostPrintf("heap_bench_sizeclass %s: quantum %u, %u bins, small max %u; internal fragmentation", SIZECLASS_CONFIG,
+	     1 << LG_QUANTUM, NBINS, SMALL_MAXCLASS);
+  for (i = 0; i < NTRACES; i++)
+  {
+    nFrag = run_trace(pMalloc, &(s_atrace[i]), &fFailed);
+    HostPrintf("%s %s %u.%u%%", i ? "," : "", s_atrace[i].pszName, nFrag / 10, nFrag % 10);
+  }
+  HostPrintf("\n");
+  IUnknown_Release(pMalloc);
+  if (fFailed)
+    HostPrintf("heap_bench_sizeclass %s: allocation failed\n", SIZECLASS_CONFIG);
+  return fFailed ? 1 : 0;
+}
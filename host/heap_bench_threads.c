@@ -0,0 +1,212 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include <comrogue/scode.h>
+#include <comrogue/allocator.h>
+#include <comrogue/heap.h>
+#include "comrogue_host.h"
+
+/*-------------------------------------------------------------------------------------------------------------
+ * Multi-threaded scaling benchmark of the heap on the host stand-ins.  From 1 to MAX_THREADS threads each run
+ * the same alloc/free loop against one shared heap, and the total throughput is reported.  The heap is created
+ * once with a single arena, where every thread contends for the same arena lock, and once with an arena per
+ * thread, so the two can be compared.  Throughput can only rise with the thread count up to the number of CPUs
+ * the process actually gets.
+ *-------------------------------------------------------------------------------------------------------------
+ */
+
+#define MAX_THREADS     8         /* largest number of threads run */
+#define OPS_PER_THREAD  2000000   /* Alloc+Free pairs done by each thread */
+#define LIVE_BLOCKS     64        /* blocks each thread holds at once */
+
+typedef struct tagBENCHTHREAD {
+  IMalloc *pMalloc;                  /* heap being measured */
+  UINT32 uiSeed;                     /* seed for the thread's sizes */
+  BOOL fFailed;                      /* did an allocation fail? */
+  PVOID apvLive[LIVE_BLOCKS];        /* blocks the thread holds */
+} BENCHTHREAD, *PBENCHTHREAD;
+
+static RAWHEAPDATA g_rhd;                        /* heap data for the heap being measured */
+static BENCHTHREAD g_abt[MAX_THREADS];           /* per-thread state */
+static UINT32 volatile g_nReady;                 /* number of threads waiting to start */
+static BOOL volatile g_fGo;                      /* set to start the threads */
+
+/*
+ * Benchmark thread: waits for the start signal, then replaces its live blocks one at a time, in round-robin
+ * order, with blocks of pseudo-random small and large sizes.
+ *
+ * Parameters:
+ * - pvArg = Pointer to the thread's BENCHTHREAD block.
+ *
+ * Returns:
+ * 0.
+ */
+static INT32 bench_thread(PVOID pvArg)
+{
+  PBENCHTHREAD pbt = (PBENCHTHREAD)pvArg;   /* thread state */
+  UINT32 uiRand = pbt->uiSeed;              /* pseudo-random state */
+  SIZE_T cb;                                /* size of next block */
+  UINT32 i, ndx;                            /* loop counter and block index */
+
+  __sync_add_and_fetch(&g_nReady, 1);
+  while (!g_fGo)
+    HostThreadYield();
+
+  for (i = 0; i < OPS_PER_THREAD; i++)
+  {
+    uiRand = uiRand * 1103515245 + 12345;
+    cb = ((uiRand >> 16) % 64 == 0) ? 4096 + ((uiRand >> 8) & 0x3FFF) : 8 + ((uiRand >> 16) & 0x1FF);
+    ndx = i % LIVE_BLOCKS;
+    if (pbt->apvLive[ndx])
+      IMalloc_Free(pbt->pMalloc, pbt->apvLive[ndx]);
+    pbt->apvLive[ndx] = IMalloc_Alloc(pbt->pMalloc, cb);
+    if (!(pbt->apvLive[ndx]))
+    {
+      pbt->fFailed = TRUE;
+      break;
+    }
+    *((PBYTE)(pbt->apvLive[ndx])) = (BYTE)i;
+  }
+  for (i = 0; i < LIVE_BLOCKS; i++)
+  {
+    IMalloc_Free(pbt->pMalloc, pbt->apvLive[i]);
+    pbt->apvLive[i] = NULL;
+  }
+  return 0;
+}
+
+/*
+ * Runs the benchmark loop on a number of threads at once against one heap.
+ *
+ * Parameters:
+ * - pMalloc = Heap being measured.
+ * - nThreads = Number of threads to run.
+ * - pfFailed = Set to TRUE if any allocation or thread creation failed.
+ *
+ * Returns:
+ * Total throughput, in tenths of a million Alloc+Free pairs per second.
+ */
+static UINT32 bench_run(IMalloc *pMalloc, UINT32 nThreads, BOOL *pfFailed)
+{
+  PHOSTTHREAD apthr[MAX_THREADS];   /* threads being run */
+  UINT64 tmStart;                   /* starting time */
+  UINT64 tmElapsed;                 /* elapsed time */
+  UINT32 i;                         /* loop counter */
+
+  g_nReady = 0;
+  g_fGo = FALSE;
+  for (i = 0; i < nThreads; i++)
+  {
+    g_abt[i].pMalloc = pMalloc;
+    g_abt[i].uiSeed = i + 1;
+    g_abt[i].fFailed = FALSE;
+    if (FAILED(HostThreadCreate(bench_thread, &(g_abt[i]), &(apthr[i]))))
+    {
+      *pfFailed = TRUE;
+      nThreads = i;
+      break;
+    }
+  }
+  while (g_nReady < nThreads)
+    HostThreadYield();
+
+  tmStart = HostTimeNs();
+  g_fGo = TRUE;
+  for (i = 0; i < nThreads; i++)
+  {
+    HostThreadJoin(apthr[i]);
+    if (g_abt[i].fFailed)
+      *pfFailed = TRUE;
+  }
+  tmElapsed = HostTimeNs() - tmStart;
+  if (tmElapsed == 0)
+    return 0;
+  return (UINT32)(((UINT64)nThreads * OPS_PER_THREAD * 10000) / tmElapsed);
+}
+
+/*
+ * Runs the benchmark from 1 to MAX_THREADS threads against a heap with a given number of arenas, printing a line
+ * per thread count.
+ *
+ * Parameters:
+ * - cArenas = Number of arenas to create the heap with.
+ * - pfFailed = Set to TRUE if anything failed.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void bench_arenas(UINT32 cArenas, BOOL *pfFailed)
+{
+  IMalloc *pMalloc;   /* heap being measured */
+  UINT32 nRate;       /* throughput */
+  UINT32 nRateOne;    /* throughput with one thread */
+  UINT32 nThreads;    /* number of threads */
+
+  if (FAILED(HostCreateHeap(&g_rhd, 0, cArenas, &pMalloc)))
+  {
+    HostPrintf("heap_bench_threads: cannot create heap\n");
+    *pfFailed = TRUE;
+    return;
+  }
+  nRateOne = 0;
+  for (nThreads = 1; (nThreads <= MAX_THREADS) && !(*pfFailed); nThreads++)
+  {
+    nRate = bench_run(pMalloc, nThreads, pfFailed);
+    if (nThreads == 1)
+      nRateOne = nRate;
+    HostPrintf("%8u %8u %8u.%u %8u%%\n", cArenas, nThreads, nRate / 10, nRate % 10,
+	       nRateOne ? (nRate * 100) / nRateOne : 0);
+  }
+  IUnknown_Release(pMalloc);
+}
+
+/*
+ * Runs the benchmark.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * 0 if everything succeeded, 1 if not.
+ */
+INT32 HostMain(void)
+{
+  BOOL fFailed = FALSE;   /* did anything fail? */
+
+  HostPrintf("heap_bench_threads: millions of Alloc+Free pairs per second, and scaling relative to 1 thread\n");
+  HostPrintf("%8s %8s %10s %9s\n", "arenas", "threads", "Mops/s", "scaling");
+  bench_arenas(1, &fFailed);
+  bench_arenas(MAX_THREADS, &fFailed);
+  if (fFailed)
+    HostPrintf("heap_bench_threads: allocation or thread creation failed\n");
+  return fFailed ? 1 : 0;
+}
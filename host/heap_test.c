@@ -0,0 +1,514 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include <comrogue/scode.h>
+#include <comrogue/str.h>
+#include <comrogue/allocator.h>
+#include <comrogue/heap.h>
+#include <comrogue/internals/mmu.h>
+#include "comrogue_host.h"
+
+/*-------------------------------------------------------------------------------------------------------------
+ * Functional test of the heap on the host stand-ins.  Each test creates its own heap, exercises one area of the
+ * allocator interfaces, and releases the heap.  Failures are reported with their line numbers; the program
+ * exits with the number of failures.
+ *-------------------------------------------------------------------------------------------------------------
+ */
+
+/* Checks a condition, reporting a failure if it is false. */
+#define CHECK(expr)  check_result(MAKEBOOL(expr), #expr, __LINE__)
+
+#define RING_SIZE          1024      /* number of slots in the producer/consumer ring */
+#define REMOTE_BLOCKS      200000    /* number of blocks passed from producer to consumer */
+#define REMOTE_BATCH       64        /* number of blocks the consumer frees per batch, when batching */
+
+/* Sizes covering the small, large, and huge classes */
+static const SIZE_T SEG_RODATA s_acbSizes[] = { 1, 8, 17, 100, 512, 3584, 3585, 9000, 100000, 1000000, 5000000 };
+#define NSIZES  (sizeof(s_acbSizes) / sizeof(SIZE_T))
+
+/* Sizes used for the batch tests */
+static const SIZE_T SEG_RODATA s_acbBatchSizes[] = { 8, 100, 3584, 9000, 100000 };
+#define NBATCHSIZES  (sizeof(s_acbBatchSizes) / sizeof(SIZE_T))
+#define BATCH_COUNT  200
+
+/* State shared by the producer and consumer threads */
+typedef struct tagREMOTETEST {
+  IMalloc *pMalloc;                   /* heap being tested */
+  IMallocBatch *pBatch;               /* batch interface, or NULL to free blocks one at a time */
+  PVOID volatile apvRing[RING_SIZE];  /* ring of blocks passed from producer to consumer */
+  UINT32 volatile nHead;              /* number of blocks produced */
+  UINT32 volatile nTail;              /* number of blocks consumed */
+} REMOTETEST, *PREMOTETEST;
+
+static UINT32 g_cFailures = 0;                 /* number of failed checks */
+static RAWHEAPDATA g_rhd;                      /* heap data for the heap under test */
+static PVOID g_apvBlocks[20000];               /* blocks allocated by the tests */
+static REMOTETEST g_rt;                        /* producer/consumer state */
+
+/*
+ * Records the result of a check.
+ *
+ * Parameters:
+ * - fResult = TRUE if the check passed.
+ * - pszExpr = Text of the checked expression.
+ * - nLine = Source line of the check.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void check_result(BOOL fResult, PCSTR pszExpr, INT32 nLine)
+{
+  if (!fResult)
+  {
+    HostPrintf("heap_test.c:%d: check failed: %s\n", nLine, pszExpr);
+    __sync_add_and_fetch(&g_cFailures, 1);
+  }
+}
+
+/*
+ * Fills a block with a pattern derived from a seed value.
+ *
+ * Parameters:
+ * - pv = Pointer to the block.
+ * - cb = Number of bytes to fill.
+ * - uiSeed = Seed value for the pattern.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void fill_pattern(PVOID pv, SIZE_T cb, UINT32 uiSeed)
+{
+  PBYTE pb = (PBYTE)pv;   /* pointer into block */
+  SIZE_T i;               /* loop counter */
+
+  for (i = 0; i < cb; i++)
+    pb[i] = (BYTE)(uiSeed + i * 7);
+}
+
+/*
+ * Checks that a block holds the pattern written by fill_pattern.
+ *
+ * Parameters:
+ * - pv = Pointer to the block.
+ * - cb = Number of bytes to check.
+ * - uiSeed = Seed value for the pattern.
+ *
+ * Returns:
+ * TRUE if the pattern is intact, FALSE if not.
+ */
+static BOOL check_pattern(PCVOID pv, SIZE_T cb, UINT32 uiSeed)
+{
+  const BYTE *pb = (const BYTE *)pv;   /* pointer into block */
+  SIZE_T i;                            /* loop counter */
+
+  for (i = 0; i < cb; i++)
+    if (pb[i] != (BYTE)(uiSeed + i * 7))
+      return FALSE;
+  return TRUE;
+}
+
+/*
+ * Tests Alloc, Free, Realloc, GetSize, and DidAlloc across the small, large, and huge size classes.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void test_alloc_free(void)
+{
+  IMalloc *pMalloc;   /* heap under test */
+  PVOID pv;           /* block pointer */
+  SIZE_T cb;          /* block size */
+  UINT32 i;           /* loop counter */
+
+  CHECK(SUCCEEDED(HostCreateHeap(&g_rhd, 0, 0, &pMalloc)));
+
+  for (i = 0; i < NSIZES; i++)
+  {
+    pv = g_apvBlocks[i] = IMalloc_Alloc(pMalloc, s_acbSizes[i]);
+    CHECK(pv != NULL);
+    CHECK(IMalloc_DidAlloc(pMalloc, pv) == 1);
+    CHECK(IMalloc_GetSize(pMalloc, pv) >= s_acbSizes[i]);
+    fill_pattern(pv, s_acbSizes[i], i);
+  }
+  for (i = 0; i < NSIZES; i++)
+    CHECK(check_pattern(g_apvBlocks[i], s_acbSizes[i], i));
+
+  /* grow each block across at least one class boundary, then shrink it below its original size */
+  for (i = 0; i < NSIZES; i++)
+  {
+    cb = s_acbSizes[i];
+    pv = IMalloc_Realloc(pMalloc, g_apvBlocks[i], cb * 3);
+    CHECK(pv != NULL);
+    CHECK(IMalloc_GetSize(pMalloc, pv) >= cb * 3);
+    CHECK(check_pattern(pv, cb, i));
+    g_apvBlocks[i] = pv;
+    pv = IMalloc_Realloc(pMalloc, pv, (cb / 2) + 1);
+    CHECK(pv != NULL);
+    CHECK(IMalloc_GetSize(pMalloc, pv) >= (cb / 2) + 1);
+    CHECK(check_pattern(pv, (cb / 2) + 1, i));
+    g_apvBlocks[i] = pv;
+  }
+  for (i = 0; i < NSIZES; i++)
+    IMalloc_Free(pMalloc, g_apvBlocks[i]);
+
+  /* Realloc with NULL allocates, and with a zero size frees */
+  pv = IMalloc_Realloc(pMalloc, NULL, 40);
+  CHECK(pv != NULL);
+  CHECK(IMalloc_DidAlloc(pMalloc, pv) == 1);
+  CHECK(IMalloc_Realloc(pMalloc, pv, 0) == NULL);
+
+  /* blocks that are not ours */
+  CHECK(IMalloc_DidAlloc(pMalloc, NULL) == -1);
+  CHECK(IMalloc_DidAlloc(pMalloc, &g_cFailures) == 0);
+  CHECK(IMalloc_GetSize(pMalloc, &g_cFailures) == (SIZE_T)(-1));
+  CHECK(IMalloc_Realloc(pMalloc, &g_cFailures, 16) == NULL);
+
+  CHECK(IUnknown_Release(pMalloc) == 0);
+}
+
+/*
+ * Tests AllocBatch, FreeBatch, and FreeSized.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void test_batch_sized(void)
+{
+  IMalloc *pMalloc;         /* heap under test */
+  IMallocBatch *pBatch;     /* batch interface */
+  IMallocSized *pSized;     /* sized-free interface */
+  PVOID pv;                 /* block pointer */
+  UINT32 cGot;              /* number of blocks allocated by a batch */
+  UINT32 i, j;              /* loop counters */
+
+  CHECK(SUCCEEDED(HostCreateHeap(&g_rhd, 0, 0, &pMalloc)));
+  CHECK(SUCCEEDED(IUnknown_QueryInterface(pMalloc, &IID_IMallocBatch, (PPVOID)(&pBatch))));
+  CHECK(SUCCEEDED(IUnknown_QueryInterface(pMalloc, &IID_IMallocSized, (PPVOID)(&pSized))));
+
+  for (i = 0; i < NBATCHSIZES; i++)
+  {
+    cGot = IMallocBatch_AllocBatch(pBatch, s_acbBatchSizes[i], BATCH_COUNT, g_apvBlocks);
+    CHECK(cGot == BATCH_COUNT);
+    for (j = 0; j < cGot; j++)
+    {
+      CHECK(IMalloc_GetSize(pMalloc, g_apvBlocks[j]) >= s_acbBatchSizes[i]);
+      fill_pattern(g_apvBlocks[j], s_acbBatchSizes[i], j);
+    }
+    for (j = 0; j < cGot; j++)
+      CHECK(check_pattern(g_apvBlocks[j], s_acbBatchSizes[i], j));
+    IMallocBatch_FreeBatch(pBatch, cGot, g_apvBlocks);
+    for (j = 0; j < cGot; j++)
+      CHECK(g_apvBlocks[j] == NULL);
+  }
+
+  for (i = 0; i < NSIZES; i++)
+  {
+    pv = IMalloc_Alloc(pMalloc, s_acbSizes[i]);
+    CHECK(pv != NULL);
+    IMallocSized_FreeSized(pSized, pv, s_acbSizes[i]);
+    if (s_acbSizes[i] <= 512)  /* small blocks come straight back from the thread cache */
+      CHECK(IMalloc_Alloc(pMalloc, s_acbSizes[i]) == pv);
+    else
+      pv = IMalloc_Alloc(pMalloc, s_acbSizes[i]);
+    IMallocSized_FreeSized(pSized, pv, s_acbSizes[i]);
+  }
+
+  IUnknown_Release(pSized);
+  IUnknown_Release(pBatch);
+  CHECK(IUnknown_Release(pMalloc) == 0);
+}
+
+/*
+ * Tests that the byte count returned by Minimize matches what the chunk allocator was asked to release.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void test_minimize(void)
+{
+  IMalloc *pMalloc;               /* heap under test */
+  IHeapConfiguration *pConfig;    /* configuration interface */
+  HOSTCHUNKSTATS csBefore;        /* chunk statistics before Minimize */
+  HOSTCHUNKSTATS csAfter;         /* chunk statistics after Minimize */
+  SIZE_T cbReleased;              /* bytes released by Minimize */
+  UINT32 i;                       /* loop counter */
+
+  CHECK(SUCCEEDED(HostCreateHeap(&g_rhd, PHDFLAGS_NOTCACHE, 1, &pMalloc)));
+  CHECK(SUCCEEDED(IUnknown_QueryInterface(pMalloc, &IID_IHeapConfiguration, (PPVOID)(&pConfig))));
+
+  for (i = 0; i < 20000; i++)
+    g_apvBlocks[i] = IMalloc_Alloc(pMalloc, (i % 9 == 0) ? 9000 : 16 + (i % 200));
+  for (i = 0; i < 20000; i++)
+    IMalloc_Free(pMalloc, g_apvBlocks[i]);
+
+  HostGetChunkStats(&csBefore);
+  CHECK(SUCCEEDED(IHeapConfiguration_Minimize(pConfig, &cbReleased)));
+  HostGetChunkStats(&csAfter);
+  CHECK(cbReleased > 0);
+  CHECK(cbReleased == (SIZE_T)((csAfter.cbPurged - csBefore.cbPurged) + (csAfter.cbUnmapped - csBefore.cbUnmapped)));
+
+  /* nothing is left to release the second time around */
+  CHECK(SUCCEEDED(IHeapConfiguration_Minimize(pConfig, &cbReleased)));
+  CHECK(cbReleased == 0);
+
+  IUnknown_Release(pConfig);
+  CHECK(IUnknown_Release(pMalloc) == 0);
+}
+
+/*
+ * Checks that a chunk which goes into the spare-chunk cache with all its pages dirty keeps them until Minimize,
+ * and that statistics count them meanwhile.  The chunk comes from freeing a block that fills an arena chunk by
+ * itself; the size of such a block is found by shrinking a chunk-sized request a page at a time until the block
+ * no longer starts on a chunk boundary, i.e. it is no longer a huge block.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void test_spare_dirty(void)
+{
+  IMalloc *pMalloc;               /* heap under test */
+  IHeapStatistics *pStats;        /* statistics interface */
+  IHeapConfiguration *pConfig;    /* configuration interface */
+  HEAPARENASTATS has;             /* arena statistics */
+  HOSTCHUNKSTATS csBefore;        /* chunk statistics before the free */
+  HOSTCHUNKSTATS csAfter;         /* chunk statistics after the free */
+  SIZE_T cbChunk = (SIZE_T)1 << STD_CHUNK_BITS;   /* size of a chunk */
+  SIZE_T cb;                      /* size of block being tried */
+  SIZE_T cbReleased;              /* bytes released by Minimize */
+  PVOID pv = NULL;                /* block being tried */
+
+  CHECK(SUCCEEDED(HostCreateHeap(&g_rhd, PHDFLAGS_NOTCACHE, 1, &pMalloc)));
+  CHECK(SUCCEEDED(IUnknown_QueryInterface(pMalloc, &IID_IHeapStatistics, (PPVOID)(&pStats))));
+  CHECK(SUCCEEDED(IUnknown_QueryInterface(pMalloc, &IID_IHeapConfiguration, (PPVOID)(&pConfig))));
+  for (cb = cbChunk - SYS_PAGE_SIZE; cb >= (cbChunk >> 1); cb -= SYS_PAGE_SIZE)
+  {
+    pv = IMalloc_Alloc(pMalloc, cb);
+    CHECK(pv != NULL);
+    if (((UINT_PTR)pv & (cbChunk - 1)) != 0)
+      break;
+    IMalloc_Free(pMalloc, pv);
+    pv = NULL;
+  }
+  CHECK(pv != NULL);
+  if (pv)
+  {
+    fill_pattern(pv, cb, 3);
+    HostGetChunkStats(&csBefore);
+    IMalloc_Free(pMalloc, pv);
+    HostGetChunkStats(&csAfter);
+    CHECK(csAfter.cbPurged == csBefore.cbPurged);   /* the spare keeps its pages */
+    CHECK(SUCCEEDED(IHeapStatistics_Refresh(pStats)));
+    CHECK(SUCCEEDED(IHeapStatistics_GetArenaStats(pStats, 0, &has)));
+    CHECK(has.cpgDirty >= (cb >> SYS_PAGE_BITS));
+
+    HostGetChunkStats(&csBefore);
+    CHECK(SUCCEEDED(IHeapConfiguration_Minimize(pConfig, &cbReleased)));
+    HostGetChunkStats(&csAfter);
+    CHECK(csAfter.cbPurged - csBefore.cbPurged >= cb);
+    CHECK(SUCCEEDED(IHeapStatistics_Refresh(pStats)));
+    CHECK(SUCCEEDED(IHeapStatistics_GetArenaStats(pStats, 0, &has)));
+    CHECK(has.cpgDirty == 0);
+  }
+  IUnknown_Release(pConfig);
+  IUnknown_Release(pStats);
+  CHECK(IUnknown_Release(pMalloc) == 0);
+}
+
+/*
+ * Producer thread: allocates blocks, tags each with its sequence number, and passes them to the consumer.
+ *
+ * Parameters:
+ * - pvArg = Pointer to the REMOTETEST block.
+ *
+ * Returns:
+ * 0.
+ */
+static INT32 remote_producer(PVOID pvArg)
+{
+  PREMOTETEST prt = (PREMOTETEST)pvArg;   /* shared state */
+  PUINT32 puiBlock;                       /* new block */
+  UINT32 i;                               /* loop counter */
+
+  for (i = 0; i < REMOTE_BLOCKS; i++)
+  {
+    puiBlock = (PUINT32)IMalloc_Alloc(prt->pMalloc, (i % 97 == 0) ? 20000 : 8 + (i % 500));
+    CHECK(puiBlock != NULL);
+    if (!puiBlock)
+      break;
+    *puiBlock = i;
+    while (prt->nHead - prt->nTail == RING_SIZE)
+      HostThreadYield();
+    prt->apvRing[i % RING_SIZE] = puiBlock;
+    __sync_synchronize();
+    prt->nHead = i + 1;
+  }
+  return 0;
+}
+
+/*
+ * Consumer thread: takes blocks from the producer, checks their sequence numbers, and frees them, either one at
+ * a time or in batches.  The consumer allocates a block of its own first, so that it is bound to a different
+ * arena than the producer and every free it makes goes through the remote-free path.
+ *
+ * Parameters:
+ * - pvArg = Pointer to the REMOTETEST block.
+ *
+ * Returns:
+ * 0.
+ */
+static INT32 remote_consumer(PVOID pvArg)
+{
+  PREMOTETEST prt = (PREMOTETEST)pvArg;   /* shared state */
+  PVOID pvOwn;                            /* block allocated by this thread */
+  PUINT32 puiBlock;                       /* block from the producer */
+  PVOID apvBatch[REMOTE_BATCH];           /* blocks waiting to be freed in a batch */
+  UINT32 nBatch = 0;                      /* number of blocks in apvBatch */
+  UINT32 i;                               /* loop counter */
+
+  pvOwn = IMalloc_Alloc(prt->pMalloc, 16);
+  CHECK(pvOwn != NULL);
+  for (i = 0; i < REMOTE_BLOCKS; i++)
+  {
+    while (prt->nHead == i)
+      HostThreadYield();
+    __sync_synchronize();
+    puiBlock = (PUINT32)(prt->apvRing[i % RING_SIZE]);
+    CHECK(*puiBlock == i);
+    if (prt->pBatch)
+    {
+      apvBatch[nBatch++] = puiBlock;
+      if (nBatch == REMOTE_BATCH)
+      {
+	IMallocBatch_FreeBatch(prt->pBatch, nBatch, apvBatch);
+	nBatch = 0;
+      }
+    }
+    else
+      IMalloc_Free(prt->pMalloc, puiBlock);
+    prt->nTail = i + 1;
+  }
+  if (nBatch > 0)
+    IMallocBatch_FreeBatch(prt->pBatch, nBatch, apvBatch);
+  IMalloc_Free(prt->pMalloc, pvOwn);
+  return 0;
+}
+
+/*
+ * Tests the remote-free path with a producer thread and a consumer thread on separate arenas.
+ *
+ * Parameters:
+ * - uiFlags = Flags to create the heap with.
+ * - fBatch = If TRUE, the consumer frees blocks with IMallocBatch::FreeBatch; if FALSE, with IMalloc::Free.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void test_remote_free(UINT32 uiFlags, BOOL fBatch)
+{
+  IMalloc *pMalloc;               /* heap under test */
+  IHeapStatistics *pStats;        /* statistics interface */
+  IHeapConfiguration *pConfig;    /* configuration interface */
+  HEAPARENASTATS has;             /* arena statistics */
+  PHOSTTHREAD pthrProducer;       /* producer thread */
+  PHOSTTHREAD pthrConsumer;       /* consumer thread */
+  SIZE_T cbReleased;              /* bytes released by Minimize */
+  UINT32 i;                       /* loop counter */
+
+  CHECK(SUCCEEDED(HostCreateHeap(&g_rhd, uiFlags, 2, &pMalloc)));
+  CHECK(SUCCEEDED(IUnknown_QueryInterface(pMalloc, &IID_IHeapStatistics, (PPVOID)(&pStats))));
+  CHECK(SUCCEEDED(IUnknown_QueryInterface(pMalloc, &IID_IHeapConfiguration, (PPVOID)(&pConfig))));
+  g_rt.pMalloc = pMalloc;
+  g_rt.pBatch = NULL;
+  if (fBatch)
+    CHECK(SUCCEEDED(IUnknown_QueryInterface(pMalloc, &IID_IMallocBatch, (PPVOID)(&(g_rt.pBatch)))));
+  g_rt.nHead = g_rt.nTail = 0;
+
+  CHECK(SUCCEEDED(HostThreadCreate(remote_producer, &g_rt, &pthrProducer)));
+  CHECK(SUCCEEDED(HostThreadCreate(remote_consumer, &g_rt, &pthrConsumer)));
+  HostThreadJoin(pthrProducer);
+  HostThreadJoin(pthrConsumer);
+  CHECK(g_rt.nTail == REMOTE_BLOCKS);
+
+  /* both arenas were used, and once the remote frees are drained, everything allocated has been freed */
+  CHECK(SUCCEEDED(IHeapConfiguration_Minimize(pConfig, &cbReleased)));
+  CHECK(SUCCEEDED(IHeapStatistics_Refresh(pStats)));
+  for (i = 0; i < 2; i++)
+  {
+    CHECK(SUCCEEDED(IHeapStatistics_GetArenaStats(pStats, i, &has)));
+    CHECK(has.cSmallRequests > 0);
+    CHECK(has.nThreads == 0);
+  }
+  CHECK(SUCCEEDED(IHeapStatistics_GetArenaStats(pStats, HEAPSTATS_ALL_ARENAS, &has)));
+  CHECK(has.cbAllocatedSmall == 0);
+  CHECK(has.cbAllocatedLarge == 0);
+  CHECK(has.cSmallMalloc == has.cSmallDalloc);
+  CHECK(has.cLargeMalloc == has.cLargeDalloc);
+
+  if (g_rt.pBatch)
+    IUnknown_Release(g_rt.pBatch);
+  IUnknown_Release(pConfig);
+  IUnknown_Release(pStats);
+  CHECK(IUnknown_Release(pMalloc) == 0);
+}
+
+/*
+ * Runs the tests.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * The number of failed checks; 0 if all passed.
+ */
+INT32 HostMain(void)
+{
+  test_alloc_free();
+  test_batch_sized();
+  test_minimize();
+  test_spare_dirty();
+  test_remote_free(0, FALSE);
+  test_remote_free(PHDFLAGS_NOTCACHE, TRUE);
+  HostPrintf("heap_test: %u failure(s)\n", g_cFailures);
+  return (INT32)g_cFailures;
+}
@@ -0,0 +1,176 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include <comrogue/scode.h>
+#include <comrogue/str.h>
+#include <comrogue/objectbase.h>
+#include <comrogue/allocator.h>
+#include <comrogue/objhelp.h>
+#include <comrogue/internals/mmu.h>
+#include <comrogue/internals/seg.h>
+#include "host_internals.h"
+
+/*-----------------------------------------------------------------------------------------------------
+ * Host chunk allocator.  Chunks are anonymous private mappings, which the kernel hands out zero-filled,
+ * and purged regions are discarded with MADV_DONTNEED, which makes them read back as zeroes as well.
+ * Running totals are kept so that tests can check the heap's accounting against what it actually did.
+ *-----------------------------------------------------------------------------------------------------
+ */
+
+static HOSTCHUNKSTATS g_stats;   /* running totals */
+
+/*
+ * Allocates a chunk of memory.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IChunkAllocator interface.
+ * - cbChunk = Size of the chunk to allocate, in bytes.
+ * - uiAlignment = Required alignment of the chunk; must be a power of 2.
+ * - ppvChunk = On successful return, receives a pointer to the new chunk.
+ *
+ * Returns:
+ * - S_OK = The chunk was allocated, and is zero-filled.
+ * - E_POINTER = ppvChunk is NULL.
+ * - E_OUTOFMEMORY = The chunk could not be allocated.
+ */
+static HRESULT chunkalloc_AllocChunk(IChunkAllocator *pThis, UINT32 cbChunk, UINT32 uiAlignment, PVOID *ppvChunk)
+{
+  UINT_PTR uiMap;      /* start of the mapping */
+  UINT_PTR uiChunk;    /* aligned start of the chunk */
+  SIZE_T cbMap;        /* size of the mapping */
+
+  if (!ppvChunk)
+    return E_POINTER;
+  *ppvChunk = NULL;
+  if (uiAlignment < SYS_PAGE_SIZE)
+    uiAlignment = SYS_PAGE_SIZE;
+
+  /* Map enough extra to be able to align the chunk, then unmap the slop on either side of it. */
+  cbMap = cbChunk + uiAlignment - SYS_PAGE_SIZE;
+  if (cbMap < cbChunk)
+    return E_OUTOFMEMORY;
+  uiMap = (UINT_PTR)_HostMapPages(cbMap);
+  if (!uiMap)
+    return E_OUTOFMEMORY;
+  uiChunk = (uiMap + uiAlignment - 1) & ~((UINT_PTR)uiAlignment - 1);
+  if (uiChunk > uiMap)
+    _HostUnmapPages((PVOID)uiMap, uiChunk - uiMap);
+  if ((uiChunk + cbChunk) < (uiMap + cbMap))
+    _HostUnmapPages((PVOID)(uiChunk + cbChunk), (uiMap + cbMap) - (uiChunk + cbChunk));
+  __sync_add_and_fetch(&(g_stats.cbMapped), cbChunk);
+  __sync_add_and_fetch(&(g_stats.cChunkAllocs), 1);
+  *ppvChunk = (PVOID)uiChunk;
+  return S_OK;
+}
+
+/*
+ * Frees a chunk of memory.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IChunkAllocator interface.
+ * - pvChunk = Pointer to the chunk to be freed.
+ * - cbChunk = Size of the chunk to be freed, in bytes.
+ *
+ * Returns:
+ * - S_OK = The chunk was freed.
+ * - E_FAIL = The chunk could not be unmapped.
+ */
+static HRESULT chunkalloc_FreeChunk(IChunkAllocator *pThis, PVOID pvChunk, UINT32 cbChunk)
+{
+  if (HOST_SYSCALL_FAILED(_HostSyscall(HOST_SYS_MUNMAP, (UINT32)pvChunk, cbChunk, 0, 0, 0, 0)))
+    return E_FAIL;
+  __sync_sub_and_fetch(&(g_stats.cbMapped), cbChunk);
+  __sync_add_and_fetch(&(g_stats.cbUnmapped), cbChunk);
+  return S_OK;
+}
+
+/*
+ * Tells the system that a region within a chunk is no longer in use, so its physical pages may be reclaimed.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IChunkAllocator interface.
+ * - pvRegion = Pointer to the start of the region; must be page-aligned.
+ * - cbRegion = Size of the region in bytes; must be a multiple of the page size.
+ *
+ * Returns:
+ * - S_OK = The region was purged and will read back as zeroes.
+ * - E_FAIL = The region could not be purged.
+ */
+static HRESULT chunkalloc_PurgeUnusedRegion(IChunkAllocator *pThis, PVOID pvRegion, UINT32 cbRegion)
+{
+  if (HOST_SYSCALL_FAILED(_HostSyscall(HOST_SYS_MADVISE, (UINT32)pvRegion, cbRegion, HOST_MADV_DONTNEED, 0, 0, 0)))
+    return E_FAIL;
+  __sync_add_and_fetch(&(g_stats.cbPurged), cbRegion);
+  return S_OK;
+}
+
+/* VTable for the host chunk allocator */
+static const SEG_RODATA struct IChunkAllocatorVTable vtblChunkAllocator =
+{
+  .QueryInterface = ObjHlpStandardQueryInterface_IChunkAllocator,
+  .AddRef = ObjHlpStaticAddRefRelease,
+  .Release = ObjHlpStaticAddRefRelease,
+  .AllocChunk = chunkalloc_AllocChunk,
+  .FreeChunk = chunkalloc_FreeChunk,
+  .PurgeUnusedRegion = chunkalloc_PurgeUnusedRegion
+};
+
+/* The host chunk allocator object */
+static IChunkAllocator g_chunkAllocator = { &vtblChunkAllocator };
+
+/*
+ * Returns the host chunk allocator.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * Pointer to the IChunkAllocator interface of the host chunk allocator.
+ */
+IChunkAllocator *HostGetChunkAllocator(void)
+{
+  return &g_chunkAllocator;
+}
+
+/*
+ * Returns the running totals kept by the host chunk allocator.
+ *
+ * Parameters:
+ * - pStats = Receives the totals.
+ *
+ * Returns:
+ * Nothing.
+ */
+void HostGetChunkStats(PHOSTCHUNKSTATS pStats)
+{
+  StrCopyMem(pStats, &g_stats, sizeof(HOSTCHUNKSTATS));
+}
@@ -0,0 +1,128 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include "quad.h"
+
+/*------------------------------------------------------------------------------------------------------------
+ * Host versions of the 64-bit division helpers that the compiler calls on i386.  On the target these are the
+ * __aeabi_* entry points in kernel/lib/divide.S; both sets do their work in __qdivrem.
+ *------------------------------------------------------------------------------------------------------------
+ */
+
+extern UINT64 __udivdi3(UINT64 a, UINT64 b);
+extern UINT64 __umoddi3(UINT64 a, UINT64 b);
+extern UINT64 __udivmoddi4(UINT64 a, UINT64 b, PUINT64 pRem);
+extern INT64 __divdi3(INT64 a, INT64 b);
+extern INT64 __moddi3(INT64 a, INT64 b);
+
+/*
+ * Divides two unsigned 64-bit values.
+ *
+ * Parameters:
+ * - a = Dividend.
+ * - b = Divisor.
+ *
+ * Returns:
+ * The quotient.
+ */
+UINT64 __udivdi3(UINT64 a, UINT64 b)
+{
+  return __qdivrem(a, b, NULL);
+}
+
+/*
+ * Returns the remainder of dividing two unsigned 64-bit values.
+ *
+ * Parameters:
+ * - a = Dividend.
+ * - b = Divisor.
+ *
+ * Returns:
+ * The remainder.
+ */
+UINT64 __umoddi3(UINT64 a, UINT64 b)
+{
+  UINT64 uRem;   /* remainder */
+
+  __qdivrem(a, b, &uRem);
+  return uRem;
+}
+
+/*
+ * Divides two unsigned 64-bit values, returning both quotient and remainder.
+ *
+ * Parameters:
+ * - a = Dividend.
+ * - b = Divisor.
+ * - pRem = If not NULL, receives the remainder.
+ *
+ * Returns:
+ * The quotient.
+ */
+UINT64 __udivmoddi4(UINT64 a, UINT64 b, PUINT64 pRem)
+{
+  return __qdivrem(a, b, pRem);
+}
+
+/*
+ * Divides two signed 64-bit values, truncating toward zero.
+ *
+ * Parameters:
+ * - a = Dividend.
+ * - b = Divisor.
+ *
+ * Returns:
+ * The quotient.
+ */
+INT64 __divdi3(INT64 a, INT64 b)
+{
+  UINT64 uq = __qdivrem((a < 0) ? -(UINT64)a : (UINT64)a, (b < 0) ? -(UINT64)b : (UINT64)b, NULL);
+  return ((a < 0) != (b < 0)) ? -(INT64)uq : (INT64)uq;
+}
+
+/*
+ * Returns the remainder of dividing two signed 64-bit values.  The remainder has the sign of the dividend.
+ *
+ * Parameters:
+ * - a = Dividend.
+ * - b = Divisor.
+ *
+ * Returns:
+ * The remainder.
+ */
+INT64 __moddi3(INT64 a, INT64 b)
+{
+  UINT64 uRem;   /* remainder */
+
+  __qdivrem((a < 0) ? -(UINT64)a : (UINT64)a, (b < 0) ? -(UINT64)b : (UINT64)b, &uRem);
+  return (a < 0) ? -(INT64)uRem : (INT64)uRem;
+}
@@ -0,0 +1,127 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#ifndef __HOST_INTERNALS_H_INCLUDED
+#define __HOST_INTERNALS_H_INCLUDED
+
+#include <comrogue/types.h>
+#include <comrogue/compiler_macros.h>
+#include "comrogue_host.h"
+
+#ifndef __i386__
+#error The host build of kernel/lib is ILP32 and supports i386 Linux only.
+#endif
+
+/*-----------------------------------------------------------------------------------------------------
+ * Internals of the host stand-ins.  The host layer talks to the Linux kernel directly through the i386
+ * system call interface, so that it needs neither a 32-bit C library nor libgcc.
+ *-----------------------------------------------------------------------------------------------------
+ */
+
+/* Linux i386 system call numbers */
+#define HOST_SYS_EXIT            1
+#define HOST_SYS_WRITE           4
+#define HOST_SYS_MUNMAP          91
+#define HOST_SYS_MPROTECT        125
+#define HOST_SYS_CLONE           120
+#define HOST_SYS_SCHED_YIELD     158
+#define HOST_SYS_MMAP2           192
+#define HOST_SYS_MADVISE         219
+#define HOST_SYS_FUTEX           240
+#define HOST_SYS_EXIT_GROUP      252
+#define HOST_SYS_CLOCK_GETTIME   265
+
+/* Linux constants used with the above */
+#define HOST_PROT_NONE           0x0
+#define HOST_PROT_READ           0x1
+#define HOST_PROT_WRITE          0x2
+#define HOST_MAP_PRIVATE         0x02
+#define HOST_MAP_ANONYMOUS       0x20
+#define HOST_MADV_DONTNEED       4
+#define HOST_FUTEX_WAIT          (0 | 128)    /* FUTEX_WAIT | FUTEX_PRIVATE_FLAG */
+#define HOST_FUTEX_WAKE          (1 | 128)    /* FUTEX_WAKE | FUTEX_PRIVATE_FLAG */
+#define HOST_FUTEX_WAIT_SHARED   0            /* FUTEX_WAIT, matching the kernel's wake on thread exit */
+#define HOST_CLOCK_MONOTONIC     1
+#define HOST_CLONE_FLAGS         0x00350f00   /* VM|FS|FILES|SIGHAND|THREAD|SYSVSEM|PARENT_SETTID|CHILD_CLEARTID */
+
+/* System calls return -errno in this range on failure. */
+#define HOST_SYSCALL_FAILED(rc)  (((UINT_PTR)(rc)) > ((UINT_PTR)(-4096)))
+
+/*
+ * Every thread, including the initial one, runs on a stack region allocated by the host layer and aligned to its
+ * own size.  The thread's HOSTTHREAD block sits at the bottom of the region, below a guard page, so the block for
+ * the current thread is found by masking the stack pointer.
+ */
+#define HOST_STACK_BITS          20
+#define HOST_STACK_SIZE          (1 << HOST_STACK_BITS)
+
+#define HOST_MAX_THREADLOCALS    128   /* maximum number of IThreadLocal objects existing at once */
+#define HOST_CLEANUP_PASSES      4     /* passes made over thread-local cleanup functions at thread exit */
+
+/* Per-thread block */
+typedef struct tagHOSTTHREAD {
+  INT32 volatile tid;                        /* thread ID; cleared by the kernel when the thread exits */
+  PFNHOSTTHREAD pfnThread;                   /* thread function */
+  PVOID pvArg;                               /* argument to thread function */
+  INT32 nExitCode;                           /* return value from thread function */
+  PVOID apvLocals[HOST_MAX_THREADLOCALS];    /* values of thread-local objects */
+  UINT32 auiLocalGen[HOST_MAX_THREADLOCALS]; /* generation of the thread-local object each value was set for */
+} HOSTTHREAD;
+
+CDECL_BEGIN
+
+extern INT32 _HostSyscall(UINT32 nCall, UINT32 a1, UINT32 a2, UINT32 a3, UINT32 a4, UINT32 a5, UINT32 a6);
+extern PVOID _HostMapPages(SIZE_T cb);
+extern void _HostUnmapPages(PVOID pv, SIZE_T cb);
+extern void _HostFutexWait(INT32 volatile *pnFutex, INT32 nExpected);
+extern void _HostFutexWake(INT32 volatile *pnFutex, INT32 nWake);
+extern void _HostThreadLocalCleanup(PHOSTTHREAD pthr);
+
+CDECL_END
+
+/*
+ * Returns the block for the calling thread.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * Pointer to the calling thread's HOSTTHREAD block.
+ */
+static inline PHOSTTHREAD _HostCurrentThread(void)
+{
+  UINT_PTR uiStack;   /* current stack pointer */
+
+  __asm__("movl %%esp, %0" : "=r" (uiStack));
+  return (PHOSTTHREAD)(uiStack & ~(HOST_STACK_SIZE - 1));
+}
+
+#endif /* __HOST_INTERNALS_H_INCLUDED */
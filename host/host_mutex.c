@@ -0,0 +1,248 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include <comrogue/scode.h>
+#include <comrogue/objectbase.h>
+#include <comrogue/mutex.h>
+#include <comrogue/objhelp.h>
+#include <comrogue/internals/mmu.h>
+#include <comrogue/internals/objcache.h>
+#include <comrogue/internals/seg.h>
+#include "host_internals.h"
+
+/*-----------------------------------------------------------------------------------------------------------
+ * Host mutexes.  Each IMutex is a futex-based lock with three states: 0 = unlocked, 1 = locked, 2 = locked
+ * and possibly contended.  Unlocking only makes a system call when the lock was contended.  Mutex objects
+ * come from an object cache whose slabs are mapped pages; the cache itself is guarded by a static mutex.
+ *-----------------------------------------------------------------------------------------------------------
+ */
+
+/* Host mutex object */
+typedef struct tagHOSTMUTEX {
+  IMutex mutexInterface;      /* the mutex interface */
+  UINT32 volatile uiRefCount; /* reference count */
+  INT32 volatile nState;      /* lock state */
+} HOSTMUTEX, *PHOSTMUTEX;
+
+static const struct IMutexVTable vtblMutex;
+static HOSTMUTEX g_mtxCache = { { &vtblMutex }, 1, 0 };   /* guards g_ocMutexes */
+static OBJCACHE g_ocMutexes;                              /* cache of mutex objects */
+static BOOL volatile g_fCacheReady = FALSE;               /* has g_ocMutexes been initialized? */
+
+/*
+ * Slab allocator function for the mutex object cache.
+ *
+ * Parameters:
+ * - pvArg = Not used.
+ * - cb = Number of bytes in the slab.
+ *
+ * Returns:
+ * - NULL = Allocation failed.
+ * - Other = Pointer to the new slab.
+ */
+static PVOID mutex_slab_alloc(PVOID pvArg, SIZE_T cb)
+{
+  return _HostMapPages(cb);
+}
+
+/*
+ * Adds a reference to the mutex.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IMutex interface.
+ *
+ * Returns:
+ * The new reference count.
+ */
+static UINT32 mutex_AddRef(IUnknown *pThis)
+{
+  return __sync_add_and_fetch(&(((PHOSTMUTEX)pThis)->uiRefCount), 1);
+}
+
+/*
+ * Removes a reference from the mutex, returning it to the object cache when the last reference is gone.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IMutex interface.
+ *
+ * Returns:
+ * The new reference count.
+ */
+static UINT32 mutex_Release(IUnknown *pThis)
+{
+  UINT32 rc = __sync_sub_and_fetch(&(((PHOSTMUTEX)pThis)->uiRefCount), 1);   /* return from this function */
+
+  if (rc == 0)
+    ObjCacheFree(&g_ocMutexes, pThis);
+  return rc;
+}
+
+/*
+ * Locks the mutex, blocking until it is available.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IMutex interface.
+ *
+ * Returns:
+ * S_OK.
+ */
+static HRESULT mutex_Lock(IMutex *pThis)
+{
+  PHOSTMUTEX pmtx = (PHOSTMUTEX)pThis;   /* pointer to mutex object */
+  INT32 nState;                          /* previous lock state */
+
+  nState = __sync_val_compare_and_swap(&(pmtx->nState), 0, 1);
+  if (nState != 0)
+  { /* contended: mark it so, and sleep until we get it */
+    if (nState != 2)
+      nState = __sync_lock_test_and_set(&(pmtx->nState), 2);
+    while (nState != 0)
+    {
+      _HostFutexWait(&(pmtx->nState), 2);
+      nState = __sync_lock_test_and_set(&(pmtx->nState), 2);
+    }
+  }
+  return S_OK;
+}
+
+/*
+ * Attempts to lock the mutex without blocking.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IMutex interface.
+ *
+ * Returns:
+ * - S_OK = The mutex is now locked by the calling thread.
+ * - S_FALSE = The mutex is locked by another thread.
+ */
+static HRESULT mutex_TryLock(IMutex *pThis)
+{
+  return (__sync_val_compare_and_swap(&(((PHOSTMUTEX)pThis)->nState), 0, 1) == 0) ? S_OK : S_FALSE;
+}
+
+/*
+ * Unlocks the mutex, waking a waiter if there may be one.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IMutex interface.
+ *
+ * Returns:
+ * S_OK.
+ */
+static HRESULT mutex_Unlock(IMutex *pThis)
+{
+  PHOSTMUTEX pmtx = (PHOSTMUTEX)pThis;   /* pointer to mutex object */
+
+  if (__sync_fetch_and_sub(&(pmtx->nState), 1) != 1)
+  {
+    pmtx->nState = 0;
+    _HostFutexWake(&(pmtx->nState), 1);
+  }
+  return S_OK;
+}
+
+/* VTable for host mutexes */
+static const SEG_RODATA struct IMutexVTable vtblMutex =
+{
+  .QueryInterface = ObjHlpStandardQueryInterface_IMutex,
+  .AddRef = mutex_AddRef,
+  .Release = mutex_Release,
+  .Lock = mutex_Lock,
+  .TryLock = mutex_TryLock,
+  .Unlock = mutex_Unlock
+};
+
+/*
+ * Creates a new mutex.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IMutexFactory interface.
+ * - ppmtx = On successful return, receives a pointer to the new mutex's IMutex interface, with one reference.
+ *
+ * Returns:
+ * - S_OK = The mutex was created.
+ * - E_POINTER = ppmtx is NULL.
+ * - E_OUTOFMEMORY = The mutex could not be created.
+ */
+static HRESULT mutexfactory_CreateMutex(IMutexFactory *pThis, IMutex **ppmtx)
+{
+  PHOSTMUTEX pmtx;   /* pointer to new mutex object */
+
+  if (!ppmtx)
+    return E_POINTER;
+  *ppmtx = NULL;
+  if (!g_fCacheReady)
+  { /* first mutex ever created, set up the cache */
+    mutex_Lock(&(g_mtxCache.mutexInterface));
+    if (!g_fCacheReady)
+    {
+      ObjCacheInit(&g_ocMutexes, sizeof(HOSTMUTEX), SYS_PAGE_SIZE, NULL, mutex_slab_alloc, NULL,
+		   &(g_mtxCache.mutexInterface));
+      g_fCacheReady = TRUE;
+    }
+    mutex_Unlock(&(g_mtxCache.mutexInterface));
+  }
+  pmtx = (PHOSTMUTEX)ObjCacheAlloc(&g_ocMutexes);
+  if (!pmtx)
+    return E_OUTOFMEMORY;
+  pmtx->mutexInterface.pVTable = &vtblMutex;
+  pmtx->uiRefCount = 1;
+  pmtx->nState = 0;
+  *ppmtx = &(pmtx->mutexInterface);
+  return S_OK;
+}
+
+/* VTable for the host mutex factory */
+static const SEG_RODATA struct IMutexFactoryVTable vtblMutexFactory =
+{
+  .QueryInterface = ObjHlpStandardQueryInterface_IMutexFactory,
+  .AddRef = ObjHlpStaticAddRefRelease,
+  .Release = ObjHlpStaticAddRefRelease,
+  .CreateMutex = mutexfactory_CreateMutex
+};
+
+/* The host mutex factory object */
+static IMutexFactory g_mutexFactory = { &vtblMutexFactory };
+
+/*
+ * Returns the host mutex factory.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * Pointer to the IMutexFactory interface of the host mutex factory.
+ */
+IMutexFactory *HostGetMutexFactory(void)
+{
+  return &g_mutexFactory;
+}
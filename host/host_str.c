@@ -0,0 +1,161 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include <comrogue/str.h>
+
+/*-------------------------------------------------------------------------------------------------
+ * Host versions of the memory block functions that kernel/lib implements in ARM assembler, plus
+ * the memcpy/memmove/memset/memcmp entry points that the compiler may call for structure copies
+ * and initializers.  The host build has no C library, so these are simple byte loops; this file
+ * must be compiled with -fno-tree-loop-distribute-patterns so those loops do not turn back into
+ * calls to the functions themselves.
+ *-------------------------------------------------------------------------------------------------
+ */
+
+extern void *memcpy(void *pDest, const void *pSrc, SIZE_T cb);
+extern void *memmove(void *pDest, const void *pSrc, SIZE_T cb);
+extern void *memset(void *pMem, int ch, SIZE_T cb);
+extern int memcmp(const void *pMem1, const void *pMem2, SIZE_T cb);
+
+/*
+ * Copies a block of memory.  The source and destination blocks may overlap.
+ *
+ * Parameters:
+ * - pDest = Pointer to the destination block.
+ * - pSrc = Pointer to the source block.
+ * - cb = Number of bytes to copy.
+ *
+ * Returns:
+ * pDest.
+ */
+PVOID StrCopyMem(PVOID pDest, PCVOID pSrc, SSIZE_T cb)
+{
+  PBYTE pbDest = (PBYTE)pDest;               /* destination pointer */
+  const BYTE *pbSrc = (const BYTE *)pSrc;    /* source pointer */
+
+  if (cb <= 0 || pbDest == pbSrc)
+    return pDest;
+  if ((pbDest < pbSrc) || (pbDest >= pbSrc + cb))
+  { /* copy forward */
+    while (cb >= (SSIZE_T)sizeof(UINT32) && !(((UINT_PTR)pbDest | (UINT_PTR)pbSrc) & (sizeof(UINT32) - 1)))
+    {
+      *((PUINT32)pbDest) = *((const UINT32 *)pbSrc);
+      pbDest += sizeof(UINT32);
+      pbSrc += sizeof(UINT32);
+      cb -= sizeof(UINT32);
+    }
+    while (cb-- > 0)
+      *pbDest++ = *pbSrc++;
+  }
+  else
+  { /* overlapping with destination above source, copy backward */
+    pbDest += cb;
+    pbSrc += cb;
+    while (cb-- > 0)
+      *--pbDest = *--pbSrc;
+  }
+  return pDest;
+}
+
+/*
+ * Compares two blocks of memory.
+ *
+ * Parameters:
+ * - pMem1 = Pointer to the first block.
+ * - pMem2 = Pointer to the second block.
+ * - cb = Number of bytes to compare.
+ *
+ * Returns:
+ * - < 0 = The first differing byte in pMem1 is less than the corresponding byte in pMem2.
+ * - 0 = The blocks are equal.
+ * - > 0 = The first differing byte in pMem1 is greater than the corresponding byte in pMem2.
+ */
+INT32 StrCompareMem(PCVOID pMem1, PCVOID pMem2, SSIZE_T cb)
+{
+  const BYTE *pb1 = (const BYTE *)pMem1;     /* pointer into first block */
+  const BYTE *pb2 = (const BYTE *)pMem2;     /* pointer into second block */
+
+  for (; cb > 0; cb--, pb1++, pb2++)
+    if (*pb1 != *pb2)
+      return (INT32)(*pb1) - (INT32)(*pb2);
+  return 0;
+}
+
+/*
+ * Fills a block of memory with a byte value.
+ *
+ * Parameters:
+ * - pMem = Pointer to the block to fill.
+ * - ch = Byte value to fill with.
+ * - cb = Number of bytes to fill.
+ *
+ * Returns:
+ * pMem.
+ */
+PVOID StrSetMem(PVOID pMem, INT32 ch, SSIZE_T cb)
+{
+  PBYTE pb = (PBYTE)pMem;                           /* pointer into block */
+  UINT32 uiFill = (ch & 0xFF) * 0x01010101U;        /* fill value, four bytes at a time */
+
+  while (cb > 0 && ((UINT_PTR)pb & (sizeof(UINT32) - 1)))
+  {
+    *pb++ = (BYTE)ch;
+    cb--;
+  }
+  for (; cb >= (SSIZE_T)sizeof(UINT32); cb -= sizeof(UINT32), pb += sizeof(UINT32))
+    *((PUINT32)pb) = uiFill;
+  while (cb-- > 0)
+    *pb++ = (BYTE)ch;
+  return pMem;
+}
+
+/* Compiler-called entry points */
+
+void *memcpy(void *pDest, const void *pSrc, SIZE_T cb)
+{
+  return StrCopyMem(pDest, pSrc, (SSIZE_T)cb);
+}
+
+void *memmove(void *pDest, const void *pSrc, SIZE_T cb)
+{
+  return StrCopyMem(pDest, pSrc, (SSIZE_T)cb);
+}
+
+void *memset(void *pMem, int ch, SIZE_T cb)
+{
+  return StrSetMem(pMem, ch, (SSIZE_T)cb);
+}
+
+int memcmp(const void *pMem1, const void *pMem2, SIZE_T cb)
+{
+  return StrCompareMem(pMem1, pMem2, (SSIZE_T)cb);
+}
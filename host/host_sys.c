@@ -0,0 +1,428 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <stdarg.h>
+#include <comrogue/types.h>
+#include <comrogue/scode.h>
+#include <comrogue/str.h>
+#include <comrogue/internals/mmu.h>
+#include "host_internals.h"
+
+/*-------------------------------------------------------------------------------------------------------------
+ * Host system layer: system call entry, process entry point, threads, clock, and console output.  Every thread
+ * (including the initial one, which is moved onto such a stack before HostMain is called) runs on a stack
+ * region aligned to HOST_STACK_SIZE, with its HOSTTHREAD block at the bottom; see _HostCurrentThread.
+ *-------------------------------------------------------------------------------------------------------------
+ */
+
+#define PRINTF_BUFFER_SIZE  512   /* size of HostPrintf's output buffer */
+
+/* Buffer used by HostPrintf */
+typedef struct tagPRINTFBUF {
+  UINT32 cch;                         /* number of characters in buffer */
+  CHAR ach[PRINTF_BUFFER_SIZE];       /* the characters */
+} PRINTFBUF, *PPRINTFBUF;
+
+/* Linux i386 timespec */
+typedef struct tagHOSTTIMESPEC {
+  INT32 nSeconds;                     /* seconds */
+  INT32 nNanoseconds;                 /* nanoseconds */
+} HOSTTIMESPEC;
+
+extern INT32 host_clone(UINT32 uiFlags, PVOID pvStack, INT32 volatile *ptidParent, INT32 volatile *ptidChild);
+
+/*
+ * _HostSyscall(nCall, a1, ..., a6) makes a system call through int $0x80 and returns the raw result.
+ *
+ * host_clone(uiFlags, pvStack, ptidParent, ptidChild) creates a thread with the new stack pvStack, whose first
+ * word must hold the thread's HOSTTHREAD pointer.  The new thread calls host_thread_start with that pointer.
+ *
+ * _start is the process entry point; it calls host_start with a 16-byte-aligned stack.
+ */
+__asm__(".text\n"
+	".globl _HostSyscall\n"
+	"_HostSyscall:\n"
+	"\tpushl %ebx\n"
+	"\tpushl %esi\n"
+	"\tpushl %edi\n"
+	"\tpushl %ebp\n"
+	"\tmovl 20(%esp), %eax\n"
+	"\tmovl 24(%esp), %ebx\n"
+	"\tmovl 28(%esp), %ecx\n"
+	"\tmovl 32(%esp), %edx\n"
+	"\tmovl 36(%esp), %esi\n"
+	"\tmovl 40(%esp), %edi\n"
+	"\tmovl 44(%esp), %ebp\n"
+	"\tint $0x80\n"
+	"\tpopl %ebp\n"
+	"\tpopl %edi\n"
+	"\tpopl %esi\n"
+	"\tpopl %ebx\n"
+	"\tret\n"
+	".globl host_clone\n"
+	"host_clone:\n"
+	"\tpushl %ebx\n"
+	"\tpushl %esi\n"
+	"\tpushl %edi\n"
+	"\tmovl 16(%esp), %ebx\n"
+	"\tmovl 20(%esp), %ecx\n"
+	"\tmovl 24(%esp), %edx\n"
+	"\txorl %esi, %esi\n"
+	"\tmovl 28(%esp), %edi\n"
+	"\tmovl $120, %eax\n"
+	"\tint $0x80\n"
+	"\ttestl %eax, %eax\n"
+	"\tjnz 1f\n"
+	"\txorl %ebp, %ebp\n"
+	"\tcall host_thread_start\n"
+	"\thlt\n"
+	"1:\n"
+	"\tpopl %edi\n"
+	"\tpopl %esi\n"
+	"\tpopl %ebx\n"
+	"\tret\n"
+	".globl _start\n"
+	"_start:\n"
+	"\txorl %ebp, %ebp\n"
+	"\tandl $-16, %esp\n"
+	"\tcall host_start\n"
+	"\thlt\n");
+
+/*
+ * Maps anonymous, zero-filled memory.
+ *
+ * Parameters:
+ * - cb = Number of bytes to map; a multiple of the page size.
+ *
+ * Returns:
+ * - NULL = The mapping failed.
+ * - Other = Pointer to the new memory.
+ */
+PVOID _HostMapPages(SIZE_T cb)
+{
+  INT32 rc = _HostSyscall(HOST_SYS_MMAP2, 0, cb, HOST_PROT_READ|HOST_PROT_WRITE,
+			  HOST_MAP_PRIVATE|HOST_MAP_ANONYMOUS, (UINT32)(-1), 0);
+  return HOST_SYSCALL_FAILED(rc) ? NULL : (PVOID)rc;
+}
+
+/*
+ * Unmaps memory mapped by _HostMapPages.
+ *
+ * Parameters:
+ * - pv = Pointer to the memory to unmap.
+ * - cb = Number of bytes to unmap; a multiple of the page size.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HostUnmapPages(PVOID pv, SIZE_T cb)
+{
+  _HostSyscall(HOST_SYS_MUNMAP, (UINT32)pv, cb, 0, 0, 0, 0);
+}
+
+/*
+ * Waits on a futex, returning when woken or when the futex no longer holds the expected value.
+ *
+ * Parameters:
+ * - pnFutex = Pointer to the futex word.
+ * - nExpected = Value the futex must hold for the thread to sleep.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HostFutexWait(INT32 volatile *pnFutex, INT32 nExpected)
+{
+  _HostSyscall(HOST_SYS_FUTEX, (UINT32)pnFutex, HOST_FUTEX_WAIT, (UINT32)nExpected, 0, 0, 0);
+}
+
+/*
+ * Wakes threads waiting on a futex.
+ *
+ * Parameters:
+ * - pnFutex = Pointer to the futex word.
+ * - nWake = Maximum number of threads to wake.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HostFutexWake(INT32 volatile *pnFutex, INT32 nWake)
+{
+  _HostSyscall(HOST_SYS_FUTEX, (UINT32)pnFutex, HOST_FUTEX_WAKE, (UINT32)nWake, 0, 0, 0);
+}
+
+/*
+ * Allocates the stack region for a new thread, with its HOSTTHREAD block at the bottom, a guard page above the
+ * block, and the stack above that.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * - NULL = The region could not be allocated.
+ * - Other = Pointer to the new thread's HOSTTHREAD block, zero-filled.
+ */
+static PHOSTTHREAD thread_region_alloc(void)
+{
+  UINT_PTR uiMap;     /* start of mapping */
+  UINT_PTR uiRegion;  /* aligned start of region */
+
+  uiMap = (UINT_PTR)_HostMapPages(2 * HOST_STACK_SIZE);
+  if (!uiMap)
+    return NULL;
+  uiRegion = (uiMap + HOST_STACK_SIZE - 1) & ~(HOST_STACK_SIZE - 1);
+  if (uiRegion > uiMap)
+    _HostUnmapPages((PVOID)uiMap, uiRegion - uiMap);
+  if (uiRegion + HOST_STACK_SIZE < uiMap + 2 * HOST_STACK_SIZE)
+    _HostUnmapPages((PVOID)(uiRegion + HOST_STACK_SIZE), uiMap + HOST_STACK_SIZE - uiRegion);
+  _HostSyscall(HOST_SYS_MPROTECT, uiRegion + SYS_PAGE_CEILING(sizeof(HOSTTHREAD)), SYS_PAGE_SIZE, HOST_PROT_NONE,
+	       0, 0, 0);
+  return (PHOSTTHREAD)uiRegion;
+}
+
+/*
+ * Returns the initial stack pointer for a thread, with the thread's block pointer stored as its first word.
+ *
+ * Parameters:
+ * - pthr = Pointer to the thread's HOSTTHREAD block.
+ *
+ * Returns:
+ * The initial stack pointer, aligned to 16 bytes.
+ */
+static PUINT32 thread_initial_stack(PHOSTTHREAD pthr)
+{
+  PUINT32 puiStack = (PUINT32)((UINT_PTR)pthr + HOST_STACK_SIZE - 16);   /* initial stack pointer */
+
+  puiStack[0] = (UINT32)pthr;
+  return puiStack;
+}
+
+/*
+ * Entry point of threads created by HostThreadCreate.  Runs the thread function, then the thread-local cleanup
+ * functions, then exits the thread.  The stack region is unmapped by HostThreadJoin.
+ *
+ * Parameters:
+ * - pthr = Pointer to the thread's HOSTTHREAD block.
+ *
+ * Returns:
+ * Does not return.
+ */
+void host_thread_start(PHOSTTHREAD pthr)
+{
+  pthr->nExitCode = (*(pthr->pfnThread))(pthr->pvArg);
+  _HostThreadLocalCleanup(pthr);
+  for (;;)
+    _HostSyscall(HOST_SYS_EXIT, 0, 0, 0, 0, 0, 0);
+}
+
+/*
+ * Runs HostMain on the initial thread's new stack, then exits the process with its return value.
+ *
+ * Parameters:
+ * - pthr = Pointer to the initial thread's HOSTTHREAD block.
+ *
+ * Returns:
+ * Does not return.
+ */
+void host_main_start(PHOSTTHREAD pthr)
+{
+  HostExit(HostMain());
+}
+
+/*
+ * Called from _start.  Moves the initial thread onto a host stack region and calls host_main_start there.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * Does not return.
+ */
+void host_start(void)
+{
+  PHOSTTHREAD pthr = thread_region_alloc();   /* initial thread block */
+
+  if (!pthr)
+    HostExit(127);
+  __asm__ volatile("movl %0, %%esp\n\tcall host_main_start\n\thlt" : : "r" (thread_initial_stack(pthr)) : "memory");
+}
+
+/*
+ * Creates a new thread.
+ *
+ * Parameters:
+ * - pfnThread = Function the thread runs; its return value becomes the thread's exit code.
+ * - pvArg = Argument passed to pfnThread.
+ * - ppthr = Receives the handle of the new thread, which must eventually be passed to HostThreadJoin.
+ *
+ * Returns:
+ * - S_OK = The thread was created.
+ * - E_POINTER = ppthr is NULL.
+ * - E_OUTOFMEMORY = The thread could not be created.
+ */
+HRESULT HostThreadCreate(PFNHOSTTHREAD pfnThread, PVOID pvArg, PHOSTTHREAD *ppthr)
+{
+  PHOSTTHREAD pthr;   /* new thread block */
+
+  if (!ppthr)
+    return E_POINTER;
+  *ppthr = NULL;
+  pthr = thread_region_alloc();
+  if (!pthr)
+    return E_OUTOFMEMORY;
+  pthr->pfnThread = pfnThread;
+  pthr->pvArg = pvArg;
+  if (HOST_SYSCALL_FAILED(host_clone(HOST_CLONE_FLAGS, thread_initial_stack(pthr), &(pthr->tid), &(pthr->tid))))
+  {
+    _HostUnmapPages(pthr, HOST_STACK_SIZE);
+    return E_OUTOFMEMORY;
+  }
+  *ppthr = pthr;
+  return S_OK;
+}
+
+/*
+ * Waits for a thread to exit and releases its resources.
+ *
+ * Parameters:
+ * - pthr = Handle of the thread, from HostThreadCreate.
+ *
+ * Returns:
+ * The thread's exit code.
+ */
+INT32 HostThreadJoin(PHOSTTHREAD pthr)
+{
+  INT32 tid;   /* thread ID */
+  INT32 rc;    /* return from this function */
+
+  /* the kernel's wake when the thread exits is not a private one, so neither is this wait */
+  while ((tid = pthr->tid) != 0)
+    _HostSyscall(HOST_SYS_FUTEX, (UINT32)(&(pthr->tid)), HOST_FUTEX_WAIT_SHARED, (UINT32)tid, 0, 0, 0);
+  rc = pthr->nExitCode;
+  _HostUnmapPages(pthr, HOST_STACK_SIZE);
+  return rc;
+}
+
+/*
+ * Yields the processor to another thread.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * Nothing.
+ */
+void HostThreadYield(void)
+{
+  _HostSyscall(HOST_SYS_SCHED_YIELD, 0, 0, 0, 0, 0, 0);
+}
+
+/*
+ * Returns the time from a monotonic clock.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * The current time in nanoseconds, from an arbitrary starting point.
+ */
+UINT64 HostTimeNs(void)
+{
+  HOSTTIMESPEC ts;   /* time value */
+
+  _HostSyscall(HOST_SYS_CLOCK_GETTIME, HOST_CLOCK_MONOTONIC, (UINT32)(&ts), 0, 0, 0, 0);
+  return ((UINT64)ts.nSeconds * 1000000000ULL) + ts.nNanoseconds;
+}
+
+/*
+ * Format output function for HostPrintf, which adds characters to its buffer.
+ *
+ * Parameters:
+ * - ppArg = Pointer to the buffer pointer.
+ * - pch = Characters to add.
+ * - cch = Number of characters to add.
+ *
+ * Returns:
+ * S_OK.
+ */
+static HRESULT printf_func(PPVOID ppArg, PCCHAR pch, UINT32 cch)
+{
+  PPRINTFBUF pbuf = (PPRINTFBUF)(*ppArg);   /* pointer to output buffer */
+
+  while (cch-- > 0)
+  {
+    if (pbuf->cch == PRINTF_BUFFER_SIZE)
+    {
+      _HostSyscall(HOST_SYS_WRITE, 1, (UINT32)(pbuf->ach), pbuf->cch, 0, 0, 0);
+      pbuf->cch = 0;
+    }
+    pbuf->ach[pbuf->cch++] = *pch++;
+  }
+  return S_OK;
+}
+
+/*
+ * Writes formatted output to standard output.  Output of a single call is written at once where it fits in the
+ * buffer, so lines from different threads do not interleave.
+ *
+ * Parameters:
+ * - pszFormat = Format string, as for StrFormatV8.
+ * - ... = Arguments to be formatted.
+ *
+ * Returns:
+ * Nothing.
+ */
+void HostPrintf(PCSTR pszFormat, ...)
+{
+  PRINTFBUF buf;   /* output buffer */
+  va_list argp;    /* argument pointer */
+
+  buf.cch = 0;
+  va_start(argp, pszFormat);
+  StrFormatV8(printf_func, &buf, pszFormat, argp);
+  va_end(argp);
+  if (buf.cch > 0)
+    _HostSyscall(HOST_SYS_WRITE, 1, (UINT32)(buf.ach), buf.cch, 0, 0, 0);
+}
+
+/*
+ * Exits the process.
+ *
+ * Parameters:
+ * - nExitCode = Exit code for the process.
+ *
+ * Returns:
+ * Does not return.
+ */
+void HostExit(INT32 nExitCode)
+{
+  for (;;)
+    _HostSyscall(HOST_SYS_EXIT_GROUP, (UINT32)nExitCode, 0, 0, 0, 0, 0);
+}
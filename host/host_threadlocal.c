@@ -0,0 +1,271 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include <comrogue/scode.h>
+#include <comrogue/objectbase.h>
+#include <comrogue/threadlocal.h>
+#include <comrogue/objhelp.h>
+#include <comrogue/internals/seg.h>
+#include "host_internals.h"
+
+/*----------------------------------------------------------------------------------------------------------
+ * Host thread-local values.  Each IThreadLocal occupies one entry of a fixed table, and each thread keeps
+ * its values in the matching entries of its HOSTTHREAD block.  A table entry gets a new generation number
+ * each time it is handed out, and a thread's value only counts if it was set under the current generation;
+ * until then, the thread sees the initial value given when the IThreadLocal was created.  At thread exit,
+ * each non-NULL value is cleared and passed to its cleanup function; a cleanup function that sets a new value
+ * causes another pass, which lets the heap move its thread caches through their "purgatory" state.
+ *----------------------------------------------------------------------------------------------------------
+ */
+
+/* Host thread-local object */
+typedef struct tagHOSTTHREADLOCAL {
+  IThreadLocal thrlInterface;           /* the thread-local interface */
+  UINT32 volatile uiRefCount;           /* reference count */
+  INT32 volatile fInUse;                /* is this table entry in use? */
+  UINT32 volatile uiGeneration;         /* generation of the current user of this entry */
+  PVOID pvInitial;                      /* value seen by threads which have not set one */
+  PFNTHREADLOCALCLEANUP pfnCleanup;     /* cleanup function called at thread exit, or NULL */
+  PVOID pvCleanupParam;                 /* parameter passed to cleanup function */
+} HOSTTHREADLOCAL, *PHOSTTHREADLOCAL;
+
+static HOSTTHREADLOCAL g_athrl[HOST_MAX_THREADLOCALS];   /* table of thread-local objects */
+
+/*
+ * Adds a reference to the thread-local object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IThreadLocal interface.
+ *
+ * Returns:
+ * The new reference count.
+ */
+static UINT32 threadlocal_AddRef(IUnknown *pThis)
+{
+  return __sync_add_and_fetch(&(((PHOSTTHREADLOCAL)pThis)->uiRefCount), 1);
+}
+
+/*
+ * Removes a reference from the thread-local object, returning its table entry when the last reference is
+ * gone.  The cleanup function will not be called for the values of threads still running.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IThreadLocal interface.
+ *
+ * Returns:
+ * The new reference count.
+ */
+static UINT32 threadlocal_Release(IUnknown *pThis)
+{
+  PHOSTTHREADLOCAL pthrl = (PHOSTTHREADLOCAL)pThis;                 /* pointer to thread-local object */
+  UINT32 rc = __sync_sub_and_fetch(&(pthrl->uiRefCount), 1);        /* return from this function */
+
+  if (rc == 0)
+  {
+    pthrl->pfnCleanup = NULL;
+    __sync_lock_release(&(pthrl->fInUse));
+  }
+  return rc;
+}
+
+/*
+ * Sets the cleanup function to be called on a thread's value when the thread exits.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IThreadLocal interface.
+ * - pfnCleanup = Pointer to the cleanup function, or NULL for none.
+ * - pvParam = Parameter to pass to the cleanup function.
+ *
+ * Returns:
+ * S_OK.
+ */
+static HRESULT threadlocal_SetCleanupFunc(IThreadLocal *pThis, PFNTHREADLOCALCLEANUP pfnCleanup, PVOID pvParam)
+{
+  PHOSTTHREADLOCAL pthrl = (PHOSTTHREADLOCAL)pThis;   /* pointer to thread-local object */
+
+  pthrl->pfnCleanup = pfnCleanup;
+  pthrl->pvCleanupParam = pvParam;
+  return S_OK;
+}
+
+/*
+ * Gets the calling thread's value.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IThreadLocal interface.
+ * - ppv = Receives the calling thread's value, or the initial value if the thread has not set one.
+ *
+ * Returns:
+ * - S_OK = The value was retrieved.
+ * - E_POINTER = ppv is NULL.
+ */
+static HRESULT threadlocal_Get(IThreadLocal *pThis, PPVOID ppv)
+{
+  PHOSTTHREADLOCAL pthrl = (PHOSTTHREADLOCAL)pThis;   /* pointer to thread-local object */
+  PHOSTTHREAD pthr = _HostCurrentThread();            /* pointer to calling thread's block */
+  UINT32 ndx = pthrl - g_athrl;                       /* index of this object's entry */
+
+  if (!ppv)
+    return E_POINTER;
+  *ppv = (pthr->auiLocalGen[ndx] == pthrl->uiGeneration) ? pthr->apvLocals[ndx] : pthrl->pvInitial;
+  return S_OK;
+}
+
+/*
+ * Sets the calling thread's value.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IThreadLocal interface.
+ * - pv = The new value.
+ *
+ * Returns:
+ * S_OK.
+ */
+static HRESULT threadlocal_Set(IThreadLocal *pThis, PVOID pv)
+{
+  PHOSTTHREADLOCAL pthrl = (PHOSTTHREADLOCAL)pThis;   /* pointer to thread-local object */
+  PHOSTTHREAD pthr = _HostCurrentThread();            /* pointer to calling thread's block */
+  UINT32 ndx = pthrl - g_athrl;                       /* index of this object's entry */
+
+  pthr->apvLocals[ndx] = pv;
+  pthr->auiLocalGen[ndx] = pthrl->uiGeneration;
+  return S_OK;
+}
+
+/* VTable for host thread-local objects */
+static const SEG_RODATA struct IThreadLocalVTable vtblThreadLocal =
+{
+  .QueryInterface = ObjHlpStandardQueryInterface_IThreadLocal,
+  .AddRef = threadlocal_AddRef,
+  .Release = threadlocal_Release,
+  .SetCleanupFunc = threadlocal_SetCleanupFunc,
+  .Get = threadlocal_Get,
+  .Set = threadlocal_Set
+};
+
+/*
+ * Runs the cleanup functions for an exiting thread's values.
+ *
+ * Parameters:
+ * - pthr = Pointer to the exiting thread's block.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HostThreadLocalCleanup(PHOSTTHREAD pthr)
+{
+  UINT32 nPass;               /* pass counter */
+  UINT32 ndx;                 /* index into table */
+  BOOL fCalled;               /* was any cleanup function called on this pass? */
+  PVOID pv;                   /* value to clean up */
+  PFNTHREADLOCALCLEANUP pfn;  /* cleanup function */
+
+  for (nPass = 0; nPass < HOST_CLEANUP_PASSES; nPass++)
+  {
+    fCalled = FALSE;
+    for (ndx = 0; ndx < HOST_MAX_THREADLOCALS; ndx++)
+    {
+      pv = pthr->apvLocals[ndx];
+      pfn = g_athrl[ndx].pfnCleanup;
+      if (!pv || !pfn || !g_athrl[ndx].fInUse || (pthr->auiLocalGen[ndx] != g_athrl[ndx].uiGeneration))
+	continue;
+      pthr->apvLocals[ndx] = NULL;
+      (*pfn)(pv, g_athrl[ndx].pvCleanupParam);
+      fCalled = TRUE;
+    }
+    if (!fCalled)
+      break;
+  }
+}
+
+/*
+ * Creates a new thread-local object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the IThreadLocalFactory interface.
+ * - pvInitial = Value seen by each thread until it sets its own.
+ * - ppthrl = On successful return, receives a pointer to the new object's IThreadLocal interface, with one
+ *            reference.
+ *
+ * Returns:
+ * - S_OK = The thread-local object was created.
+ * - E_POINTER = ppthrl is NULL.
+ * - E_OUTOFMEMORY = All HOST_MAX_THREADLOCALS table entries are in use.
+ */
+static HRESULT threadlocalfactory_CreateThreadLocal(IThreadLocalFactory *pThis, PVOID pvInitial,
+						    IThreadLocal **ppthrl)
+{
+  PHOSTTHREADLOCAL pthrl;   /* pointer to new thread-local object */
+
+  if (!ppthrl)
+    return E_POINTER;
+  *ppthrl = NULL;
+  for (pthrl = g_athrl; pthrl < g_athrl + HOST_MAX_THREADLOCALS; pthrl++)
+    if (!__sync_lock_test_and_set(&(pthrl->fInUse), 1))
+      break;
+  if (pthrl == g_athrl + HOST_MAX_THREADLOCALS)
+    return E_OUTOFMEMORY;
+  pthrl->thrlInterface.pVTable = &vtblThreadLocal;
+  pthrl->uiRefCount = 1;
+  pthrl->pvInitial = pvInitial;
+  pthrl->pfnCleanup = NULL;
+  pthrl->pvCleanupParam = NULL;
+  __sync_add_and_fetch(&(pthrl->uiGeneration), 1);
+  *ppthrl = &(pthrl->thrlInterface);
+  return S_OK;
+}
+
+/* VTable for the host thread-local factory */
+static const SEG_RODATA struct IThreadLocalFactoryVTable vtblThreadLocalFactory =
+{
+  .QueryInterface = ObjHlpStandardQueryInterface_IThreadLocalFactory,
+  .AddRef = ObjHlpStaticAddRefRelease,
+  .Release = ObjHlpStaticAddRefRelease,
+  .CreateThreadLocal = threadlocalfactory_CreateThreadLocal
+};
+
+/* The host thread-local factory object */
+static IThreadLocalFactory g_threadLocalFactory = { &vtblThreadLocalFactory };
+
+/*
+ * Returns the host thread-local factory.
+ *
+ * Parameters:
+ * None.
+ *
+ * Returns:
+ * Pointer to the IThreadLocalFactory interface of the host thread-local factory.
+ */
+IThreadLocalFactory *HostGetThreadLocalFactory(void)
+{
+  return &g_threadLocalFactory;
+}
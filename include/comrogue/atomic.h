@@ -0,0 +1,68 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#ifndef __ATOMIC_H_INCLUDED
+#define __ATOMIC_H_INCLUDED
+
+#ifndef __ASM__
+
+#include <comrogue/types.h>
+#include <comrogue/compiler_macros.h>
+
+/*----------------------------------------
+ * Atomic pointer operations and barriers
+ *----------------------------------------
+ */
+
+#ifdef __arm__
+
+CDECL_BEGIN
+
+extern PVOID AtomicCompareExchangePtr(PPVOID ppv, PVOID pvCompare, PVOID pvNew);
+extern PVOID AtomicExchangePtr(PPVOID ppv, PVOID pvNew);
+extern void AtomicMemoryBarrier(void);
+
+CDECL_END
+
+#else
+
+/* Portable fallback for host builds, using the compiler's atomic builtins (full barriers in both cases). */
+#define AtomicCompareExchangePtr(ppv, pvCompare, pvNew) \
+  ((PVOID)__sync_val_compare_and_swap((ppv), (pvCompare), (pvNew)))
+#define AtomicExchangePtr(ppv, pvNew) \
+  ({ PVOID __pvOld = (PVOID)__sync_lock_test_and_set((ppv), (pvNew)); __sync_synchronize(); __pvOld; })
+#define AtomicMemoryBarrier() __sync_synchronize()
+
+#endif /* __arm__ */
+
+#endif /* __ASM__ */
+
+#endif /* __ATOMIC_H_INCLUDED */
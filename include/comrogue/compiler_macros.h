@@ -59,6 +59,7 @@
  */
 
 #define UNUSED(var)   ((void)var)
+#define RETURN_ADDRESS()  __builtin_return_address(0)
 
 #endif /* __ASM__ */
 
@@ -39,6 +39,7 @@
 #include <comrogue/scode.h>
 #include <comrogue/allocator.h>
 #include <comrogue/mutex.h>
+#include <comrogue/threadlocal.h>
 
 /*------------------------------------------------------------------------------------
  * The raw heap data used to hold the heap internals.  It's defined as opaque memory.
@@ -47,7 +48,7 @@
 
 typedef struct tagRAWHEAPDATA
 {
-  UINT32 opaque[128];             /* opaque data, do not modify */
+  UINT32 opaque[1024];            /* opaque data, do not modify */
 } RAWHEAPDATA, *PRAWHEAPDATA;
 
 typedef void (*PFNRAWHEAPDATAFREE)(PRAWHEAPDATA); /* function that optionally frees the heap data */
@@ -68,9 +69,9 @@ typedef void (*PFNRAWHEAPDATAFREE)(PRAWHEAPDATA); /* function that optionally fr
 
 CDECL_BEGIN
 
-extern HRESULT HeapCreate(PRAWHEAPDATA prhd, PFNRAWHEAPDATAFREE pfnFree, UINT32 uiFlags, UINT32 nChunkBits, 
-			  IChunkAllocator *pChunkAllocator, IMutexFactory *pMutexFactory,
-			  IMalloc **ppHeap);
+extern HRESULT HeapCreate(PRAWHEAPDATA prhd, PFNRAWHEAPDATAFREE pfnFree, UINT32 uiFlags, UINT32 nChunkBits,
+			  UINT32 cArenas, IChunkAllocator *pChunkAllocator, IMutexFactory *pMutexFactory,
+			  IThreadLocalFactory *pThreadLocalFactory, IMalloc **ppHeap);
 
 CDECL_END
 
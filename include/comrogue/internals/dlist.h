@@ -58,7 +58,7 @@
   do { dlistPrev(ptrNew, fieldname) = dlistPrev(ptrInsBefore, fieldname); \
        dlistNext(ptrNew, fieldname) = (ptrInsBefore); \
        dlistNext(dlistPrev(ptrInsBefore, fieldname), fieldname) = (ptrNew); \
-       dlistPrev(ptrInsBefore) = (ptrNew); } while (0)
+       dlistPrev(ptrInsBefore, fieldname) = (ptrNew); } while (0)
 
 /* Insert a node after another in a list. */
 #define dlistInsertAfter(ptrInsAfter, ptrNew, fieldname) \
@@ -107,7 +107,7 @@
 
 /* Pointers to the first and last elements of a list. */
 #define dlistFirst(hptr, fieldname)  ((hptr)->pDLHFirst)
-#define dlistLast(hptr, fieldname)   (dlistFirst(hptr) ? dlistPrev(dlistFirst(hptr), fieldname) : NULL)
+#define dlistLast(hptr, fieldname)   (dlistFirst(hptr, fieldname) ? dlistPrev(dlistFirst(hptr, fieldname), fieldname) : NULL)
 
 /* Reinitializer for a list. */
 #define dlistListInit(hptr, fieldname) do { dlistFirst(hptr, fieldname) = NULL; } while (0)
@@ -59,6 +59,7 @@
 #define SYS_PAGE_MASK       (SYS_PAGE_SIZE - 1)
 #define SYS_CACHELINE_MASK  (SYS_CACHELINE_SIZE - 1)
 
+#define SYS_PAGE_CEILING(sz)      (((sz) + SYS_PAGE_MASK) & ~SYS_PAGE_MASK)
 #define SYS_CACHELINE_CEILING(sz) (((sz) + SYS_CACHELINE_MASK) & ~SYS_CACHELINE_MASK)
 
 /* Section descriptor bits */
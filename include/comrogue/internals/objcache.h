@@ -0,0 +1,84 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#ifndef __OBJCACHE_H_INCLUDED
+#define __OBJCACHE_H_INCLUDED
+
+#ifndef __ASM__
+
+#include <comrogue/types.h>
+#include <comrogue/compiler_macros.h>
+#include <comrogue/allocator.h>
+#include <comrogue/mutex.h>
+
+/*--------------------------------------------------------------------------------------------------------
+ * Typed object caches for fixed-size kernel metadata.  Each cache hands out objects of a single size,
+ * carved from slabs obtained from a caller-supplied slab allocator, and keeps its own free list of
+ * returned objects (linked through their first word).  Objects no larger than a cache line are packed so
+ * that none of them straddles a cache line boundary.  Slabs are never given back to the slab allocator.
+ *--------------------------------------------------------------------------------------------------------
+ */
+
+/* Constructor run on each object as it is handed out by ObjCacheAlloc. */
+typedef void (*PFNOBJCTOR)(PVOID);
+
+/* Slab allocator used to obtain fresh memory for a cache; returns NULL on failure. */
+typedef PVOID (*PFNOBJSLABALLOC)(PVOID, SIZE_T);
+
+/* The object cache structure. */
+typedef struct tagOBJCACHE {
+  SIZE_T cbObject;                /* size of each object, after packing */
+  SIZE_T cbSlab;                  /* size of each slab */
+  PFNOBJCTOR pfnCtor;             /* constructor function, or NULL */
+  PFNOBJSLABALLOC pfnSlabAlloc;   /* slab allocator function */
+  PVOID pvSlabArg;                /* argument passed to slab allocator function */
+  IMutex *pmtx;                   /* mutex protecting the cache, or NULL if caller serializes access */
+  PVOID pvFree;                   /* free list of returned objects */
+  UINT_PTR uiNext;                /* next object to carve from the current slab */
+  UINT_PTR uiPast;                /* address immediately past the last object in the current slab */
+  UINT32 cSlabs;                  /* number of slabs obtained */
+  UINT32 cInUse;                  /* number of objects currently handed out */
+} OBJCACHE, *POBJCACHE;
+
+/* Function prototypes. */
+CDECL_BEGIN
+
+extern PVOID ObjCacheStdSlabAlloc(PVOID pvMalloc, SIZE_T cb);
+extern void ObjCacheInit(POBJCACHE poc, SIZE_T cbObject, SIZE_T cbSlab, PFNOBJCTOR pfnCtor,
+			 PFNOBJSLABALLOC pfnSlabAlloc, PVOID pvSlabArg, IMutex *pmtx);
+extern PVOID ObjCacheAlloc(POBJCACHE poc);
+extern void ObjCacheFree(POBJCACHE poc, PVOID pv);
+
+CDECL_END
+
+#endif /* __ASM__ */
+
+#endif /* __OBJCACHE_H_INCLUDED */
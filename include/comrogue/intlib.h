@@ -49,10 +49,115 @@ typedef struct tagLDIV {
 CDECL_BEGIN
 
 extern HRESULT IntLDiv(PLDIV pResult, INT64 num, INT64 denom);
-extern INT32 IntFirstSet(INT32 nMask);
 
 CDECL_END
 
+/*----------------------------
+ * Bit manipulation functions
+ *----------------------------
+ */
+
+/*
+ * Returns the number of leading (most-significant) zero bits in a value.  Uses the ARMv5 "clz" instruction on
+ * the target, and the compiler's builtin elsewhere.
+ *
+ * Parameters:
+ * - x = The value to be tested.
+ *
+ * Returns:
+ * The number of leading zero bits, which is 32 if x is 0.
+ */
+static inline UINT32 IntCountLeadingZeros(UINT32 x)
+{
+#ifdef __arm__
+  UINT32 rc;  /* return from this function */
+  __asm__ ("clz %0, %1" : "=r" (rc) : "r" (x));
+  return rc;
+#else
+  return x ? (UINT32)__builtin_clz(x) : 32;
+#endif
+}
+
+/*
+ * Returns the index of the last (most-significant) bit set in the specified mask, where the least-significant
+ * bit is considered bit #1.
+ *
+ * Parameters:
+ * - nMask = The mask to be tested.
+ *
+ * Returns:
+ * - 0 = If nMask is 0.
+ * - Other = Index of the last set bit in nMask.
+ */
+static inline INT32 IntLastSet(UINT32 nMask)
+{
+  return 32 - IntCountLeadingZeros(nMask);
+}
+
+/*
+ * Returns the index of the first bit set in the specified mask, where the least-significant bit is considered
+ * bit #1.
+ *
+ * Parameters:
+ * - nMask = The mask to be tested.
+ *
+ * Returns:
+ * - 0 = If nMask is 0.
+ * - Other = Index of the first set bit in nMask.
+ */
+static inline INT32 IntFirstSet(INT32 nMask)
+{
+  return IntLastSet((UINT32)nMask & -(UINT32)nMask);  /* isolate the lowest set bit */
+}
+
+/*
+ * Returns the number of bits set in a value.
+ *
+ * Parameters:
+ * - x = The value to be tested.
+ *
+ * Returns:
+ * The number of 1 bits in x.
+ */
+static inline UINT32 IntPopCount(UINT32 x)
+{
+  /* Done in parallel rather than with the builtin, which would need a libgcc helper on both ARM and x86. */
+  x = x - ((x >> 1) & 0x55555555U);
+  x = (x & 0x33333333U) + ((x >> 2) & 0x33333333U);
+  x = (x + (x >> 4)) & 0x0F0F0F0FU;
+  return (x * 0x01010101U) >> 24;
+}
+
+/*
+ * Computes the smallest power of 2 greater than or equal to a value.
+ *
+ * Parameters:
+ * - x = The value to compute.
+ *
+ * Returns:
+ * The smallest power of 2 greater than or equal to x; 0 if x is 0 or if the result would not fit in 32 bits.
+ */
+static inline UINT32 IntPow2Ceiling(UINT32 x)
+{
+  if (x <= 1)
+    return x;
+  return (x > 0x80000000U) ? 0 : (1U << IntLastSet(x - 1));
+}
+
+/*
+ * Computes the largest power of 2 less than or equal to a value.
+ *
+ * Parameters:
+ * - x = The value to compute.
+ *
+ * Returns:
+ * The largest power of 2 less than or equal to x, or 0 if x is 0.
+ */
+static inline UINT32 IntPow2Floor(UINT32 x)
+{
+  return x ? (1U << (IntLastSet(x) - 1)) : 0;
+}
+
 #endif /* __ASM__ */
 
 #endif /* __INTLIB_H_INCLUDED */
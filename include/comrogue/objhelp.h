@@ -39,6 +39,8 @@
 #include <comrogue/connpoint.h>
 #include <comrogue/allocator.h>
 #include <comrogue/stream.h>
+#include <comrogue/mutex.h>
+#include <comrogue/threadlocal.h>
 
 /*------------------------------------------------
  * Generic fixed connection point data structure.
@@ -54,6 +56,7 @@ typedef struct tagFIXEDCPDATA
   UINT32 ncpSize;                             /* number of connection points actually connected */
   UINT32 ncpCapacity;                         /* maximum number of connection points connectable */
   IMalloc *pAllocator;                        /* pointer to allocator */
+  UINT32 uiGeneration;                        /* bumped each time a connection is made or broken */
 } FIXEDCPDATA, *PFIXEDCPDATA;
 
 /*---------------------
@@ -64,10 +67,15 @@ typedef struct tagFIXEDCPDATA
 CDECL_BEGIN
 
 /* QueryInterface helpers */
+extern HRESULT ObjHlpStandardQueryInterface_IChunkAllocator(IUnknown *pThis, REFIID riid, PPVOID ppvObject);
 extern HRESULT ObjHlpStandardQueryInterface_IConnectionPoint(IUnknown *pThis, REFIID riid, PPVOID ppvObject);
 extern HRESULT ObjHlpStandardQueryInterface_IEnumConnections(IUnknown *pThis, REFIID riid, PPVOID ppvObject);
 extern HRESULT ObjHlpStandardQueryInterface_IMalloc(IUnknown *pThis, REFIID riid, PPVOID ppvObject);
+extern HRESULT ObjHlpStandardQueryInterface_IMutex(IUnknown *pThis, REFIID riid, PPVOID ppvObject);
+extern HRESULT ObjHlpStandardQueryInterface_IMutexFactory(IUnknown *pThis, REFIID riid, PPVOID ppvObject);
 extern HRESULT ObjHlpStandardQueryInterface_ISequentialStream(IUnknown *pThis, REFIID riid, PPVOID ppvObject);
+extern HRESULT ObjHlpStandardQueryInterface_IThreadLocal(IUnknown *pThis, REFIID riid, PPVOID ppvObject);
+extern HRESULT ObjHlpStandardQueryInterface_IThreadLocalFactory(IUnknown *pThis, REFIID riid, PPVOID ppvObject);
 
 /* AddRef/Release helpers */
 extern UINT32 ObjHlpStaticAddRefRelease(IUnknown *pThis);
@@ -34,8 +34,10 @@
  */
 #include <comrogue/compiler_macros.h>
 #include <comrogue/types.h>
+#include <comrogue/atomic.h>
 #include <comrogue/scode.h>
 #include <comrogue/intlib.h>
+#include <comrogue/str.h>
 #include <comrogue/internals/mmu.h>
 #include <comrogue/internals/seg.h>
 #include "heap_internals.h"
@@ -52,34 +54,14 @@ _DECLARE_H_THIS_FILE
 #define RUN_MAX_OVRHD           0x0000003DU
 #define RUN_MAX_OVRHD_RELAX     0x00001800U
 
+#if SIZE_CLASSES_LG_PAGE != SYS_PAGE_BITS
+#error heap_size_classes.h was generated for a different page size
+#endif
+
 /* Lookup table for sorting allocation sizes into bins. */
 const SEG_RODATA BYTE abSmallSize2Bin[] =
 {
-#define S2B_8(x)                       x,
-#define S2B_16(x)                      S2B_8(x) S2B_8(x)
-#define S2B_32(x)                      S2B_16(x) S2B_16(x)
-#define S2B_64(x)                      S2B_32(x) S2B_32(x)
-#define S2B_128(x)                     S2B_64(x) S2B_64(x)
-#define S2B_256(x)                     S2B_128(x) S2B_128(x)
-#define S2B_512(x)                     S2B_256(x) S2B_256(x)
-#define S2B_1024(x)                    S2B_512(x) S2B_512(x)
-#define S2B_2048(x)                    S2B_1024(x) S2B_1024(x)
-#define S2B_4096(x)                    S2B_2048(x) S2B_2048(x)
-#define S2B_8192(x)                    S2B_4096(x) S2B_4096(x)
-#define SIZE_CLASS(bin, delta, size)   S2B_##delta(bin)
-  SIZE_CLASSES
-#undef S2B_8
-#undef S2B_16
-#undef S2B_32
-#undef S2B_64
-#undef S2B_128
-#undef S2B_256
-#undef S2B_512
-#undef S2B_1024
-#undef S2B_2048
-#undef S2B_4096
-#undef S2B_8192
-#undef SIZE_CLASS
+  SMALL_SIZE2BIN_TABLE
 };
 
 /*----------------------------
@@ -340,12 +322,13 @@ void _HeapArenaMapBitsUnallocatedSizeSet(PHEAPDATA phd, PARENACHUNK pChunk, SIZE
  */
 void _HeapArenaMapBitsLargeSet(PHEAPDATA phd, PARENACHUNK pChunk, SIZE_T ndxPage, SIZE_T sz, SIZE_T szFlags)
 {
-  register PSIZE_T pMapBits = _HeapArenaMapBitsPGet(phd, pChunk, ndxPage);
+  register PARENACHUNKMAP pMapElement = _HeapArenaMapPGet(phd, pChunk, ndxPage);
   _H_ASSERT(phd, (sz & SYS_PAGE_MASK) == 0);
   _H_ASSERT(phd, (szFlags & CHUNK_MAP_DIRTY) == szFlags);
   /* preserve the existing "unzeroed" flag */
-  *pMapBits = sz | CHUNK_MAP_BININD_INVALID | szFlags | (*pMapBits & CHUNK_MAP_UNZEROED) | CHUNK_MAP_LARGE
-                 | CHUNK_MAP_ALLOCATED;
+  pMapElement->bits = sz | CHUNK_MAP_BININD_INVALID | szFlags | (pMapElement->bits & CHUNK_MAP_UNZEROED)
+                         | CHUNK_MAP_LARGE | CHUNK_MAP_ALLOCATED;
+  pMapElement->u.uiSpyGen = 0;  /* not marked by any spy */
 }
 
 /*
@@ -428,15 +411,15 @@ void _HeapArenaMapBitsUnzeroedSet(PHEAPDATA phd, PARENACHUNK pChunk, SIZE_T ndxP
  */
 BOOL _HeapArenaProfAccumImpl(PHEAPDATA phd, PARENA pArena, UINT64 cbAccum)
 {
-  /* XXX assert the profile interval is non-zero */
+  SIZE_T cbInterval = phd->cbProfInterval;  /* profile interval */
+
+  _H_ASSERT(phd, cbInterval != 0);
   pArena->cbProfAccum += cbAccum;
-  /* XXX
-    if (pArena->cbProfAccum >= phd->prof_interval)
-    {
-      pArena->cbProfAccum -= phd->prof_interval;
-      return TRUE;
-    }
-   */
+  if (pArena->cbProfAccum >= cbInterval)
+  {
+    pArena->cbProfAccum %= cbInterval;
+    return TRUE;
+  }
   return FALSE;
 }
 
@@ -455,8 +438,9 @@ BOOL _HeapArenaProfAccumImpl(PHEAPDATA phd, PARENA pArena, UINT64 cbAccum)
  */
 BOOL _HeapArenaProfAccumLocked(PHEAPDATA phd, PARENA pArena, UINT64 cbAccum)
 {
-  return FALSE; /* XXX if phd->prof_interval == 0 */
-  /* XXX return _HeapArenaProfAccumImpl(phd, pArena, cbAccum); */
+  if (!(phd->uiFlags & PHDFLAGS_PROFILE_ACTIVE))
+    return FALSE;
+  return _HeapArenaProfAccumImpl(phd, pArena, cbAccum);
 }
 
 /*
@@ -474,16 +458,14 @@ BOOL _HeapArenaProfAccumLocked(PHEAPDATA phd, PARENA pArena, UINT64 cbAccum)
  */
 BOOL _HeapArenaProfAccum(PHEAPDATA phd, PARENA pArena, UINT64 cbAccum)
 {
-  return FALSE; /* XXX if phd->prof_interval == 0 */
-  /* XXX
-     {
-       BOOL rc;
-       IMutex_Lock(pArena->pmtxLock);
-       rc = _HeapArenaProfAccumImpl(phd, pArena, cbAccum);
-       IMutex_Unlock(pArena->pmtxLock);
-       return rc;
-     }
-   */
+  BOOL rc;   /* return from this function */
+
+  if (!(phd->uiFlags & PHDFLAGS_PROFILE_ACTIVE))
+    return FALSE;
+  IMutex_Lock(pArena->pmtxLock);
+  rc = _HeapArenaProfAccumImpl(phd, pArena, cbAccum);
+  IMutex_Unlock(pArena->pmtxLock);
+  return rc;
 }
 
 /*
@@ -551,6 +533,19 @@ SIZE_T _HeapArenaBinIndex(PHEAPDATA phd, PARENA pArena, PARENABIN pBin)
   return ndxBin;
 }
 
+/*
+ * Returns the index of the region within a small-object run that a pointer refers to.  The division by the
+ * region interval is done with a reciprocal multiply wherever possible.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pRun = Pointer to the run containing the region.
+ * - pBinInfo = Pointer to the bin information for the run's size class.
+ * - pv = Pointer to the region.
+ *
+ * Returns:
+ * Index of the region within the run.
+ */
 UINT32 _HeapArenaRunRegInd(PHEAPDATA phd, PARENARUN pRun, PARENABININFO pBinInfo, PCVOID pv)
 {
   UINT32 ofsDiff;        /* offset between pointer and start of run */
@@ -603,141 +598,2980 @@ UINT32 _HeapArenaRunRegInd(PHEAPDATA phd, PARENARUN pRun, PARENABININFO pBinInfo
   return nRegionIndex;
 }
 
+/*
+ * Allocates a small or large block of memory from an arena, going through the thread cache if possible.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena to allocate from.  If this is NULL, an arena will be chosen for the
+ *            current thread.
+ * - sz = Size of the block to allocate, in bytes.  Must be no greater than phd->szArenaMaxClass.
+ * - fZero = If TRUE, the returned block will be zero-filled.
+ * - fTryTCache = If TRUE, try to allocate the block from the thread cache first.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the new memory block.
+ */
 PVOID _HeapArenaMalloc(PHEAPDATA phd, PARENA pArena, SIZE_T sz, BOOL fZero, BOOL fTryTCache)
 {
-  return NULL; /* TODO */
+  PTCACHE ptcache;  /* pointer to the thread cache */
+
+  _H_ASSERT(phd, sz != 0);
+  _H_ASSERT(phd, sz <= phd->szArenaMaxClass);
+
+  if (sz <= SMALL_MAXCLASS)
+  {
+    if (fTryTCache && ((ptcache = _HeapTCacheGet(phd, TRUE)) != NULL))
+      return _HeapTCacheAllocSmall(phd, ptcache, sz, fZero);
+    return _HeapArenaMallocSmall(phd, _HeapChooseArena(phd, pArena), sz, fZero);
+  }
+  if (fTryTCache && (sz <= phd->cbTCacheMaxClass) && ((ptcache = _HeapTCacheGet(phd, TRUE)) != NULL))
+    return _HeapTCacheAllocLarge(phd, ptcache, sz, fZero);
+  return _HeapArenaMallocLarge(phd, _HeapChooseArena(phd, pArena), sz, fZero);
 }
 
+/*
+ * Returns the usable size of a small or large block of memory allocated from an arena.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the memory block.  It must lie within an arena chunk.
+ * - fDemote = If TRUE, a small allocation promoted to a page for profiling reports the size of the page
+ *             rather than its original size class.
+ *
+ * Returns:
+ * The usable size of the memory block, in bytes.
+ */
 SIZE_T _HeapArenaSAlloc(PHEAPDATA phd, PCVOID pv, BOOL fDemote)
 {
-  return 0; /* TODO */
+  PARENACHUNK pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);       /* pointer to enclosing chunk */
+  SIZE_T ndxPage = ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;  /* page index of the pointer */
+  SIZE_T ndxBin;                                                     /* bin index for the block */
+
+  _H_ASSERT(phd, (PCVOID)pChunk != pv);
+  _H_ASSERT(phd, _HeapArenaMapBitsAllocatedGet(phd, pChunk, ndxPage) != 0);
+  ndxBin = _HeapArenaMapBitsBinIndexGet(phd, pChunk, ndxPage);
+  if ((ndxBin == BININD_INVALID) || (!fDemote && _HeapArenaMapBitsLargeGet(phd, pChunk, ndxPage)))
+  { /* large allocation (or a promoted small one) */
+    _H_ASSERT(phd, ((UINT_PTR)pv & SYS_PAGE_MASK) == 0);
+    return _HeapArenaMapBitsLargeSizeGet(phd, pChunk, ndxPage);
+  }
+  _H_ASSERT(phd, _HeapArenaPtrSmallBinIndGet(phd, pv, _HeapArenaMapBitsGet(phd, pChunk, ndxPage)) == ndxBin);
+  return phd->aArenaBinInfo[ndxBin].cbRegions;
 }
 
+/*
+ * Frees a small or large block of memory allocated from an arena, going through the thread cache if possible.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena that owns the chunk containing the block.
+ * - pChunk = Pointer to the arena chunk containing the block.
+ * - pv = Pointer to the memory block to be freed.
+ * - fTryTCache = If TRUE, try to return the block to the thread cache first.
+ *
+ * Returns:
+ * Nothing.
+ */
 void _HeapArenaDAlloc(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PCVOID pv, BOOL fTryTCache)
 {
-  /* TODO */
-}
+  SIZE_T ndxPage = ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;  /* page index of the pointer */
+  SIZE_T szMapBits;                                                  /* map bits for the page */
+  SIZE_T sz;                                                         /* size of a large block */
+  PTCACHE ptcache;                                                   /* pointer to the thread cache */
 
-void _HeapArenaPurgeAll(PHEAPDATA phd, PARENA pArena)
-{
-  /* TODO */
+  _H_ASSERT(phd, (PCVOID)pChunk != pv);
+  _H_ASSERT(phd, ndxPage >= phd->cpgMapBias);
+  _H_ASSERT(phd, ndxPage < phd->cpgChunk);
+  szMapBits = _HeapArenaMapBitsGet(phd, pChunk, ndxPage);
+  _H_ASSERT(phd, szMapBits & CHUNK_MAP_ALLOCATED);
+  ptcache = (fTryTCache ? _HeapTCacheGet(phd, FALSE) : NULL);
+  if ((szMapBits & CHUNK_MAP_LARGE) == 0)
+  { /* small allocation */
+    if (ptcache)
+      _HeapTCacheDAllocSmall(phd, ptcache, (PVOID)pv, _HeapArenaPtrSmallBinIndGet(phd, pv, szMapBits));
+    else
+      _HeapArenaDAllocSmall(phd, pArena, pChunk, (PVOID)pv, ndxPage, NULL);
+  }
+  else
+  { /* large allocation */
+    sz = _HeapArenaMapBitsLargeSizeGet(phd, pChunk, ndxPage);
+    _H_ASSERT(phd, ((UINT_PTR)pv & SYS_PAGE_MASK) == 0);
+    if (ptcache && (sz <= phd->cbTCacheMaxClass))
+      _HeapTCacheDAllocLarge(phd, ptcache, (PVOID)pv, sz);
+    else
+      _HeapArenaDAllocLarge(phd, pArena, pChunk, (PVOID)pv, ptcache);
+  }
 }
 
-void _HeapArenaTCacheFillSmall(PHEAPDATA phd, PARENA pArena, PTCACHEBIN ptbin, SIZE_T ndxBin, UINT64 cbProfAccum)
+/*
+ * Returns the index of the page within an arena chunk that a chunk map element describes.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pChunk = Pointer to the arena chunk.
+ * - pmap = Pointer to the chunk map element within the chunk.
+ *
+ * Returns:
+ * Index of the page.
+ */
+static SIZE_T mapelm_to_pageind(PHEAPDATA phd, PARENACHUNK pChunk, PARENACHUNKMAP pmap)
 {
-  /* TODO */
+  return (SIZE_T)(pmap - pChunk->aMaps) + phd->cpgMapBias;
 }
 
-void _HeapArenaAllocJunkSmall(PHEAPDATA phd, PVOID pv, PARENABININFO pBinInfo, BOOL fZero)
+/*
+ * Determines whether the page preceding an available run is itself part of an available run.  Since adjacent
+ * available runs with the same dirty state are always coalesced, such a neighbor must differ in dirty state.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pChunk = Pointer to the arena chunk containing the run.
+ * - ndxPage = Index of the first page of the run.
+ *
+ * Returns:
+ * - TRUE = The preceding page is unallocated.
+ * - FALSE = The preceding page is allocated, or the run begins the chunk.
+ */
+static BOOL arena_avail_adjac_pred(PHEAPDATA phd, PARENACHUNK pChunk, SIZE_T ndxPage)
 {
-  /* TODO */
+  BOOL rc;   /* return from this function */
+
+  if (ndxPage - 1 < phd->cpgMapBias)
+    return FALSE;
+  rc = MAKEBOOL(_HeapArenaMapBitsAllocatedGet(phd, pChunk, ndxPage - 1) == 0);
+  _H_ASSERT(phd, !rc || (_HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage - 1)
+			 != _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage)));
+  return rc;
 }
 
-void _HeapArenaDAllocJunkSmall(PHEAPDATA phd, PVOID pv, PARENABININFO pBinInfo)
+/*
+ * Determines whether the page following an available run is itself part of an available run.  Since adjacent
+ * available runs with the same dirty state are always coalesced, such a neighbor must differ in dirty state.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pChunk = Pointer to the arena chunk containing the run.
+ * - ndxPage = Index of the first page of the run.
+ * - cPages = Number of pages in the run.
+ *
+ * Returns:
+ * - TRUE = The following page is unallocated.
+ * - FALSE = The following page is allocated, or the run ends the chunk.
+ */
+static BOOL arena_avail_adjac_succ(PHEAPDATA phd, PARENACHUNK pChunk, SIZE_T ndxPage, SIZE_T cPages)
 {
-  /* TODO */
+  BOOL rc;   /* return from this function */
+
+  if (ndxPage + cPages == phd->cpgChunk)
+    return FALSE;
+  _H_ASSERT(phd, ndxPage + cPages < phd->cpgChunk);
+  rc = MAKEBOOL(_HeapArenaMapBitsAllocatedGet(phd, pChunk, ndxPage + cPages) == 0);
+  _H_ASSERT(phd, !rc || (_HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage + cPages)
+			 != _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage)));
+  return rc;
 }
 
-PVOID _HeapArenaMallocSmall(PHEAPDATA phd, PARENA pArena, SIZE_T sz, BOOL fZero)
+/*
+ * Determines whether an available run is adjacent to another available run (of the opposite dirty state) on
+ * either side.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pChunk = Pointer to the arena chunk containing the run.
+ * - ndxPage = Index of the first page of the run.
+ * - cPages = Number of pages in the run.
+ *
+ * Returns:
+ * - TRUE = The run has an available neighbor.
+ * - FALSE = The run has no available neighbors.
+ */
+static BOOL arena_avail_adjac(PHEAPDATA phd, PARENACHUNK pChunk, SIZE_T ndxPage, SIZE_T cPages)
 {
-  return NULL; /* TODO */
+  return MAKEBOOL(   arena_avail_adjac_pred(phd, pChunk, ndxPage)
+		  || arena_avail_adjac_succ(phd, pChunk, ndxPage, cPages));
 }
 
-PVOID _HeapArenaMallocLarge(PHEAPDATA phd, PARENA pArena, SIZE_T sz, BOOL fZero)
+/*
+ * Inserts a run of unallocated pages into the arena's tree of available runs, updating the chunk's available-run
+ * and dirty-page counts.  Because the arena's tree of dirty chunks is ordered by those counts, the chunk is
+ * removed from that tree and reinserted around the update.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the arena chunk containing the run.
+ * - ndxPage = Index of the first page of the run.
+ * - cPages = Number of pages in the run.
+ * - fMaybeAdjPred = TRUE if the run may now be adjacent to a preceding available run.
+ * - fMaybeAdjSucc = TRUE if the run may now be adjacent to a following available run.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_avail_insert(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, SIZE_T ndxPage, SIZE_T cPages,
+			       BOOL fMaybeAdjPred, BOOL fMaybeAdjSucc)
 {
-  return NULL; /* TODO */
-}
+  PARENACHUNKMAP pmap = _HeapArenaMapPGet(phd, pChunk, ndxPage);  /* map element for run */
 
-PVOID _HeapArenaPalloc(PHEAPDATA phd, PARENA pArena, SIZE_T sz, SIZE_T szAlignment, BOOL fZero)
-{
-  return NULL; /* TODO */
-}
+  _H_ASSERT(phd, cPages == (_HeapArenaMapBitsUnallocatedSizeGet(phd, pChunk, ndxPage) >> SYS_PAGE_BITS));
+  if (pChunk->cpgDirty != 0)
+    RbtDelete(&(pArena->rbtDirtyChunks), (TREEKEY)pChunk);
 
-void _HeapArenaProfPromoted(PHEAPDATA phd, PCVOID pv, SIZE_T sz)
-{
-  /* TODO */
-}
+  if (fMaybeAdjPred && arena_avail_adjac_pred(phd, pChunk, ndxPage))
+    pChunk->cAvailRunAdjacent++;
+  if (fMaybeAdjSucc && arena_avail_adjac_succ(phd, pChunk, ndxPage, cPages))
+    pChunk->cAvailRunAdjacent++;
+  pChunk->cAvailRuns++;
 
-void _HeapArenaDAllocBinLocked(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, PARENACHUNKMAP pMapElement)
-{
-  /* TODO */
+  if (_HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage) != 0)
+  {
+    pArena->cpgDirty += cPages;
+    pChunk->cpgDirty += cPages;
+  }
+  if (pChunk->cpgDirty != 0)
+  {
+    rbtNewNode(&(pChunk->rbtnDirty));
+    RbtInsert(&(pArena->rbtDirtyChunks), pChunk);
+  }
+
+  rbtNewNode(&(pmap->u.rbtn));
+  RbtInsert(&(pArena->rbtAvailRuns), pmap);
 }
 
-void _HeapArenaDAllocBin(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, PARENACHUNKMAP pMapElement)
+/*
+ * Removes a run of unallocated pages from the arena's tree of available runs, updating the chunk's available-run
+ * and dirty-page counts.  This must be done before the run's map bits are changed, since the tree is ordered by
+ * the size stored there.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the arena chunk containing the run.
+ * - ndxPage = Index of the first page of the run.
+ * - cPages = Number of pages in the run.
+ * - fMaybeAdjPred = TRUE if the run may be adjacent to a preceding available run.
+ * - fMaybeAdjSucc = TRUE if the run may be adjacent to a following available run.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_avail_remove(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, SIZE_T ndxPage, SIZE_T cPages,
+			       BOOL fMaybeAdjPred, BOOL fMaybeAdjSucc)
 {
-  /* TODO */
+  _H_ASSERT(phd, cPages == (_HeapArenaMapBitsUnallocatedSizeGet(phd, pChunk, ndxPage) >> SYS_PAGE_BITS));
+  if (pChunk->cpgDirty != 0)
+    RbtDelete(&(pArena->rbtDirtyChunks), (TREEKEY)pChunk);
+
+  if (fMaybeAdjPred && arena_avail_adjac_pred(phd, pChunk, ndxPage))
+    pChunk->cAvailRunAdjacent--;
+  if (fMaybeAdjSucc && arena_avail_adjac_succ(phd, pChunk, ndxPage, cPages))
+    pChunk->cAvailRunAdjacent--;
+  pChunk->cAvailRuns--;
+
+  if (_HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage) != 0)
+  {
+    pArena->cpgDirty -= cPages;
+    pChunk->cpgDirty -= cPages;
+  }
+  if (pChunk->cpgDirty != 0)
+  {
+    rbtNewNode(&(pChunk->rbtnDirty));
+    RbtInsert(&(pArena->rbtDirtyChunks), pChunk);
+  }
+
+  RbtDelete(&(pArena->rbtAvailRuns), (TREEKEY)_HeapArenaMapPGet(phd, pChunk, ndxPage));
 }
 
-void _HeapArenaDAllocSmall(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, SIZE_T ndxPage)
+/*
+ * Zero-fills the pages of a newly-allocated large run that are not already known to be zeroed.  If the run was
+ * dirty, every page is filled; otherwise only pages carrying the "unzeroed" flag are, with adjacent pages filled
+ * by a single call.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pChunk = Pointer to the arena chunk.
+ * - ndxRun = Page index of the run.
+ * - cPages = Number of pages in the run.
+ * - szFlagDirty = Dirty flag of the run, either CHUNK_MAP_DIRTY or 0.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_run_zero(PHEAPDATA phd, PARENACHUNK pChunk, SIZE_T ndxRun, SIZE_T cPages, SIZE_T szFlagDirty)
 {
-  /* TODO */
+  register SIZE_T i, j;   /* loop counters */
+
+  if (szFlagDirty)
+  {
+    StrSetMem((PVOID)((UINT_PTR)pChunk + (ndxRun << SYS_PAGE_BITS)), 0, cPages << SYS_PAGE_BITS);
+    return;
+  }
+  for (i = 0; i < cPages; i = j)
+  {
+    j = i + 1;
+    if (_HeapArenaMapBitsUnzeroedGet(phd, pChunk, ndxRun + i) == 0)
+      continue;
+    while ((j < cPages) && (_HeapArenaMapBitsUnzeroedGet(phd, pChunk, ndxRun + j) != 0))
+      j++;
+    StrSetMem((PVOID)((UINT_PTR)pChunk + ((ndxRun + i) << SYS_PAGE_BITS)), 0, (j - i) << SYS_PAGE_BITS);
+  }
 }
 
-void _HeapArenaDAllocLargeLocked(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv)
+/*
+ * Determines whether all of a run's pages are known to contain only zeroes: the run must be clean, and none of its
+ * pages may carry the "unzeroed" flag.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pChunk = Pointer to the arena chunk.
+ * - ndxRun = Page index of the run.
+ * - cPages = Number of pages in the run.
+ *
+ * Returns:
+ * TRUE if every page of the run is zeroed, FALSE if not.
+ */
+static BOOL arena_run_is_zeroed(PHEAPDATA phd, PARENACHUNK pChunk, SIZE_T ndxRun, SIZE_T cPages)
 {
-  /* TODO */
+  register SIZE_T i;   /* loop counter */
+
+  if (_HeapArenaMapBitsDirtyGet(phd, pChunk, ndxRun) != 0)
+    return FALSE;
+  for (i = 0; i < cPages; i++)
+    if (_HeapArenaMapBitsUnzeroedGet(phd, pChunk, ndxRun + i) != 0)
+      return FALSE;
+  return TRUE;
 }
 
-void _HeapArenaDAllocLarge(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv)
+/*
+ * Splits off the first part of an available run for use as a small-object run or a large allocation, returning
+ * any trailing pages to the arena's tree of available runs.  Assumes the arena mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pRun = Pointer to the available run to be split.
+ * - sz = Number of bytes to split off; must be a multiple of SYS_PAGE_SIZE.
+ * - fLarge = TRUE if the new run is a large allocation, FALSE if it's a small-object run.
+ * - ndxBin = Bin index for a small-object run, or BININD_INVALID for a large allocation.
+ * - fZero = If TRUE, the new run will be zero-filled.  Only valid for large allocations.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_run_split(PHEAPDATA phd, PARENA pArena, PARENARUN pRun, SIZE_T sz, BOOL fLarge, SIZE_T ndxBin,
+			    BOOL fZero)
 {
-  /* TODO */
+  PARENACHUNK pChunk;    /* pointer to chunk containing the run */
+  SIZE_T ndxRun;         /* page index of the run */
+  SIZE_T szFlagDirty;    /* dirty flag for the run */
+  SIZE_T cpgRun;         /* number of pages in the available run */
+  SIZE_T cpgNew;         /* number of pages being split off */
+  register SIZE_T i;     /* loop counter */
+
+  pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pRun);
+  ndxRun = ((UINT_PTR)pRun - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;
+  szFlagDirty = _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxRun);
+  cpgRun = _HeapArenaMapBitsUnallocatedSizeGet(phd, pChunk, ndxRun) >> SYS_PAGE_BITS;
+  _H_ASSERT(phd, _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxRun + cpgRun - 1) == szFlagDirty);
+  cpgNew = sz >> SYS_PAGE_BITS;
+  _H_ASSERT(phd, cpgNew > 0);
+  _H_ASSERT(phd, cpgNew <= cpgRun);
+
+  arena_avail_remove(phd, pArena, pChunk, ndxRun, cpgRun, TRUE, TRUE);
+  pArena->cpgActive += cpgNew;
+
+  if (cpgNew < cpgRun)
+  { /* keep track of the trailing unused pages */
+    if (szFlagDirty)
+    {
+      _HeapArenaMapBitsUnallocatedSet(phd, pChunk, ndxRun + cpgNew, (cpgRun - cpgNew) << SYS_PAGE_BITS,
+				      CHUNK_MAP_DIRTY);
+      _HeapArenaMapBitsUnallocatedSet(phd, pChunk, ndxRun + cpgRun - 1, (cpgRun - cpgNew) << SYS_PAGE_BITS,
+				      CHUNK_MAP_DIRTY);
+    }
+    else
+    {
+      _HeapArenaMapBitsUnallocatedSet(phd, pChunk, ndxRun + cpgNew, (cpgRun - cpgNew) << SYS_PAGE_BITS,
+				      _HeapArenaMapBitsUnzeroedGet(phd, pChunk, ndxRun + cpgNew));
+      _HeapArenaMapBitsUnallocatedSet(phd, pChunk, ndxRun + cpgRun - 1, (cpgRun - cpgNew) << SYS_PAGE_BITS,
+				      _HeapArenaMapBitsUnzeroedGet(phd, pChunk, ndxRun + cpgRun - 1));
+    }
+    arena_avail_insert(phd, pArena, pChunk, ndxRun + cpgNew, cpgRun - cpgNew, FALSE, TRUE);
+  }
+
+  if (fLarge)
+  {
+    if (fZero)
+      arena_run_zero(phd, pChunk, ndxRun, cpgNew, szFlagDirty);
+    /* Set the last element first, in case the run only contains one page. */
+    _HeapArenaMapBitsLargeSet(phd, pChunk, ndxRun + cpgNew - 1, 0, szFlagDirty);
+    _HeapArenaMapBitsLargeSet(phd, pChunk, ndxRun, sz, szFlagDirty);
+  }
+  else
+  {
+    _H_ASSERT(phd, !fZero);
+    _H_ASSERT(phd, ndxBin != BININD_INVALID);
+    /* Propagate the dirty flag to the first and last pages; the unzeroed flags are preserved. */
+    _HeapArenaMapBitsSmallSet(phd, pChunk, ndxRun, 0, ndxBin, szFlagDirty);
+    for (i = 1; i < cpgNew - 1; i++)
+      _HeapArenaMapBitsSmallSet(phd, pChunk, ndxRun + i, i, ndxBin, 0);
+    if (cpgNew > 1)
+      _HeapArenaMapBitsSmallSet(phd, pChunk, ndxRun + cpgNew - 1, cpgNew - 1, ndxBin, szFlagDirty);
+  }
 }
 
-PVOID _HeapArenaRAllocNoMove(PHEAPDATA phd, PVOID pv, SIZE_T szOld, SIZE_T sz, SIZE_T szExtra, BOOL fZero)
+/*
+ * Finds the lowest- or highest-addressed chunk in an arena's spare-chunk cache.  Assumes the arena mutex is locked.
+ *
+ * Parameters:
+ * - pArena = Pointer to the arena.
+ * - fHighest = TRUE to find the highest-addressed spare chunk, FALSE to find the lowest-addressed one.
+ *
+ * Returns:
+ * Index of the chosen chunk within pArena->apchunkSpare.  The cache must not be empty.
+ */
+static UINT32 arena_spare_find(PARENA pArena, BOOL fHighest)
 {
-  return NULL; /* TODO */
+  UINT32 rc = 0;        /* return from this function */
+  register UINT32 i;    /* loop counter */
+
+  for (i = 1; i < pArena->cSpareChunks; i++)
+    if (fHighest ? (pArena->apchunkSpare[i] > pArena->apchunkSpare[rc])
+	         : (pArena->apchunkSpare[i] < pArena->apchunkSpare[rc]))
+      rc = i;
+  return rc;
 }
 
-PVOID _HeapArenaRAlloc(PHEAPDATA phd, PVOID pv, SIZE_T szOld, SIZE_T sz, SIZE_T szExtra, SIZE_T szAlignment,
-		       BOOL fZero, BOOL fTryTCacheAlloc, BOOL fTryTCacheDAlloc)
+/*
+ * Determines whether a chunk is in an arena's spare-chunk cache.  Assumes the arena mutex is locked.
+ *
+ * Parameters:
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk to look for.
+ *
+ * Returns:
+ * TRUE if the chunk is a spare, FALSE if not.
+ */
+static BOOL arena_chunk_is_spare(PARENA pArena, PARENACHUNK pChunk)
 {
-  return NULL; /* TODO */
+  register UINT32 i;    /* loop counter */
+
+  for (i = 0; i < pArena->cSpareChunks; i++)
+    if (pArena->apchunkSpare[i] == pChunk)
+      return TRUE;
+  return FALSE;
 }
 
-void _HeapArenaStatsMerge(PHEAPDATA phd, PARENA pArena, PPCCHAR dss, PSIZE_T pnActive, PSIZE_T pnDirty,
-			  PARENASTATS pArenaStats, PMALLOCBINSTATS pBinStats, PMALLOCLARGESTATS pLargeStats)
+/*
+ * Returns the number of dirty pages in a completely unused arena chunk.  A chunk only becomes completely unused
+ * when all its pages coalesce into one run, and runs only coalesce with runs of the same dirtiness, so the pages
+ * are either all dirty or all clean.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pChunk = Pointer to the chunk.
+ *
+ * Returns:
+ * The number of dirty pages in the chunk.
+ */
+static SIZE_T arena_spare_dirty_pages(PHEAPDATA phd, PARENACHUNK pChunk)
 {
-  /* TODO */
+  return (_HeapArenaMapBitsDirtyGet(phd, pChunk, phd->cpgMapBias) != 0) ? phd->cpgChunk - phd->cpgMapBias : 0;
 }
 
-BOOL _HeapArenaNew(PHEAPDATA phd, PARENA pArena, UINT32 ndx)
+/*
+ * Allocates a new chunk for an arena, or reuses the lowest-addressed chunk in the arena's spare-chunk cache, and
+ * makes its pages available for runs.  Reusing a spare does not touch the global chunk mutex.  Assumes the arena
+ * mutex is locked; it is dropped while a new chunk is allocated.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ *
+ * Returns:
+ * - NULL = A new chunk could not be allocated.
+ * - Other = Pointer to the arena chunk.
+ */
+static PARENACHUNK arena_chunk_alloc(PHEAPDATA phd, PARENA pArena)
 {
-  return FALSE; /* TODO */
+  PARENACHUNK pChunk;   /* pointer to the chunk */
+  BOOL fZero;           /* is the new chunk zeroed? */
+  SIZE_T szUnzeroed;    /* unzeroed flag for the chunk's pages */
+  register SIZE_T i;    /* loop counter */
+
+  if (pArena->cSpareChunks > 0)
+  { /* reuse a spare chunk, preferring low addresses so the higher spares are the ones that age out */
+    i = arena_spare_find(pArena, FALSE);
+    pChunk = pArena->apchunkSpare[i];
+    pArena->apchunkSpare[i] = pArena->apchunkSpare[--pArena->cSpareChunks];
+    pArena->cpgSpareDirty -= arena_spare_dirty_pages(phd, pChunk);
+    pArena->stats.cSpareHits++;
+    _H_ASSERT(phd, _HeapArenaMapBitsAllocatedGet(phd, pChunk, phd->cpgMapBias) == 0);
+    _H_ASSERT(phd, _HeapArenaMapBitsUnallocatedSizeGet(phd, pChunk, phd->cpgMapBias) == phd->szArenaMaxClass);
+  }
+  else
+  {
+    pArena->stats.cSpareMisses++;
+    fZero = FALSE;
+    IMutex_Unlock(pArena->pmtxLock);
+    pChunk = (PARENACHUNK)_HeapChunkAlloc(phd, phd->szChunk, phd->szChunk, FALSE, &fZero);
+    IMutex_Lock(pArena->pmtxLock);
+    if (!pChunk)
+      return NULL;
+    pArena->stats.cbMapped += phd->szChunk;
+
+    pChunk->parena = pArena;
+    pChunk->cpgDirty = 0;
+    pChunk->cAvailRuns = 0;
+    pChunk->cAvailRunAdjacent = 0;
+
+    /*
+     * Initialize the map to contain one maximal free unallocated run.  If the chunk came back zeroed, the map
+     * bits of the interior pages are already 0.
+     */
+    szUnzeroed = (fZero ? 0 : CHUNK_MAP_UNZEROED);
+    _HeapArenaMapBitsUnallocatedSet(phd, pChunk, phd->cpgMapBias, phd->szArenaMaxClass, szUnzeroed);
+    if (!fZero)
+      for (i = phd->cpgMapBias + 1; i < phd->cpgChunk - 1; i++)
+	_HeapArenaMapBitsUnzeroedSet(phd, pChunk, i, szUnzeroed);
+    _HeapArenaMapBitsUnallocatedSet(phd, pChunk, phd->cpgChunk - 1, phd->szArenaMaxClass, szUnzeroed);
+  }
+
+  arena_avail_insert(phd, pArena, pChunk, phd->cpgMapBias, phd->cpgChunk - phd->cpgMapBias, FALSE, FALSE);
+  return pChunk;
 }
 
 /*
- * Calculate the run size and other key pieces of data for an arena bin based on its region size.
+ * Releases a completely unused arena chunk.  The chunk goes into the arena's spare-chunk cache; if the cache is
+ * full, whichever of the chunk and the highest-addressed spare lies higher is returned to the chunk allocator.
+ * Assumes the arena mutex is locked; it is dropped while a chunk is deallocated.
  *
  * Parameters:
- * - phd = Pointer to HEAPDATA block.
- * - pBinInfo = Pointer to arena bin information being set up.
- * - cbMinRun = Minimum size in bytes of a run; this will always be a multiple of SYS_PAGE_SIZE.
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk being released.
  *
  * Returns:
- * The size of a run for this bin, which will be used as a starting point for the next bin calculation.
+ * Nothing.
  */
-static SIZE_T bin_info_cbRunSize_calc(PHEAPDATA phd, PARENABININFO pBinInfo, SIZE_T cbMinRun)
+static void arena_chunk_dealloc(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk)
 {
-  SIZE_T cbPad;               /* bytes of padding required */
-  SIZE_T cbTryRunSize;        /* trial for pBinInfo->cbRunSize */
-  SIZE_T cbGoodRunSize;       /* good value for pBinInfo->cbRunSize */
-  UINT32 nTryRegions;         /* trial for pBinInfo->nRegions */
-  UINT32 nGoodRegions;        /* good value for pBinInfo->nRegions */
-  UINT32 cbTryHeader;         /* trial for header data size */
-  UINT32 cbGoodHeader;        /* good value for header data size */
-  UINT32 ofsTryBitmap;        /* trial for pBinInfo->ofsBitmap */
-  UINT32 ofsGoodBitmap;       /* good value for pBinInfo->ofsBitmap */
-  UINT32 ofsTryCtx0;          /* trial for pBinInfo->ofsCtx0 */
-  UINT32 ofsGoodCtx0;         /* good value for pBinInfo->ofsCtx0 */
-  UINT32 ofsTryRedZone0;      /* trial for first red zone offset */
-  UINT32 ofsGoodRedZone0;     /* good value for first red zone offset */
+  PARENACHUNK pSpare;   /* pointer to spare chunk being evicted */
+  UINT32 ndx;           /* index of highest-addressed spare chunk */
 
-  _H_ASSERT(phd, cbMinRun >= SYS_PAGE_SIZE);
-  _H_ASSERT(phd, cbMinRun <= phd->szArenaMaxClass);
+  _H_ASSERT(phd, _HeapArenaMapBitsAllocatedGet(phd, pChunk, phd->cpgMapBias) == 0);
+  _H_ASSERT(phd, _HeapArenaMapBitsAllocatedGet(phd, pChunk, phd->cpgChunk - 1) == 0);
+  _H_ASSERT(phd, _HeapArenaMapBitsUnallocatedSizeGet(phd, pChunk, phd->cpgMapBias) == phd->szArenaMaxClass);
 
-  /*
-   * Determine red zone size based on minimum alignment and minimum red zone size; add padding
-   * to the end if needed to align regions.
+  /* Remove the run from the available tree, so the arena doesn't allocate from it. */
+  arena_avail_remove(phd, pArena, pChunk, phd->cpgMapBias, phd->cpgChunk - phd->cpgMapBias, FALSE, FALSE);
+
+  pArena->cpgSpareDirty += arena_spare_dirty_pages(phd, pChunk);
+  if (pArena->cSpareChunks < phd->cSpareChunksMax)
+  {
+    pArena->apchunkSpare[pArena->cSpareChunks++] = pChunk;
+    return;
+  }
+
+  if (pArena->cSpareChunks > 0)
+  { /* cache is full; keep the lower-addressed of this chunk and the highest spare */
+    ndx = arena_spare_find(pArena, TRUE);
+    if (pArena->apchunkSpare[ndx] > pChunk)
+    {
+      pSpare = pArena->apchunkSpare[ndx];
+      pArena->apchunkSpare[ndx] = pChunk;
+      pChunk = pSpare;
+    }
+  }
+  pArena->cpgSpareDirty -= arena_spare_dirty_pages(phd, pChunk);
+  IMutex_Unlock(pArena->pmtxLock);
+  _HeapChunkDeAlloc(phd, (PVOID)pChunk, phd->szChunk, TRUE);
+  IMutex_Lock(pArena->pmtxLock);
+  pArena->stats.cbMapped -= phd->szChunk;
+  pArena->cSpareEvictions++;
+}
+
+/*
+ * Looks for an available run in the arena that's large enough to satisfy a request, and splits it.  The smallest
+ * such run is used, and of the runs of that size, the one with the lowest address.  Assumes the arena mutex
+ * is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - sz = Size of the run to allocate; must be a multiple of SYS_PAGE_SIZE.
+ * - fLarge = TRUE if the new run is a large allocation, FALSE if it's a small-object run.
+ * - ndxBin = Bin index for a small-object run, or BININD_INVALID for a large allocation.
+ * - fZero = If TRUE, the new run will be zero-filled.
+ *
+ * Returns:
+ * - NULL = No available run was large enough.
+ * - Other = Pointer to the new run.
+ */
+static PARENARUN arena_run_alloc_helper(PHEAPDATA phd, PARENA pArena, SIZE_T sz, BOOL fLarge, SIZE_T ndxBin,
+					BOOL fZero)
+{
+  ARENACHUNKMAP mapKey;   /* key for searching the available runs tree */
+  PARENACHUNKMAP pmap;    /* map element of the run we find */
+  PARENACHUNK pChunk;     /* pointer to chunk containing the run */
+  PARENARUN pRun;         /* pointer to the run */
+
+  mapKey.bits = sz | CHUNK_MAP_KEY;
+  pmap = (PARENACHUNKMAP)RbtFindSuccessor(&(pArena->rbtAvailRuns), (TREEKEY)(&mapKey));
+  if (!pmap)
+    return NULL;
+  pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pmap);
+  pRun = (PARENARUN)((UINT_PTR)pChunk + (mapelm_to_pageind(phd, pChunk, pmap) << SYS_PAGE_BITS));
+  arena_run_split(phd, pArena, pRun, sz, fLarge, ndxBin, fZero);
+  return pRun;
+}
+
+/*
+ * Allocates a run from the arena, adding a new chunk to the arena if no available run is large enough.
+ * Assumes the arena mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - sz = Size of the run to allocate; must be a multiple of SYS_PAGE_SIZE.
+ * - fLarge = TRUE if the new run is a large allocation, FALSE if it's a small-object run.
+ * - ndxBin = Bin index for a small-object run, or BININD_INVALID for a large allocation.
+ * - fZero = If TRUE, the new run will be zero-filled.
+ *
+ * Returns:
+ * - NULL = The run could not be allocated.
+ * - Other = Pointer to the new run.
+ */
+static PARENARUN arena_run_alloc(PHEAPDATA phd, PARENA pArena, SIZE_T sz, BOOL fLarge, SIZE_T ndxBin, BOOL fZero)
+{
+  PARENACHUNK pChunk;   /* pointer to new chunk */
+  PARENARUN pRun;       /* pointer to the run */
+
+  _H_ASSERT(phd, sz <= phd->szArenaMaxClass);
+  _H_ASSERT(phd, (sz & SYS_PAGE_MASK) == 0);
+  _H_ASSERT(phd, fLarge || (ndxBin != BININD_INVALID));
+
+  /* Search the arena's chunks for the lowest best fit. */
+  pRun = arena_run_alloc_helper(phd, pArena, sz, fLarge, ndxBin, fZero);
+  if (pRun)
+    return pRun;
+
+  /* No usable runs.  Create a new chunk from which to allocate the run. */
+  pChunk = arena_chunk_alloc(phd, pArena);
+  if (pChunk)
+  {
+    pRun = (PARENARUN)((UINT_PTR)pChunk + (phd->cpgMapBias << SYS_PAGE_BITS));
+    arena_run_split(phd, pArena, pRun, sz, fLarge, ndxBin, fZero);
+    return pRun;
+  }
+
+  /*
+   * arena_chunk_alloc() failed, but another thread may have made sufficient memory available while this one
+   * dropped the arena lock in arena_chunk_alloc(), so search one more time.
+   */
+  return arena_run_alloc_helper(phd, pArena, sz, fLarge, ndxBin, fZero);
+}
+
+/* Defined below; arena_run_dalloc() and the purge code call each other. */
+static void arena_maybe_purge(PHEAPDATA phd, PARENA pArena);
+
+/*
+ * Returns a run to the arena's available runs, coalescing it with any adjacent available runs that have the same
+ * dirty state.  If the chunk containing it is left completely unused, the chunk is released.  If dirty pages
+ * were added, the arena may then be purged.  Assumes the arena mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pRun = Pointer to the run being deallocated.
+ * - fDirty = TRUE if the run's pages may have been written to.
+ * - fCleaned = TRUE if the run's pages have just been purged, in which case its existing dirty flag is ignored.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_run_dalloc(PHEAPDATA phd, PARENA pArena, PARENARUN pRun, BOOL fDirty, BOOL fCleaned)
+{
+  PARENACHUNK pChunk;    /* pointer to chunk containing the run */
+  SIZE_T ndxRun;         /* page index of the run */
+  SIZE_T sz;             /* size of the run */
+  SIZE_T cpgRun;         /* number of pages in the run */
+  SIZE_T szFlagDirty;    /* dirty flag for the run */
+  SIZE_T szAdj;          /* size of adjacent run */
+
+  pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pRun);
+  ndxRun = ((UINT_PTR)pRun - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;
+  _H_ASSERT(phd, ndxRun >= phd->cpgMapBias);
+  _H_ASSERT(phd, ndxRun < phd->cpgChunk);
+  if (_HeapArenaMapBitsLargeGet(phd, pChunk, ndxRun) != 0)
+    sz = _HeapArenaMapBitsLargeSizeGet(phd, pChunk, ndxRun);
+  else
+    sz = phd->aArenaBinInfo[_HeapArenaBinIndex(phd, pArena, pRun->pBin)].cbRunSize;
+  cpgRun = sz >> SYS_PAGE_BITS;
+  pArena->cpgActive -= cpgRun;
+
+  /* The run is dirty if the caller claims to have dirtied it, or if it was already dirty before being allocated. */
+  if (!fCleaned && (_HeapArenaMapBitsDirtyGet(phd, pChunk, ndxRun) != 0))
+    fDirty = TRUE;
+  szFlagDirty = (fDirty ? CHUNK_MAP_DIRTY : 0);
+
+  /* Mark pages as unallocated in the chunk map. */
+  if (fDirty)
+  {
+    _HeapArenaMapBitsUnallocatedSet(phd, pChunk, ndxRun, sz, CHUNK_MAP_DIRTY);
+    _HeapArenaMapBitsUnallocatedSet(phd, pChunk, ndxRun + cpgRun - 1, sz, CHUNK_MAP_DIRTY);
+  }
+  else
+  {
+    _HeapArenaMapBitsUnallocatedSet(phd, pChunk, ndxRun, sz, _HeapArenaMapBitsUnzeroedGet(phd, pChunk, ndxRun));
+    _HeapArenaMapBitsUnallocatedSet(phd, pChunk, ndxRun + cpgRun - 1, sz,
+				    _HeapArenaMapBitsUnzeroedGet(phd, pChunk, ndxRun + cpgRun - 1));
+  }
+
+  /* Try to coalesce forward. */
+  if (   (ndxRun + cpgRun < phd->cpgChunk)
+      && (_HeapArenaMapBitsAllocatedGet(phd, pChunk, ndxRun + cpgRun) == 0)
+      && (_HeapArenaMapBitsDirtyGet(phd, pChunk, ndxRun + cpgRun) == szFlagDirty))
+  {
+    szAdj = _HeapArenaMapBitsUnallocatedSizeGet(phd, pChunk, ndxRun + cpgRun);
+    /* Remove the successor from the available runs tree; the coalesced run is inserted below. */
+    arena_avail_remove(phd, pArena, pChunk, ndxRun + cpgRun, szAdj >> SYS_PAGE_BITS, FALSE, TRUE);
+    sz += szAdj;
+    cpgRun += (szAdj >> SYS_PAGE_BITS);
+    _HeapArenaMapBitsUnallocatedSizeSet(phd, pChunk, ndxRun, sz);
+    _HeapArenaMapBitsUnallocatedSizeSet(phd, pChunk, ndxRun + cpgRun - 1, sz);
+  }
+
+  /* Try to coalesce backward. */
+  if (   (ndxRun > phd->cpgMapBias)
+      && (_HeapArenaMapBitsAllocatedGet(phd, pChunk, ndxRun - 1) == 0)
+      && (_HeapArenaMapBitsDirtyGet(phd, pChunk, ndxRun - 1) == szFlagDirty))
+  {
+    szAdj = _HeapArenaMapBitsUnallocatedSizeGet(phd, pChunk, ndxRun - 1);
+    ndxRun -= (szAdj >> SYS_PAGE_BITS);
+    /* Remove the predecessor from the available runs tree; the coalesced run is inserted below. */
+    arena_avail_remove(phd, pArena, pChunk, ndxRun, szAdj >> SYS_PAGE_BITS, TRUE, FALSE);
+    sz += szAdj;
+    cpgRun += (szAdj >> SYS_PAGE_BITS);
+    _HeapArenaMapBitsUnallocatedSizeSet(phd, pChunk, ndxRun, sz);
+    _HeapArenaMapBitsUnallocatedSizeSet(phd, pChunk, ndxRun + cpgRun - 1, sz);
+  }
+
+  /* Insert into the available runs tree. */
+  _H_ASSERT(phd, _HeapArenaMapBitsUnallocatedSizeGet(phd, pChunk, ndxRun)
+	         == _HeapArenaMapBitsUnallocatedSizeGet(phd, pChunk, ndxRun + cpgRun - 1));
+  _H_ASSERT(phd, _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxRun)
+	         == _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxRun + cpgRun - 1));
+  arena_avail_insert(phd, pArena, pChunk, ndxRun, cpgRun, TRUE, TRUE);
+
+  /* Deallocate the chunk if it's now completely unused. */
+  if (cpgRun == phd->cpgChunk - phd->cpgMapBias)
+    arena_chunk_dealloc(phd, pArena, pChunk);
+
+  /*
+   * It's OK to do dirty page processing even if the chunk was deallocated above, since in that case it's the
+   * spare.  Waiting until after deallocation lets an old spare be released first, lessening the chance of
+   * spuriously crossing the purge threshold.
+   */
+  if (fDirty)
+    arena_maybe_purge(phd, pArena);
+}
+
+/*
+ * Trims the head of an allocated large run, returning the leading pages to the arena.  Assumes the arena mutex
+ * is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk containing the run.
+ * - pRun = Pointer to the run.
+ * - szOld = Current size of the run.
+ * - szNew = Size of the run after trimming; must be a multiple of SYS_PAGE_SIZE less than szOld.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_run_trim_head(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PARENARUN pRun, SIZE_T szOld,
+				SIZE_T szNew)
+{
+  SIZE_T ndxPage = ((UINT_PTR)pRun - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;    /* page index of the run */
+  SIZE_T cpgHead = (szOld - szNew) >> SYS_PAGE_BITS;                      /* pages being trimmed */
+  SIZE_T szFlagDirty = _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage);   /* dirty flag for the run */
+
+  _H_ASSERT(phd, szOld > szNew);
+  _H_ASSERT(phd, _HeapArenaMapBitsLargeSizeGet(phd, pChunk, ndxPage) == szOld);
+
+  /*
+   * Update the chunk map so that arena_run_dalloc() can treat the leading run as separately allocated.  Set the
+   * last element of each run first, in case of single-page runs.
+   */
+  _HeapArenaMapBitsLargeSet(phd, pChunk, ndxPage + cpgHead - 1, 0, szFlagDirty);
+  _HeapArenaMapBitsLargeSet(phd, pChunk, ndxPage, szOld - szNew, szFlagDirty);
+  _HeapArenaMapBitsLargeSet(phd, pChunk, ndxPage + cpgHead, szNew, szFlagDirty);
+  arena_run_dalloc(phd, pArena, pRun, FALSE, FALSE);
+}
+
+/*
+ * Trims the tail of an allocated run, returning the trailing pages to the arena.  Assumes the arena mutex
+ * is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk containing the run.
+ * - pRun = Pointer to the run.
+ * - szOld = Current size of the run.
+ * - szNew = Size of the run after trimming; must be a multiple of SYS_PAGE_SIZE less than szOld.
+ * - fDirty = TRUE if the trailing pages may have been written to.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_run_trim_tail(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PARENARUN pRun, SIZE_T szOld,
+				SIZE_T szNew, BOOL fDirty)
+{
+  SIZE_T ndxPage = ((UINT_PTR)pRun - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;    /* page index of the run */
+  SIZE_T cpgHead = szNew >> SYS_PAGE_BITS;                                /* pages remaining in the run */
+  SIZE_T szFlagDirty = _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage);   /* dirty flag for the run */
+
+  _H_ASSERT(phd, szOld > szNew);
+
+  /*
+   * Update the chunk map so that arena_run_dalloc() can treat the trailing run as separately allocated.  Set the
+   * last element of each run first, in case of single-page runs.
+   */
+  _HeapArenaMapBitsLargeSet(phd, pChunk, ndxPage + cpgHead - 1, 0, szFlagDirty);
+  _HeapArenaMapBitsLargeSet(phd, pChunk, ndxPage, szNew, szFlagDirty);
+  _HeapArenaMapBitsLargeSet(phd, pChunk, ndxPage + cpgHead, szOld - szNew, szFlagDirty);
+  arena_run_dalloc(phd, pArena, (PARENARUN)((UINT_PTR)pRun + szNew), fDirty, FALSE);
+}
+
+/*
+ * Purges dirty pages from an arena chunk.  The dirty available runs are temporarily allocated so nothing else
+ * can use them, the arena mutex is dropped while the chunk allocator purges them, and the runs are then returned
+ * to the arena as clean.  Each dirty run is always coalesced with any adjacent dirty pages, so it's purged with
+ * one call to the chunk allocator.  Assumes the arena mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk to be purged.
+ * - fAll = If TRUE, purge all dirty runs in the chunk; if FALSE, purge only those adjacent to clean runs.
+ *
+ * Returns:
+ * The number of pages purged.
+ */
+static SIZE_T arena_chunk_purge(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, BOOL fAll)
+{
+  DLIST_HEAD_DECLARE(ARENACHUNKMAP, dlistPurge);   /* list of runs in purgatory */
+  PARENACHUNKMAP pmap;      /* pointer to map element */
+  PARENARUN pRun;           /* pointer to run */
+  SIZE_T ndxPage;           /* page index */
+  SIZE_T cPages;            /* number of pages in run */
+  SIZE_T cpgPurged = 0;     /* number of pages purged */
+  UINT64 cAdvise = 0;       /* number of purge calls made */
+  SIZE_T szUnzeroed;        /* unzeroed flag for purged pages */
+  register SIZE_T i;        /* loop counter */
+
+  _H_ASSERT(phd, !arena_chunk_is_spare(pArena, pChunk));
+  pArena->stats.cPagesPurged += pChunk->cpgDirty;
+
+  /* If there's no fragmentation between clean and dirty runs, operate on all dirty runs. */
+  if (pChunk->cAvailRunAdjacent == 0)
+    fAll = TRUE;
+
+  /* Temporarily allocate the dirty runs to be purged, and stash them in a list. */
+  dlistListInit(&dlistPurge, u.link);
+  for (ndxPage = phd->cpgMapBias; ndxPage < phd->cpgChunk; ndxPage += cPages)
+  {
+    if (_HeapArenaMapBitsAllocatedGet(phd, pChunk, ndxPage) == 0)
+    {
+      cPages = _HeapArenaMapBitsUnallocatedSizeGet(phd, pChunk, ndxPage) >> SYS_PAGE_BITS;
+      _H_ASSERT(phd, ndxPage + cPages <= phd->cpgChunk);
+      if (   (_HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage) != 0)
+	  && (fAll || arena_avail_adjac(phd, pChunk, ndxPage, cPages)))
+      {
+	pRun = (PARENARUN)((UINT_PTR)pChunk + (ndxPage << SYS_PAGE_BITS));
+	arena_run_split(phd, pArena, pRun, cPages << SYS_PAGE_BITS, TRUE, BININD_INVALID, FALSE);
+	pmap = _HeapArenaMapPGet(phd, pChunk, ndxPage);
+	dlistNodeInit(pmap, u.link);
+	dlistListInsertLast(&dlistPurge, pmap, u.link);
+      }
+    }
+    else if (_HeapArenaMapBitsLargeGet(phd, pChunk, ndxPage) != 0)
+      cPages = _HeapArenaMapBitsLargeSizeGet(phd, pChunk, ndxPage) >> SYS_PAGE_BITS;
+    else
+    { /* skip a small-object run */
+      pRun = (PARENARUN)((UINT_PTR)pChunk + (ndxPage << SYS_PAGE_BITS));
+      _H_ASSERT(phd, _HeapArenaMapBitsSmallRunIndexGet(phd, pChunk, ndxPage) == 0);
+      cPages = phd->aArenaBinInfo[_HeapArenaBinIndex(phd, pArena, pRun->pBin)].cbRunSize >> SYS_PAGE_BITS;
+    }
+  }
+  _H_ASSERT(phd, ndxPage == phd->cpgChunk);
+  _H_ASSERT(phd, (pChunk->cpgDirty == 0) || !fAll);
+  _H_ASSERT(phd, pChunk->cAvailRunAdjacent == 0);
+
+  /*
+   * Purge the runs with the arena mutex dropped.  Setting the unzeroed flags is safe without the mutex, because
+   * the runs are marked allocated and the allocated bits of their first and last pages aren't disturbed.
+   */
+  IMutex_Unlock(pArena->pmtxLock);
+  dlistListForEach(pmap, &dlistPurge, u.link)
+  {
+    ndxPage = mapelm_to_pageind(phd, pChunk, pmap);
+    cPages = _HeapArenaMapBitsLargeSizeGet(phd, pChunk, ndxPage) >> SYS_PAGE_BITS;
+    _H_ASSERT(phd, ndxPage + cPages <= phd->cpgChunk);
+    szUnzeroed = (IChunkAllocator_PurgeUnusedRegion(phd->pChunkAllocator,
+						    (PVOID)((UINT_PTR)pChunk + (ndxPage << SYS_PAGE_BITS)),
+						    cPages << SYS_PAGE_BITS) == MEMMGR_S_NONZEROED)
+      ? CHUNK_MAP_UNZEROED : 0;
+    for (i = 0; i < cPages; i++)
+      _HeapArenaMapBitsUnzeroedSet(phd, pChunk, ndxPage + i, szUnzeroed);
+    cpgPurged += cPages;
+    cAdvise++;
+  }
+  IMutex_Lock(pArena->pmtxLock);
+  pArena->stats.cAdvise += cAdvise;
+
+  /* Return the purged runs to the arena as clean. */
+  while ((pmap = dlistFirst(&dlistPurge, u.link)) != NULL)
+  {
+    dlistListRemove(&dlistPurge, pmap, u.link);
+    pRun = (PARENARUN)((UINT_PTR)pChunk + (mapelm_to_pageind(phd, pChunk, pmap) << SYS_PAGE_BITS));
+    arena_run_dalloc(phd, pArena, pRun, FALSE, TRUE);
+  }
+
+  return cpgPurged;
+}
+
+/*
+ * Purges dirty pages from an arena, taking chunks from the tree of dirty chunks, most fragmented first, until
+ * the active:dirty ratio is satisfied.  Assumes the arena mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - fAll = If TRUE, purge all dirty pages, regardless of the active:dirty ratio.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_purge(PHEAPDATA phd, PARENA pArena, BOOL fAll)
+{
+  PARENACHUNK pChunk;    /* pointer to chunk being purged */
+  SIZE_T cpgPurgatory;   /* number of pages this call intends to purge */
+  SIZE_T cpgPurgeable;   /* number of dirty pages in the chunk */
+  SIZE_T cpgUnpurged;    /* number of dirty pages in the chunk not purged */
+
+  _H_ASSERT(phd, fAll || (pArena->cpgDirty > pArena->cpgPurgatory));
+  pArena->stats.cPurges++;
+
+  /*
+   * Compute the minimum number of pages to purge and add it to the purgatory count.  This keeps multiple threads
+   * from racing to reduce the dirty count below the threshold while the mutex is dropped.
+   */
+  cpgPurgatory = pArena->cpgDirty - pArena->cpgPurgatory;
+  if (!fAll)
+    cpgPurgatory -= (pArena->cpgActive >> phd->cbActiveDirtyRatio);
+  pArena->cpgPurgatory += cpgPurgatory;
+
+  while (cpgPurgatory > 0)
+  {
+    pChunk = (PARENACHUNK)RbtFindMin(&(pArena->rbtDirtyChunks));
+    if (!pChunk)
+    { /* other threads did some of the purging, or re-used dirty pages */
+      pArena->cpgPurgatory -= cpgPurgatory;
+      return;
+    }
+    cpgPurgeable = pChunk->cpgDirty;
+    _H_ASSERT(phd, cpgPurgeable != 0);
+
+    if ((cpgPurgeable > cpgPurgatory) && (pChunk->cAvailRunAdjacent == 0))
+    { /* all dirty pages in this chunk will be purged, so claim them to keep other threads from doing so */
+      pArena->cpgPurgatory += cpgPurgeable - cpgPurgatory;
+      cpgPurgatory = cpgPurgeable;
+    }
+
+    /* Track how many pages were purgeable versus how many actually got purged, and adjust accordingly. */
+    pArena->cpgPurgatory -= cpgPurgeable;
+    cpgPurgatory -= cpgPurgeable;
+    cpgUnpurged = cpgPurgeable - arena_chunk_purge(phd, pArena, pChunk, fAll);
+    pArena->cpgPurgatory += cpgUnpurged;
+    cpgPurgatory += cpgUnpurged;
+  }
+}
+
+/*
+ * Purges dirty pages from an arena if the number of dirty pages not already being purged exceeds both the number
+ * of active pages divided by 2 to the power of the active:dirty ratio, and one chunk's worth of pages.  The floor
+ * keeps a small or nearly empty arena, whose ratio threshold is about zero, from purging on every free; once it is
+ * crossed, arena_purge() purges all the way down to the ratio threshold.  Dirty pages in spare chunks don't count;
+ * keeping them is the point of the spare-chunk cache, and they are released when a spare is evicted from the
+ * cache or by _HeapArenaMinimize.  Assumes the arena mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_maybe_purge(PHEAPDATA phd, PARENA pArena)
+{
+  if (phd->cbActiveDirtyRatio < 0)
+    return;  /* purging is disabled */
+  if (pArena->cpgDirty <= pArena->cpgPurgatory)
+    return;  /* all dirty pages are already being purged */
+  if (pArena->cpgDirty - pArena->cpgPurgatory <= (pArena->cpgActive >> phd->cbActiveDirtyRatio))
+    return;  /* below the threshold */
+  if (pArena->cpgDirty - pArena->cpgPurgatory <= phd->cpgChunk)
+    return;  /* below the floor */
+  arena_purge(phd, pArena, FALSE);
+}
+
+/*
+ * Returns the lowest-addressed non-full run in a bin's tree of runs.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pBin = Pointer to the arena bin.
+ *
+ * Returns:
+ * - NULL = The bin has no non-full runs.
+ * - Other = Pointer to the run.
+ */
+static PARENARUN arena_bin_runs_first(PHEAPDATA phd, PARENABIN pBin)
+{
+  PARENACHUNKMAP pmap = (PARENACHUNKMAP)RbtFindMin(&(pBin->rbtRuns));  /* map element of the run */
+  PARENACHUNK pChunk;                                                  /* pointer to chunk containing the run */
+
+  if (!pmap)
+    return NULL;
+  pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pmap);
+  return (PARENARUN)((UINT_PTR)pChunk + (mapelm_to_pageind(phd, pChunk, pmap) << SYS_PAGE_BITS));
+}
+
+/*
+ * Inserts a non-full run into a bin's tree of runs.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pBin = Pointer to the arena bin.
+ * - pRun = Pointer to the run.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_bin_runs_insert(PHEAPDATA phd, PARENABIN pBin, PARENARUN pRun)
+{
+  PARENACHUNK pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pRun);   /* pointer to chunk containing the run */
+  PARENACHUNKMAP pmap = _HeapArenaMapPGet(phd, pChunk, ((UINT_PTR)pRun - (UINT_PTR)pChunk) >> SYS_PAGE_BITS);
+
+  rbtNewNode(&(pmap->u.rbtn));
+  RbtInsert(&(pBin->rbtRuns), pmap);
+}
+
+/*
+ * Removes a run from a bin's tree of runs.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pBin = Pointer to the arena bin.
+ * - pRun = Pointer to the run.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_bin_runs_remove(PHEAPDATA phd, PARENABIN pBin, PARENARUN pRun)
+{
+  PARENACHUNK pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pRun);   /* pointer to chunk containing the run */
+
+  RbtDelete(&(pBin->rbtRuns),
+	    (TREEKEY)_HeapArenaMapPGet(phd, pChunk, ((UINT_PTR)pRun - (UINT_PTR)pChunk) >> SYS_PAGE_BITS));
+}
+
+/*
+ * Removes the lowest-addressed non-full run from a bin's tree of runs and returns it.  Assumes the bin mutex
+ * is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pBin = Pointer to the arena bin.
+ *
+ * Returns:
+ * - NULL = The bin has no non-full runs.
+ * - Other = Pointer to the run.
+ */
+static PARENARUN arena_bin_nonfull_run_tryget(PHEAPDATA phd, PARENABIN pBin)
+{
+  PARENARUN pRun = arena_bin_runs_first(phd, pBin);   /* return from this function */
+
+  if (pRun)
+  {
+    arena_bin_runs_remove(phd, pBin, pRun);
+    pBin->stats.cReRuns++;
+  }
+  return pRun;
+}
+
+/*
+ * Gets a non-full run for a bin, either by reusing the lowest-addressed non-full run, or by allocating a new run
+ * from the arena.  Assumes the bin mutex is locked; it is dropped while a new run is allocated.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pBin = Pointer to the arena bin.
+ *
+ * Returns:
+ * - NULL = No run could be obtained.
+ * - Other = Pointer to the run.
+ */
+static PARENARUN arena_bin_nonfull_run_get(PHEAPDATA phd, PARENA pArena, PARENABIN pBin)
+{
+  PARENARUN pRun;           /* return from this function */
+  SIZE_T ndxBin;            /* index of the bin */
+  PARENABININFO pBinInfo;   /* pointer to bin information */
+  PARENACHUNK pChunk;       /* pointer to chunk containing the new run */
+
+  /* Look for a usable run. */
+  pRun = arena_bin_nonfull_run_tryget(phd, pBin);
+  if (pRun)
+    return pRun;
+
+  /* No existing runs have any space available, allocate a new run. */
+  ndxBin = _HeapArenaBinIndex(phd, pArena, pBin);
+  pBinInfo = &(phd->aArenaBinInfo[ndxBin]);
+  IMutex_Unlock(pBin->pmtxLock);
+  IMutex_Lock(pArena->pmtxLock);
+  pRun = arena_run_alloc(phd, pArena, pBinInfo->cbRunSize, FALSE, ndxBin, FALSE);
+  if (pRun)
+  { /* initialize the run header */
+    pRun->pBin = pBin;
+    pRun->ndxNext = 0;
+    pRun->nFree = pBinInfo->nRegions;
+    pRun->uiSpyGen = 0;
+    pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pRun);
+    pRun->fZeroed = arena_run_is_zeroed(phd, pChunk, ((UINT_PTR)pRun - (UINT_PTR)pChunk) >> SYS_PAGE_BITS,
+					pBinInfo->cbRunSize >> SYS_PAGE_BITS);
+    _HeapBitmapInit((PBITMAP)((UINT_PTR)pRun + pBinInfo->ofsBitmap), &(pBinInfo->bitmapinfo));
+  }
+  IMutex_Unlock(pArena->pmtxLock);
+  IMutex_Lock(pBin->pmtxLock);
+  if (pRun)
+  {
+    pBin->stats.cRuns++;
+    pBin->stats.cRunsCurrent++;
+    return pRun;
+  }
+
+  /*
+   * arena_run_alloc() failed, but another thread may have made sufficient memory available while this one
+   * dropped the bin lock, so search one more time.
+   */
+  return arena_bin_nonfull_run_tryget(phd, pBin);
+}
+
+/*
+ * Allocates a region from a small-object run with at least one free region.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pRun = Pointer to the run.
+ * - pBinInfo = Pointer to the bin information for the run's size class.
+ * - pfZeroed = If not NULL, receives TRUE if the region is known to contain only zeroes, FALSE if not.
+ *
+ * Returns:
+ * Pointer to the allocated region.
+ */
+static PVOID arena_run_reg_alloc(PHEAPDATA phd, PARENARUN pRun, PARENABININFO pBinInfo, BOOL *pfZeroed)
+{
+  UINT32 ndxReg;   /* index of the region */
+  BOOL fZeroed;    /* is the region known to be zeroed? */
+
+  _H_ASSERT(phd, pRun->nFree > 0);
+  ndxReg = (UINT32)_HeapBitmapSetFirstUnset((PBITMAP)((UINT_PTR)pRun + pBinInfo->ofsBitmap),
+					    &(pBinInfo->bitmapinfo));
+  pRun->nFree--;
+  fZeroed = FALSE;
+  if (ndxReg == pRun->ndxNext)
+  { /* never allocated before, so it's still zeroed if the run started out that way */
+    pRun->ndxNext++;
+    fZeroed = pRun->fZeroed;
+  }
+  if (pfZeroed)
+    *pfZeroed = fZeroed;
+  _H_ASSERT(phd, ndxReg < pRun->ndxNext);
+  return (PVOID)((UINT_PTR)pRun + (UINT_PTR)(pBinInfo->ofsRegion0) + (UINT_PTR)(ndxReg * pBinInfo->cbInterval));
+}
+
+/*
+ * Returns a region to the small-object run containing it.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pRun = Pointer to the run.
+ * - pBinInfo = Pointer to the bin information for the run's size class.
+ * - pv = Pointer to the region being freed.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_run_reg_dalloc(PHEAPDATA phd, PARENARUN pRun, PARENABININFO pBinInfo, PVOID pv)
+{
+  UINT32 ndxReg = _HeapArenaRunRegInd(phd, pRun, pBinInfo, pv);       /* index of the region */
+  PBITMAP pBitmap = (PBITMAP)((UINT_PTR)pRun + pBinInfo->ofsBitmap);   /* run's region bitmap */
+
+  _H_ASSERT(phd, pRun->nFree < pBinInfo->nRegions);
+  /* Freeing an unallocated pointer can cause assertion failure. */
+  _H_ASSERT(phd, _HeapBitmapGet(pBitmap, &(pBinInfo->bitmapinfo), ndxReg));
+  _HeapBitmapUnset(pBitmap, &(pBinInfo->bitmapinfo), ndxReg);
+  pRun->nFree++;
+}
+
+/*
+ * Makes sure that if the bin's current run is non-NULL, it refers to the lowest non-full run, if one exists.
+ * Either the given run becomes the current run, or it's inserted into the bin's tree of runs.  Assumes the
+ * bin mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk containing the run.
+ * - pRun = Pointer to the run that has just become non-full.
+ * - pBin = Pointer to the arena bin.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_bin_lower_run(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PARENARUN pRun, PARENABIN pBin)
+{
+  if (pBin->prunCurrent && ((UINT_PTR)(pBin->prunCurrent) > (UINT_PTR)pRun))
+  { /* switch the current run */
+    if (pBin->prunCurrent->nFree > 0)
+      arena_bin_runs_insert(phd, pBin, pBin->prunCurrent);
+    pBin->prunCurrent = pRun;
+    pBin->stats.cReRuns++;
+  }
+  else
+    arena_bin_runs_insert(phd, pBin, pRun);
+}
+
+/*
+ * Detaches a run that has become empty from its bin, so that it can be deallocated.  Assumes the bin mutex
+ * is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pChunk = Pointer to the chunk containing the run.
+ * - pRun = Pointer to the run.
+ * - pBin = Pointer to the arena bin.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_dissociate_bin_run(PHEAPDATA phd, PARENACHUNK pChunk, PARENARUN pRun, PARENABIN pBin)
+{
+  if (pRun == pBin->prunCurrent)
+    pBin->prunCurrent = NULL;
+  else if (phd->aArenaBinInfo[_HeapArenaBinIndex(phd, pChunk->parena, pRun->pBin)].nRegions != 1)
+    /* a run with only one region never gets inserted into the non-full runs tree */
+    arena_bin_runs_remove(phd, pBin, pRun);
+}
+
+/*
+ * Returns an empty small-object run to the arena.  Assumes the bin mutex is locked; it is dropped while the arena
+ * mutex is held.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk containing the run.
+ * - pRun = Pointer to the run.
+ * - pBin = Pointer to the arena bin.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_dalloc_bin_run(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PARENARUN pRun, PARENABIN pBin)
+{
+  PARENABININFO pBinInfo = &(phd->aArenaBinInfo[_HeapArenaBinIndex(phd, pArena, pBin)]);  /* bin information */
+  SIZE_T cpgRun = pBinInfo->cbRunSize >> SYS_PAGE_BITS;                   /* number of pages in run */
+  SIZE_T ndxRun = ((UINT_PTR)pRun - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;   /* page index of run */
+  SIZE_T ndxPast;  /* index of first page past the highest region ever allocated */
+
+  _H_ASSERT(phd, pRun != pBin->prunCurrent);
+  ndxPast = (SYS_PAGE_CEILING((UINT_PTR)pRun + (UINT_PTR)(pBinInfo->ofsRegion0)
+			      + (UINT_PTR)(pRun->ndxNext * pBinInfo->cbInterval - pBinInfo->cbRedzone))
+	     - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;
+  IMutex_Unlock(pBin->pmtxLock);
+  IMutex_Lock(pArena->pmtxLock);
+
+  /*
+   * If the run was originally clean, and some pages were never touched, trim the clean pages before
+   * deallocating the dirty portion of the run.
+   */
+  if ((_HeapArenaMapBitsDirtyGet(phd, pChunk, ndxRun) == 0) && (ndxPast - ndxRun < cpgRun))
+  { /* convert to a large run beforehand */
+    _HeapArenaMapBitsLargeSet(phd, pChunk, ndxRun, pBinInfo->cbRunSize, 0);
+    _HeapArenaMapBitsLargeSet(phd, pChunk, ndxRun + cpgRun - 1, 0, 0);
+    arena_run_trim_tail(phd, pArena, pChunk, pRun, cpgRun << SYS_PAGE_BITS, (ndxPast - ndxRun) << SYS_PAGE_BITS,
+			FALSE);
+  }
+  arena_run_dalloc(phd, pArena, pRun, TRUE, FALSE);
+  IMutex_Unlock(pArena->pmtxLock);
+  IMutex_Lock(pBin->pmtxLock);
+  pBin->stats.cRunsCurrent--;
+}
+
+/*
+ * Allocates a region from a bin when the bin's current run is full, switching to a new current run.  Assumes the
+ * bin mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pBin = Pointer to the arena bin.
+ * - pfZeroed = If not NULL, receives TRUE if the region is known to contain only zeroes, FALSE if not.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the allocated region.
+ */
+static PVOID arena_bin_malloc_hard(PHEAPDATA phd, PARENA pArena, PARENABIN pBin, BOOL *pfZeroed)
+{
+  PARENABININFO pBinInfo = &(phd->aArenaBinInfo[_HeapArenaBinIndex(phd, pArena, pBin)]);  /* bin information */
+  PARENARUN pRun;   /* pointer to the new run */
+  PVOID rc;         /* return from this function */
+
+  pBin->prunCurrent = NULL;
+  pRun = arena_bin_nonfull_run_get(phd, pArena, pBin);
+  if (pBin->prunCurrent && (pBin->prunCurrent->nFree > 0))
+  {
+    /*
+     * Another thread updated prunCurrent while this one ran without the bin lock in arena_bin_nonfull_run_get().
+     * Use prunCurrent, and put pRun back (or return it to the arena if it's empty).
+     */
+    rc = arena_run_reg_alloc(phd, pBin->prunCurrent, pBinInfo, pfZeroed);
+    if (pRun)
+    {
+      if (pRun->nFree == pBinInfo->nRegions)
+	arena_dalloc_bin_run(phd, pArena, (PARENACHUNK)CHUNK_ADDR2BASE(phd, pRun), pRun, pBin);
+      else
+	arena_bin_lower_run(phd, pArena, (PARENACHUNK)CHUNK_ADDR2BASE(phd, pRun), pRun, pBin);
+    }
+    return rc;
+  }
+
+  if (!pRun)
+    return NULL;
+  pBin->prunCurrent = pRun;
+  return arena_run_reg_alloc(phd, pRun, pBinInfo, pfZeroed);
+}
+
+/*
+ * Returns the arena bin owning the run that contains a small object.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pChunk = Pointer to the chunk containing the object.
+ * - pv = Pointer to the object.
+ *
+ * Returns:
+ * - NULL = The object is a large object, which is owned by its arena rather than by a bin.
+ * - Other = Pointer to the arena bin owning the object's run.
+ */
+static PARENABIN arena_ptr_bin(PHEAPDATA phd, PARENACHUNK pChunk, PCVOID pv)
+{
+  SIZE_T ndxPage = ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;  /* page index of the pointer */
+  PARENARUN pRun;                                                    /* pointer to run containing the object */
+
+  _H_ASSERT(phd, _HeapArenaMapBitsAllocatedGet(phd, pChunk, ndxPage) != 0);
+  if (_HeapArenaMapBitsLargeGet(phd, pChunk, ndxPage))
+    return NULL;
+  pRun = (PARENARUN)((UINT_PTR)pChunk
+		     + ((ndxPage - _HeapArenaMapBitsSmallRunIndexGet(phd, pChunk, ndxPage)) << SYS_PAGE_BITS));
+  return pRun->pBin;
+}
+
+/*
+ * Determines whether a free into an arena should go through the arena's remote-free stack, i.e. whether the
+ * calling thread is bound to some other arena (or to none).  An arena with no threads bound to it has no one
+ * to drain its stack, so frees into it are always done directly.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena owning the object being freed.
+ * - ptcache = Pointer to the calling thread's cache, or NULL if the caller has not looked it up or the thread has
+ *             none.  A thread cache belongs to its thread's arena, so this saves looking the arena up.
+ *
+ * Returns:
+ * - TRUE = The free is a remote free.
+ * - FALSE = The free should be done directly.
+ */
+static BOOL arena_is_remote(PHEAPDATA phd, PARENA pArena, PTCACHE ptcache)
+{
+  PARENA pArenaThread = NULL;   /* arena the calling thread is bound to */
+
+  if (pArena->nThreads == 0)
+    return FALSE;
+  if (ptcache)
+    return MAKEBOOL(ptcache->parena != pArena);
+  IThreadLocal_Get(phd->pthrlArena, (PPVOID)(&pArenaThread));
+  return MAKEBOOL(pArenaThread != pArena);
+}
+
+/*
+ * Pushes a chain of objects onto an arena's remote-free stack, to be freed by the arena's own threads the next
+ * time one of them allocates from it.  The objects are linked through their first words; the caller must have
+ * linked each object in the chain to the next, and the link in the last object is overwritten.  No locks are
+ * taken, and any number of threads may push at once.  If the arena's last thread left while the objects were
+ * being pushed, nobody else will drain them, so the pushing thread does it; for that reason, this must be called
+ * with no arena or bin locks held.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena owning all the objects.
+ * - pvFirst = Pointer to the first object in the chain.
+ * - pvLast = Pointer to the last object in the chain.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaRemoteFree(PHEAPDATA phd, PARENA pArena, PVOID pvFirst, PVOID pvLast)
+{
+  PVOID pvHead;   /* current head of the stack */
+
+  /*
+   * The stack is only ever emptied as a whole, never popped, so a head that compares equal has not been
+   * removed and reinserted in the meantime, and the compare-and-swap is safe from ABA.
+   */
+  do
+  {
+    pvHead = pArena->pvRemoteFree;
+    *((PPVOID)pvLast) = pvHead;
+  } while (AtomicCompareExchangePtr((PPVOID)(&(pArena->pvRemoteFree)), pvHead, pvFirst) != pvHead);
+
+  /*
+   * arenaCleanup drops the thread count before it drains, and we push before we check the count, so either it
+   * sees our objects or we see the count at zero.
+   */
+  if (pArena->nThreads == 0)
+    _HeapArenaRemoteDrain(phd, pArena);
+}
+
+/*
+ * Frees every object on an arena's remote-free stack.  The whole stack is detached at once, then freed in groups
+ * sharing an owner, as in _HeapArenaDAllocBatch.  Must be called with no arena or bin locks held.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_remote_drain_hard(PHEAPDATA phd, PARENA pArena)
+{
+  PVOID pvList;            /* objects remaining to be freed */
+  PVOID pv;                /* pointer to object being freed */
+  PVOID pvNext;            /* pointer to next object in the list */
+  PPVOID ppvLink;          /* pointer to the link to the current object */
+  PARENACHUNK pChunk;      /* pointer to chunk containing object */
+  PARENABIN pBin;          /* pointer to arena bin owning the current group, or NULL for large objects */
+  IMutex *pmtx;            /* mutex protecting the current group */
+
+  pvList = AtomicExchangePtr((PPVOID)(&(pArena->pvRemoteFree)), NULL);
+  while (pvList)
+  {
+    /* The first remaining object determines the group for this pass. */
+    pBin = arena_ptr_bin(phd, (PARENACHUNK)CHUNK_ADDR2BASE(phd, pvList), pvList);
+    pmtx = (pBin ? pBin->pmtxLock : pArena->pmtxLock);
+    IMutex_Lock(pmtx);
+    ppvLink = &pvList;
+    while ((pv = *ppvLink) != NULL)
+    {
+      pvNext = *((PPVOID)pv);  /* fetch the link now, since freeing may junk-fill the object */
+      pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);
+      _H_ASSERT(phd, pChunk->parena == pArena);
+      if (arena_ptr_bin(phd, pChunk, pv) != pBin)
+      { /* belongs to another group, leave it for a later pass */
+	ppvLink = (PPVOID)pv;
+	continue;
+      }
+      *ppvLink = pvNext;
+      if (pBin)
+	_HeapArenaDAllocBinLocked(phd, pArena, pChunk, pv,
+				  _HeapArenaMapPGet(phd, pChunk, ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS));
+      else
+	_HeapArenaDAllocLargeLocked(phd, pArena, pChunk, pv);
+    }
+    IMutex_Unlock(pmtx);
+  }
+}
+
+/*
+ * Frees any objects other threads have pushed onto an arena's remote-free stack.  Called by the arena's own
+ * threads before they allocate from it, and periodically from their thread caches, with no arena or bin locks
+ * held.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaRemoteDrain(PHEAPDATA phd, PARENA pArena)
+{
+  if (pArena->pvRemoteFree)
+    arena_remote_drain_hard(phd, pArena);
+}
+
+/*
+ * Purges all dirty pages in an arena, returning their physical memory to the chunk allocator.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaPurgeAll(PHEAPDATA phd, PARENA pArena)
+{
+  IMutex_Lock(pArena->pmtxLock);
+  arena_purge(phd, pArena, TRUE);
+  IMutex_Unlock(pArena->pmtxLock);
+}
+
+/*
+ * Shrinks an arena's physical footprint as far as possible: releases the spare chunks back to the chunk allocator,
+ * then purges all remaining dirty pages.  Purging can leave whole chunks free, which go into the spare-chunk cache
+ * (or evict a spare from it), so the two steps repeat until no spares are left.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ *
+ * Returns:
+ * The number of bytes released, counting each purged page and each released chunk in full.
+ */
+SIZE_T _HeapArenaMinimize(PHEAPDATA phd, PARENA pArena)
+{
+  PARENACHUNK pSpare;       /* pointer to spare chunk */
+  SIZE_T cChunks = 0;       /* number of spare chunks released */
+  SIZE_T cEvictions;        /* eviction count before purging */
+  UINT64 cPagesPurged;      /* purged page count before purging */
+
+  _HeapArenaRemoteDrain(phd, pArena);
+  IMutex_Lock(pArena->pmtxLock);
+  cEvictions = pArena->cSpareEvictions;
+  cPagesPurged = pArena->stats.cPagesPurged;
+  do
+  {
+    while (pArena->cSpareChunks > 0)
+    {
+      pSpare = pArena->apchunkSpare[--pArena->cSpareChunks];
+      pArena->cpgSpareDirty -= arena_spare_dirty_pages(phd, pSpare);
+      IMutex_Unlock(pArena->pmtxLock);
+      _HeapChunkDeAlloc(phd, (PVOID)pSpare, phd->szChunk, TRUE);
+      IMutex_Lock(pArena->pmtxLock);
+      pArena->stats.cbMapped -= phd->szChunk;
+      cChunks++;
+    }
+    arena_purge(phd, pArena, TRUE);
+  } while (pArena->cSpareChunks > 0);
+  cChunks += pArena->cSpareEvictions - cEvictions;  /* chunks released by arena_chunk_dealloc() while purging */
+  cPagesPurged = pArena->stats.cPagesPurged - cPagesPurged;
+  IMutex_Unlock(pArena->pmtxLock);
+  return (cChunks * phd->szChunk) + ((SIZE_T)cPagesPurged << SYS_PAGE_BITS);
+}
+
+/*
+ * Fills a thread cache bin with regions from an arena bin.  The regions are stacked so that the lowest-addressed
+ * regions are used first.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - ptbin = Pointer to the thread cache bin to be filled.
+ * - ndxBin = Index of the bin to be filled.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaTCacheFillSmall(PHEAPDATA phd, PARENA pArena, PTCACHEBIN ptbin, SIZE_T ndxBin)
+{
+  PARENABIN pBin = &(pArena->aBins[ndxBin]);                 /* pointer to arena bin */
+  PARENABININFO pBinInfo = &(phd->aArenaBinInfo[ndxBin]);   /* pointer to bin information */
+  PARENARUN pRun;          /* pointer to current run */
+  PVOID pv;                /* pointer to allocated region */
+  register UINT32 i, j;    /* loop counters */
+  UINT32 nFill;            /* number of regions to fill */
+
+  _HeapArenaRemoteDrain(phd, pArena);
+  _H_ASSERT(phd, ptbin->nCached == 0);
+  IMutex_Lock(pBin->pmtxLock);
+  for (i = 0, nFill = phd->ptcbi[ndxBin].nCachedMax >> ptbin->cbitFill; i < nFill; i++)
+  {
+    if ((pRun = pBin->prunCurrent) != NULL && (pRun->nFree > 0))
+      pv = arena_run_reg_alloc(phd, pRun, pBinInfo, NULL);
+    else
+      pv = arena_bin_malloc_hard(phd, pArena, pBin, NULL);
+    if (!pv)
+      break;
+    /* Insert such that low regions get used first. */
+    ptbin->ppvAvail[nFill - 1 - i] = pv;
+  }
+  pBin->stats.cbAllocated += i * pBinInfo->cbRegions;
+  pBin->stats.cMalloc += i;
+  pBin->stats.cRequests += ptbin->stats.nRequests;
+  pBin->stats.cFills++;
+  ptbin->stats.nRequests = 0;
+  IMutex_Unlock(pBin->pmtxLock);
+
+  if (i < nFill)
+  { /* the fill came up short, so move what we got down to the bottom of the stack */
+    for (j = 0; j < i; j++)
+      ptbin->ppvAvail[j] = ptbin->ppvAvail[nFill - i + j];
+  }
+  ptbin->nCached = i;
+}
+
+/*
+ * Junk-fills a newly-allocated small object, along with its red zones.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the new object.
+ * - pBinInfo = Pointer to the bin information for the object's size class.
+ * - fZero = If TRUE, the object itself is about to be zero-filled, so only the red zones are junk-filled.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaAllocJunkSmall(PHEAPDATA phd, PVOID pv, PARENABININFO pBinInfo, BOOL fZero)
+{
+  if (fZero)
+  {
+    if (pBinInfo->cbRedzone)
+    {
+      StrSetMem((PVOID)((UINT_PTR)pv - pBinInfo->cbRedzone), JUNK_ALLOC, pBinInfo->cbRedzone);
+      StrSetMem((PVOID)((UINT_PTR)pv + pBinInfo->cbRegions), JUNK_ALLOC, pBinInfo->cbRedzone);
+    }
+  }
+  else
+    StrSetMem((PVOID)((UINT_PTR)pv - pBinInfo->cbRedzone), JUNK_ALLOC, pBinInfo->cbInterval);
+}
+
+/*
+ * Junk-fills a small object that is being freed, along with its red zones.  The red zones are not validated,
+ * because junk fill may have been switched on since the object was allocated.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the object being freed.
+ * - pBinInfo = Pointer to the bin information for the object's size class.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaDAllocJunkSmall(PHEAPDATA phd, PVOID pv, PARENABININFO pBinInfo)
+{
+  StrSetMem((PVOID)((UINT_PTR)pv - pBinInfo->cbRedzone), JUNK_FREE, pBinInfo->cbInterval);
+}
+
+/*
+ * Allocates a small object directly from an arena bin.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - sz = Size of the object to allocate.  Must be no greater than SMALL_MAXCLASS.
+ * - fZero = If TRUE, the returned object will be zero-filled.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the new object.
+ */
+PVOID _HeapArenaMallocSmall(PHEAPDATA phd, PARENA pArena, SIZE_T sz, BOOL fZero)
+{
+  SIZE_T ndxBin = SMALL_SIZE2BIN(sz);   /* bin index */
+  PARENABIN pBin;                       /* pointer to arena bin */
+  PARENARUN pRun;                       /* pointer to current run */
+  PVOID rc;                             /* return from this function */
+  BOOL fZeroed;                         /* is the region already zeroed? */
+
+  _HeapArenaRemoteDrain(phd, pArena);
+  _H_ASSERT(phd, ndxBin < NBINS);
+  pBin = &(pArena->aBins[ndxBin]);
+  sz = phd->aArenaBinInfo[ndxBin].cbRegions;
+
+  IMutex_Lock(pBin->pmtxLock);
+  if ((pRun = pBin->prunCurrent) != NULL && (pRun->nFree > 0))
+    rc = arena_run_reg_alloc(phd, pRun, &(phd->aArenaBinInfo[ndxBin]), &fZeroed);
+  else
+    rc = arena_bin_malloc_hard(phd, pArena, pBin, &fZeroed);
+  if (!rc)
+  {
+    IMutex_Unlock(pBin->pmtxLock);
+    return NULL;
+  }
+  pBin->stats.cbAllocated += sz;
+  pBin->stats.cMalloc++;
+  pBin->stats.cRequests++;
+  IMutex_Unlock(pBin->pmtxLock);
+
+  if (fZero)
+  {
+    if (phd->uiFillFlags & PHDFLAGS_JUNKFILL)
+      _HeapArenaAllocJunkSmall(phd, rc, &(phd->aArenaBinInfo[ndxBin]), TRUE);
+    if (!fZeroed)
+      StrSetMem(rc, 0, sz);
+  }
+  else if (phd->uiFillFlags)
+  {
+    if (phd->uiFillFlags & PHDFLAGS_JUNKFILL)
+      _HeapArenaAllocJunkSmall(phd, rc, &(phd->aArenaBinInfo[ndxBin]), FALSE);
+    else if (!fZeroed)
+      StrSetMem(rc, 0, sz);
+  }
+  return rc;
+}
+
+/*
+ * Allocates a number of small objects of the same size class directly from an arena bin, taking the bin mutex
+ * only once for the whole batch.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - sz = Size of the objects to allocate.  Must be no greater than SMALL_MAXCLASS.
+ * - n = Number of objects to allocate.
+ * - ppv = Pointer to an array of n pointers that receives the new objects.
+ *
+ * Returns:
+ * The number of objects actually allocated, which will be less than n only if memory ran out.  The new
+ * objects are stored in the first elements of ppv.
+ */
+UINT32 _HeapArenaMallocSmallBatch(PHEAPDATA phd, PARENA pArena, SIZE_T sz, UINT32 n, PPVOID ppv)
+{
+  SIZE_T ndxBin = SMALL_SIZE2BIN(sz);   /* bin index */
+  PARENABIN pBin;                       /* pointer to arena bin */
+  PARENABININFO pBinInfo;               /* pointer to bin information */
+  PARENARUN pRun;                       /* pointer to current run */
+  PVOID pv;                             /* pointer to allocated region */
+  register UINT32 i, j;                 /* loop counters */
+
+  _HeapArenaRemoteDrain(phd, pArena);
+  _H_ASSERT(phd, ndxBin < NBINS);
+  pBin = &(pArena->aBins[ndxBin]);
+  pBinInfo = &(phd->aArenaBinInfo[ndxBin]);
+
+  IMutex_Lock(pBin->pmtxLock);
+  for (i = 0; i < n; i++)
+  {
+    if ((pRun = pBin->prunCurrent) != NULL && (pRun->nFree > 0))
+      pv = arena_run_reg_alloc(phd, pRun, pBinInfo, NULL);
+    else
+      pv = arena_bin_malloc_hard(phd, pArena, pBin, NULL);
+    if (!pv)
+      break;
+    ppv[i] = pv;
+  }
+  pBin->stats.cbAllocated += i * pBinInfo->cbRegions;
+  pBin->stats.cMalloc += i;
+  pBin->stats.cRequests += i;
+  IMutex_Unlock(pBin->pmtxLock);
+
+  if (phd->uiFillFlags)
+  { /* one test of the fill mode covers the whole batch */
+    for (j = 0; j < i; j++)
+    {
+      if (phd->uiFillFlags & PHDFLAGS_JUNKFILL)
+	_HeapArenaAllocJunkSmall(phd, ppv[j], pBinInfo, FALSE);
+      else
+	StrSetMem(ppv[j], 0, pBinInfo->cbRegions);
+    }
+  }
+  return i;
+}
+
+/*
+ * Allocates a large object as a run of pages from an arena.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - sz = Size of the object to allocate.  Must be greater than SMALL_MAXCLASS and no greater than
+ *        phd->szArenaMaxClass.
+ * - fZero = If TRUE, the returned object will be zero-filled.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the new object.
+ */
+PVOID _HeapArenaMallocLarge(PHEAPDATA phd, PARENA pArena, SIZE_T sz, BOOL fZero)
+{
+  PVOID rc;             /* return from this function */
+  PARENACHUNK pChunk;   /* pointer to the chunk containing the run */
+  SIZE_T ndxPage;       /* page index of the run */
+
+  _HeapArenaRemoteDrain(phd, pArena);
+  /* Zero-fill outside the arena lock. */
+  sz = SYS_PAGE_CEILING(sz);
+  IMutex_Lock(pArena->pmtxLock);
+  rc = (PVOID)arena_run_alloc(phd, pArena, sz, TRUE, BININD_INVALID, FALSE);
+  if (!rc)
+  {
+    IMutex_Unlock(pArena->pmtxLock);
+    return NULL;
+  }
+  pArena->stats.cLargeMalloc++;
+  pArena->stats.cLargeRequests++;
+  pArena->stats.cbAllocatedLarge += sz;
+  pArena->stats.amls[(sz >> SYS_PAGE_BITS) - 1].nMalloc++;
+  pArena->stats.amls[(sz >> SYS_PAGE_BITS) - 1].nRequests++;
+  pArena->stats.amls[(sz >> SYS_PAGE_BITS) - 1].cRuns++;
+  IMutex_Unlock(pArena->pmtxLock);
+
+  if (fZero || (phd->uiFillFlags == PHDFLAGS_ZEROFILL))
+  { /* only pages not known to be zeroed need filling */
+    pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, rc);
+    ndxPage = ((UINT_PTR)rc - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;
+    arena_run_zero(phd, pChunk, ndxPage, sz >> SYS_PAGE_BITS, _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage));
+  }
+  else if (phd->uiFillFlags)
+    _HeapFillAlloc(phd, rc, sz);
+  return rc;
+}
+
+/*
+ * Allocates a large object from an arena with a specified alignment, by allocating an over-sized run and
+ * trimming off the leading and trailing pages.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - sz = Size of the object to allocate; must be a multiple of SYS_PAGE_SIZE.
+ * - szAlignment = Alignment of the object; must be a power of 2.
+ * - fZero = If TRUE, the returned object will be zero-filled.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the new object.
+ */
+PVOID _HeapArenaPalloc(PHEAPDATA phd, PARENA pArena, SIZE_T sz, SIZE_T szAlignment, BOOL fZero)
+{
+  PVOID rc;             /* return from this function */
+  SIZE_T szAlloc;       /* size of the over-sized run */
+  SIZE_T szLead;        /* number of bytes to trim from the head */
+  SIZE_T szTrail;       /* number of bytes to trim from the tail */
+  PARENARUN pRun;       /* pointer to the over-sized run */
+  PARENACHUNK pChunk;   /* pointer to the chunk containing the run */
+  SIZE_T ndxPage;       /* page index of the aligned run */
+
+  _HeapArenaRemoteDrain(phd, pArena);
+  _H_ASSERT(phd, (sz & SYS_PAGE_MASK) == 0);
+  szAlignment = SYS_PAGE_CEILING(szAlignment);
+  szAlloc = sz + szAlignment - SYS_PAGE_SIZE;
+
+  /* Zero-fill after trimming, so the pages trimmed away are not filled needlessly. */
+  IMutex_Lock(pArena->pmtxLock);
+  pRun = arena_run_alloc(phd, pArena, szAlloc, TRUE, BININD_INVALID, FALSE);
+  if (!pRun)
+  {
+    IMutex_Unlock(pArena->pmtxLock);
+    return NULL;
+  }
+  pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pRun);
+
+  szLead = ALIGNMENT_CEILING((UINT_PTR)pRun, szAlignment - 1) - (UINT_PTR)pRun;
+  _H_ASSERT(phd, szAlloc >= szLead + sz);
+  szTrail = szAlloc - szLead - sz;
+  rc = (PVOID)((UINT_PTR)pRun + szLead);
+  if (szLead != 0)
+    arena_run_trim_head(phd, pArena, pChunk, pRun, szAlloc, szAlloc - szLead);
+  if (szTrail != 0)
+    arena_run_trim_tail(phd, pArena, pChunk, (PARENARUN)rc, sz + szTrail, sz, FALSE);
+
+  pArena->stats.cLargeMalloc++;
+  pArena->stats.cLargeRequests++;
+  pArena->stats.cbAllocatedLarge += sz;
+  pArena->stats.amls[(sz >> SYS_PAGE_BITS) - 1].nMalloc++;
+  pArena->stats.amls[(sz >> SYS_PAGE_BITS) - 1].nRequests++;
+  pArena->stats.amls[(sz >> SYS_PAGE_BITS) - 1].cRuns++;
+  IMutex_Unlock(pArena->pmtxLock);
+
+  if (fZero || (phd->uiFillFlags == PHDFLAGS_ZEROFILL))
+  {
+    ndxPage = ((UINT_PTR)rc - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;
+    arena_run_zero(phd, pChunk, ndxPage, sz >> SYS_PAGE_BITS, _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage));
+  }
+  else if (phd->uiFillFlags)
+    _HeapFillAlloc(phd, rc, sz);
+  return rc;
+}
+
+void _HeapArenaProfPromoted(PHEAPDATA phd, PCVOID pv, SIZE_T sz)
+{
+  /* TODO */
+}
+
+/*
+ * Frees a small object back to its arena bin.  Assumes the bin mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk containing the object.
+ * - pv = Pointer to the object being freed.
+ * - pMapElement = Pointer to the chunk map element for the page containing the object.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaDAllocBinLocked(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, PARENACHUNKMAP pMapElement)
+{
+  SIZE_T ndxPage;           /* index of the page containing the object */
+  PARENARUN pRun;           /* pointer to run containing the object */
+  PARENABIN pBin;           /* pointer to arena bin */
+  PARENABININFO pBinInfo;   /* pointer to bin information */
+
+  ndxPage = ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;
+  pRun = (PARENARUN)((UINT_PTR)pChunk
+		     + ((ndxPage - _HeapArenaMapBitsSmallRunIndexGet(phd, pChunk, ndxPage)) << SYS_PAGE_BITS));
+  pBin = pRun->pBin;
+  pBinInfo = &(phd->aArenaBinInfo[_HeapArenaPtrSmallBinIndGet(phd, pv, pMapElement->bits)]);
+
+  if (phd->uiFillFlags & PHDFLAGS_JUNKFILL)
+    _HeapArenaDAllocJunkSmall(phd, pv, pBinInfo);
+  arena_run_reg_dalloc(phd, pRun, pBinInfo, pv);
+  if (pRun->nFree == pBinInfo->nRegions)
+  { /* run is now empty, give it back */
+    arena_dissociate_bin_run(phd, pChunk, pRun, pBin);
+    arena_dalloc_bin_run(phd, pArena, pChunk, pRun, pBin);
+  }
+  else if ((pRun->nFree == 1) && (pRun != pBin->prunCurrent))
+    arena_bin_lower_run(phd, pArena, pChunk, pRun, pBin);  /* run was full, make it available again */
+
+  pBin->stats.cbAllocated -= pBinInfo->cbRegions;
+  pBin->stats.cDalloc++;
+}
+
+/*
+ * Frees a small object back to its arena bin, locking the bin.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk containing the object.
+ * - pv = Pointer to the object being freed.
+ * - pMapElement = Pointer to the chunk map element for the page containing the object.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaDAllocBin(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, PARENACHUNKMAP pMapElement)
+{
+  SIZE_T ndxPage;    /* index of the page containing the object */
+  PARENARUN pRun;    /* pointer to run containing the object */
+  PARENABIN pBin;    /* pointer to arena bin */
+
+  ndxPage = ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;
+  pRun = (PARENARUN)((UINT_PTR)pChunk
+		     + ((ndxPage - _HeapArenaMapBitsSmallRunIndexGet(phd, pChunk, ndxPage)) << SYS_PAGE_BITS));
+  pBin = pRun->pBin;
+  IMutex_Lock(pBin->pmtxLock);
+  _HeapArenaDAllocBinLocked(phd, pArena, pChunk, pv, pMapElement);
+  IMutex_Unlock(pBin->pmtxLock);
+}
+
+/*
+ * Frees a small object directly back to its arena, or pushes it onto the arena's remote-free stack if the
+ * calling thread is bound to another arena.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk containing the object.
+ * - pv = Pointer to the object being freed.
+ * - ndxPage = Index of the page containing the object.
+ * - ptcache = Pointer to the calling thread's cache, if the caller has it, or NULL.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaDAllocSmall(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, SIZE_T ndxPage,
+			   PTCACHE ptcache)
+{
+  if (arena_is_remote(phd, pArena, ptcache))
+    _HeapArenaRemoteFree(phd, pArena, pv, pv);
+  else
+    _HeapArenaDAllocBin(phd, pArena, pChunk, pv, _HeapArenaMapPGet(phd, pChunk, ndxPage));
+}
+
+/*
+ * Frees a large object back to its arena.  Assumes the arena mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk containing the object.
+ * - pv = Pointer to the object being freed.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaDAllocLargeLocked(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv)
+{
+  SIZE_T sz = _HeapArenaMapBitsLargeSizeGet(phd, pChunk, ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS);
+
+  pArena->stats.cLargeDalloc++;
+  pArena->stats.cbAllocatedLarge -= sz;
+  pArena->stats.amls[(sz >> SYS_PAGE_BITS) - 1].nDalloc++;
+  pArena->stats.amls[(sz >> SYS_PAGE_BITS) - 1].cRuns--;
+  if (phd->uiFillFlags & PHDFLAGS_JUNKFILL)
+    StrSetMem(pv, JUNK_FREE, sz);
+  arena_run_dalloc(phd, pArena, (PARENARUN)pv, TRUE, FALSE);
+}
+
+/*
+ * Frees a large object back to its arena, locking the arena, or pushes it onto the arena's remote-free stack if
+ * the calling thread is bound to another arena.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk containing the object.
+ * - pv = Pointer to the object being freed.
+ * - ptcache = Pointer to the calling thread's cache, if the caller has it, or NULL.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaDAllocLarge(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, PTCACHE ptcache)
+{
+  if (arena_is_remote(phd, pArena, ptcache))
+  {
+    _HeapArenaRemoteFree(phd, pArena, pv, pv);
+    return;
+  }
+  IMutex_Lock(pArena->pmtxLock);
+  _HeapArenaDAllocLargeLocked(phd, pArena, pChunk, pv);
+  IMutex_Unlock(pArena->pmtxLock);
+}
+
+/*
+ * Determines whether an object in an arena was marked as allocated under a given spy generation.  A large object
+ * keeps its generation in the chunk map element of its first page; a small object has a bit in its run's spy
+ * bitmap, which is only valid if the run's generation matches.  The pointer may lie anywhere within a small
+ * object, or within the first page of a large one, since a spy may hand out pointers offset into its blocks.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pChunk = Pointer to the chunk containing the object.
+ * - pv = Pointer into the object.
+ * - uiGen = The spy generation to test against.
+ *
+ * Returns:
+ * TRUE if the object was marked under spy generation uiGen, FALSE if not.
+ */
+BOOL _HeapArenaIsSpyed(PHEAPDATA phd, PARENACHUNK pChunk, PCVOID pv, UINT32 uiGen)
+{
+  SIZE_T ndxPage = ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;  /* page index of the pointer */
+  PARENACHUNKMAP pMapElement;   /* chunk map element for the page */
+  PARENARUN pRun;               /* pointer to the run containing a small object */
+  PARENABININFO pBinInfo;       /* pointer to bin information */
+  SIZE_T ndxReg;                /* region index of a small object */
+
+  pMapElement = _HeapArenaMapPGet(phd, pChunk, ndxPage);
+  if (!(pMapElement->bits & CHUNK_MAP_ALLOCATED))
+    return FALSE;
+  if (pMapElement->bits & CHUNK_MAP_LARGE)
+    return MAKEBOOL((pMapElement->bits & ~SYS_PAGE_MASK) && (pMapElement->u.uiSpyGen == uiGen));
+
+  pRun = (PARENARUN)((UINT_PTR)pChunk
+		     + ((ndxPage - _HeapArenaMapBitsSmallRunIndexGet(phd, pChunk, ndxPage)) << SYS_PAGE_BITS));
+  if (pRun->uiSpyGen != uiGen)
+    return FALSE;  /* run's spy bitmap is stale */
+  pBinInfo = &(phd->aArenaBinInfo[_HeapArenaPtrSmallBinIndGet(phd, pv, pMapElement->bits)]);
+  ndxReg = ((UINT_PTR)pv - (UINT_PTR)pRun - pBinInfo->ofsRegion0) / pBinInfo->cbInterval;
+  if (ndxReg >= pBinInfo->nRegions)
+    return FALSE;
+  return MAKEBOOL(((PBITMAP)((UINT_PTR)pRun + pBinInfo->ofsSpyBitmap))[ndxReg >> LG_BITMAP_GROUP_NBITS]
+		  & (1U << (ndxReg & BITMAP_GROUP_NBITS_MASK)));
+}
+
+/*
+ * Marks or unmarks an object in an arena as allocated under a given spy generation.  A small run's spy bitmap is
+ * cleared the first time an object in it is marked under a new generation, so attaching or detaching a spy never
+ * requires walking the heap.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pChunk = Pointer to the chunk containing the object.
+ * - pv = Pointer to the start of the object.
+ * - uiGen = The current spy generation.
+ * - fMark = TRUE to mark the object, FALSE to unmark it.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaSpyMark(PHEAPDATA phd, PARENACHUNK pChunk, PCVOID pv, UINT32 uiGen, BOOL fMark)
+{
+  SIZE_T ndxPage = ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;  /* page index of the pointer */
+  PARENACHUNKMAP pMapElement;   /* chunk map element for the page */
+  PARENARUN pRun;               /* pointer to the run containing a small object */
+  PARENABIN pBin;               /* pointer to the arena bin */
+  PARENABININFO pBinInfo;       /* pointer to bin information */
+  PBITMAP pSpyBitmap;           /* pointer to the run's spy bitmap */
+  SIZE_T ndxReg;                /* region index of a small object */
+
+  pMapElement = _HeapArenaMapPGet(phd, pChunk, ndxPage);
+  _H_ASSERT(phd, pMapElement->bits & CHUNK_MAP_ALLOCATED);
+  if (pMapElement->bits & CHUNK_MAP_LARGE)
+  { /* the object owns its first page's map element */
+    _H_ASSERT(phd, ((UINT_PTR)pv & SYS_PAGE_MASK) == 0);
+    pMapElement->u.uiSpyGen = (fMark ? uiGen : 0);
+    return;
+  }
+
+  pRun = (PARENARUN)((UINT_PTR)pChunk
+		     + ((ndxPage - _HeapArenaMapBitsSmallRunIndexGet(phd, pChunk, ndxPage)) << SYS_PAGE_BITS));
+  pBin = pRun->pBin;
+  pBinInfo = &(phd->aArenaBinInfo[_HeapArenaPtrSmallBinIndGet(phd, pv, pMapElement->bits)]);
+  ndxReg = ((UINT_PTR)pv - (UINT_PTR)pRun - pBinInfo->ofsRegion0) / pBinInfo->cbInterval;
+  _H_ASSERT(phd, ndxReg < pBinInfo->nRegions);
+  pSpyBitmap = (PBITMAP)((UINT_PTR)pRun + pBinInfo->ofsSpyBitmap);
+
+  IMutex_Lock(pBin->pmtxLock);
+  if (fMark)
+  {
+    if (pRun->uiSpyGen != uiGen)
+    { /* the bitmap belongs to an older generation, so start it over */
+      StrSetMem(pSpyBitmap, 0, SPY_BITMAP_SIZE(pBinInfo->nRegions));
+      pRun->uiSpyGen = uiGen;
+    }
+    pSpyBitmap[ndxReg >> LG_BITMAP_GROUP_NBITS] |= (1U << (ndxReg & BITMAP_GROUP_NBITS_MASK));
+  }
+  else if (pRun->uiSpyGen == uiGen)
+    pSpyBitmap[ndxReg >> LG_BITMAP_GROUP_NBITS] &= ~(1U << (ndxReg & BITMAP_GROUP_NBITS_MASK));
+  IMutex_Unlock(pBin->pmtxLock);
+}
+
+/*
+ * Offers an object being freed in a batch to the thread cache.  The object is taken only if its thread cache bin
+ * has room for it, so that a batch never causes a flush; the rest of the batch goes to the arenas in groups.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the calling thread's cache.
+ * - pv = Pointer to the object being freed.
+ *
+ * Returns:
+ * - TRUE = The object was returned to the thread cache.
+ * - FALSE = The object was not taken, and must still be freed.
+ */
+static BOOL arena_batch_tcache(PHEAPDATA phd, PTCACHE ptcache, PVOID pv)
+{
+  PARENACHUNK pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);         /* pointer to chunk containing object */
+  SIZE_T ndxPage = ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;  /* page index of the pointer */
+  SIZE_T szMapBits = _HeapArenaMapBitsGet(phd, pChunk, ndxPage);      /* map bits for the page */
+  SIZE_T sz = 0;                                                      /* size of a large object */
+  SIZE_T ndxBin;                                                      /* thread cache bin index */
+
+  if ((szMapBits & CHUNK_MAP_LARGE) == 0)
+    ndxBin = _HeapArenaPtrSmallBinIndGet(phd, pv, szMapBits);
+  else
+  {
+    sz = _HeapArenaMapBitsLargeSizeGet(phd, pChunk, ndxPage);
+    if (sz > phd->cbTCacheMaxClass)
+      return FALSE;
+    ndxBin = NBINS + (sz >> SYS_PAGE_BITS) - 1;
+  }
+  if (ptcache->aBins[ndxBin].nCached >= phd->ptcbi[ndxBin].nCachedMax)
+    return FALSE;
+  if (sz == 0)
+    _HeapTCacheDAllocSmall(phd, ptcache, pv, ndxBin);
+  else
+    _HeapTCacheDAllocLarge(phd, ptcache, pv, sz);
+  return TRUE;
+}
+
+/*
+ * Sifts an element of a max-heap of object pointers, ordered by address, down to its place in the heap.
+ *
+ * Parameters:
+ * - ppv = Pointer to the array holding the heap.
+ * - ndx = Index of the element to sift down.
+ * - n = Number of elements in the heap.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_batch_sift(PPVOID ppv, UINT32 ndx, UINT32 n)
+{
+  PVOID pv = ppv[ndx];   /* element being sifted down */
+  UINT32 ndxChild;       /* index of the larger child of the hole */
+
+  while ((ndxChild = (ndx << 1) + 1) < n)
+  {
+    if ((ndxChild + 1 < n) && ((UINT_PTR)(ppv[ndxChild + 1]) > (UINT_PTR)(ppv[ndxChild])))
+      ndxChild++;
+    if ((UINT_PTR)(ppv[ndxChild]) <= (UINT_PTR)pv)
+      break;
+    ppv[ndx] = ppv[ndxChild];
+    ndx = ndxChild;
+  }
+  ppv[ndx] = pv;
+}
+
+/*
+ * Sorts an array of object pointers into ascending address order, using heapsort so that no extra memory is
+ * needed.  Sorted this way, the objects in each chunk, and in each run within it, lie next to each other.
+ *
+ * Parameters:
+ * - ppv = Pointer to the array of pointers to sort.
+ * - n = Number of elements in the array.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_batch_sort(PPVOID ppv, UINT32 n)
+{
+  PVOID pv;             /* temporary for swapping */
+  register UINT32 i;    /* loop counter */
+
+  for (i = n >> 1; i > 0; i--)
+    arena_batch_sift(ppv, i - 1, n);
+  for (i = n; i > 1; i--)
+  { /* move the highest remaining address to the end */
+    pv = ppv[i - 1];
+    ppv[i - 1] = ppv[0];
+    ppv[0] = pv;
+    arena_batch_sift(ppv, 0, i - 1);
+  }
+}
+
+/*
+ * Frees an array of small and large objects back to their arenas.  Objects whose thread cache bins have room go
+ * to the calling thread's cache.  The rest are sorted by address, which groups them by chunk and by run, and
+ * each group is then freed in one step:  a run of consecutive small objects sharing an arena bin under a single
+ * acquisition of that bin's mutex, consecutive large objects sharing an arena under a single acquisition of the
+ * arena mutex, and consecutive objects owned by an arena the calling thread is not bound to with a single push
+ * onto that arena's remote-free stack, as tbin_flush_remote() does for the thread cache.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - n = Number of elements in the ppv array.
+ * - ppv = Pointer to an array of pointers to the objects to free.  NULL elements are skipped.  Every non-NULL
+ *         element must lie within an arena chunk.  The array may be reordered; on return, every element is NULL.
+ * - ptcache = Pointer to the calling thread's cache, or NULL if it has none.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaDAllocBatch(PHEAPDATA phd, UINT32 n, PPVOID ppv, PTCACHE ptcache)
+{
+  register UINT32 i, j;    /* loop counters */
+  UINT32 nLeft = 0;        /* number of objects left for the arenas */
+  PVOID pv;                /* pointer to object being freed */
+  PVOID pvFirst;           /* first object in a remote-free chain */
+  PVOID pvLast = NULL;     /* last object in a remote-free chain */
+  PARENACHUNK pChunk;      /* pointer to chunk containing object */
+  PARENA pArena;           /* pointer to arena owning the current group */
+  PARENABIN pBin;          /* pointer to arena bin owning the current group, or NULL for large objects */
+  IMutex *pmtx;            /* mutex protecting the current group */
+
+  /* Let the thread cache take what it has room for, and pack the rest at the front of the array. */
+  for (i = 0; i < n; i++)
+  {
+    if (!(pv = ppv[i]))
+      continue;
+    ppv[i] = NULL;
+    if (!ptcache || !arena_batch_tcache(phd, ptcache, pv))
+      ppv[nLeft++] = pv;
+  }
+  arena_batch_sort(ppv, nLeft);
+
+  for (i = 0; i < nLeft; i = j)
+  {
+    /* The first remaining object determines the group. */
+    pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, ppv[i]);
+    pArena = pChunk->parena;
+    if (arena_is_remote(phd, pArena, ptcache))
+    { /* chain all the arena's objects through their first words and hand them over in one push */
+      pvFirst = ppv[i];
+      for (j = i; (j < nLeft) && (((PARENACHUNK)CHUNK_ADDR2BASE(phd, ppv[j]))->parena == pArena); j++)
+      {
+	if (j > i)
+	  *((PPVOID)pvLast) = ppv[j];
+	pvLast = ppv[j];
+	ppv[j] = NULL;
+      }
+      _HeapArenaRemoteFree(phd, pArena, pvFirst, pvLast);
+      continue;
+    }
+
+    pBin = arena_ptr_bin(phd, pChunk, ppv[i]);
+    pmtx = (pBin ? pBin->pmtxLock : pArena->pmtxLock);
+    IMutex_Lock(pmtx);
+    for (j = i; j < nLeft; j++)
+    {
+      pv = ppv[j];
+      pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);
+      if ((pChunk->parena != pArena) || (arena_ptr_bin(phd, pChunk, pv) != pBin))
+	break;  /* start of the next group */
+      if (pBin)
+	_HeapArenaDAllocBinLocked(phd, pArena, pChunk, pv,
+				  _HeapArenaMapPGet(phd, pChunk, ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS));
+      else
+	_HeapArenaDAllocLargeLocked(phd, pArena, pChunk, pv);
+      ppv[j] = NULL;
+    }
+    IMutex_Unlock(pmtx);
+  }
+}
+
+/*
+ * Updates an arena's large-object statistics when a large allocation changes size in place.  Assumes the arena
+ * mutex is locked.
+ *
+ * Parameters:
+ * - pArena = Pointer to the arena.
+ * - szOld = Old size of the allocation.
+ * - szNew = New size of the allocation.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_ralloc_large_stats(PARENA pArena, SIZE_T szOld, SIZE_T szNew)
+{
+  pArena->stats.cLargeDalloc++;
+  pArena->stats.cbAllocatedLarge -= szOld;
+  pArena->stats.amls[(szOld >> SYS_PAGE_BITS) - 1].nDalloc++;
+  pArena->stats.amls[(szOld >> SYS_PAGE_BITS) - 1].cRuns--;
+
+  pArena->stats.cLargeMalloc++;
+  pArena->stats.cLargeRequests++;
+  pArena->stats.cbAllocatedLarge += szNew;
+  pArena->stats.amls[(szNew >> SYS_PAGE_BITS) - 1].nMalloc++;
+  pArena->stats.amls[(szNew >> SYS_PAGE_BITS) - 1].nRequests++;
+  pArena->stats.amls[(szNew >> SYS_PAGE_BITS) - 1].cRuns++;
+}
+
+/*
+ * Shrinks a large allocation in place, making its trailing pages available for other allocations.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk containing the allocation.
+ * - pv = Pointer to the allocation.
+ * - szOld = Current size of the allocation.
+ * - sz = New size of the allocation; must be a multiple of SYS_PAGE_SIZE less than szOld.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_ralloc_large_shrink(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, SIZE_T szOld,
+				      SIZE_T sz)
+{
+  _H_ASSERT(phd, sz < szOld);
+  IMutex_Lock(pArena->pmtxLock);
+  arena_run_trim_tail(phd, pArena, pChunk, (PARENARUN)pv, szOld, sz, TRUE);
+  arena_ralloc_large_stats(pArena, szOld, sz);
+  IMutex_Unlock(pArena->pmtxLock);
+}
+
+/*
+ * Grows a large allocation in place by splitting the available run that follows it, if there is one and it's
+ * large enough.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - pChunk = Pointer to the chunk containing the allocation.
+ * - pv = Pointer to the allocation.
+ * - szOld = Current size of the allocation.
+ * - sz = Minimum new size of the allocation; must be a multiple of SYS_PAGE_SIZE.
+ * - szExtra = Number of additional bytes to include if available; must be a multiple of SYS_PAGE_SIZE.
+ * - fZero = If TRUE, the added pages will be zero-filled.
+ *
+ * Returns:
+ * - FALSE = The allocation was grown.
+ * - TRUE = The allocation could not be grown in place.
+ */
+static BOOL arena_ralloc_large_grow(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, SIZE_T szOld,
+				    SIZE_T sz, SIZE_T szExtra, BOOL fZero)
+{
+  SIZE_T ndxPage = ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS;   /* page index of the allocation */
+  SIZE_T cPages = szOld >> SYS_PAGE_BITS;                               /* pages in the allocation */
+  SIZE_T szFollow;      /* size of the following available run */
+  SIZE_T szSplit;       /* size to split off the following run */
+  SIZE_T szFlagDirty;   /* dirty flag for the grown allocation */
+
+  _H_ASSERT(phd, szOld == _HeapArenaMapBitsLargeSizeGet(phd, pChunk, ndxPage));
+  _H_ASSERT(phd, sz + szExtra > szOld);
+
+  IMutex_Lock(pArena->pmtxLock);
+  if (   (ndxPage + cPages < phd->cpgChunk)
+      && (_HeapArenaMapBitsAllocatedGet(phd, pChunk, ndxPage + cPages) == 0)
+      && ((szFollow = _HeapArenaMapBitsUnallocatedSizeGet(phd, pChunk, ndxPage + cPages)) >= sz - szOld))
+  {
+    /*
+     * The next run is available and big enough.  Split it, taking as much of the extra as will fit, and merge the
+     * first part with the existing allocation.
+     */
+    szSplit = (szOld + szFollow <= sz + szExtra) ? szFollow : sz + szExtra - szOld;
+    arena_run_split(phd, pArena, (PARENARUN)((UINT_PTR)pv + szOld), szSplit, TRUE, BININD_INVALID, fZero);
+
+    sz = szOld + szSplit;
+    cPages = sz >> SYS_PAGE_BITS;
+
+    /* The grown allocation is dirty if either portion of it was dirty before. */
+    szFlagDirty = _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage)
+                | _HeapArenaMapBitsDirtyGet(phd, pChunk, ndxPage + cPages - 1);
+    _HeapArenaMapBitsLargeSet(phd, pChunk, ndxPage, sz, szFlagDirty);
+    _HeapArenaMapBitsLargeSet(phd, pChunk, ndxPage + cPages - 1, 0, szFlagDirty);
+
+    arena_ralloc_large_stats(pArena, szOld, sz);
+    IMutex_Unlock(pArena->pmtxLock);
+    return FALSE;
+  }
+  IMutex_Unlock(pArena->pmtxLock);
+  return TRUE;
+}
+
+/*
+ * Attempts to resize a large allocation in place, either by trimming its tail or by growing it into the
+ * following available run.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the allocation.
+ * - szOld = Current size of the allocation.
+ * - sz = Minimum new size of the allocation.
+ * - szExtra = Number of additional bytes that may be included in the resized allocation if convenient.
+ * - fZero = If TRUE, any added memory will be zero-filled.
+ *
+ * Returns:
+ * - FALSE = The allocation was resized in place.
+ * - TRUE = The allocation could not be resized in place.
+ */
+static BOOL arena_ralloc_large(PHEAPDATA phd, PVOID pv, SIZE_T szOld, SIZE_T sz, SIZE_T szExtra, BOOL fZero)
+{
+  SIZE_T szPages = SYS_PAGE_CEILING(sz + szExtra);             /* page-rounded size with the extra */
+  PARENACHUNK pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);  /* pointer to chunk containing the allocation */
+
+  if (szPages == szOld)
+    return FALSE;  /* same size class */
+  if (szPages < szOld)
+  {
+    if (phd->uiFillFlags & PHDFLAGS_JUNKFILL)
+      StrSetMem((PVOID)((UINT_PTR)pv + szPages), JUNK_FREE, szOld - szPages);
+    arena_ralloc_large_shrink(phd, pChunk->parena, pChunk, pv, szOld, szPages);
+    return FALSE;
+  }
+  if (arena_ralloc_large_grow(phd, pChunk->parena, pChunk, pv, szOld, SYS_PAGE_CEILING(sz),
+			      szPages - SYS_PAGE_CEILING(sz), fZero))
+    return TRUE;
+  if (!fZero && phd->uiFillFlags)
+    _HeapFillAlloc(phd, (PVOID)((UINT_PTR)pv + szOld), _HeapArenaSAlloc(phd, pv, FALSE) - szOld);
+  return FALSE;
+}
+
+/*
+ * Attempts to resize an arena allocation without moving it.  A small allocation stays put if the new size maps
+ * to the same size class, or if its current size lies between sz and sz + szExtra.  A large allocation may be
+ * trimmed, or grown into an available run that follows it.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the allocation.
+ * - szOld = Current size of the allocation.
+ * - sz = Minimum new size of the allocation.
+ * - szExtra = Number of additional bytes that may be included in the resized allocation if convenient.
+ * - fZero = If TRUE, any added memory will be zero-filled.
+ *
+ * Returns:
+ * - NULL = The allocation could not be resized in place.
+ * - Other = The pointer pv, which has been resized.
+ */
+PVOID _HeapArenaRAllocNoMove(PHEAPDATA phd, PVOID pv, SIZE_T szOld, SIZE_T sz, SIZE_T szExtra, BOOL fZero)
+{
+  if (szOld <= phd->szArenaMaxClass)
+  {
+    if (szOld <= SMALL_MAXCLASS)
+    {
+      _H_ASSERT(phd, phd->aArenaBinInfo[SMALL_SIZE2BIN(szOld)].cbRegions == szOld);
+      if (   ((sz + szExtra <= SMALL_MAXCLASS) && (SMALL_SIZE2BIN(sz + szExtra) == SMALL_SIZE2BIN(szOld)))
+	  || ((sz <= szOld) && (sz + szExtra >= szOld)))
+	return pv;
+    }
+    else
+    {
+      _H_ASSERT(phd, sz <= phd->szArenaMaxClass);
+      if ((sz + szExtra > SMALL_MAXCLASS) && !arena_ralloc_large(phd, pv, szOld, sz, szExtra, fZero))
+	return pv;
+    }
+  }
+  return NULL;  /* reallocation would require a move */
+}
+
+/*
+ * Reallocates a block of memory to a new size that fits within an arena.  If the block cannot be resized in place,
+ * a new block is allocated, the contents copied to it, and the old block freed.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the memory block to be reallocated.
+ * - szOld = Current usable size of the memory block.
+ * - sz = Size the memory block must be reallocated to.
+ * - szExtra = Additional bytes the block may be given, if that can be done without additional cost.
+ * - szAlignment = Required alignment of the new block, or 0 for no alignment requirement.
+ * - fZero = If TRUE, any newly-allocated part of the block will be zero-filled.
+ * - fTryTCacheAlloc = If TRUE, try to allocate the new block from the thread cache.
+ * - fTryTCacheDAlloc = If TRUE, try to return the old block to the thread cache.
+ *
+ * Returns:
+ * - NULL = The reallocation failed.  The old block is left untouched.
+ * - Other = Pointer to the reallocated block.
+ */
+PVOID _HeapArenaRAlloc(PHEAPDATA phd, PVOID pv, SIZE_T szOld, SIZE_T sz, SIZE_T szExtra, SIZE_T szAlignment,
+		       BOOL fZero, BOOL fTryTCacheAlloc, BOOL fTryTCacheDAlloc)
+{
+  PVOID rc;         /* return from this function */
+  SIZE_T szUsable;  /* usable size of an aligned allocation */
+
+  /* Try to avoid moving the allocation. */
+  rc = _HeapArenaRAllocNoMove(phd, pv, szOld, sz, szExtra, fZero);
+  if (rc)
+    return rc;
+
+  /* Allocate a new block and copy the contents over. */
+  if (szAlignment != 0)
+  {
+    szUsable = _HeapSA2U(phd, sz + szExtra, szAlignment);
+    if (szUsable == 0)
+      return NULL;
+    rc = _HeapPalloc(phd, szUsable, szAlignment, fZero, fTryTCacheAlloc);
+  }
+  else
+    rc = _HeapArenaMalloc(phd, NULL, sz + szExtra, fZero, fTryTCacheAlloc);
+  if (!rc)
+  {
+    if (szExtra == 0)
+      return NULL;
+    /* try again without the extra */
+    if (szAlignment != 0)
+    {
+      szUsable = _HeapSA2U(phd, sz, szAlignment);
+      if (szUsable == 0)
+	return NULL;
+      rc = _HeapPalloc(phd, szUsable, szAlignment, fZero, fTryTCacheAlloc);
+    }
+    else
+      rc = _HeapArenaMalloc(phd, NULL, sz, fZero, fTryTCacheAlloc);
+    if (!rc)
+      return NULL;
+  }
+
+  /* Copy at most sz bytes; the caller can't count on the "extra" bytes being preserved. */
+  StrCopyMem(rc, pv, intMin(sz, szOld));
+  _HeapDAlloc(phd, pv, fTryTCacheDAlloc);
+  return rc;
+}
+
+/*
+ * Adds an arena's statistics to a set of accumulated statistics.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena whose statistics are to be merged.
+ * - pnActive = Pointer to the active page count to be added to.
+ * - pnDirty = Pointer to the dirty page count to be added to.
+ * - pArenaStats = Pointer to the arena statistics to be added to.  Its amls array is not touched.
+ * - pBinStats = Pointer to an array of NBINS bin statistics to be added to.
+ * - pLargeStats = Pointer to an array of large statistics, one per large size class, to be added to.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapArenaStatsMerge(PHEAPDATA phd, PARENA pArena, PSIZE_T pnActive, PSIZE_T pnDirty,
+			  PARENASTATS pArenaStats, PMALLOCBINSTATS pBinStats, PMALLOCLARGESTATS pLargeStats)
+{
+  register SIZE_T i;                                             /* loop counter */
+  SIZE_T nLargeClasses = phd->szArenaMaxClass >> SYS_PAGE_BITS;  /* number of large size classes */
+  PARENABIN pBin;                                                /* pointer to bin being merged */
+
+  IMutex_Lock(pArena->pmtxLock);
+  *pnActive += pArena->cpgActive;
+  *pnDirty += pArena->cpgDirty + pArena->cpgSpareDirty;
+
+  pArenaStats->cbMapped += pArena->stats.cbMapped;
+  pArenaStats->cPurges += pArena->stats.cPurges;
+  pArenaStats->cAdvise += pArena->stats.cAdvise;
+  pArenaStats->cPagesPurged += pArena->stats.cPagesPurged;
+  pArenaStats->cSpareHits += pArena->stats.cSpareHits;
+  pArenaStats->cSpareMisses += pArena->stats.cSpareMisses;
+  pArenaStats->cbAllocatedLarge += pArena->stats.cbAllocatedLarge;
+  pArenaStats->cLargeMalloc += pArena->stats.cLargeMalloc;
+  pArenaStats->cLargeDalloc += pArena->stats.cLargeDalloc;
+  pArenaStats->cLargeRequests += pArena->stats.cLargeRequests;
+
+  for (i = 0; i < nLargeClasses; i++)
+  {
+    pLargeStats[i].nMalloc += pArena->stats.amls[i].nMalloc;
+    pLargeStats[i].nDalloc += pArena->stats.amls[i].nDalloc;
+    pLargeStats[i].nRequests += pArena->stats.amls[i].nRequests;
+    pLargeStats[i].cRuns += pArena->stats.amls[i].cRuns;
+  }
+  IMutex_Unlock(pArena->pmtxLock);
+
+  for (i = 0; i < NBINS; i++)
+  {
+    pBin = &(pArena->aBins[i]);
+    IMutex_Lock(pBin->pmtxLock);
+    pBinStats[i].cbAllocated += pBin->stats.cbAllocated;
+    pBinStats[i].cMalloc += pBin->stats.cMalloc;
+    pBinStats[i].cDalloc += pBin->stats.cDalloc;
+    pBinStats[i].cRequests += pBin->stats.cRequests;
+    pBinStats[i].cFills += pBin->stats.cFills;
+    pBinStats[i].cFlushes += pBin->stats.cFlushes;
+    pBinStats[i].cRuns += pBin->stats.cRuns;
+    pBinStats[i].cReRuns += pBin->stats.cReRuns;
+    pBinStats[i].cRunsCurrent += pBin->stats.cRunsCurrent;
+    IMutex_Unlock(pBin->pmtxLock);
+  }
+}
+
+/*
+ * Compares two chunk map elements in a bin's tree of runs.  The runs are ordered by address.
+ *
+ * Parameters:
+ * - pmapA = Pointer to the first chunk map element.
+ * - pmapB = Pointer to the second chunk map element.
+ *
+ * Returns:
+ * A value less than, equal to, or greater than 0 as pmapA is less than, equal to, or greater than pmapB.
+ */
+static INT32 compare_run(TREEKEY pmapA, TREEKEY pmapB)
+{
+  return RbtStdCompareByValue(pmapA, pmapB);
+}
+
+/*
+ * Compares two chunk map elements in an arena's tree of available runs.  The runs are ordered by size, then by
+ * address.  A search key (with CHUNK_MAP_KEY set in its bits) compares lower than any run of the same size, so
+ * that a successor search finds the lowest-addressed run of the best size.
+ *
+ * Parameters:
+ * - pmapA = Pointer to the first chunk map element.
+ * - pmapB = Pointer to the second chunk map element.
+ *
+ * Returns:
+ * A value less than, equal to, or greater than 0 as pmapA is less than, equal to, or greater than pmapB.
+ */
+static INT32 compare_avail(TREEKEY pmapA, TREEKEY pmapB)
+{
+  SIZE_T szA = ((PARENACHUNKMAP)pmapA)->bits & ~SYS_PAGE_MASK;  /* size of run A */
+  SIZE_T szB = ((PARENACHUNKMAP)pmapB)->bits & ~SYS_PAGE_MASK;  /* size of run B */
+  INT32 rc = (szA > szB) - (szA < szB);                         /* return from this function */
+
+  if (rc == 0)
+  {
+    if ((((PARENACHUNKMAP)pmapA)->bits & CHUNK_MAP_KEY) == CHUNK_MAP_KEY)
+      rc = -1;   /* keys sort below everything else of the same size */
+    else
+      rc = RbtStdCompareByValue(pmapA, pmapB);
+  }
+  return rc;
+}
+
+/*
+ * Returns the key of a chunk map element in a run tree, which is the chunk map element pointer itself.
+ *
+ * Parameters:
+ * - pmap = Pointer to the chunk map element.
+ *
+ * Returns:
+ * The key value.
+ */
+static TREEKEY get_mapelm_key(PVOID pmap)
+{
+  return (TREEKEY)pmap;
+}
+
+/*
+ * Returns a pointer to the tree node within a chunk map element.
+ *
+ * Parameters:
+ * - pmap = Pointer to the chunk map element.
+ *
+ * Returns:
+ * Pointer to the tree node.
+ */
+static PRBTREENODE get_mapelm_node(PVOID pmap)
+{
+  return &(((PARENACHUNKMAP)pmap)->u.rbtn);
+}
+
+/*
+ * Returns a pointer to a chunk map element given a pointer to its tree node.
+ *
+ * Parameters:
+ * - prbtn = Pointer to the tree node.
+ *
+ * Returns:
+ * Pointer to the chunk map element.
+ */
+static PVOID get_from_mapelm_node(PRBTREENODE prbtn)
+{
+  return (PVOID)(((UINT_PTR)prbtn) - OFFSETOF(ARENACHUNKMAP, u.rbtn));
+}
+
+/*
+ * Compares two chunks in an arena's tree of dirty chunks.  Chunks with greater fragmentation of their available
+ * runs sort lower, so that they're purged first; ties are broken by address.  Fragmentation is measured as the
+ * ratio of the number of available runs to the number that would remain if all clean and dirty runs were
+ * coalesced.
+ *
+ * Parameters:
+ * - pChunkA = Pointer to the first chunk.
+ * - pChunkB = Pointer to the second chunk.
+ *
+ * Returns:
+ * A value less than, equal to, or greater than 0 as pChunkA is less than, equal to, or greater than pChunkB.
+ */
+static INT32 compare_chunk_dirty(TREEKEY pChunkA, TREEKEY pChunkB)
+{
+  PARENACHUNK pA = (PARENACHUNK)pChunkA;   /* first chunk */
+  PARENACHUNK pB = (PARENACHUNK)pChunkB;   /* second chunk */
+  SIZE_T nA, nB;                           /* cross-multiplied fragmentation values */
+
+  if (pA == pB)
+    return 0;
+  nA = (pA->cAvailRuns - pA->cAvailRunAdjacent) * pB->cAvailRuns;
+  nB = (pB->cAvailRuns - pB->cAvailRunAdjacent) * pA->cAvailRuns;
+  if (nA != nB)
+    return (nA < nB) ? 1 : -1;
+  return RbtStdCompareByValue(pChunkA, pChunkB);
+}
+
+/*
+ * Returns the key of a chunk in the dirty chunk tree, which is the chunk pointer itself.
+ *
+ * Parameters:
+ * - pChunk = Pointer to the chunk.
+ *
+ * Returns:
+ * The key value.
+ */
+static TREEKEY get_chunk_key(PVOID pChunk)
+{
+  return (TREEKEY)pChunk;
+}
+
+/*
+ * Returns a pointer to the dirty chunk tree node within a chunk.
+ *
+ * Parameters:
+ * - pChunk = Pointer to the chunk.
+ *
+ * Returns:
+ * Pointer to the tree node.
+ */
+static PRBTREENODE get_chunk_dirty_node(PVOID pChunk)
+{
+  return &(((PARENACHUNK)pChunk)->rbtnDirty);
+}
+
+/*
+ * Returns a pointer to a chunk given a pointer to its dirty chunk tree node.
+ *
+ * Parameters:
+ * - prbtn = Pointer to the tree node.
+ *
+ * Returns:
+ * Pointer to the chunk.
+ */
+static PVOID get_from_chunk_dirty_node(PRBTREENODE prbtn)
+{
+  return (PVOID)(((UINT_PTR)prbtn) - OFFSETOF(ARENACHUNK, rbtnDirty));
+}
+
+/*
+ * Releases the mutexes held by an arena.
+ *
+ * Parameters:
+ * - pArena = Pointer to the arena.
+ * - cBins = Number of bins in the arena that have mutexes to be released.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arena_release_mutexes(PARENA pArena, UINT32 cBins)
+{
+  register UINT32 i;  /* loop counter */
+
+  for (i = 0; i < cBins; i++)
+    IUnknown_Release(pArena->aBins[i].pmtxLock);
+  IUnknown_Release(pArena->pmtxLock);
+}
+
+/*
+ * Initializes a new arena.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the memory for the arena to be initialized.
+ * - ndx = Index of this arena.
+ *
+ * Returns:
+ * - FALSE = The arena was successfully initialized.
+ * - TRUE = The arena could not be initialized.
+ */
+BOOL _HeapArenaNew(PHEAPDATA phd, PARENA pArena, UINT32 ndx)
+{
+  register UINT32 i;  /* loop counter */
+  SIZE_T cbLargeStats = (phd->szArenaMaxClass >> SYS_PAGE_BITS) * sizeof(MALLOCLARGESTATS);
+  PARENABIN pBin;     /* pointer to bin being initialized */
+
+  pArena->nIndex = ndx;
+  pArena->nThreads = 0;
+  if (FAILED(IMutexFactory_CreateMutex(phd->pMutexFactory, &(pArena->pmtxLock))))
+    return TRUE;
+
+  StrSetMem(&(pArena->stats), 0, sizeof(ARENASTATS));
+  pArena->stats.amls = (PMALLOCLARGESTATS)_HeapBaseAlloc(phd, cbLargeStats);
+  if (!(pArena->stats.amls))
+  {
+    IUnknown_Release(pArena->pmtxLock);
+    return TRUE;
+  }
+  StrSetMem(pArena->stats.amls, 0, cbLargeStats);
+
+  dlistListInit(&(pArena->dlistTCache), link);
+  pArena->cbProfAccum = 0;
+  pArena->cSpareChunks = 0;
+  pArena->pvRemoteFree = NULL;
+  pArena->cpgActive = 0;
+  pArena->cpgDirty = 0;
+  pArena->cpgPurgatory = 0;
+  pArena->cpgSpareDirty = 0;
+  pArena->cSpareEvictions = 0;
+  rbtInitTree(&(pArena->rbtDirtyChunks), compare_chunk_dirty, get_chunk_key, get_chunk_dirty_node,
+	      get_from_chunk_dirty_node);
+  rbtInitTree(&(pArena->rbtAvailRuns), compare_avail, get_mapelm_key, get_mapelm_node, get_from_mapelm_node);
+
+  /* Initialize the bins. */
+  for (i = 0; i < NBINS; i++)
+  {
+    pBin = &(pArena->aBins[i]);
+    if (FAILED(IMutexFactory_CreateMutex(phd->pMutexFactory, &(pBin->pmtxLock))))
+    {
+      arena_release_mutexes(pArena, i);
+      return TRUE;
+    }
+    pBin->prunCurrent = NULL;
+    rbtInitTree(&(pBin->rbtRuns), compare_run, get_mapelm_key, get_mapelm_node, get_from_mapelm_node);
+    StrSetMem(&(pBin->stats), 0, sizeof(MALLOCBINSTATS));
+  }
+
+  return FALSE;
+}
+
+/*
+ * Allocates and initializes a new arena, and stores it in the arena array.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ndx = Index of the new arena within the arena array.
+ *
+ * Returns:
+ * - NULL = The arena could not be created.
+ * - Other = Pointer to the new arena.
+ */
+PARENA _HeapArenasExtend(PHEAPDATA phd, UINT32 ndx)
+{
+  PARENA pArena;   /* pointer to new arena */
+
+  _H_ASSERT(phd, ndx < phd->cArenas);
+  pArena = (PARENA)_HeapBaseAlloc(phd, sizeof(ARENA));
+  if (!pArena || _HeapArenaNew(phd, pArena, ndx))
+    return NULL;
+  phd->aparenas[ndx] = pArena;
+  return pArena;
+}
+
+/*
+ * Called when a thread exits, to remove it from the thread count of the arena it was bound to.  If it was the
+ * arena's last thread, nobody is left to drain the arena's remote-free stack, so it is drained here.
+ *
+ * Parameters:
+ * - pvContents = Contents of the thread-local arena pointer for the exiting thread.
+ * - pvArg = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void arenaCleanup(PVOID pvContents, PVOID pvArg)
+{
+  PHEAPDATA phd = (PHEAPDATA)pvArg;      /* pointer to HEAPDATA block */
+  PARENA pArena = (PARENA)pvContents;    /* pointer to thread's arena */
+  BOOL fLast;                            /* was this the arena's last thread? */
+
+  if (pArena)
+  {
+    IMutex_Lock(phd->pmtxArenas);
+    fLast = MAKEBOOL(--pArena->nThreads == 0);
+    IMutex_Unlock(phd->pmtxArenas);
+    if (fLast)
+      _HeapArenaRemoteDrain(phd, pArena);
+  }
+}
+
+/*
+ * Calculate the run size and other key pieces of data for an arena bin based on its region size.
+ *
+ * Parameters:
+ * - phd = Pointer to HEAPDATA block.
+ * - pBinInfo = Pointer to arena bin information being set up.
+ * - cbMinRun = Minimum size in bytes of a run; this will always be a multiple of SYS_PAGE_SIZE.
+ *
+ * Returns:
+ * The size of a run for this bin, which will be used as a starting point for the next bin calculation.
+ */
+static SIZE_T bin_info_cbRunSize_calc(PHEAPDATA phd, PARENABININFO pBinInfo, SIZE_T cbMinRun)
+{
+  SIZE_T cbPad;               /* bytes of padding required */
+  SIZE_T cbTryRunSize;        /* trial for pBinInfo->cbRunSize */
+  SIZE_T cbGoodRunSize;       /* good value for pBinInfo->cbRunSize */
+  UINT32 nTryRegions;         /* trial for pBinInfo->nRegions */
+  UINT32 nGoodRegions;        /* good value for pBinInfo->nRegions */
+  UINT32 cbTryHeader;         /* trial for header data size */
+  UINT32 cbGoodHeader;        /* good value for header data size */
+  UINT32 ofsTryBitmap;        /* trial for pBinInfo->ofsBitmap */
+  UINT32 ofsGoodBitmap;       /* good value for pBinInfo->ofsBitmap */
+  UINT32 ofsTryCtx0;          /* trial for pBinInfo->ofsCtx0 */
+  UINT32 ofsGoodCtx0;         /* good value for pBinInfo->ofsCtx0 */
+  UINT32 ofsTrySpyBitmap;     /* trial for pBinInfo->ofsSpyBitmap */
+  UINT32 ofsGoodSpyBitmap;    /* good value for pBinInfo->ofsSpyBitmap */
+  UINT32 ofsTryRedZone0;      /* trial for first red zone offset */
+  UINT32 ofsGoodRedZone0;     /* good value for first red zone offset */
+
+  _H_ASSERT(phd, cbMinRun >= SYS_PAGE_SIZE);
+  _H_ASSERT(phd, cbMinRun <= phd->szArenaMaxClass);
+
+  /*
+   * Determine red zone size based on minimum alignment and minimum red zone size; add padding
+   * to the end if needed to align regions.
    */
   if (phd->uiFlags & PHDFLAGS_REDZONE)
   {
@@ -776,6 +3610,8 @@ static SIZE_T bin_info_cbRunSize_calc(PHEAPDATA phd, PARENABININFO pBinInfo, SIZ
     cbTryHeader = LONG_CEILING(cbTryHeader);  /* pad to long integer boundary */
     ofsTryBitmap = cbTryHeader;
     cbTryHeader += _HeapBitmapSize(nTryRegions); /* add bitmap space */
+    ofsTrySpyBitmap = cbTryHeader;
+    cbTryHeader += SPY_BITMAP_SIZE(nTryRegions); /* add spy bitmap space */
     ofsTryCtx0 = 0;  /* XXX not using profiling */
     ofsTryRedZone0 = cbTryRunSize - (nTryRegions * pBinInfo->cbInterval) - cbPad;
 
@@ -789,6 +3625,7 @@ static SIZE_T bin_info_cbRunSize_calc(PHEAPDATA phd, PARENABININFO pBinInfo, SIZ
     cbGoodHeader = cbTryHeader;
     ofsGoodBitmap = ofsTryBitmap;
     ofsGoodCtx0 = ofsTryCtx0;
+    ofsGoodSpyBitmap = ofsTrySpyBitmap;
     ofsGoodRedZone0 = ofsTryRedZone0;
 
     /* Try more aggressive settings. */
@@ -803,6 +3640,8 @@ static SIZE_T bin_info_cbRunSize_calc(PHEAPDATA phd, PARENABININFO pBinInfo, SIZ
       cbTryHeader = LONG_CEILING(cbTryHeader);  /* pad to long integer boundary */
       ofsTryBitmap = cbTryHeader;
       cbTryHeader += _HeapBitmapSize(nTryRegions); /* add bitmap space */
+      ofsTrySpyBitmap = cbTryHeader;
+      cbTryHeader += SPY_BITMAP_SIZE(nTryRegions); /* add spy bitmap space */
       ofsTryCtx0 = 0;  /* XXX not using profiling */
       ofsTryRedZone0 = cbTryRunSize - (nTryRegions * pBinInfo->cbInterval) - cbPad;
 
@@ -820,6 +3659,7 @@ static SIZE_T bin_info_cbRunSize_calc(PHEAPDATA phd, PARENABININFO pBinInfo, SIZ
   pBinInfo->nRegions = nGoodRegions;
   pBinInfo->ofsBitmap = ofsGoodBitmap;
   pBinInfo->ofsCtx0 = ofsGoodCtx0;
+  pBinInfo->ofsSpyBitmap = ofsGoodSpyBitmap;
   pBinInfo->ofsRegion0 = ofsGoodRedZone0 + pBinInfo->cbRedzone;
 
   _H_ASSERT(phd, pBinInfo->ofsRegion0 - pBinInfo->cbRedzone + (pBinInfo->nRegions * pBinInfo->cbInterval)
@@ -865,6 +3705,7 @@ HRESULT _HeapArenaSetup(PHEAPDATA phd)
 {
   SIZE_T szHeader;   /* size of the header */
   UINT32 i;          /* loop counter */
+  HRESULT hr;        /* intermediate result */
 
   phd->cpgMapBias = 0;
   for (i = 0; i < 3; i++)
@@ -876,7 +3717,32 @@ HRESULT _HeapArenaSetup(PHEAPDATA phd)
   _H_ASSERT(phd, phd->cpgMapBias > 0);
   phd->szArenaMaxClass = phd->szChunk - (phd->cpgMapBias << SYS_PAGE_BITS);
   bin_info_init(phd);
+
+  /* Set up the arena array and create the first arena. */
+  hr = IMutexFactory_CreateMutex(phd->pMutexFactory, &(phd->pmtxArenas));
+  if (FAILED(hr))
+    return hr;
+  hr = IThreadLocalFactory_CreateThreadLocal(phd->pThreadLocalFactory, NULL, &(phd->pthrlArena));
+  if (FAILED(hr))
+    goto error0;
+  IThreadLocal_SetCleanupFunc(phd->pthrlArena, arenaCleanup, phd);
+  phd->aparenas = (PARENA *)_HeapBaseAlloc(phd, phd->cArenas * sizeof(PARENA));
+  if (!(phd->aparenas))
+    goto error1;
+  StrSetMem(phd->aparenas, 0, phd->cArenas * sizeof(PARENA));
+  if (!_HeapArenasExtend(phd, 0))
+    goto error1;
   return S_OK;
+
+error1:
+  hr = E_OUTOFMEMORY;
+  IUnknown_Release(phd->pthrlArena);
+  phd->pthrlArena = NULL;
+error0:
+  IUnknown_Release(phd->pmtxArenas);
+  phd->pmtxArenas = NULL;
+  phd->aparenas = NULL;
+  return hr;
 }
 
 /*
@@ -890,5 +3756,14 @@ HRESULT _HeapArenaSetup(PHEAPDATA phd)
  */
 void _HeapArenaShutdown(PHEAPDATA phd)
 {
-  /* TODO */
+  register UINT32 i;  /* loop counter */
+
+  if (!(phd->aparenas))
+    return;
+  for (i = 0; i < phd->cArenas; i++)
+    if (phd->aparenas[i])
+      arena_release_mutexes(phd->aparenas[i], NBINS);
+  IUnknown_Release(phd->pthrlArena);
+  IUnknown_Release(phd->pmtxArenas);
+  phd->aparenas = NULL;
 }
@@ -111,7 +111,23 @@ error0:
 }
 
 /*
- * Allocate a new EXTENT_NODE from the base allocator.
+ * Slab allocator function for the extent node cache, which takes its slabs from the base allocator.
+ *
+ * Parameters:
+ * - pvHeapData = Pointer to the HEAPDATA block.
+ * - cb = Number of bytes in the slab.
+ *
+ * Returns:
+ * - NULL = Allocation failed.
+ * - Other = Pointer to the new slab.
+ */
+static PVOID base_node_slab_alloc(PVOID pvHeapData, SIZE_T cb)
+{
+  return _HeapBaseAlloc((PHEAPDATA)pvHeapData, cb);
+}
+
+/*
+ * Allocate a new EXTENT_NODE from the extent node cache.
  *
  * Parameters:
  * - phd = Pointer to the HEAPDATA block.
@@ -122,23 +138,11 @@ error0:
  */
 PEXTENT_NODE _HeapBaseNodeAlloc(PHEAPDATA phd)
 {
-  PEXTENT_NODE rc = NULL;  /* return from this function */
-
-  IMutex_Lock(phd->pmtxBase);
-  if (phd->pexnBaseNodes)
-  { /* pull a node off the free list */
-    rc = phd->pexnBaseNodes;
-    phd->pexnBaseNodes = *((PPEXTENT_NODE)rc);
-  }
-
-  IMutex_Unlock(phd->pmtxBase);
-  if (!rc)  /* use base allocator to get one */
-    rc = (PEXTENT_NODE)_HeapBaseAlloc(phd, sizeof(EXTENT_NODE));
-  return rc;
+  return (PEXTENT_NODE)ObjCacheAlloc(&(phd->ocExtentNodes));
 }
 
 /*
- * Returns an EXTENT_NODE to the free list.
+ * Returns an EXTENT_NODE to the extent node cache.
  *
  * Parameters:
  * - phd = Pointer to the HEAPDATA block.
@@ -149,11 +153,7 @@ PEXTENT_NODE _HeapBaseNodeAlloc(PHEAPDATA phd)
  */
 void _HeapBaseNodeDeAlloc(PHEAPDATA phd, PEXTENT_NODE pexn)
 {
-  /* add it to the free list */
-  IMutex_Lock(phd->pmtxBase);
-  *((PPEXTENT_NODE)pexn) = phd->pexnBaseNodes;
-  phd->pexnBaseNodes = pexn;
-  IMutex_Unlock(phd->pmtxBase);
+  ObjCacheFree(&(phd->ocExtentNodes), pexn);
 }
 
 /*
@@ -170,7 +170,15 @@ HRESULT _HeapBaseSetup(PHEAPDATA phd)
   HRESULT hr = IMutexFactory_CreateMutex(phd->pMutexFactory, &(phd->pmtxBase));
   if (FAILED(hr))
     return hr;
-  phd->pexnBaseNodes = NULL;
+  hr = IMutexFactory_CreateMutex(phd->pMutexFactory, &(phd->pmtxExtentNodes));
+  if (FAILED(hr))
+  {
+    IUnknown_Release(phd->pmtxBase);
+    return hr;
+  }
+  /* Extent node slabs come from the base allocator, which takes its own lock, so the cache gets a separate one. */
+  ObjCacheInit(&(phd->ocExtentNodes), sizeof(EXTENT_NODE), SYS_PAGE_SIZE, NULL, base_node_slab_alloc, phd,
+	       phd->pmtxExtentNodes);
   return S_OK;
 }
 
@@ -201,5 +209,6 @@ void _HeapBaseShutdown(PHEAPDATA phd)
     pChunk = pNextChunk;
   }
 
+  IUnknown_Release(phd->pmtxExtentNodes);
   IUnknown_Release(phd->pmtxBase);
 }
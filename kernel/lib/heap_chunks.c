@@ -34,6 +34,7 @@
  */
 #include <comrogue/compiler_macros.h>
 #include <comrogue/types.h>
+#include <comrogue/intlib.h>
 #include <comrogue/str.h>
 #include <comrogue/objectbase.h>
 #include <comrogue/scode.h>
@@ -122,6 +123,21 @@ static PRBTREENODE get_addr_node(PEXTENT_NODE pexn)
   return &(pexn->rbtnAddress);
 }
 
+/*
+ * Given a pointer to an extent node, returns its tree key, which is the extent node pointer itself.  (The
+ * comparison functions look at the node's fields.)
+ *
+ * Parameters:
+ * - pexn = Pointer to the extent node.
+ *
+ * Returns:
+ * The key value.
+ */
+static TREEKEY get_extent_key(PEXTENT_NODE pexn)
+{
+  return (TREEKEY)pexn;
+}
+
 /*
  * Given a pointer to an extent node's "size-address" RBTREENODE, returns a pointer to the extent node.
  *
@@ -365,8 +381,9 @@ static void chunk_record(PHEAPDATA phd, PVOID pvChunk, SIZE_T sz)
     RbtInsert(&(phd->rbtExtAddr), pexn);
   }
 
-  /* Try to coalesce backwards now. */
-  pexnPrev = (PEXTENT_NODE)RbtFindPredecessor(&(phd->rbtExtAddr), (TREEKEY)pexn);
+  /* Try to coalesce backwards now.  (Search below pvChunk so we don't just find pexn itself.) */
+  exnKey.pv = (PVOID)(((UINT_PTR)pvChunk) - 1);
+  pexnPrev = (PEXTENT_NODE)RbtFindPredecessor(&(phd->rbtExtAddr), (TREEKEY)(&exnKey));
   if (pexnPrev && ((PVOID)(((UINT_PTR)(pexnPrev->pv)) + pexnPrev->sz)) == pvChunk)
   { /* Coalesce chunk with previous address range. */
     RbtDelete(&(phd->rbtExtSizeAddr), (TREEKEY)pexnPrev);
@@ -400,10 +417,67 @@ void _HeapChunkUnmap(PHEAPDATA phd, PVOID pvChunk, SIZE_T sz)
   _H_ASSERT(phd, pvChunk);
   _H_ASSERT(phd, CHUNK_ADDR2BASE(phd, pvChunk) == pvChunk);
   _H_ASSERT(phd, sz);
-  _H_ASSERT(phd, (sz && phd->uiChunkSizeMask) == 0);
+  _H_ASSERT(phd, (sz & phd->uiChunkSizeMask) == 0);
   chunk_record(phd, pvChunk, sz);
 }
 
+/*
+ * Takes space from the "free extents" list at a specific address, so that an existing allocation ending at that
+ * address can be extended in place.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Address at which the space must begin; must be chunk-aligned.
+ * - szMin = Minimum amount of space to take; must be a multiple of the chunk size.
+ * - szMax = Maximum amount of space to take; must be a multiple of the chunk size no less than szMin.
+ * - pfZeroed = Points to a flag which is set to TRUE if the space taken is zeroed, FALSE if not.
+ *
+ * Returns:
+ * - 0 = No free extent begins at pv, or the one that does is smaller than szMin.
+ * - Other = Number of bytes taken, between szMin and szMax.
+ */
+SIZE_T _HeapChunkAllocAt(PHEAPDATA phd, PVOID pv, SIZE_T szMin, SIZE_T szMax, BOOL *pfZeroed)
+{
+  SIZE_T rc;            /* return from this function */
+  PEXTENT_NODE pexn;    /* pointer to extent node we find */
+  EXTENT_NODE exnKey;   /* key for tree search */
+
+  _H_ASSERT(phd, CHUNK_ADDR2BASE(phd, pv) == pv);
+  _H_ASSERT(phd, szMin != 0);
+  _H_ASSERT(phd, (szMin & phd->uiChunkSizeMask) == 0);
+  _H_ASSERT(phd, (szMax & phd->uiChunkSizeMask) == 0);
+  _H_ASSERT(phd, szMax >= szMin);
+
+  exnKey.pv = pv;
+  IMutex_Lock(phd->pmtxChunks);
+  pexn = (PEXTENT_NODE)RbtFind(&(phd->rbtExtAddr), (TREEKEY)(&exnKey));
+  if (!pexn || (pexn->sz < szMin))
+  { /* nothing there, or not enough */
+    IMutex_Unlock(phd->pmtxChunks);
+    return 0;
+  }
+
+  rc = intMin(pexn->sz, szMax);
+  *pfZeroed = pexn->fZeroed;
+  RbtDelete(&(phd->rbtExtSizeAddr), (TREEKEY)pexn);
+  RbtDelete(&(phd->rbtExtAddr), (TREEKEY)pexn);
+  if (rc < pexn->sz)
+  { /* put back what we didn't use */
+    pexn->pv = (PVOID)(((UINT_PTR)pv) + rc);
+    pexn->sz -= rc;
+    rbtNewNode(&(pexn->rbtnSizeAddress));
+    rbtNewNode(&(pexn->rbtnAddress));
+    RbtInsert(&(phd->rbtExtSizeAddr), pexn);
+    RbtInsert(&(phd->rbtExtAddr), pexn);
+    pexn = NULL;  /* reused the node */
+  }
+  IMutex_Unlock(phd->pmtxChunks);
+
+  if (pexn)
+    _HeapBaseNodeDeAlloc(phd, pexn);  /* deallocate unused node */
+  return rc;
+}
+
 /*
  * Deallocate a chunk of memory.
  *
@@ -421,7 +495,7 @@ void _HeapChunkDeAlloc(PHEAPDATA phd, PVOID pvChunk, SIZE_T sz, BOOL fUnmap)
   _H_ASSERT(phd, pvChunk);
   _H_ASSERT(phd, CHUNK_ADDR2BASE(phd, pvChunk) == pvChunk);
   _H_ASSERT(phd, sz);
-  _H_ASSERT(phd, (sz && phd->uiChunkSizeMask) == 0);
+  _H_ASSERT(phd, (sz & phd->uiChunkSizeMask) == 0);
 
   _HeapRTreeSet(phd, phd->prtChunks, (UINT_PTR)pvChunk, NULL);
   if (fUnmap)
@@ -444,9 +518,9 @@ HRESULT _HeapChunkSetup(PHEAPDATA phd)
   hr = IMutexFactory_CreateMutex(phd->pMutexFactory, &(phd->pmtxChunks));
   if (FAILED(hr))
     return hr;
-  rbtInitTree(&(phd->rbtExtSizeAddr), (PFNTREECOMPARE)compare_sizeaddr, (PFNGETTREEKEY)get_from_sizeaddr_node,
+  rbtInitTree(&(phd->rbtExtSizeAddr), (PFNTREECOMPARE)compare_sizeaddr, (PFNGETTREEKEY)get_extent_key,
 	      (PFNGETTREENODEPTR)get_sizeaddr_node, (PFNGETFROMTREENODEPTR)get_from_sizeaddr_node);
-  rbtInitTree(&(phd->rbtExtAddr), (PFNTREECOMPARE)compare_addr, (PFNGETTREEKEY)get_from_addr_node,
+  rbtInitTree(&(phd->rbtExtAddr), (PFNTREECOMPARE)compare_addr, (PFNGETTREEKEY)get_extent_key,
 	      (PFNGETTREENODEPTR)get_addr_node, (PFNGETFROMTREENODEPTR)get_from_addr_node);
   phd->prtChunks = _HeapRTreeNew(phd, (1U << (LOG_PTRSIZE + 3)) - phd->nChunkBits);
   if (!(phd->prtChunks))
@@ -0,0 +1,419 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+/*
+ * This code is based on/inspired by jemalloc-3.3.1.  Please see LICENSE.jemalloc for further details.
+ */
+#include <comrogue/compiler_macros.h>
+#include <comrogue/types.h>
+#include <comrogue/intlib.h>
+#include <comrogue/str.h>
+#include <comrogue/objectbase.h>
+#include <comrogue/scode.h>
+#include <comrogue/stdobj.h>
+#include <comrogue/mutex.h>
+#include <comrogue/internals/mmu.h>
+#include "heap_internals.h"
+
+#ifdef _H_THIS_FILE
+#undef _H_THIS_FILE
+_DECLARE_H_THIS_FILE
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Functions driving the red-black tree that contains huge allocation extents
+ *-----------------------------------------------------------------------------
+ */
+
+/*
+ * Given a pointer to an extent node, returns its tree key, which is the base address of the extent.  Huge
+ * allocations never overlap, so the address alone identifies an extent, and lookups need no key node.
+ *
+ * Parameters:
+ * - pexn = Pointer to the extent node.
+ *
+ * Returns:
+ * The key value.
+ */
+static TREEKEY get_huge_key(PEXTENT_NODE pexn)
+{
+  return (TREEKEY)(pexn->pv);
+}
+
+/*
+ * Given a pointer to an extent node, returns a pointer to its RBTREENODE for the address tree.
+ *
+ * Parameters:
+ * - pexn = Pointer to the extent node.
+ *
+ * Returns:
+ * Pointer to the extent node's "address" RBTREENODE.
+ */
+static PRBTREENODE get_huge_node(PEXTENT_NODE pexn)
+{
+  return &(pexn->rbtnAddress);
+}
+
+/*
+ * Given a pointer to an extent node's "address" RBTREENODE, returns a pointer to the extent node.
+ *
+ * Parameters:
+ * - prbtn = Pointer to the "address" RBTREENODE.
+ *
+ * Returns:
+ * Pointer to the base extent node.
+ */
+static PEXTENT_NODE get_from_huge_node(PRBTREENODE prbtn)
+{
+  return (PEXTENT_NODE)(((UINT_PTR)prbtn) - OFFSETOF(EXTENT_NODE, rbtnAddress));
+}
+
+/*----------------------------
+ * Huge allocation functions
+ *----------------------------
+ */
+
+/*
+ * Allocates a huge block of memory, with a specified alignment, directly from the chunk allocator.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - sz = Size of the block to allocate, in bytes.  Rounded up to a multiple of the chunk size.
+ * - szAlignment = Alignment of the block; must be a non-zero multiple of the chunk size.
+ * - fZero = If TRUE, the returned block will be zero-filled.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the new memory block.
+ */
+PVOID _HeapHugePalloc(PHEAPDATA phd, SIZE_T sz, SIZE_T szAlignment, BOOL fZero)
+{
+  PVOID rc;            /* return from this function */
+  SIZE_T szChunks;     /* size rounded up to whole chunks */
+  PEXTENT_NODE pexn;   /* extent node recording the allocation */
+  BOOL fZeroed;        /* is the allocated memory zeroed? */
+
+  szChunks = CHUNK_CEILING(phd, sz);
+  if (szChunks == 0)
+    return NULL;  /* the size wrapped around */
+
+  /* Allocate the extent node before the memory, since the node allocator may itself need a chunk. */
+  pexn = _HeapBaseNodeAlloc(phd);
+  if (!pexn)
+    return NULL;
+
+  fZeroed = FALSE;
+  rc = _HeapChunkAlloc(phd, szChunks, szAlignment, FALSE, &fZeroed);
+  if (!rc)
+  {
+    _HeapBaseNodeDeAlloc(phd, pexn);
+    return NULL;
+  }
+  if (!fZero && (phd->uiFillFlags & PHDFLAGS_JUNKFILL))
+    StrSetMem(rc, JUNK_ALLOC, szChunks);
+  else if ((fZero || (phd->uiFillFlags & PHDFLAGS_ZEROFILL)) && !fZeroed)
+    StrSetMem(rc, 0, szChunks);
+
+  /* Record the allocation in the huge tree. */
+  pexn->pv = rc;
+  pexn->sz = szChunks;
+  pexn->uiSpyGen = 0;
+  rbtNewNode(&(pexn->rbtnAddress));
+  IMutex_Lock(phd->pmtxHuge);
+  RbtInsert(&(phd->rbtHuge), pexn);
+  phd->cHugeMalloc++;
+  phd->cbHugeAllocated += szChunks;
+  IMutex_Unlock(phd->pmtxHuge);
+
+  return rc;
+}
+
+/*
+ * Allocates a huge block of memory, aligned on a chunk boundary, directly from the chunk allocator.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - sz = Size of the block to allocate, in bytes.  Rounded up to a multiple of the chunk size.
+ * - fZero = If TRUE, the returned block will be zero-filled.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the new memory block.
+ */
+PVOID _HeapHugeMalloc(PHEAPDATA phd, SIZE_T sz, BOOL fZero)
+{
+  return _HeapHugePalloc(phd, sz, phd->szChunk, fZero);
+}
+
+/*
+ * Attempts to resize a huge block of memory without moving it.  The block stays put if its chunk-rounded size
+ * already lies between the chunk-rounded sizes of sz and sz + szExtra.  Otherwise, it may be shrunk by returning
+ * its trailing chunks, or grown by taking over a free extent that immediately follows it.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the memory block to be resized.
+ * - szOld = Current size of the memory block.
+ * - sz = Minimum new size of the memory block.
+ * - szExtra = Number of additional bytes that may be included in the resized block if convenient.
+ * - fZero = If TRUE, any added memory will be zero-filled.
+ *
+ * Returns:
+ * - NULL = The block could not be resized in place.
+ * - Other = The pointer pv, which has been resized.
+ */
+PVOID _HeapHugeRAllocNoMove(PHEAPDATA phd, PVOID pv, SIZE_T szOld, SIZE_T sz, SIZE_T szExtra, BOOL fZero)
+{
+  SIZE_T szMin = CHUNK_CEILING(phd, sz);             /* smallest acceptable size */
+  SIZE_T szMax = CHUNK_CEILING(phd, sz + szExtra);   /* largest acceptable size */
+  SIZE_T szDelta;       /* number of bytes added or removed */
+  BOOL fZeroed;         /* is the added memory zeroed? */
+  PEXTENT_NODE pexn;    /* extent node for the block */
+
+  if (szOld <= phd->szArenaMaxClass)
+    return NULL;  /* not a huge block */
+  _H_ASSERT(phd, CHUNK_CEILING(phd, szOld) == szOld);
+  if ((szOld >= szMin) && (szOld <= szMax))
+    return pv;    /* size class can be left the same */
+
+  if (szOld > szMax)
+  { /* return the trailing chunks */
+    szDelta = szOld - szMax;
+    IMutex_Lock(phd->pmtxHuge);
+    pexn = (PEXTENT_NODE)RbtFind(&(phd->rbtHuge), (TREEKEY)pv);
+    _H_ASSERT(phd, pexn);
+    pexn->sz = szMax;
+    phd->cbHugeAllocated -= szDelta;
+    IMutex_Unlock(phd->pmtxHuge);
+    _HeapChunkDeAlloc(phd, (PVOID)((UINT_PTR)pv + szMax), szDelta, TRUE);
+    return pv;
+  }
+
+  /* Try to take over a free extent following the block. */
+  fZeroed = FALSE;
+  szDelta = _HeapChunkAllocAt(phd, (PVOID)((UINT_PTR)pv + szOld), szMin - szOld, szMax - szOld, &fZeroed);
+  if (szDelta == 0)
+    return NULL;  /* reallocation would require a move */
+  if (!fZero && (phd->uiFillFlags & PHDFLAGS_JUNKFILL))
+    StrSetMem((PVOID)((UINT_PTR)pv + szOld), JUNK_ALLOC, szDelta);
+  else if ((fZero || (phd->uiFillFlags & PHDFLAGS_ZEROFILL)) && !fZeroed)
+    StrSetMem((PVOID)((UINT_PTR)pv + szOld), 0, szDelta);
+  IMutex_Lock(phd->pmtxHuge);
+  pexn = (PEXTENT_NODE)RbtFind(&(phd->rbtHuge), (TREEKEY)pv);
+  _H_ASSERT(phd, pexn);
+  pexn->sz += szDelta;
+  phd->cbHugeAllocated += szDelta;
+  IMutex_Unlock(phd->pmtxHuge);
+  return pv;
+}
+
+/*
+ * Reallocates a huge block of memory, moving it if it cannot be resized in place.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the memory block to be reallocated.
+ * - szOld = Current size of the memory block.
+ * - sz = Minimum new size of the memory block.
+ * - szExtra = Number of additional bytes that may be included in the reallocated block if convenient.
+ * - szAlignment = Alignment of the reallocated block, or 0 for the default alignment.
+ * - fZero = If TRUE, any newly-allocated memory will be zero-filled.
+ * - fTryTCacheDAlloc = If TRUE, try to return the old block to the thread cache if it's moved.
+ *
+ * Returns:
+ * - NULL = The reallocation failed.  The old block is left untouched.
+ * - Other = Pointer to the reallocated block.
+ */
+PVOID _HeapHugeRAlloc(PHEAPDATA phd, PVOID pv, SIZE_T szOld, SIZE_T sz, SIZE_T szExtra, SIZE_T szAlignment,
+		      BOOL fZero, BOOL fTryTCacheDAlloc)
+{
+  PVOID rc;    /* return from this function */
+
+  /* Try to avoid moving the allocation. */
+  rc = _HeapHugeRAllocNoMove(phd, pv, szOld, sz, szExtra, fZero);
+  if (rc)
+    return rc;
+
+  /* The sizes are different enough that we need a new block. */
+  if (szAlignment > phd->szChunk)
+    rc = _HeapHugePalloc(phd, sz + szExtra, szAlignment, fZero);
+  else
+    rc = _HeapHugeMalloc(phd, sz + szExtra, fZero);
+  if (!rc)
+  {
+    if (szExtra == 0)
+      return NULL;
+    /* try again without the extra */
+    if (szAlignment > phd->szChunk)
+      rc = _HeapHugePalloc(phd, sz, szAlignment, fZero);
+    else
+      rc = _HeapHugeMalloc(phd, sz, fZero);
+    if (!rc)
+      return NULL;
+  }
+
+  /* Copy at most sz bytes; the caller can't count on the "extra" bytes being preserved. */
+  StrCopyMem(rc, pv, intMin(sz, szOld));
+  _HeapDAlloc(phd, pv, fTryTCacheDAlloc);
+  return rc;
+}
+
+/*
+ * Returns the usable size of a huge block of memory.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the memory block.
+ *
+ * Returns:
+ * The size of the memory block, in bytes.
+ */
+SIZE_T _HeapHugeSAlloc(PHEAPDATA phd, PCVOID pv)
+{
+  PEXTENT_NODE pexn;   /* extent node for the block */
+  SIZE_T rc;           /* return from this function */
+
+  IMutex_Lock(phd->pmtxHuge);
+  pexn = (PEXTENT_NODE)RbtFind(&(phd->rbtHuge), (TREEKEY)pv);
+  _H_ASSERT(phd, pexn);
+  rc = pexn->sz;
+  IMutex_Unlock(phd->pmtxHuge);
+  return rc;
+}
+
+/*
+ * Determines whether a huge block was marked as allocated under a given spy generation.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the start of the memory block.
+ * - uiGen = The spy generation to test against.
+ *
+ * Returns:
+ * TRUE if the block was marked under spy generation uiGen, FALSE if not.
+ */
+BOOL _HeapHugeIsSpyed(PHEAPDATA phd, PCVOID pv, UINT32 uiGen)
+{
+  PEXTENT_NODE pexn;   /* extent node for the block */
+  BOOL rc;             /* return from this function */
+
+  IMutex_Lock(phd->pmtxHuge);
+  pexn = (PEXTENT_NODE)RbtFind(&(phd->rbtHuge), (TREEKEY)pv);
+  rc = MAKEBOOL(pexn && (pexn->uiSpyGen == uiGen));
+  IMutex_Unlock(phd->pmtxHuge);
+  return rc;
+}
+
+/*
+ * Marks or unmarks a huge block as allocated under a given spy generation.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the start of the memory block.
+ * - uiGen = The current spy generation.
+ * - fMark = TRUE to mark the block, FALSE to unmark it.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapHugeSpyMark(PHEAPDATA phd, PCVOID pv, UINT32 uiGen, BOOL fMark)
+{
+  PEXTENT_NODE pexn;   /* extent node for the block */
+
+  IMutex_Lock(phd->pmtxHuge);
+  pexn = (PEXTENT_NODE)RbtFind(&(phd->rbtHuge), (TREEKEY)pv);
+  _H_ASSERT(phd, pexn);
+  pexn->uiSpyGen = (fMark ? uiGen : 0);
+  IMutex_Unlock(phd->pmtxHuge);
+}
+
+/*
+ * Frees a huge block of memory, returning its chunks to the chunk allocator.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the memory block to be freed.
+ * - fUnmap = If TRUE, the block's chunks will be unmapped.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapHugeDAlloc(PHEAPDATA phd, PVOID pv, BOOL fUnmap)
+{
+  PEXTENT_NODE pexn;   /* extent node for the block */
+
+  IMutex_Lock(phd->pmtxHuge);
+  pexn = (PEXTENT_NODE)RbtFind(&(phd->rbtHuge), (TREEKEY)pv);
+  _H_ASSERT(phd, pexn);
+  RbtDelete(&(phd->rbtHuge), (TREEKEY)pv);
+  phd->cHugeDalloc++;
+  phd->cbHugeAllocated -= pexn->sz;
+  IMutex_Unlock(phd->pmtxHuge);
+
+  _HeapChunkDeAlloc(phd, pexn->pv, pexn->sz, fUnmap);
+  _HeapBaseNodeDeAlloc(phd, pexn);
+}
+
+/*
+ * Set up the huge allocation code in the heap.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+HRESULT _HeapHugeSetup(PHEAPDATA phd)
+{
+  HRESULT hr = IMutexFactory_CreateMutex(phd->pMutexFactory, &(phd->pmtxHuge));
+  if (FAILED(hr))
+    return hr;
+  rbtInitTree(&(phd->rbtHuge), RbtStdCompareByValue, (PFNGETTREEKEY)get_huge_key,
+	      (PFNGETTREENODEPTR)get_huge_node, (PFNGETFROMTREENODEPTR)get_from_huge_node);
+  phd->cHugeMalloc = 0;
+  phd->cHugeDalloc = 0;
+  phd->cbHugeAllocated = 0;
+  return S_OK;
+}
+
+/*
+ * Shut down the huge allocation code in the heap.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapHugeShutdown(PHEAPDATA phd)
+{
+  IUnknown_Release(phd->pmtxHuge);
+}
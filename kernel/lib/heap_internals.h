@@ -51,13 +51,14 @@
 #include <comrogue/threadlocal.h>
 #include <comrogue/objhelp.h>
 #include <comrogue/internals/dlist.h>
+#include <comrogue/internals/objcache.h>
 #include <comrogue/internals/rbtree.h>
 #include <comrogue/internals/seg.h>
 
-#define LG_TINY_MIN 3                   /* smallest size class to support */
+#include "heap_size_classes.h"   /* generated: LG_TINY_MIN, LG_QUANTUM, SIZE_CLASSES, NBINS, SMALL_MAXCLASS */
+
 #define TINY_MIN (1U << LG_TINY_MIN)
 
-#define LG_QUANTUM  3                   /* minimum allocation quantum is 2^3 = 8 bytes */
 #define QUANTUM ((SIZE_T)(1U << LG_QUANTUM))
 #define QUANTUM_MASK  (QUANTUM - 1)
 
@@ -69,43 +70,6 @@
 
 #define LONG_CEILING(a)     (((a) + LONG_MASK) & ~LONG_MASK)
 
-/* Size class data is (bin index, delta in bytes, size in bytes) */
-#define SIZE_CLASSES          \
-    SIZE_CLASS(0,  8,   8)    \
-    SIZE_CLASS(1,  8,   16)   \
-    SIZE_CLASS(2,  8,   24)   \
-    SIZE_CLASS(3,  8,   32)   \
-    SIZE_CLASS(4,  8,   40)   \
-    SIZE_CLASS(5,  8,   48)   \
-    SIZE_CLASS(6,  8,   56)   \
-    SIZE_CLASS(7,  8,   64)   \
-    SIZE_CLASS(8,  16,  80)   \
-    SIZE_CLASS(9,  16,  96)   \
-    SIZE_CLASS(10, 16,  112)  \
-    SIZE_CLASS(11, 16,  128)  \
-    SIZE_CLASS(12, 32,  160)  \
-    SIZE_CLASS(13, 32,  192)  \
-    SIZE_CLASS(14, 32,  224)  \
-    SIZE_CLASS(15, 32,  256)  \
-    SIZE_CLASS(16, 64,  320)  \
-    SIZE_CLASS(17, 64,  384)  \
-    SIZE_CLASS(18, 64,  448)  \
-    SIZE_CLASS(19, 64,  512)  \
-    SIZE_CLASS(20, 128, 640)  \
-    SIZE_CLASS(21, 128, 768)  \
-    SIZE_CLASS(22, 128, 896)  \
-    SIZE_CLASS(23, 128, 1024) \
-    SIZE_CLASS(24, 256, 1280) \
-    SIZE_CLASS(25, 256, 1536) \
-    SIZE_CLASS(26, 256, 1792) \
-    SIZE_CLASS(27, 256, 2048) \
-    SIZE_CLASS(28, 512, 2560) \
-    SIZE_CLASS(29, 512, 3072) \
-    SIZE_CLASS(30, 512, 3584) \
-
-#define NBINS          31    /* number of bins */
-#define SMALL_MAXCLASS 3584  /* max size for "small" class */
-
 /*--------------------------------------------------------------
  * Radix tree implementation for keeping track of memory chunks
  *--------------------------------------------------------------
@@ -115,12 +79,29 @@
 
 typedef struct tagMEMRTREE
 {
-  IMutex *pmtx;             /* mutex for tree */
+  IMutex *pmtx;             /* mutex for tree (writers only) */
   PPVOID ppRoot;            /* tree root */
+  UINT32 volatile uiGen;    /* generation, advanced whenever a value is removed or replaced */
+  UINT32 nKeyShift;         /* number of low-order key bits the tree ignores */
   UINT32 uiHeight;          /* tree height */
   UINT32 auiLevel2Bits[0];  /* bits at level 2 - dynamically sized */
 } MEMRTREE, *PMEMRTREE;
 
+#define RTREE_CACHE_SIZE  8  /* number of entries in a radix tree lookup cache; must be a power of 2 */
+
+/* Direct-mapped cache of radix tree lookups, kept per thread. */
+typedef struct tagRTREECACHE
+{
+  UINT32 uiGen;             /* tree generation the entries are valid for */
+  struct
+  {
+    UINT_PTR uiKey;         /* key of this entry, or RTREE_CACHE_EMPTY */
+    PVOID pv;               /* value stored in the tree under that key */
+  } aEntries[RTREE_CACHE_SIZE];
+} RTREECACHE, *PRTREECACHE;
+
+#define RTREE_CACHE_EMPTY  ((UINT_PTR)(-1))  /* key of an unused cache entry */
+
 /*-------------------
  * Extent management
  *-------------------
@@ -135,6 +116,7 @@ typedef struct tagEXTENT_NODE
   PVOID pv;                      /* base pointer to region */
   SIZE_T sz;                     /* size of region */
   BOOL fZeroed;                  /* is this extent zeroed? */
+  UINT32 uiSpyGen;               /* spy generation a huge allocation was marked under, or 0 */
 } EXTENT_NODE, *PEXTENT_NODE;
 typedef PEXTENT_NODE *PPEXTENT_NODE;
 
@@ -226,10 +208,12 @@ typedef struct tagARENA ARENA, *PARENA;  /* forward declaration */
 typedef struct tagTCACHE
 {
   DLIST_FIELD_DECLARE(struct tagTCACHE, link);  /* link aggregator */
-  UINT64 cbProfAccum;                           /* accumulated bytes */
+  UINT64 cbProfAccum;                           /* bytes allocated since last profile sample */
   PARENA parena;                                /* this thread's arena */
   UINT32 cEvents;                               /* event count since incremental GC */
   UINT32 ndxNextGCBin;                          /* next bin to be GC'd */
+  BOOL fDrainRequested;                         /* set by HeapMinimize to make the owner drain the cache */
+  RTREECACHE rtcChunks;                         /* lookup cache for the chunk radix tree */
   TCACHEBIN aBins[0];                           /* cache bins (dynamically sized) */
 } TCACHE, *PTCACHE;
 
@@ -251,6 +235,7 @@ typedef struct tagARENACHUNKMAP
   {
     RBTREENODE rbtn;                                     /* tree of runs */
     DLIST_FIELD_DECLARE(struct tagARENACHUNKMAP, link);  /* list of runs in purgatory */
+    UINT32 uiSpyGen;                                     /* spy generation of a large allocation, or 0 */
   } u;
   SIZE_T bits;                                           /* run address and various flags */
 } ARENACHUNKMAP, *PARENACHUNKMAP;
@@ -307,6 +292,8 @@ typedef struct tagARENASTATS
   UINT64 cPurges;                /* number of purge sweeps made */
   UINT64 cAdvise;                /* number of memory advise calls made */
   UINT64 cPagesPurged;           /* number of pages purged */
+  UINT64 cSpareHits;             /* number of chunk allocations satisfied from the spare-chunk cache */
+  UINT64 cSpareMisses;           /* number of chunk allocations that went to the chunk allocator */
   SIZE_T cbAllocatedLarge;       /* number of bytes of large allocations */
   UINT64 cLargeMalloc;           /* number of large allocations */
   UINT64 cLargeDalloc;           /* number of large deallocations */
@@ -316,6 +303,10 @@ typedef struct tagARENASTATS
 
 #define REDZONE_MINSIZE   16     /* red zones must be at least this many bytes */
 
+/* Size in bytes of a run's spy bitmap, a flat bitmap with one bit per region. */
+#define SPY_BITMAP_SIZE(nregs) \
+  ((((nregs) + BITMAP_GROUP_NBITS_MASK) >> LG_BITMAP_GROUP_NBITS) << LG_SIZEOF_BITMAP)
+
 /* Arena bin information */
 typedef struct tagARENABININFO
 {
@@ -327,6 +318,7 @@ typedef struct tagARENABININFO
   UINT32 ofsBitmap;              /* offset of bitmap element in run header */
   BITMAPINFO bitmapinfo;         /* manipulates bitmaps associated with this bin's runs */
   UINT32 ofsCtx0;                /* offset of context in run header, or 0 */
+  UINT32 ofsSpyBitmap;           /* offset of spy bitmap in run header */
   UINT32 ofsRegion0;             /* offset of first region in a run for size class */
 } ARENABININFO, *PARENABININFO;
 
@@ -337,6 +329,8 @@ typedef struct tagARENARUN
   PARENABIN pBin;                /* bin this run is associated with */
   UINT32 ndxNext;                /* index of next region never allocated */
   UINT32 nFree;                  /* number of free regions in run */
+  UINT32 uiSpyGen;               /* spy generation the spy bitmap is valid for */
+  BOOL fZeroed;                  /* were all of the run's pages zeroed when it was created? */
 } ARENARUN, *PARENARUN;
 
 struct tagARENABIN
@@ -347,6 +341,8 @@ struct tagARENABIN
   MALLOCBINSTATS stats;          /* bin statistics */
 };
 
+#define MAX_SPARE_CHUNKS  8     /* maximum depth of an arena's spare-chunk cache */
+
 /* The actual arena definition. */
 struct tagARENA
 {
@@ -355,16 +351,81 @@ struct tagARENA
   IMutex *pmtxLock;                         /* arena lock */
   ARENASTATS stats;                         /* arena statistics */
   DLIST_HEAD_DECLARE(TCACHE, dlistTCache);  /* list of tcaches for threads in arena */
-  UINT64 cbProfAccum;                       /* accumulated bytes */
+  UINT64 cbProfAccum;                       /* bytes allocated since last profile sample */
   RBTREE rbtDirtyChunks;                    /* tree of dirty page-containing chunks */
-  PARENACHUNK pchunkSpare;                  /* most recently freed chunk, one spare per arena */
+  UINT32 cSpareChunks;                      /* number of chunks in the spare-chunk cache */
+  PARENACHUNK apchunkSpare[MAX_SPARE_CHUNKS]; /* completely free chunks kept for reuse */
+  SIZE_T cSpareEvictions;                   /* number of chunks evicted from a full spare-chunk cache */
   SIZE_T cpgActive;                         /* number of pages in active runs */
   SIZE_T cpgDirty;                          /* number of potential dirty pages */
   SIZE_T cpgPurgatory;                      /* number of pages being purged */
+  SIZE_T cpgSpareDirty;                     /* number of dirty pages in the spare-chunk cache (statistics only) */
   RBTREE rbtAvailRuns;                      /* tree of the available runs */
+  PVOID volatile pvRemoteFree;              /* lock-free stack of objects freed by other threads */
   ARENABIN aBins[NBINS];                    /* bins for storing free regions */
 };
 
+/*---------------------------------
+ * Statistics snapshot definitions
+ *---------------------------------
+ */
+
+/* Snapshot of the statistics for one arena, or the merged totals for all arenas. */
+typedef struct tagARENASTATSSNAP
+{
+  BOOL fInitialized;                        /* has this arena been created? */
+  UINT32 nThreads;                          /* number of threads assigned to the arena */
+  SIZE_T cpgActive;                         /* number of pages in active runs */
+  SIZE_T cpgDirty;                          /* number of dirty pages */
+  ARENASTATS astats;                        /* arena statistics (amls points into the snapshot block) */
+  SIZE_T cbAllocatedSmall;                  /* small bytes allocated, summed over bins */
+  UINT64 cSmallMalloc;                      /* small allocations, summed over bins */
+  UINT64 cSmallDalloc;                      /* small deallocations, summed over bins */
+  UINT64 cSmallRequests;                    /* small requests, summed over bins */
+  MALLOCBINSTATS abstats[NBINS];            /* bin statistics */
+} ARENASTATSSNAP, *PARENASTATSSNAP;
+
+/*------------------
+ * Fill definitions
+ *------------------
+ */
+
+#define PHDFLAGS_FILL  (PHDFLAGS_JUNKFILL|PHDFLAGS_ZEROFILL)  /* all fill mode flags */
+
+#define JUNK_ALLOC     0xA5       /* fill byte for newly-allocated memory */
+#define JUNK_FREE      0x5A       /* fill byte for freed memory */
+
+/*-----------------------
+ * Profiling definitions
+ *-----------------------
+ */
+
+#define PHDFLAGS_PROFILE_ACTIVE  0x40000000           /* profile sampling is active */
+
+#define PROF_INTERVAL_DEFAULT  (512 * 1024)         /* default sampling interval in bytes */
+#define PROF_NSAMPLES          1024                 /* number of samples in the sample ring */
+#define LG_PROF_NSETS          9                    /* log2 of number of sets in the live sample table */
+#define PROF_NSETS             (1 << LG_PROF_NSETS) /* number of sets in the live sample table */
+#define PROF_SETWAYS           4                    /* number of slots in each set of the live sample table */
+
+/* One sampled allocation in the sample ring. */
+typedef struct tagPROFSAMPLE
+{
+  PVOID pv;                                 /* sampled block, or NULL if it has been freed */
+  SIZE_T sz;                                /* usable size of the block */
+  SIZE_T cbWeight;                          /* number of allocated bytes this sample stands for */
+  PVOID pvSite;                             /* call site that allocated the block */
+  UINT32 ndxArena;                          /* index of the owning arena, or HEAPPROF_ARENA_HUGE */
+  UINT32 ndxSlot;                           /* index of the live sample table slot for this sample */
+} PROFSAMPLE, *PPROFSAMPLE;
+
+/* One slot in the live sample table, which maps a live sampled block back to its sample. */
+typedef struct tagPROFSLOT
+{
+  PVOID pv;                                 /* sampled block, or NULL if the slot is empty */
+  UINT32 ndxSample;                         /* index of the sample in the sample ring */
+} PROFSLOT, *PPROFSLOT;
+
 /*----------------------------------
  * The actual heap data declaration
  *----------------------------------
@@ -374,13 +435,20 @@ typedef struct tagHEAPDATA {
   IMalloc mallocInterface;                         /* pointer to IMalloc interface - MUST BE FIRST! */
   IConnectionPointContainer cpContainerInterface;  /* pointer to IConnectionPointContainer interface */
   IHeapConfiguration heapConfInterface;            /* pointer to IHeapConfiguration interface */
+  IMallocAligned mallocAlignedInterface;           /* pointer to IMallocAligned interface */
+  IMallocBatch mallocBatchInterface;               /* pointer to IMallocBatch interface */
+  IMallocSized mallocSizedInterface;               /* pointer to IMallocSized interface */
+  IHeapStatistics heapStatsInterface;              /* pointer to IHeapStatistics interface */
+  IHeapProfile heapProfInterface;                  /* pointer to IHeapProfile interface */
   UINT32 uiRefCount;                               /* reference count */
   UINT32 uiFlags;                                  /* flags word */
+  UINT32 uiFillFlags;                              /* fill mode (PHDFLAGS_FILL bits), switchable at run time */
   PFNRAWHEAPDATAFREE pfnFreeRawHeapData;           /* pointer to function that frees the raw heap data, if any */
   PFNHEAPABORT pfnAbort;                           /* pointer to abort function */
   PVOID pvAbortArg;                                /* argument to abort function */
   IChunkAllocator *pChunkAllocator;                /* chunk allocator pointer */
   IMutexFactory *pMutexFactory;                    /* mutex factory pointer */
+  IThreadLocalFactory *pThreadLocalFactory;        /* thread-local factory pointer */
   FIXEDCPDATA fcpMallocSpy;                        /* connection point for IMallocSpy */
   FIXEDCPDATA fcpSequentialStream;                 /* connection point for ISequentialStream for debugging */
   IMallocSpy *pMallocSpy;                          /* IMallocSpy interface for the allocator */
@@ -390,17 +458,28 @@ typedef struct tagHEAPDATA {
   UINT32 uiChunkSizeMask;                          /* bitmask for a chunk */
   UINT32 cpgChunk;                                 /* number of pages in a chunk */
   SSIZE_T cbActiveDirtyRatio;                      /* active/dirty ratio parameter */
+  UINT32 cSpareChunksMax;                          /* depth of each arena's spare-chunk cache */
   IMutex *pmtxChunks;                              /* chunks mutex */
   RBTREE rbtExtSizeAddr;                           /* tree ordering extents by size and address */
   RBTREE rbtExtAddr;                               /* tree ordering extents by address */
   PMEMRTREE prtChunks;                             /* radix tree containing all chunk values */
+  IMutex *pmtxHuge;                                /* huge allocations mutex */
+  RBTREE rbtHuge;                                  /* tree ordering huge allocation extents by address */
+  UINT64 cHugeMalloc;                              /* number of huge allocations made */
+  UINT64 cHugeDalloc;                              /* number of huge deallocations made */
+  SIZE_T cbHugeAllocated;                          /* number of bytes currently allocated as huge */
   IMutex *pmtxBase;                                /* base mutex */
   PVOID pvBasePages;                               /* pages being used for internal memory allocation */
   PVOID pvBaseNext;                                /* next allocation location */
   PVOID pvBasePast;                                /* address immediately past pvBasePages */
-  PEXTENT_NODE pexnBaseNodes;                      /* pointer to base nodes */
+  IMutex *pmtxExtentNodes;                         /* extent node cache mutex */
+  OBJCACHE ocExtentNodes;                          /* cache of extent nodes */
   SIZE_T cpgMapBias;                               /* number of header pages for arena chunks */
   SIZE_T szArenaMaxClass;                          /* maximum size class for arenas */
+  UINT32 cArenas;                                  /* number of arenas */
+  PARENA *aparenas;                                /* array of arena pointers */
+  IMutex *pmtxArenas;                              /* arenas array mutex */
+  IThreadLocal *pthrlArena;                        /* thread-local arena pointer */
   SSIZE_T nTCacheMaxClassBits;                     /* bits in thread cache max class size */
   PTCACHEBININFO ptcbi;                            /* pointer to thread cache bin info */
   SIZE_T nHBins;                                   /* number of thread cache bins */
@@ -408,6 +487,19 @@ typedef struct tagHEAPDATA {
   UINT32 nStackElems;                              /* number of stack elements per tcache */
   IThreadLocal *pthrlTCache;                       /* thread-local tcache value */
   IThreadLocal *pthrlTCacheEnable;                 /* thread-local tcache enable value */
+  IMutex *pmtxStats;                               /* statistics snapshot mutex */
+  PARENASTATSSNAP pasnapArenas;                    /* arena snapshots; element cArenas holds merged totals */
+  HEAPSTATS statsSnap;                             /* heap-wide statistics snapshot */
+  SIZE_T cbProfInterval;                           /* profile sampling interval in bytes */
+  IMutex *pmtxProf;                                /* profile mutex */
+  PPROFSAMPLE aprofSamples;                        /* ring of profile samples */
+  PPROFSLOT aprofSlots;                            /* table of live samples, PROF_SETWAYS slots per set */
+  PHEAPPROFSITE aprofSites;                        /* scratch table for aggregating samples by site */
+  UINT32 ndxProfNext;                              /* next element of the sample ring to be written */
+  UINT32 cProfLive;                                /* number of live samples in the ring */
+  UINT64 cProfSamples;                             /* number of samples taken */
+  UINT64 cProfEvicted;                             /* number of live samples overwritten in the ring */
+  UINT64 cProfDropped;                             /* number of samples dropped because their set was full */
   ARENABININFO aArenaBinInfo[NBINS];               /* array of arena bin information */
 } HEAPDATA, *PHEAPDATA;
 
@@ -429,8 +521,9 @@ CDECL_BEGIN
 
 extern void _HeapDbgWrite(PHEAPDATA phd, PCSTR sz);
 extern void _HeapPrintf(PHEAPDATA phd, PCSTR szFormat, ...);
+extern void _HeapStreamPrintf(ISequentialStream *pstm, PCSTR szFormat, ...);
 extern void _HeapAssertFailed(PHEAPDATA phd, PCSTR szFile, INT32 nLine);
-extern SIZE_T _HeapPow2Ceiling(SIZE_T x);
+extern void _HeapFillAlloc(PHEAPDATA phd, PVOID pv, SIZE_T sz);
 
 CDECL_END
 
@@ -439,6 +532,16 @@ CDECL_END
 
 #define _H_ASSERT(phd, expr)  ((expr) ? (void)0 : _HeapAssertFailed(phd, _H_THIS_FILE, __LINE__))
 
+/*
+ * Consistency checks that cost a chunk lookup or more on a hot path are made with _H_DEBUG_ASSERT, which is
+ * compiled in only when HEAP_DEBUG is defined.
+ */
+#ifdef HEAP_DEBUG
+#define _H_DEBUG_ASSERT(phd, expr)  _H_ASSERT(phd, expr)
+#else
+#define _H_DEBUG_ASSERT(phd, expr)  ((void)0)
+#endif
+
 /*---------------------------------
  * Radix tree management functions
  *---------------------------------
@@ -451,6 +554,7 @@ extern void _HeapRTreeDestroy(PMEMRTREE prt);
 extern PVOID _HeapRTreeGetLocked(PHEAPDATA phd, PMEMRTREE prt, UINT_PTR uiKey);
 extern PVOID _HeapRTreeGet(PHEAPDATA phd, PMEMRTREE prt, UINT_PTR uiKey);
 extern BOOL _HeapRTreeSet(PHEAPDATA phd, PMEMRTREE prt, UINT_PTR uiKey, PVOID pv);
+extern PVOID _HeapRTreeGetCached(PHEAPDATA phd, PMEMRTREE prt, UINT_PTR uiKey, PRTREECACHE prtc);
 
 CDECL_END
 
@@ -471,6 +575,7 @@ CDECL_END
 CDECL_BEGIN
 
 extern PVOID _HeapChunkAlloc(PHEAPDATA phd, SIZE_T sz, SIZE_T szAlignment, BOOL fBase, BOOL *pfZeroed);
+extern SIZE_T _HeapChunkAllocAt(PHEAPDATA phd, PVOID pv, SIZE_T szMin, SIZE_T szMax, BOOL *pfZeroed);
 extern void _HeapChunkUnmap(PHEAPDATA phd, PVOID pvChunk, SIZE_T sz);
 extern void _HeapChunkDeAlloc(PHEAPDATA phd, PVOID pvChunk, SIZE_T sz, BOOL fUnmap);
 extern HRESULT _HeapChunkSetup(PHEAPDATA phd);
@@ -478,6 +583,28 @@ extern void _HeapChunkShutdown(PHEAPDATA phd);
 
 CDECL_END
 
+/*------------------------------------
+ * Internal huge allocation functions
+ *------------------------------------
+ */
+
+CDECL_BEGIN
+
+extern PVOID _HeapHugeMalloc(PHEAPDATA phd, SIZE_T sz, BOOL fZero);
+extern PVOID _HeapHugePalloc(PHEAPDATA phd, SIZE_T sz, SIZE_T szAlignment, BOOL fZero);
+extern PVOID _HeapHugeRAllocNoMove(PHEAPDATA phd, PVOID pv, SIZE_T szOld, SIZE_T sz, SIZE_T szExtra,
+				   BOOL fZero);
+extern PVOID _HeapHugeRAlloc(PHEAPDATA phd, PVOID pv, SIZE_T szOld, SIZE_T sz, SIZE_T szExtra, SIZE_T szAlignment,
+			     BOOL fZero, BOOL fTryTCacheDAlloc);
+extern SIZE_T _HeapHugeSAlloc(PHEAPDATA phd, PCVOID pv);
+extern void _HeapHugeDAlloc(PHEAPDATA phd, PVOID pv, BOOL fUnmap);
+extern BOOL _HeapHugeIsSpyed(PHEAPDATA phd, PCVOID pv, UINT32 uiGen);
+extern void _HeapHugeSpyMark(PHEAPDATA phd, PCVOID pv, UINT32 uiGen, BOOL fMark);
+extern HRESULT _HeapHugeSetup(PHEAPDATA phd);
+extern void _HeapHugeShutdown(PHEAPDATA phd);
+
+CDECL_END
+
 /*------------------------------------
  * Internal base management functions
  *------------------------------------
@@ -522,11 +649,12 @@ CDECL_BEGIN
 extern const BYTE abSmallSize2Bin[];
 
 extern void _HeapArenaPurgeAll(PHEAPDATA phd, PARENA pArena);
-extern void _HeapArenaTCacheFillSmall(PHEAPDATA phd, PARENA pArena, PTCACHEBIN ptbin, SIZE_T ndxBin,
-                                      UINT64 cbProfAccum);
+extern SIZE_T _HeapArenaMinimize(PHEAPDATA phd, PARENA pArena);
+extern void _HeapArenaTCacheFillSmall(PHEAPDATA phd, PARENA pArena, PTCACHEBIN ptbin, SIZE_T ndxBin);
 extern void _HeapArenaAllocJunkSmall(PHEAPDATA phd, PVOID pv, PARENABININFO pBinInfo, BOOL fZero);
 extern void _HeapArenaDAllocJunkSmall(PHEAPDATA phd, PVOID pv, PARENABININFO pBinInfo);
 extern PVOID _HeapArenaMallocSmall(PHEAPDATA phd, PARENA pArena, SIZE_T sz, BOOL fZero);
+extern UINT32 _HeapArenaMallocSmallBatch(PHEAPDATA phd, PARENA pArena, SIZE_T sz, UINT32 n, PPVOID ppv);
 extern PVOID _HeapArenaMallocLarge(PHEAPDATA phd, PARENA pArena, SIZE_T sz, BOOL fZero);
 extern PVOID _HeapArenaPalloc(PHEAPDATA phd, PARENA pArena, SIZE_T sz, SIZE_T szAlignment, BOOL fZero);
 extern void _HeapArenaProfPromoted(PHEAPDATA phd, PCVOID pv, SIZE_T sz);
@@ -534,15 +662,22 @@ extern void _HeapArenaDAllocBinLocked(PHEAPDATA phd, PARENA pArena, PARENACHUNK
 				      PARENACHUNKMAP pMapElement);
 extern void _HeapArenaDAllocBin(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv,
 				PARENACHUNKMAP pMapElement);
-extern void _HeapArenaDAllocSmall(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, SIZE_T ndxPage);
+extern void _HeapArenaDAllocSmall(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, SIZE_T ndxPage,
+				  PTCACHE ptcache);
 extern void _HeapArenaDAllocLargeLocked(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv);
-extern void _HeapArenaDAllocLarge(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv);
+extern void _HeapArenaDAllocLarge(PHEAPDATA phd, PARENA pArena, PARENACHUNK pChunk, PVOID pv, PTCACHE ptcache);
+extern void _HeapArenaDAllocBatch(PHEAPDATA phd, UINT32 n, PPVOID ppv, PTCACHE ptcache);
+extern void _HeapArenaRemoteFree(PHEAPDATA phd, PARENA pArena, PVOID pvFirst, PVOID pvLast);
+extern void _HeapArenaRemoteDrain(PHEAPDATA phd, PARENA pArena);
+extern BOOL _HeapArenaIsSpyed(PHEAPDATA phd, PARENACHUNK pChunk, PCVOID pv, UINT32 uiGen);
+extern void _HeapArenaSpyMark(PHEAPDATA phd, PARENACHUNK pChunk, PCVOID pv, UINT32 uiGen, BOOL fMark);
 extern PVOID _HeapArenaRAllocNoMove(PHEAPDATA phd, PVOID pv, SIZE_T szOld, SIZE_T sz, SIZE_T szExtra, BOOL fZero);
 extern PVOID _HeapArenaRAlloc(PHEAPDATA phd, PVOID pv, SIZE_T szOld, SIZE_T sz, SIZE_T szExtra, SIZE_T szAlignment,
 			      BOOL fZero, BOOL fTryTCacheAlloc, BOOL fTryTCacheDAlloc);
-extern void _HeapArenaStatsMerge(PHEAPDATA phd, PARENA pArena, PPCCHAR dss, PSIZE_T pnActive, PSIZE_T pnDirty,
+extern void _HeapArenaStatsMerge(PHEAPDATA phd, PARENA pArena, PSIZE_T pnActive, PSIZE_T pnDirty,
 				 PARENASTATS pArenaStats, PMALLOCBINSTATS pBinStats, PMALLOCLARGESTATS pLargeStats);
 extern BOOL _HeapArenaNew(PHEAPDATA phd, PARENA pArena, UINT32 ndx);
+extern PARENA _HeapArenasExtend(PHEAPDATA phd, UINT32 ndx);
 extern HRESULT _HeapArenaSetup(PHEAPDATA phd);
 extern void _HeapArenaShutdown(PHEAPDATA phd);
 extern PARENACHUNKMAP _HeapArenaMapPGet(PHEAPDATA phd, PARENACHUNK pChunk, SIZE_T ndxPage);
@@ -601,6 +736,8 @@ extern void _HeapTCacheEventHard(PHEAPDATA phd, PTCACHE ptcache);
 extern PVOID _HeapTCacheAllocSmallHard(PHEAPDATA phd, PTCACHE ptcache, PTCACHEBIN ptbin, SIZE_T ndxBin);
 extern void _HeapTCacheBinFlushSmall(PHEAPDATA phd, PTCACHEBIN ptbin, SIZE_T ndxBin, UINT32 nRem, PTCACHE ptcache);
 extern void _HeapTCacheBinFlushLarge(PHEAPDATA phd, PTCACHEBIN ptbin, SIZE_T ndxBin, UINT32 nRem, PTCACHE ptcache);
+extern void _HeapTCacheDrain(PHEAPDATA phd, PTCACHE ptcache);
+extern void _HeapTCacheRequestDrain(PHEAPDATA phd, PARENA pArena, PTCACHE ptcacheExcept);
 extern void _HeapTCacheArenaAssociate(PHEAPDATA phd, PTCACHE ptcache, PARENA pArena);
 extern void _HeapTCacheArenaDisassociate(PHEAPDATA phd, PTCACHE ptcache);
 extern PTCACHE _HeapTCacheCreate(PHEAPDATA phd, PARENA pArena);
@@ -611,6 +748,44 @@ extern void _HeapTCacheShutdown(PHEAPDATA phd);
 
 CDECL_END
 
+/*----------------------
+ * Statistics functions
+ *----------------------
+ */
+
+CDECL_BEGIN
+
+extern HRESULT _HeapStatsRefresh(PHEAPDATA phd);
+extern HRESULT _HeapStatsGetHeap(PHEAPDATA phd, PHEAPSTATS pStats);
+extern HRESULT _HeapStatsGetArena(PHEAPDATA phd, UINT32 ndxArena, PHEAPARENASTATS pStats);
+extern HRESULT _HeapStatsGetBin(PHEAPDATA phd, UINT32 ndxArena, UINT32 ndxBin, PHEAPBINSTATS pStats);
+extern HRESULT _HeapStatsGetLarge(PHEAPDATA phd, UINT32 ndxArena, UINT32 ndxClass, PHEAPLARGESTATS pStats);
+extern HRESULT _HeapStatsPrint(PHEAPDATA phd, ISequentialStream *pstm, UINT32 uiFlags);
+extern HRESULT _HeapStatsSetup(PHEAPDATA phd);
+extern void _HeapStatsShutdown(PHEAPDATA phd);
+
+CDECL_END
+
+/*---------------------
+ * Profiling functions
+ *---------------------
+ */
+
+CDECL_BEGIN
+
+extern void _HeapProfMalloc(PHEAPDATA phd, PVOID pv, PVOID pvSite);
+extern void _HeapProfFree(PHEAPDATA phd, PCVOID pv);
+extern HRESULT _HeapProfSetActive(PHEAPDATA phd, BOOL fActive);
+extern HRESULT _HeapProfSetInterval(PHEAPDATA phd, SIZE_T cbInterval);
+extern HRESULT _HeapProfReset(PHEAPDATA phd);
+extern HRESULT _HeapProfGetSiteTable(PHEAPDATA phd, UINT32 ndxArena, UINT32 cMax, PHEAPPROFSITE aSites,
+				     PUINT32 pcSites);
+extern HRESULT _HeapProfPrint(PHEAPDATA phd, ISequentialStream *pstm, UINT32 ndxArena);
+extern HRESULT _HeapProfSetup(PHEAPDATA phd);
+extern void _HeapProfShutdown(PHEAPDATA phd);
+
+CDECL_END
+
 /*------------------------------
  * Top-level internal functions
  *------------------------------
@@ -620,6 +795,14 @@ CDECL_BEGIN
 
 extern PARENA _HeapChooseArenaHard(PHEAPDATA phd);
 extern PARENA _HeapChooseArena(PHEAPDATA phd, PARENA parena);
+extern PVOID _HeapMalloc(PHEAPDATA phd, SIZE_T sz, BOOL fZero);
+extern SIZE_T _HeapSA2U(PHEAPDATA phd, SIZE_T sz, SIZE_T szAlignment);
+extern PVOID _HeapPalloc(PHEAPDATA phd, SIZE_T sz, SIZE_T szAlignment, BOOL fZero, BOOL fTryTCache);
+extern SIZE_T _HeapSAlloc(PHEAPDATA phd, PCVOID pv, BOOL fDemote);
+extern UINT32 _HeapMallocBatch(PHEAPDATA phd, SIZE_T sz, UINT32 n, PPVOID ppv);
+extern void _HeapDAlloc(PHEAPDATA phd, PVOID pv, BOOL fTryTCache);
+extern void _HeapDAllocSized(PHEAPDATA phd, PVOID pv, SIZE_T sz, BOOL fTryTCache);
+extern void _HeapDAllocBatch(PHEAPDATA phd, UINT32 n, PPVOID ppv);
 
 CDECL_END
 
@@ -0,0 +1,448 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+/*
+ * This code is based on/inspired by jemalloc-3.3.1.  Please see LICENSE.jemalloc for further details.
+ */
+#include <comrogue/compiler_macros.h>
+#include <comrogue/types.h>
+#include <comrogue/intlib.h>
+#include <comrogue/str.h>
+#include <comrogue/objectbase.h>
+#include <comrogue/scode.h>
+#include <comrogue/stdobj.h>
+#include <comrogue/mutex.h>
+#include <comrogue/stream.h>
+#include <comrogue/internals/mmu.h>
+#include "heap_internals.h"
+
+#ifdef _H_THIS_FILE
+#undef _H_THIS_FILE
+_DECLARE_H_THIS_FILE
+#endif
+
+/*-----------------
+ * Sample handling
+ *-----------------
+ */
+
+/*
+ * Returns the index of the set in the live sample table that holds the sample for a block, if it has one.
+ *
+ * Parameters:
+ * - pv = Pointer to the block.
+ *
+ * Returns:
+ * Index of the set in the live sample table.
+ */
+static UINT32 prof_set(PCVOID pv)
+{
+  /* blocks are at least 8-byte aligned, so drop those bits and use Fibonacci hashing on the rest */
+  return ((UINT32)(((UINT_PTR)pv) >> 3) * 0x9E3779B1U) >> (32 - LG_PROF_NSETS);
+}
+
+/*
+ * Marks a sample as no longer live, removing it from the live sample table.  Assumes the profile mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ps = Pointer to the live sample.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void prof_sample_kill(PHEAPDATA phd, PPROFSAMPLE ps)
+{
+  _H_ASSERT(phd, phd->aprofSlots[ps->ndxSlot].pv == ps->pv);
+  phd->aprofSlots[ps->ndxSlot].pv = NULL;
+  ps->pv = NULL;
+  phd->cProfLive--;
+}
+
+/*
+ * Records a sampled block in the next element of the sample ring, overwriting the oldest sample.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the sampled block.
+ * - sz = Usable size of the sampled block.
+ * - pvSite = Call site that allocated the block.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void prof_record(PHEAPDATA phd, PVOID pv, SIZE_T sz, PVOID pvSite)
+{
+  PPROFSLOT pslot = &(phd->aprofSlots[prof_set(pv) * PROF_SETWAYS]);  /* pointer to slot set */
+  PARENACHUNK pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);        /* pointer to chunk */
+  PPROFSAMPLE ps;                                                     /* pointer to sample */
+  register UINT32 i;                                                  /* loop counter */
+
+  IMutex_Lock(phd->pmtxProf);
+  ps = &(phd->aprofSamples[phd->ndxProfNext]);
+  if (ps->pv)
+  { /* the oldest sample is still live, but it drops out of the profile now */
+    prof_sample_kill(phd, ps);
+    phd->cProfEvicted++;
+  }
+  for (i = 0; (i < PROF_SETWAYS) && pslot[i].pv; i++) ;
+  if (i == PROF_SETWAYS)
+  { /* no room in the live sample table for this one */
+    phd->cProfDropped++;
+    IMutex_Unlock(phd->pmtxProf);
+    return;
+  }
+
+  ps->pv = pv;
+  ps->sz = sz;
+  ps->cbWeight = intMax(sz, phd->cbProfInterval);
+  ps->pvSite = pvSite;
+  ps->ndxArena = (((PVOID)pChunk == pv) ? HEAPPROF_ARENA_HUGE : pChunk->parena->nIndex);
+  ps->ndxSlot = (pslot + i) - phd->aprofSlots;
+  pslot[i].ndxSample = phd->ndxProfNext;
+  pslot[i].pv = pv;
+  phd->cProfLive++;
+  phd->cProfSamples++;
+  if (++(phd->ndxProfNext) == PROF_NSAMPLES)
+    phd->ndxProfNext = 0;
+  IMutex_Unlock(phd->pmtxProf);
+}
+
+/*
+ * Counts a newly-allocated block toward the sampling interval, and samples it if the interval rolls over.  Bytes
+ * are counted in the thread cache if the thread has one, so that sampling takes no locks between samples;
+ * otherwise they are counted in the thread's arena.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the newly-allocated block.
+ * - pvSite = Call site that allocated the block.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapProfMalloc(PHEAPDATA phd, PVOID pv, PVOID pvSite)
+{
+  SIZE_T sz = _HeapSAlloc(phd, pv, FALSE);  /* usable size of the block */
+  SIZE_T cbInterval = phd->cbProfInterval;  /* sampling interval */
+  PTCACHE ptcache;                          /* pointer to thread cache */
+  BOOL fSample;                             /* sample this block? */
+
+  if ((ptcache = _HeapTCacheGet(phd, FALSE)) != NULL)
+  {
+    ptcache->cbProfAccum += sz;
+    fSample = MAKEBOOL(ptcache->cbProfAccum >= cbInterval);
+    if (fSample)
+      ptcache->cbProfAccum %= cbInterval;
+  }
+  else
+    fSample = _HeapArenaProfAccum(phd, _HeapChooseArena(phd, NULL), sz);
+  if (fSample)
+    prof_record(phd, pv, sz, pvSite);
+}
+
+/*
+ * Removes the sample for a block about to be freed, if it has one.  Only the block's set in the live sample table
+ * is searched, and the profile mutex is taken only if the block is found there.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the block being freed.  Must not be NULL.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapProfFree(PHEAPDATA phd, PCVOID pv)
+{
+  PPROFSLOT pslot = &(phd->aprofSlots[prof_set(pv) * PROF_SETWAYS]);  /* pointer to slot set */
+  register UINT32 i;                                                  /* loop counter */
+
+  _H_ASSERT(phd, pv);
+  for (i = 0; i < PROF_SETWAYS; i++)
+  {
+    if (pslot[i].pv == pv)
+    { /* check again under the mutex */
+      IMutex_Lock(phd->pmtxProf);
+      if (pslot[i].pv == pv)
+	prof_sample_kill(phd, &(phd->aprofSamples[pslot[i].ndxSample]));
+      IMutex_Unlock(phd->pmtxProf);
+      return;
+    }
+  }
+}
+
+/*--------------------------
+ * Profile access functions
+ *--------------------------
+ */
+
+/*
+ * Turns sampling on or off.  Blocks sampled while it was on are still tracked until they are freed.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - fActive = TRUE to turn sampling on, FALSE to turn it off.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+HRESULT _HeapProfSetActive(PHEAPDATA phd, BOOL fActive)
+{
+  IMutex_Lock(phd->pmtxProf);
+  if (fActive)
+    phd->uiFlags |= PHDFLAGS_PROFILE_ACTIVE;
+  else
+    phd->uiFlags &= ~PHDFLAGS_PROFILE_ACTIVE;
+  IMutex_Unlock(phd->pmtxProf);
+  return S_OK;
+}
+
+/*
+ * Sets the sampling interval.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - cbInterval = Number of bytes allocated between samples.  Must be non-zero.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+HRESULT _HeapProfSetInterval(PHEAPDATA phd, SIZE_T cbInterval)
+{
+  if (cbInterval == 0)
+    return E_INVALIDARG;
+  phd->cbProfInterval = cbInterval;
+  return S_OK;
+}
+
+/*
+ * Discards all samples and resets the profile counters.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+HRESULT _HeapProfReset(PHEAPDATA phd)
+{
+  IMutex_Lock(phd->pmtxProf);
+  StrSetMem(phd->aprofSlots, 0, PROF_NSETS * PROF_SETWAYS * sizeof(PROFSLOT));
+  StrSetMem(phd->aprofSamples, 0, PROF_NSAMPLES * sizeof(PROFSAMPLE));
+  phd->ndxProfNext = 0;
+  phd->cProfLive = 0;
+  phd->cProfSamples = phd->cProfEvicted = phd->cProfDropped = 0;
+  IMutex_Unlock(phd->pmtxProf);
+  return S_OK;
+}
+
+/*
+ * Aggregates the live samples by call site into the scratch site table, which is sorted into descending order
+ * of estimated live bytes.  Assumes the profile mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ndxArena = Index of the arena whose samples are aggregated, HEAPPROF_ARENA_HUGE for huge allocations, or
+ *              HEAPSTATS_ALL_ARENAS for all samples.
+ *
+ * Returns:
+ * The number of sites in the scratch site table.
+ */
+static UINT32 prof_aggregate(PHEAPDATA phd, UINT32 ndxArena)
+{
+  PPROFSAMPLE ps;          /* pointer to sample */
+  PHEAPPROFSITE psite;     /* pointer to site */
+  HEAPPROFSITE siteTemp;   /* temporary for sorting */
+  UINT32 cSites = 0;       /* number of sites */
+  register UINT32 i, j;    /* loop counters */
+
+  for (i = 0; i < PROF_NSAMPLES; i++)
+  {
+    ps = &(phd->aprofSamples[i]);
+    if (!(ps->pv) || ((ndxArena != HEAPSTATS_ALL_ARENAS) && (ps->ndxArena != ndxArena)))
+      continue;
+    for (j = 0; (j < cSites) && (phd->aprofSites[j].pvSite != ps->pvSite); j++) ;
+    psite = &(phd->aprofSites[j]);
+    if (j == cSites)
+    { /* first sample from this site */
+      StrSetMem(psite, 0, sizeof(HEAPPROFSITE));
+      psite->pvSite = ps->pvSite;
+      cSites++;
+    }
+    psite->cLive++;
+    psite->cbLiveSampled += ps->sz;
+    psite->cbLiveEstimated += ps->cbWeight;
+  }
+
+  for (i = 1; i < cSites; i++)
+  { /* insertion sort, heaviest sites first */
+    StrCopyMem(&siteTemp, &(phd->aprofSites[i]), sizeof(HEAPPROFSITE));
+    for (j = i; (j > 0) && (phd->aprofSites[j - 1].cbLiveEstimated < siteTemp.cbLiveEstimated); j--)
+      StrCopyMem(&(phd->aprofSites[j]), &(phd->aprofSites[j - 1]), sizeof(HEAPPROFSITE));
+    StrCopyMem(&(phd->aprofSites[j]), &siteTemp, sizeof(HEAPPROFSITE));
+  }
+  return cSites;
+}
+
+/*
+ * Retrieves the live samples aggregated by call site, heaviest sites first.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ndxArena = Index of the arena whose samples are reported, HEAPPROF_ARENA_HUGE for huge allocations, or
+ *              HEAPSTATS_ALL_ARENAS for all samples.
+ * - cMax = Number of elements in the aSites array.
+ * - aSites = Pointer to the array to receive the sites.
+ * - pcSites = Pointer to a variable to receive the number of sites stored in aSites.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator; S_FALSE if there were more sites than would fit in aSites.
+ */
+HRESULT _HeapProfGetSiteTable(PHEAPDATA phd, UINT32 ndxArena, UINT32 cMax, PHEAPPROFSITE aSites, PUINT32 pcSites)
+{
+  UINT32 cSites;   /* number of sites */
+
+  if ((ndxArena >= phd->cArenas) && (ndxArena != HEAPPROF_ARENA_HUGE) && (ndxArena != HEAPSTATS_ALL_ARENAS))
+    return E_INVALIDARG;
+  IMutex_Lock(phd->pmtxProf);
+  cSites = prof_aggregate(phd, ndxArena);
+  *pcSites = intMin(cSites, cMax);
+  StrCopyMem(aSites, phd->aprofSites, *pcSites * sizeof(HEAPPROFSITE));
+  IMutex_Unlock(phd->pmtxProf);
+  return (cSites > cMax) ? S_FALSE : S_OK;
+}
+
+/*
+ * Prints the live samples aggregated by call site as text, heaviest sites first.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pstm = Pointer to the stream to print to.  If this is NULL, the debugging output stream connected to the
+ *          heap's ISequentialStream connection point is used.
+ * - ndxArena = Index of the arena whose samples are printed, HEAPPROF_ARENA_HUGE for huge allocations, or
+ *              HEAPSTATS_ALL_ARENAS for all samples.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+HRESULT _HeapProfPrint(PHEAPDATA phd, ISequentialStream *pstm, UINT32 ndxArena)
+{
+  PHEAPPROFSITE psite;   /* pointer to site */
+  UINT32 cSites;         /* number of sites */
+  register UINT32 i;     /* loop counter */
+
+  if (!pstm)
+    pstm = phd->pDebugStream;
+  if (!pstm)
+    return E_POINTER;
+  if ((ndxArena >= phd->cArenas) && (ndxArena != HEAPPROF_ARENA_HUGE) && (ndxArena != HEAPSTATS_ALL_ARENAS))
+    return E_INVALIDARG;
+
+  IMutex_Lock(phd->pmtxProf);
+  cSites = prof_aggregate(phd, ndxArena);
+  _HeapStreamPrintf(pstm, "___ Begin heap profile ___\n");
+  _HeapStreamPrintf(pstm, "Sampling: %s, interval: %u\n",
+		    ((phd->uiFlags & PHDFLAGS_PROFILE_ACTIVE) ? "active" : "inactive"), phd->cbProfInterval);
+  _HeapStreamPrintf(pstm, "Samples: %lu taken, %u live, %lu evicted, %lu dropped\n", phd->cProfSamples,
+		    phd->cProfLive, phd->cProfEvicted, phd->cProfDropped);
+  if (ndxArena == HEAPSTATS_ALL_ARENAS)
+    _HeapStreamPrintf(pstm, "Live samples for all arenas:\n");
+  else if (ndxArena == HEAPPROF_ARENA_HUGE)
+    _HeapStreamPrintf(pstm, "Live samples for huge allocations:\n");
+  else
+    _HeapStreamPrintf(pstm, "Live samples for arenas[%u]:\n", ndxArena);
+  _HeapStreamPrintf(pstm, "      site  live      sampled     estimated\n");
+  for (i = 0; i < cSites; i++)
+  {
+    psite = &(phd->aprofSites[i]);
+    _HeapStreamPrintf(pstm, "%10p %5u %12u %13lu\n", psite->pvSite, psite->cLive, psite->cbLiveSampled,
+		      psite->cbLiveEstimated);
+  }
+  _HeapStreamPrintf(pstm, "--- End heap profile ---\n");
+  IMutex_Unlock(phd->pmtxProf);
+  return S_OK;
+}
+
+/*----------------------------
+ * Profile setup and shutdown
+ *----------------------------
+ */
+
+/*
+ * Sets up the profile data for the heap.  If the heap was created with PHDFLAGS_PROFILE, the sample ring and
+ * tables are allocated and sampling is turned on.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+HRESULT _HeapProfSetup(PHEAPDATA phd)
+{
+  HRESULT hr;   /* intermediate result */
+
+  phd->cbProfInterval = PROF_INTERVAL_DEFAULT;
+  if (!(phd->uiFlags & PHDFLAGS_PROFILE))
+    return S_OK;  /* profiling not enabled */
+
+  phd->aprofSamples = (PPROFSAMPLE)_HeapBaseAlloc(phd, PROF_NSAMPLES * sizeof(PROFSAMPLE));
+  phd->aprofSlots = (PPROFSLOT)_HeapBaseAlloc(phd, PROF_NSETS * PROF_SETWAYS * sizeof(PROFSLOT));
+  phd->aprofSites = (PHEAPPROFSITE)_HeapBaseAlloc(phd, PROF_NSAMPLES * sizeof(HEAPPROFSITE));
+  if (!(phd->aprofSamples) || !(phd->aprofSlots) || !(phd->aprofSites))
+    return E_OUTOFMEMORY;
+  StrSetMem(phd->aprofSamples, 0, PROF_NSAMPLES * sizeof(PROFSAMPLE));
+  StrSetMem(phd->aprofSlots, 0, PROF_NSETS * PROF_SETWAYS * sizeof(PROFSLOT));
+  hr = IMutexFactory_CreateMutex(phd->pMutexFactory, &(phd->pmtxProf));
+  if (SUCCEEDED(hr))
+    phd->uiFlags |= PHDFLAGS_PROFILE_ACTIVE;
+  return hr;
+}
+
+/*
+ * Shuts down the profile data for the heap.  The sample ring and tables belong to the base allocator.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapProfShutdown(PHEAPDATA phd)
+{
+  phd->uiFlags &= ~PHDFLAGS_PROFILE_ACTIVE;
+  if (phd->pmtxProf)
+    IUnknown_Release(phd->pmtxProf);
+  phd->pmtxProf = NULL;
+  phd->aprofSamples = NULL;
+  phd->aprofSlots = NULL;
+  phd->aprofSites = NULL;
+}
@@ -34,6 +34,7 @@
  */
 #include <comrogue/compiler_macros.h>
 #include <comrogue/types.h>
+#include <comrogue/atomic.h>
 #include <comrogue/str.h>
 #include <comrogue/intlib.h>
 #include <comrogue/objectbase.h>
@@ -72,7 +73,7 @@ PMEMRTREE _HeapRTreeNew(PHEAPDATA phd, UINT32 cBits)
   register UINT32 i;      /* loop counter */
 
   /* Compute the number of bits per level and the height of the tree. */
-  cBitsPerLevel = IntFirstSet(_HeapPow2Ceiling(RTREE_NODESIZE / sizeof(PVOID))) - 1;
+  cBitsPerLevel = IntLastSet(IntPow2Ceiling(RTREE_NODESIZE / sizeof(PVOID))) - 1;
   uiHeight = cBits / cBitsPerLevel;
   if ((uiHeight * cBitsPerLevel) != cBits)
     uiHeight++;
@@ -88,6 +89,8 @@ PMEMRTREE _HeapRTreeNew(PHEAPDATA phd, UINT32 cBits)
   /* Allocate the mutex and fill the tree data. */
   if (FAILED(IMutexFactory_CreateMutex(phd->pMutexFactory, &(rc->pmtx))))
     return NULL;  /* just leak the allocation */
+  rc->uiGen = 1;  /* so a zero-filled cache never looks current */
+  rc->nKeyShift = (1U << (LOG_PTRSIZE + 3)) - cBits;
   rc->uiHeight = uiHeight;
   if ((uiHeight * cBitsPerLevel) > cBits)
     rc->auiLevel2Bits[0] = cBits % cBitsPerLevel;
@@ -124,7 +127,9 @@ void _HeapRTreeDestroy(PMEMRTREE prt)
 }
 
 /*
- * Retrieve a value from the radix tree.  (Can either do it with the tree locked or not.)
+ * Retrieve a value from the radix tree.  (Can either do it with the tree locked or not.)  The unlocked version is
+ * safe against concurrent writers, because _HeapRTreeSet publishes each interior node only after it is fully
+ * initialized, and nodes are never freed.
  *
  * Parameters:
  * - phd = Pointer to HEAPDATA block.
@@ -168,27 +173,71 @@ PVOID name (PHEAPDATA phd, PMEMRTREE prt, UINT_PTR uiKey)
   uiSubkey = (uiKey << nLeftShift) >> ((1U << (LOG_PTRSIZE + 3)) - cBits);      \
   rc = ppNode[uiSubkey];                                                        \
   DO_UNLOCK(prt->pmtx);	                                                        \
-  DO_GET_VALIDATE                                                               \
   return rc;                                                                    \
 }
 
 /* Generate locked version of function */
 #define DO_LOCK(mtx)    IMutex_Lock(mtx)
 #define DO_UNLOCK(mtx)  IMutex_Unlock(mtx)
-#define DO_GET_VALIDATE
 GENERATE_GET_FUNC(_HeapRTreeGetLocked)
 #undef DO_LOCK
 #undef DO_UNLOCK
-#undef DO_GET_VALIDATE
 
 /* Generate unlocked version of function */
 #define DO_LOCK(mtx)
 #define DO_UNLOCK(mtx)
-#define DO_GET_VALIDATE   _H_ASSERT(phd, _HeapRTreeGetLocked(phd, prt, uiKey) == rc);
 GENERATE_GET_FUNC(_HeapRTreeGet)
 #undef DO_LOCK
 #undef DO_UNLOCK
-#undef DO_GET_VALIDATE
+
+/*
+ * Retrieve a value from the radix tree, consulting a small direct-mapped cache first.  Only successful lookups
+ * are cached.  The whole cache is discarded when the tree's generation changes, i.e. when any value has been
+ * removed or replaced since the cache was filled.  A value found by the unlocked walk is cached only if the
+ * generation did not change during the walk, since the walk may have seen a value that was being replaced.
+ *
+ * Parameters:
+ * - phd = Pointer to HEAPDATA block.
+ * - prt = Pointer to the radix tree structure to search.
+ * - uiKey = Key value to look for in the tree.  The bits the tree ignores must be 0.
+ * - prtc = Pointer to the lookup cache, which must belong to the calling thread.
+ *
+ * Returns:
+ * - NULL = Key value not found.
+ * - Other = Pointer value stashed in the tree under that key value.
+ */
+PVOID _HeapRTreeGetCached(PHEAPDATA phd, PMEMRTREE prt, UINT_PTR uiKey, PRTREECACHE prtc)
+{
+  PVOID rc;           /* return from this function */
+  UINT32 ndx;         /* index of cache entry */
+  UINT32 uiGen;       /* tree generation before the walk */
+  register UINT32 i;  /* loop counter */
+
+  _H_ASSERT(phd, (uiKey & ((1U << prt->nKeyShift) - 1)) == 0);
+  ndx = (UINT32)(uiKey >> prt->nKeyShift) & (RTREE_CACHE_SIZE - 1);
+  uiGen = prt->uiGen;
+  if (prtc->uiGen == uiGen)
+  {
+    if (prtc->aEntries[ndx].uiKey == uiKey)
+      return prtc->aEntries[ndx].pv;
+  }
+  else
+  { /* stale, throw out all entries */
+    for (i = 0; i < RTREE_CACHE_SIZE; i++)
+      prtc->aEntries[i].uiKey = RTREE_CACHE_EMPTY;
+    prtc->uiGen = uiGen;
+  }
+
+  AtomicMemoryBarrier();  /* the walk must not read the tree before the generation */
+  rc = _HeapRTreeGet(phd, prt, uiKey);
+  AtomicMemoryBarrier();  /* ...nor after the generation is checked again */
+  if (rc && (prt->uiGen == uiGen))
+  {
+    prtc->aEntries[ndx].uiKey = uiKey;
+    prtc->aEntries[ndx].pv = rc;
+  }
+  return rc;
+}
 
 /*
  * Sets a pointer value into the radix tree under a specified key.
@@ -213,6 +262,7 @@ BOOL _HeapRTreeSet(PHEAPDATA phd, PMEMRTREE prt, UINT_PTR uiKey, PVOID pv)
   PPVOID ppNode;      /* pointer to current node */
   PPVOID ppChild;     /* pointer to child node */
   SIZE_T cb;          /* number of bytes to allocate */
+  BOOL fReplace;      /* are we removing or replacing a value? */
 
   IMutex_Lock(prt->pmtx);
   /* Walk the tree to find the right leaf node (creating where applicable) */
@@ -233,6 +283,7 @@ BOOL _HeapRTreeSet(PHEAPDATA phd, PMEMRTREE prt, UINT_PTR uiKey, PVOID pv)
 	return TRUE;
       }
       StrSetMem(ppChild, 0, cb);
+      AtomicMemoryBarrier();  /* lock-free readers must never see the node before its contents */
       ppNode[uiSubkey] = (PVOID)ppChild;
     }
   }
@@ -240,7 +291,14 @@ BOOL _HeapRTreeSet(PHEAPDATA phd, PMEMRTREE prt, UINT_PTR uiKey, PVOID pv)
   /* this is a leaf node, it contains values, not pointers */
   cBits = prt->auiLevel2Bits[i];
   uiSubkey = (uiKey << nLeftShift) >> ((1U << (LOG_PTRSIZE + 3)) - cBits);
+  fReplace = MAKEBOOL(ppNode[uiSubkey] != NULL);
   ppNode[uiSubkey] = pv;
+  if (fReplace)
+  { /* invalidate lookup caches that may hold the old value */
+    AtomicMemoryBarrier();
+    if (++(prt->uiGen) == 0)
+      prt->uiGen = 1;
+  }
   IMutex_Unlock(prt->pmtx);
   return FALSE;
 }
@@ -0,0 +1,117 @@
+#
+# This file is part of the COMROGUE Operating System for Raspberry Pi
+#
+# Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+# All rights reserved.
+#
+# This program is free for commercial and non-commercial use as long as the following conditions are
+# adhered to.
+#
+# Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+# in the code are not to be removed.
+#
+# Redistribution and use in source and binary forms, with or without modification, are permitted
+# provided that the following conditions are met:
+# 
+# * Redistributions of source code must retain the above copyright notice, this list of conditions and
+#   the following disclaimer.
+# * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+#   the following disclaimer in the documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+# WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+# PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+# ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+# TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+# NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+#
+# "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+#
+# Generates heap_size_classes.h, the table of small-object size classes used by the heap, from three parameters:
+# the allocation quantum, the number of size classes per doubling of size, and the page size.  The classes
+# follow the jemalloc scheme: tiny power-of-two classes below the quantum, then classes spaced by the greater of
+# the quantum and (size / classes per doubling), up to but not including the page size.
+#
+# Usage: perl heap_size_classes.pl [--lg-quantum=N] [--classes-per-doubling=N] [--lg-page=N] [--lg-tiny-min=N]
+#
+use strict;
+use warnings;
+use Getopt::Long;
+
+my $lg_quantum = 3;          # log2 of the allocation quantum
+my $classes_per_double = 4;  # size classes per doubling of size; must be a power of 2
+my $lg_page = 12;            # log2 of the page size
+my $lg_tiny_min = 3;         # log2 of the smallest size class
+
+GetOptions('lg-quantum=i' => \$lg_quantum,
+	   'classes-per-doubling=i' => \$classes_per_double,
+	   'lg-page=i' => \$lg_page,
+	   'lg-tiny-min=i' => \$lg_tiny_min) or die "usage: $0 [--lg-quantum=N] [--classes-per-doubling=N] [--lg-page=N] [--lg-tiny-min=N]\n";
+
+die "$0: classes per doubling must be a power of 2\n"
+  if ($classes_per_double < 1) || ($classes_per_double & ($classes_per_double - 1));
+die "$0: tiny minimum must not exceed the quantum\n" if $lg_tiny_min > $lg_quantum;
+die "$0: quantum must be smaller than the page size\n" if $lg_quantum >= $lg_page;
+
+my $quantum = 1 << $lg_quantum;
+my $page = 1 << $lg_page;
+my @classes = ();   # each element is [bin, delta, size]
+my $prev = 0;       # previous class size
+my $sz = 1 << $lg_tiny_min;
+my $spacing;
+
+# Tiny size classes, doubling up to the quantum.
+while ($sz < $quantum)
+{
+  push @classes, [scalar(@classes), $sz - $prev, $sz];
+  $prev = $sz;
+  $sz *= 2;
+}
+
+# Quantum-spaced size classes, up to the page size.
+CLASS: while ($sz < $page)
+{
+  $spacing = $sz / $classes_per_double;
+  $spacing = $quantum if $spacing < $quantum;
+  for (my $next = $sz * 2; $sz < $next; $sz += $spacing)
+  {
+    push @classes, [scalar(@classes), $sz - $prev, $sz];
+    $prev = $sz;
+    last CLASS if $sz + $spacing >= $page;
+  }
+}
+
+die "$0: too many size classes (" . scalar(@classes) . ")\n" if scalar(@classes) > 255;
+
+print <<"END";
+/*
+ * Generated by heap_size_classes.pl (--lg-quantum=$lg_quantum --classes-per-doubling=$classes_per_double
+ * --lg-page=$lg_page --lg-tiny-min=$lg_tiny_min).  DO NOT EDIT.
+ */
+#ifndef __HEAP_SIZE_CLASSES_H_INCLUDED
+#define __HEAP_SIZE_CLASSES_H_INCLUDED
+
+#define LG_TINY_MIN          $lg_tiny_min    /* smallest size class to support */
+#define LG_QUANTUM           $lg_quantum    /* minimum allocation quantum */
+#define SIZE_CLASSES_LG_PAGE $lg_page   /* page size the classes were generated for */
+
+/* Size class data is (bin index, delta in bytes, size in bytes) */
+#define SIZE_CLASSES \\
+END
+printf "    SIZE_CLASS(%d, %d, %d) \\\n", @$_ foreach @classes;
+printf "\n#define NBINS          %d    /* number of bins */\n", scalar(@classes);
+printf "#define SMALL_MAXCLASS %d  /* max size for \"small\" class */\n\n", $prev;
+
+# Lookup table contents: bin index for each (size - 1) >> LG_TINY_MIN.
+my @table = ();
+push @table, ($_->[0]) x ($_->[1] >> $lg_tiny_min) foreach @classes;
+print "/* Initializer for the table mapping (size - 1) >> LG_TINY_MIN to a bin index */\n";
+print "#define SMALL_SIZE2BIN_TABLE \\\n";
+for (my $i = 0; $i < scalar(@table); $i += 16)
+{
+  my $end = ($i + 16 < scalar(@table)) ? $i + 15 : $#table;
+  print "    " . join(", ", @table[$i .. $end]) . ", \\\n";
+}
+print "\n#endif /* __HEAP_SIZE_CLASSES_H_INCLUDED */\n";
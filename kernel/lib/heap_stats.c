@@ -0,0 +1,669 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+/*
+ * This code is based on/inspired by jemalloc-3.3.1.  Please see LICENSE.jemalloc for further details.
+ */
+#include <stdarg.h>
+#include <comrogue/compiler_macros.h>
+#include <comrogue/types.h>
+#include <comrogue/str.h>
+#include <comrogue/objectbase.h>
+#include <comrogue/scode.h>
+#include <comrogue/stdobj.h>
+#include <comrogue/mutex.h>
+#include <comrogue/stream.h>
+#include <comrogue/internals/mmu.h>
+#include "heap_internals.h"
+
+#ifdef _H_THIS_FILE
+#undef _H_THIS_FILE
+_DECLARE_H_THIS_FILE
+#endif
+
+/*------------------------------
+ * Statistics snapshot handling
+ *------------------------------
+ */
+
+/*
+ * Resets an arena statistics snapshot to all zeroes, keeping its large statistics array.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - psnap = Pointer to the snapshot to be cleared.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void snapshot_clear(PHEAPDATA phd, PARENASTATSSNAP psnap)
+{
+  PMALLOCLARGESTATS amls = psnap->astats.amls;   /* large statistics array */
+
+  StrSetMem(psnap, 0, sizeof(ARENASTATSSNAP));
+  StrSetMem(amls, 0, (phd->szArenaMaxClass >> SYS_PAGE_BITS) * sizeof(MALLOCLARGESTATS));
+  psnap->astats.amls = amls;
+}
+
+/*
+ * Takes a snapshot of one arena's statistics.  The request counts held in the arena's thread caches are merged
+ * into the arena first, so that they are included.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - psnap = Pointer to the snapshot to be filled in; it must have been cleared.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void snapshot_arena(PHEAPDATA phd, PARENA pArena, PARENASTATSSNAP psnap)
+{
+  PTCACHE ptcache;     /* pointer to thread cache */
+  register UINT32 i;   /* loop counter */
+
+  IMutex_Lock(pArena->pmtxLock);
+  dlistListForEach(ptcache, &(pArena->dlistTCache), link)
+    _HeapTCacheStatsMerge(phd, ptcache, pArena);
+  IMutex_Unlock(pArena->pmtxLock);
+
+  psnap->fInitialized = TRUE;
+  psnap->nThreads = pArena->nThreads;
+  _HeapArenaStatsMerge(phd, pArena, &(psnap->cpgActive), &(psnap->cpgDirty), &(psnap->astats), psnap->abstats,
+		       psnap->astats.amls);
+  for (i = 0; i < NBINS; i++)
+  {
+    psnap->cbAllocatedSmall += psnap->abstats[i].cbAllocated;
+    psnap->cSmallMalloc += psnap->abstats[i].cMalloc;
+    psnap->cSmallDalloc += psnap->abstats[i].cDalloc;
+    psnap->cSmallRequests += psnap->abstats[i].cRequests;
+  }
+}
+
+/*
+ * Adds one arena statistics snapshot to another.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - psnapSum = Pointer to the snapshot to be added to.
+ * - psnap = Pointer to the snapshot to be added.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void snapshot_add(PHEAPDATA phd, PARENASTATSSNAP psnapSum, PARENASTATSSNAP psnap)
+{
+  SIZE_T nLargeClasses = phd->szArenaMaxClass >> SYS_PAGE_BITS;  /* number of large size classes */
+  register SIZE_T i;                                             /* loop counter */
+
+  psnapSum->nThreads += psnap->nThreads;
+  psnapSum->cpgActive += psnap->cpgActive;
+  psnapSum->cpgDirty += psnap->cpgDirty;
+  psnapSum->astats.cbMapped += psnap->astats.cbMapped;
+  psnapSum->astats.cPurges += psnap->astats.cPurges;
+  psnapSum->astats.cAdvise += psnap->astats.cAdvise;
+  psnapSum->astats.cPagesPurged += psnap->astats.cPagesPurged;
+  psnapSum->astats.cSpareHits += psnap->astats.cSpareHits;
+  psnapSum->astats.cSpareMisses += psnap->astats.cSpareMisses;
+  psnapSum->astats.cbAllocatedLarge += psnap->astats.cbAllocatedLarge;
+  psnapSum->astats.cLargeMalloc += psnap->astats.cLargeMalloc;
+  psnapSum->astats.cLargeDalloc += psnap->astats.cLargeDalloc;
+  psnapSum->astats.cLargeRequests += psnap->astats.cLargeRequests;
+  psnapSum->cbAllocatedSmall += psnap->cbAllocatedSmall;
+  psnapSum->cSmallMalloc += psnap->cSmallMalloc;
+  psnapSum->cSmallDalloc += psnap->cSmallDalloc;
+  psnapSum->cSmallRequests += psnap->cSmallRequests;
+
+  for (i = 0; i < NBINS; i++)
+  {
+    psnapSum->abstats[i].cbAllocated += psnap->abstats[i].cbAllocated;
+    psnapSum->abstats[i].cMalloc += psnap->abstats[i].cMalloc;
+    psnapSum->abstats[i].cDalloc += psnap->abstats[i].cDalloc;
+    psnapSum->abstats[i].cRequests += psnap->abstats[i].cRequests;
+    psnapSum->abstats[i].cFills += psnap->abstats[i].cFills;
+    psnapSum->abstats[i].cFlushes += psnap->abstats[i].cFlushes;
+    psnapSum->abstats[i].cRuns += psnap->abstats[i].cRuns;
+    psnapSum->abstats[i].cReRuns += psnap->abstats[i].cReRuns;
+    psnapSum->abstats[i].cRunsCurrent += psnap->abstats[i].cRunsCurrent;
+  }
+
+  for (i = 0; i < nLargeClasses; i++)
+  {
+    psnapSum->astats.amls[i].nMalloc += psnap->astats.amls[i].nMalloc;
+    psnapSum->astats.amls[i].nDalloc += psnap->astats.amls[i].nDalloc;
+    psnapSum->astats.amls[i].nRequests += psnap->astats.amls[i].nRequests;
+    psnapSum->astats.amls[i].cRuns += psnap->astats.amls[i].cRuns;
+  }
+}
+
+/*
+ * Takes a new snapshot of all the heap's statistics.  Assumes the statistics mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+static HRESULT stats_refresh_locked(PHEAPDATA phd)
+{
+  SIZE_T cbLargeStats = (phd->szArenaMaxClass >> SYS_PAGE_BITS) * sizeof(MALLOCLARGESTATS);
+  PARENASTATSSNAP psnapMerged;  /* pointer to merged snapshot */
+  PARENA pArena;                /* pointer to arena being snapshotted */
+  PBYTE pb;                     /* pointer to snapshot memory */
+  register UINT32 i;            /* loop counter */
+
+  if (!(phd->pasnapArenas))
+  { /* allocate the snapshot block on first use; it persists for the life of the heap */
+    pb = (PBYTE)_HeapBaseAlloc(phd, (phd->cArenas + 1) * (sizeof(ARENASTATSSNAP) + cbLargeStats));
+    if (!pb)
+      return E_OUTOFMEMORY;
+    phd->pasnapArenas = (PARENASTATSSNAP)pb;
+    pb += (phd->cArenas + 1) * sizeof(ARENASTATSSNAP);
+    for (i = 0; i <= phd->cArenas; i++)
+    {
+      phd->pasnapArenas[i].astats.amls = (PMALLOCLARGESTATS)pb;
+      pb += cbLargeStats;
+    }
+  }
+
+  psnapMerged = &(phd->pasnapArenas[phd->cArenas]);
+  snapshot_clear(phd, psnapMerged);
+  StrSetMem(&(phd->statsSnap), 0, sizeof(HEAPSTATS));
+  phd->statsSnap.cArenas = phd->cArenas;
+  phd->statsSnap.nBins = NBINS;
+  phd->statsSnap.nLargeClasses = phd->szArenaMaxClass >> SYS_PAGE_BITS;
+  phd->statsSnap.cbChunk = phd->szChunk;
+
+  for (i = 0; i < phd->cArenas; i++)
+  {
+    snapshot_clear(phd, &(phd->pasnapArenas[i]));
+    IMutex_Lock(phd->pmtxArenas);
+    pArena = phd->aparenas[i];
+    IMutex_Unlock(phd->pmtxArenas);
+    if (pArena)
+    {
+      snapshot_arena(phd, pArena, &(phd->pasnapArenas[i]));
+      snapshot_add(phd, psnapMerged, &(phd->pasnapArenas[i]));
+      phd->statsSnap.cArenasInitialized++;
+    }
+  }
+  psnapMerged->fInitialized = TRUE;
+
+  IMutex_Lock(phd->pmtxHuge);
+  phd->statsSnap.cbHugeAllocated = phd->cbHugeAllocated;
+  phd->statsSnap.cHugeMalloc = phd->cHugeMalloc;
+  phd->statsSnap.cHugeDalloc = phd->cHugeDalloc;
+  IMutex_Unlock(phd->pmtxHuge);
+
+  phd->statsSnap.cbAllocated = psnapMerged->cbAllocatedSmall + psnapMerged->astats.cbAllocatedLarge
+    + phd->statsSnap.cbHugeAllocated;
+  phd->statsSnap.cbActive = (psnapMerged->cpgActive << SYS_PAGE_BITS) + phd->statsSnap.cbHugeAllocated;
+  phd->statsSnap.cbMapped = psnapMerged->astats.cbMapped + phd->statsSnap.cbHugeAllocated;
+  return S_OK;
+}
+
+/*
+ * Locks the statistics mutex, taking the first snapshot if none has been taken yet.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.  On failure, the statistics mutex is not left locked.
+ */
+static HRESULT stats_lock(PHEAPDATA phd)
+{
+  HRESULT hr = S_OK;   /* return from this function */
+
+  IMutex_Lock(phd->pmtxStats);
+  if (!(phd->pasnapArenas))
+  {
+    hr = stats_refresh_locked(phd);
+    if (FAILED(hr))
+      IMutex_Unlock(phd->pmtxStats);
+  }
+  return hr;
+}
+
+/*
+ * Looks up the snapshot for an arena.  Assumes the statistics mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ndxArena = Index of the arena, or HEAPSTATS_ALL_ARENAS for the merged totals.
+ *
+ * Returns:
+ * - NULL = The arena index is out of range.
+ * - Other = Pointer to the arena's snapshot.
+ */
+static PARENASTATSSNAP stats_arena_snapshot(PHEAPDATA phd, UINT32 ndxArena)
+{
+  if (ndxArena == HEAPSTATS_ALL_ARENAS)
+    return &(phd->pasnapArenas[phd->cArenas]);
+  if (ndxArena >= phd->cArenas)
+    return NULL;
+  return &(phd->pasnapArenas[ndxArena]);
+}
+
+/*-----------------------------
+ * Statistics access functions
+ *-----------------------------
+ */
+
+/*
+ * Takes a new snapshot of the heap's statistics, which the other statistics functions will report.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+HRESULT _HeapStatsRefresh(PHEAPDATA phd)
+{
+  HRESULT hr;    /* return from this function */
+
+  IMutex_Lock(phd->pmtxStats);
+  hr = stats_refresh_locked(phd);
+  IMutex_Unlock(phd->pmtxStats);
+  return hr;
+}
+
+/*
+ * Retrieves the heap-wide statistics from the current snapshot.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pStats = Pointer to the structure to receive the statistics.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+HRESULT _HeapStatsGetHeap(PHEAPDATA phd, PHEAPSTATS pStats)
+{
+  HRESULT hr;    /* return from this function */
+
+  hr = stats_lock(phd);
+  if (FAILED(hr))
+    return hr;
+  StrCopyMem(pStats, &(phd->statsSnap), sizeof(HEAPSTATS));
+  IMutex_Unlock(phd->pmtxStats);
+  return S_OK;
+}
+
+/*
+ * Retrieves the statistics for one arena, or the merged totals for all arenas, from the current snapshot.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ndxArena = Index of the arena, or HEAPSTATS_ALL_ARENAS for the merged totals.
+ * - pStats = Pointer to the structure to receive the statistics.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator:
+ * - S_OK = The statistics were returned.
+ * - S_FALSE = The arena has not been created yet; all its statistics are returned as zero.
+ * - E_INVALIDARG = The arena index is out of range.
+ */
+HRESULT _HeapStatsGetArena(PHEAPDATA phd, UINT32 ndxArena, PHEAPARENASTATS pStats)
+{
+  PARENASTATSSNAP psnap;   /* pointer to arena snapshot */
+  HRESULT hr;              /* return from this function */
+
+  hr = stats_lock(phd);
+  if (FAILED(hr))
+    return hr;
+  psnap = stats_arena_snapshot(phd, ndxArena);
+  if (psnap)
+  {
+    pStats->nThreads = psnap->nThreads;
+    pStats->cpgActive = psnap->cpgActive;
+    pStats->cpgDirty = psnap->cpgDirty;
+    pStats->cbMapped = psnap->astats.cbMapped;
+    pStats->cPurges = psnap->astats.cPurges;
+    pStats->cAdvise = psnap->astats.cAdvise;
+    pStats->cPagesPurged = psnap->astats.cPagesPurged;
+    pStats->cSpareHits = psnap->astats.cSpareHits;
+    pStats->cSpareMisses = psnap->astats.cSpareMisses;
+    pStats->cbAllocatedSmall = psnap->cbAllocatedSmall;
+    pStats->cSmallMalloc = psnap->cSmallMalloc;
+    pStats->cSmallDalloc = psnap->cSmallDalloc;
+    pStats->cSmallRequests = psnap->cSmallRequests;
+    pStats->cbAllocatedLarge = psnap->astats.cbAllocatedLarge;
+    pStats->cLargeMalloc = psnap->astats.cLargeMalloc;
+    pStats->cLargeDalloc = psnap->astats.cLargeDalloc;
+    pStats->cLargeRequests = psnap->astats.cLargeRequests;
+    hr = (psnap->fInitialized ? S_OK : S_FALSE);
+  }
+  else
+    hr = E_INVALIDARG;
+  IMutex_Unlock(phd->pmtxStats);
+  return hr;
+}
+
+/*
+ * Retrieves the statistics for one bin of an arena, or the merged totals for that bin across all arenas, from
+ * the current snapshot.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ndxArena = Index of the arena, or HEAPSTATS_ALL_ARENAS for the merged totals.
+ * - ndxBin = Index of the bin.
+ * - pStats = Pointer to the structure to receive the statistics.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator:
+ * - S_OK = The statistics were returned.
+ * - S_FALSE = The arena has not been created yet; all its counters are returned as zero.
+ * - E_INVALIDARG = The arena or bin index is out of range.
+ */
+HRESULT _HeapStatsGetBin(PHEAPDATA phd, UINT32 ndxArena, UINT32 ndxBin, PHEAPBINSTATS pStats)
+{
+  PARENASTATSSNAP psnap;   /* pointer to arena snapshot */
+  PMALLOCBINSTATS pbs;     /* pointer to bin statistics */
+  HRESULT hr;              /* return from this function */
+
+  if (ndxBin >= NBINS)
+    return E_INVALIDARG;
+  hr = stats_lock(phd);
+  if (FAILED(hr))
+    return hr;
+  psnap = stats_arena_snapshot(phd, ndxArena);
+  if (psnap)
+  {
+    pbs = &(psnap->abstats[ndxBin]);
+    pStats->cbRegion = phd->aArenaBinInfo[ndxBin].cbRegions;
+    pStats->nRegions = phd->aArenaBinInfo[ndxBin].nRegions;
+    pStats->cbRun = phd->aArenaBinInfo[ndxBin].cbRunSize;
+    pStats->cbAllocated = pbs->cbAllocated;
+    pStats->cMalloc = pbs->cMalloc;
+    pStats->cDalloc = pbs->cDalloc;
+    pStats->cRequests = pbs->cRequests;
+    pStats->cFills = pbs->cFills;
+    pStats->cFlushes = pbs->cFlushes;
+    pStats->cRuns = pbs->cRuns;
+    pStats->cReRuns = pbs->cReRuns;
+    pStats->cRunsCurrent = pbs->cRunsCurrent;
+    hr = (psnap->fInitialized ? S_OK : S_FALSE);
+  }
+  else
+    hr = E_INVALIDARG;
+  IMutex_Unlock(phd->pmtxStats);
+  return hr;
+}
+
+/*
+ * Retrieves the statistics for one large size class of an arena, or the merged totals for that size class
+ * across all arenas, from the current snapshot.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ndxArena = Index of the arena, or HEAPSTATS_ALL_ARENAS for the merged totals.
+ * - ndxClass = Index of the large size class; class n holds runs of n + 1 pages.
+ * - pStats = Pointer to the structure to receive the statistics.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator:
+ * - S_OK = The statistics were returned.
+ * - S_FALSE = The arena has not been created yet; all its counters are returned as zero.
+ * - E_INVALIDARG = The arena or size class index is out of range.
+ */
+HRESULT _HeapStatsGetLarge(PHEAPDATA phd, UINT32 ndxArena, UINT32 ndxClass, PHEAPLARGESTATS pStats)
+{
+  PARENASTATSSNAP psnap;   /* pointer to arena snapshot */
+  PMALLOCLARGESTATS pls;   /* pointer to large statistics */
+  HRESULT hr;              /* return from this function */
+
+  if (ndxClass >= (phd->szArenaMaxClass >> SYS_PAGE_BITS))
+    return E_INVALIDARG;
+  hr = stats_lock(phd);
+  if (FAILED(hr))
+    return hr;
+  psnap = stats_arena_snapshot(phd, ndxArena);
+  if (psnap)
+  {
+    pls = &(psnap->astats.amls[ndxClass]);
+    pStats->cbRun = (ndxClass + 1) << SYS_PAGE_BITS;
+    pStats->cMalloc = pls->nMalloc;
+    pStats->cDalloc = pls->nDalloc;
+    pStats->cRequests = pls->nRequests;
+    pStats->cRunsCurrent = pls->cRuns;
+    hr = (psnap->fInitialized ? S_OK : S_FALSE);
+  }
+  else
+    hr = E_INVALIDARG;
+  IMutex_Unlock(phd->pmtxStats);
+  return hr;
+}
+
+/*---------------------
+ * Statistics printing
+ *---------------------
+ */
+
+/*
+ * Internal function called to write formatted output to a statistics output stream.
+ *
+ * Parameters:
+ * - ppvArg = Pointer argument to StrFormatV8 (actually the ISequentialStream pointer).
+ * - pchData = Pointer to data to be written.
+ * - cbData = Number of characters to be written.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+static HRESULT stats_printf_func(PPVOID ppvArg, PCCHAR pchData, UINT32 cbData)
+{
+  return ISequentialStream_Write((PSEQUENTIALSTREAM)(*ppvArg), pchData, cbData, NULL);
+}
+
+/*
+ * Formats data to a statistics output stream.
+ *
+ * Parameters:
+ * - pstm = Pointer to the output stream.
+ * - szFormat = Printf-style format string.
+ * - <var> = Arguments to be substituted into the printf-style format string.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void stats_printf(ISequentialStream *pstm, PCSTR szFormat, ...)
+{
+  va_list pargs;
+
+  va_start(pargs, szFormat);
+  StrFormatV8(stats_printf_func, (PPVOID)pstm, szFormat, pargs);
+  va_end(pargs);
+}
+
+/*
+ * Prints the statistics for one arena snapshot.  Assumes the statistics mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pstm = Pointer to the output stream.
+ * - psnap = Pointer to the arena snapshot to be printed.
+ * - uiFlags = HEAPSTATS_PRINT_xxx flags controlling what is printed.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void stats_print_arena(PHEAPDATA phd, ISequentialStream *pstm, PARENASTATSSNAP psnap, UINT32 uiFlags)
+{
+  SIZE_T nLargeClasses = phd->szArenaMaxClass >> SYS_PAGE_BITS;  /* number of large size classes */
+  register SIZE_T i;                                             /* loop counter */
+  PMALLOCBINSTATS pbs;                                           /* pointer to bin statistics */
+  PMALLOCLARGESTATS pls;                                         /* pointer to large statistics */
+
+  stats_printf(pstm, "assigned threads: %u\n", psnap->nThreads);
+  stats_printf(pstm, "dirty pages: %u:%u active:dirty, %lu sweeps, %lu advises, %lu purged\n",
+	       psnap->cpgActive, psnap->cpgDirty, psnap->astats.cPurges, psnap->astats.cAdvise,
+	       psnap->astats.cPagesPurged);
+  stats_printf(pstm, "spare chunks: %lu hits, %lu misses\n", psnap->astats.cSpareHits, psnap->astats.cSpareMisses);
+  stats_printf(pstm, "            allocated      nmalloc      ndalloc    nrequests\n");
+  stats_printf(pstm, "small:   %12u %12lu %12lu %12lu\n", psnap->cbAllocatedSmall, psnap->cSmallMalloc,
+	       psnap->cSmallDalloc, psnap->cSmallRequests);
+  stats_printf(pstm, "large:   %12u %12lu %12lu %12lu\n", psnap->astats.cbAllocatedLarge, psnap->astats.cLargeMalloc,
+	       psnap->astats.cLargeDalloc, psnap->astats.cLargeRequests);
+  stats_printf(pstm, "total:   %12u %12lu %12lu %12lu\n", psnap->cbAllocatedSmall + psnap->astats.cbAllocatedLarge,
+	       psnap->cSmallMalloc + psnap->astats.cLargeMalloc, psnap->cSmallDalloc + psnap->astats.cLargeDalloc,
+	       psnap->cSmallRequests + psnap->astats.cLargeRequests);
+  stats_printf(pstm, "active:  %12u\n", psnap->cpgActive << SYS_PAGE_BITS);
+  stats_printf(pstm, "mapped:  %12u\n", psnap->astats.cbMapped);
+
+  if (!(uiFlags & HEAPSTATS_PRINT_NOBINS))
+  {
+    stats_printf(pstm, "bins:    bin  size regs pgs  allocated      nmalloc      ndalloc    nrequests"
+		 "     nfills   nflushes    newruns     reruns    curruns\n");
+    for (i = 0; i < NBINS; i++)
+    {
+      pbs = &(psnap->abstats[i]);
+      if (pbs->cRuns == 0)
+	continue;   /* bin never used */
+      stats_printf(pstm, "        %4u %5u %4u %3u %10u %12lu %12lu %12lu %10lu %10lu %10lu %10lu %10u\n", i,
+		   phd->aArenaBinInfo[i].cbRegions, phd->aArenaBinInfo[i].nRegions,
+		   phd->aArenaBinInfo[i].cbRunSize >> SYS_PAGE_BITS, pbs->cbAllocated, pbs->cMalloc, pbs->cDalloc,
+		   pbs->cRequests, pbs->cFills, pbs->cFlushes, pbs->cRuns, pbs->cReRuns, pbs->cRunsCurrent);
+    }
+  }
+
+  if (!(uiFlags & HEAPSTATS_PRINT_NOLARGE))
+  {
+    stats_printf(pstm, "large:    size pages      nmalloc      ndalloc    nrequests    curruns\n");
+    for (i = 0; i < nLargeClasses; i++)
+    {
+      pls = &(psnap->astats.amls[i]);
+      if (pls->nRequests == 0)
+	continue;   /* size class never requested */
+      stats_printf(pstm, "      %8u %5u %12lu %12lu %12lu %10u\n", (i + 1) << SYS_PAGE_BITS, i + 1, pls->nMalloc,
+		   pls->nDalloc, pls->nRequests, pls->cRuns);
+    }
+  }
+}
+
+/*
+ * Takes a new snapshot of the heap's statistics and prints it as text.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pstm = Pointer to the stream to print to.  If this is NULL, the heap's debugging output stream is used.
+ * - uiFlags = HEAPSTATS_PRINT_xxx flags controlling what is printed.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator:
+ * - S_OK = The statistics were printed.
+ * - E_POINTER = No stream was specified, and no debugging output stream is connected.
+ */
+HRESULT _HeapStatsPrint(PHEAPDATA phd, ISequentialStream *pstm, UINT32 uiFlags)
+{
+  HRESULT hr;            /* intermediate result */
+  register UINT32 i;     /* loop counter */
+
+  if (!pstm)
+    pstm = phd->pDebugStream;
+  if (!pstm)
+    return E_POINTER;
+
+  IMutex_Lock(phd->pmtxStats);
+  hr = stats_refresh_locked(phd);
+  if (FAILED(hr))
+  {
+    IMutex_Unlock(phd->pmtxStats);
+    return hr;
+  }
+
+  stats_printf(pstm, "___ Begin heap statistics ___\n");
+  stats_printf(pstm, "Arenas: %u (%u initialized)\n", phd->statsSnap.cArenas, phd->statsSnap.cArenasInitialized);
+  stats_printf(pstm, "Chunk size: %u, page size: %u\n", phd->szChunk, SYS_PAGE_SIZE);
+  stats_printf(pstm, "Size classes: %u small (max %u), %u large (max %u), thread cache max %u\n", NBINS,
+	       SMALL_MAXCLASS, phd->statsSnap.nLargeClasses, phd->szArenaMaxClass, phd->cbTCacheMaxClass);
+  stats_printf(pstm, "Active:dirty page ratio: %d\n", phd->cbActiveDirtyRatio);
+  stats_printf(pstm, "Allocated: %u, active: %u, mapped: %u\n", phd->statsSnap.cbAllocated,
+	       phd->statsSnap.cbActive, phd->statsSnap.cbMapped);
+  stats_printf(pstm, "huge: allocated: %u, nmalloc: %lu, ndalloc: %lu\n", phd->statsSnap.cbHugeAllocated,
+	       phd->statsSnap.cHugeMalloc, phd->statsSnap.cHugeDalloc);
+
+  stats_printf(pstm, "\nMerged arenas stats:\n");
+  stats_print_arena(phd, pstm, &(phd->pasnapArenas[phd->cArenas]), uiFlags);
+  if (!(uiFlags & HEAPSTATS_PRINT_NOARENAS))
+  {
+    for (i = 0; i < phd->cArenas; i++)
+    {
+      if (phd->pasnapArenas[i].fInitialized)
+      {
+	stats_printf(pstm, "\narenas[%u]:\n", i);
+	stats_print_arena(phd, pstm, &(phd->pasnapArenas[i]), uiFlags);
+      }
+    }
+  }
+  stats_printf(pstm, "--- End heap statistics ---\n");
+
+  IMutex_Unlock(phd->pmtxStats);
+  return S_OK;
+}
+
+/*-------------------------------
+ * Statistics setup and shutdown
+ *-------------------------------
+ */
+
+/*
+ * Sets up the statistics data for the heap.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+HRESULT _HeapStatsSetup(PHEAPDATA phd)
+{
+  phd->pasnapArenas = NULL;
+  return IMutexFactory_CreateMutex(phd->pMutexFactory, &(phd->pmtxStats));
+}
+
+/*
+ * Shuts down the statistics data for the heap.  The snapshot block itself belongs to the base allocator.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapStatsShutdown(PHEAPDATA phd)
+{
+  IUnknown_Release(phd->pmtxStats);
+  phd->pmtxStats = NULL;
+  phd->pasnapArenas = NULL;
+}
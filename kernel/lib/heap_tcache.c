@@ -36,6 +36,7 @@
 #include <comrogue/types.h>
 #include <comrogue/scode.h>
 #include <comrogue/intlib.h>
+#include <comrogue/str.h>
 #include <comrogue/internals/mmu.h>
 #include <comrogue/internals/seg.h>
 #include "heap_internals.h"
@@ -193,88 +194,707 @@ void _HeapTCacheSetEnabled(PHEAPDATA phd, BOOL fEnabled)
   }
 }
 
+/*
+ * Pops an object off the stack of a thread cache bin, if one is available.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptbin = Pointer to the thread cache bin.
+ *
+ * Returns:
+ * - NULL = The bin is empty.
+ * - Other = Pointer to the object popped off the bin's stack.
+ */
 PVOID _HeapTCacheAllocEasy(PHEAPDATA phd, PTCACHEBIN ptbin)
 {
-  return NULL; /* TODO */
+  if (ptbin->nCached == 0)
+  {
+    ptbin->nLowWatermark = -1;
+    return NULL;
+  }
+  ptbin->nCached--;
+  if ((INT32)(ptbin->nCached) < ptbin->nLowWatermark)
+    ptbin->nLowWatermark = ptbin->nCached;
+  return ptbin->ppvAvail[ptbin->nCached];
 }
 
+/*
+ * Allocates a small object from the thread cache, refilling the bin from the arena if it's empty.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the thread cache.
+ * - sz = Size of the object to allocate.  Must be no greater than SMALL_MAXCLASS.
+ * - fZero = If TRUE, the returned object will be zero-filled.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the new object.
+ */
 PVOID _HeapTCacheAllocSmall(PHEAPDATA phd, PTCACHE ptcache, SIZE_T sz, BOOL fZero)
 {
-  return NULL; /* TODO */
+  SIZE_T ndxBin = SMALL_SIZE2BIN(sz);  /* bin index */
+  PTCACHEBIN ptbin;                    /* pointer to thread cache bin */
+  PVOID rc;                            /* return from this function */
+
+  _H_ASSERT(phd, ndxBin < NBINS);
+  ptbin = &(ptcache->aBins[ndxBin]);
+  rc = _HeapTCacheAllocEasy(phd, ptbin);
+  if (!rc)
+  {
+    rc = _HeapTCacheAllocSmallHard(phd, ptcache, ptbin, ndxBin);
+    if (!rc)
+      return NULL;
+  }
+  _H_DEBUG_ASSERT(phd, _HeapTCacheSAlloc(phd, rc) == phd->aArenaBinInfo[ndxBin].cbRegions);
+
+  if (fZero)
+  {
+    if (phd->uiFillFlags & PHDFLAGS_JUNKFILL)
+      _HeapArenaAllocJunkSmall(phd, rc, &(phd->aArenaBinInfo[ndxBin]), TRUE);
+    StrSetMem(rc, 0, phd->aArenaBinInfo[ndxBin].cbRegions);
+  }
+  else if (phd->uiFillFlags)
+  {
+    if (phd->uiFillFlags & PHDFLAGS_JUNKFILL)
+      _HeapArenaAllocJunkSmall(phd, rc, &(phd->aArenaBinInfo[ndxBin]), FALSE);
+    else
+      StrSetMem(rc, 0, phd->aArenaBinInfo[ndxBin].cbRegions);
+  }
+  ptbin->stats.nRequests++;
+  _HeapTCacheEvent(phd, ptcache);
+  return rc;
 }
 
+/*
+ * Allocates a large object from the thread cache, going to the arena if the bin is empty.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the thread cache.
+ * - sz = Size of the object to allocate.  Must be no greater than phd->cbTCacheMaxClass.
+ * - fZero = If TRUE, the returned object will be zero-filled.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the new object.
+ */
 PVOID _HeapTCacheAllocLarge(PHEAPDATA phd, PTCACHE ptcache, SIZE_T sz, BOOL fZero)
 {
-  return NULL; /* TODO */
+  SIZE_T ndxBin;       /* bin index */
+  PTCACHEBIN ptbin;    /* pointer to thread cache bin */
+  PVOID rc;            /* return from this function */
+
+  sz = SYS_PAGE_CEILING(sz);
+  _H_ASSERT(phd, sz <= phd->cbTCacheMaxClass);
+  ndxBin = NBINS + (sz >> SYS_PAGE_BITS) - 1;
+  _H_ASSERT(phd, ndxBin < phd->nHBins);
+  ptbin = &(ptcache->aBins[ndxBin]);
+  rc = _HeapTCacheAllocEasy(phd, ptbin);
+  if (!rc)
+  { /* only allocate one large object at a time, because they're expensive to create and not use */
+    rc = _HeapArenaMallocLarge(phd, ptcache->parena, sz, fZero);
+    if (!rc)
+      return NULL;
+  }
+  else
+  {
+    if (fZero)
+      StrSetMem(rc, 0, sz);
+    else if (phd->uiFillFlags)
+      _HeapFillAlloc(phd, rc, sz);
+    ptbin->stats.nRequests++;
+  }
+
+  _HeapTCacheEvent(phd, ptcache);
+  return rc;
 }
 
+/*
+ * Returns a small object to the thread cache, flushing half the bin back to the arena if the bin is full.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the thread cache.
+ * - pv = Pointer to the object being freed.
+ * - ndxBin = Bin index of the object being freed.
+ *
+ * Returns:
+ * Nothing.
+ */
 void _HeapTCacheDAllocSmall(PHEAPDATA phd, PTCACHE ptcache, PVOID pv, SIZE_T ndxBin)
 {
-  /* TODO */
+  PTCACHEBIN ptbin = &(ptcache->aBins[ndxBin]);   /* pointer to thread cache bin */
+  PTCACHEBININFO ptbi = &(phd->ptcbi[ndxBin]);   /* pointer to thread cache bin info */
+
+  _H_DEBUG_ASSERT(phd, _HeapTCacheSAlloc(phd, pv) <= SMALL_MAXCLASS);
+  if (phd->uiFillFlags & PHDFLAGS_JUNKFILL)
+    _HeapArenaDAllocJunkSmall(phd, pv, &(phd->aArenaBinInfo[ndxBin]));
+  if (ptbin->nCached == ptbi->nCachedMax)
+    _HeapTCacheBinFlushSmall(phd, ptbin, ndxBin, ptbi->nCachedMax >> 1, ptcache);
+  _H_ASSERT(phd, ptbin->nCached < ptbi->nCachedMax);
+  ptbin->ppvAvail[ptbin->nCached++] = pv;
+  _HeapTCacheEvent(phd, ptcache);
 }
 
+/*
+ * Returns a large object to the thread cache, flushing half the bin back to the arena if the bin is full.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the thread cache.
+ * - pv = Pointer to the object being freed.
+ * - sz = Size of the object being freed.
+ *
+ * Returns:
+ * Nothing.
+ */
 void _HeapTCacheDAllocLarge(PHEAPDATA phd, PTCACHE ptcache, PVOID pv, SIZE_T sz)
 {
-  /* TODO */
+  SIZE_T ndxBin;         /* bin index */
+  PTCACHEBIN ptbin;      /* pointer to thread cache bin */
+  PTCACHEBININFO ptbi;   /* pointer to thread cache bin info */
+
+  _H_ASSERT(phd, (sz & SYS_PAGE_MASK) == 0);
+  _H_DEBUG_ASSERT(phd, _HeapTCacheSAlloc(phd, pv) > SMALL_MAXCLASS);
+  _H_DEBUG_ASSERT(phd, _HeapTCacheSAlloc(phd, pv) <= phd->cbTCacheMaxClass);
+  if (phd->uiFillFlags & PHDFLAGS_JUNKFILL)
+    StrSetMem(pv, JUNK_FREE, sz);
+  ndxBin = NBINS + (sz >> SYS_PAGE_BITS) - 1;
+  ptbin = &(ptcache->aBins[ndxBin]);
+  ptbi = &(phd->ptcbi[ndxBin]);
+  if (ptbin->nCached == ptbi->nCachedMax)
+    _HeapTCacheBinFlushLarge(phd, ptbin, ndxBin, ptbi->nCachedMax >> 1, ptcache);
+  _H_ASSERT(phd, ptbin->nCached < ptbi->nCachedMax);
+  ptbin->ppvAvail[ptbin->nCached++] = pv;
+  _HeapTCacheEvent(phd, ptcache);
 }
 
+/*
+ * Returns the size of an object held in the thread cache.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the object.
+ *
+ * Returns:
+ * The size of the object in bytes.
+ */
 SIZE_T _HeapTCacheSAlloc(PHEAPDATA phd, PCVOID pv)
 {
-  return 0; /* TODO */
+  return _HeapArenaSAlloc(phd, pv, FALSE);
 }
 
+/*
+ * Performs an incremental garbage collection on one bin of the thread cache.  If objects in the bin went unused
+ * since the last pass (the low watermark is above zero), 3/4 of those objects are flushed back to the arena and the
+ * bin's fill count is halved; if the bin ran dry, its fill count is doubled.  If HeapMinimize has requested a
+ * drain, the entire cache is flushed instead.  Objects other threads have freed into this thread's arena are
+ * also freed here, so that they are reclaimed even while allocations are all being satisfied from the cache.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the thread cache.
+ *
+ * Returns:
+ * Nothing.
+ */
 void _HeapTCacheEventHard(PHEAPDATA phd, PTCACHE ptcache)
 {
-  /* TODO */
+  SIZE_T ndxBin = ptcache->ndxNextGCBin;         /* bin index to GC */
+  PTCACHEBIN ptbin = &(ptcache->aBins[ndxBin]);   /* pointer to thread cache bin */
+  PTCACHEBININFO ptbi = &(phd->ptcbi[ndxBin]);   /* pointer to thread cache bin info */
+  UINT32 nRem;                                   /* number of objects to remain in the bin */
+
+  if (ptcache->fDrainRequested)
+  { /* HeapMinimize wants everything back */
+    _HeapTCacheDrain(phd, ptcache);
+    ptcache->cEvents = 0;
+    return;
+  }
+
+  _HeapArenaRemoteDrain(phd, ptcache->parena);
+  if (ptbin->nLowWatermark > 0)
+  { /* flush (ceiling) 3/4 of the objects below the low watermark */
+    nRem = ptbin->nCached - ptbin->nLowWatermark + (ptbin->nLowWatermark >> 2);
+    if (ndxBin < NBINS)
+      _HeapTCacheBinFlushSmall(phd, ptbin, ndxBin, nRem, ptcache);
+    else
+      _HeapTCacheBinFlushLarge(phd, ptbin, ndxBin, nRem, ptcache);
+    /* reduce fill count by 2x, keeping it at least 1 */
+    if ((ptbi->nCachedMax >> (ptbin->cbitFill + 1)) >= 1)
+      ptbin->cbitFill++;
+  }
+  else if (ptbin->nLowWatermark < 0)
+  { /* increase fill count by 2x, keeping cbitFill greater than 0 */
+    if (ptbin->cbitFill > 1)
+      ptbin->cbitFill--;
+  }
+  ptbin->nLowWatermark = ptbin->nCached;
+
+  if (++(ptcache->ndxNextGCBin) == phd->nHBins)
+    ptcache->ndxNextGCBin = 0;
+  ptcache->cEvents = 0;
 }
 
+/*
+ * Refills an empty small-object bin of the thread cache from the arena, then allocates an object from it.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the thread cache.
+ * - ptbin = Pointer to the thread cache bin to be refilled.
+ * - ndxBin = Index of the bin to be refilled.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the new object.
+ */
 PVOID _HeapTCacheAllocSmallHard(PHEAPDATA phd, PTCACHE ptcache, PTCACHEBIN ptbin, SIZE_T ndxBin)
 {
-  return NULL; /* TODO */
+  _HeapArenaTCacheFillSmall(phd, ptcache->parena, ptbin, ndxBin);
+  return _HeapTCacheAllocEasy(phd, ptbin);
 }
 
+/*
+ * Moves the objects remaining in a thread cache bin after a flush down to the bottom of its stack.
+ *
+ * Parameters:
+ * - ptbin = Pointer to the thread cache bin.
+ * - nRem = Number of objects remaining at the top of the stack.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void tbin_compact(PTCACHEBIN ptbin, UINT32 nRem)
+{
+  register UINT32 i;                           /* loop counter */
+  UINT32 ndxFirst = ptbin->nCached - nRem;     /* index of first remaining object */
+
+  for (i = 0; i < nRem; i++)
+    ptbin->ppvAvail[i] = ptbin->ppvAvail[ndxFirst + i];
+  ptbin->nCached = nRem;
+  if ((INT32)(ptbin->nCached) < ptbin->nLowWatermark)
+    ptbin->nLowWatermark = ptbin->nCached;
+}
+
+/*
+ * Hands all the objects in the first part of a thread cache bin that belong to another arena over to that arena's
+ * remote-free stack, in a single push, rather than taking that arena's locks.  The objects that do not belong to
+ * the arena are moved down to the bottom of the bin for a later pass.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptbin = Pointer to the thread cache bin being flushed.
+ * - nFlush = Number of objects at the bottom of the bin that are being flushed on this pass.
+ * - pArena = Pointer to the arena to hand objects over to.
+ *
+ * Returns:
+ * The number of objects moved down for a later pass.
+ */
+static UINT32 tbin_flush_remote(PHEAPDATA phd, PTCACHEBIN ptbin, UINT32 nFlush, PARENA pArena)
+{
+  PVOID pv;                  /* pointer to object being flushed */
+  PVOID pvFirst = NULL;      /* first object in the chain */
+  PVOID pvLast = NULL;       /* last object in the chain */
+  register UINT32 i;         /* loop counter */
+  UINT32 nDeferred = 0;      /* number of objects deferred to a later pass */
+
+  for (i = 0; i < nFlush; i++)
+  {
+    pv = ptbin->ppvAvail[i];
+    _H_ASSERT(phd, pv);
+    if (((PARENACHUNK)CHUNK_ADDR2BASE(phd, pv))->parena == pArena)
+    {
+      *((PPVOID)pv) = pvFirst;
+      if (!pvLast)
+	pvLast = pv;
+      pvFirst = pv;
+    }
+    else
+      ptbin->ppvAvail[nDeferred++] = pv;
+  }
+  _H_ASSERT(phd, pvFirst);
+  _HeapArenaRemoteFree(phd, pArena, pvFirst, pvLast);
+  return nDeferred;
+}
+
+/*
+ * Flushes objects from a small-object thread cache bin back to their arenas.  Each arena bin lock is taken once
+ * per pass, and all objects belonging to that arena are freed under it; objects belonging to other arenas are
+ * pushed onto those arenas' remote-free stacks instead.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptbin = Pointer to the thread cache bin to be flushed.
+ * - ndxBin = Index of the bin to be flushed.
+ * - nRem = Number of objects to remain in the bin after the flush.
+ * - ptcache = Pointer to the thread cache.
+ *
+ * Returns:
+ * Nothing.
+ */
 void _HeapTCacheBinFlushSmall(PHEAPDATA phd, PTCACHEBIN ptbin, SIZE_T ndxBin, UINT32 nRem, PTCACHE ptcache)
 {
-  /* TODO */
+  PVOID pv;                   /* pointer to object being flushed */
+  register UINT32 i;          /* loop counter */
+  UINT32 nFlush;              /* number of objects to flush on this pass */
+  UINT32 nDeferred;           /* number of objects deferred to a later pass */
+  BOOL fMergedStats = FALSE;  /* have we merged the stats yet? */
+  PARENACHUNK pChunk;         /* pointer to chunk containing object */
+  PARENA pArena;              /* pointer to arena being flushed to */
+  PARENABIN pBin;             /* pointer to arena bin being flushed to */
+
+  _H_ASSERT(phd, ndxBin < NBINS);
+  _H_ASSERT(phd, nRem <= ptbin->nCached);
+
+  for (nFlush = ptbin->nCached - nRem; nFlush > 0; nFlush = nDeferred)
+  {
+    pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, ptbin->ppvAvail[0]);
+    pArena = pChunk->parena;
+    if ((pArena != ptcache->parena) && (pArena->nThreads > 0))
+    {
+      nDeferred = tbin_flush_remote(phd, ptbin, nFlush, pArena);
+      continue;
+    }
+    /* Lock the arena bin associated with the first object. */
+    pBin = &(pArena->aBins[ndxBin]);
+    IMutex_Lock(pBin->pmtxLock);
+    if (pArena == ptcache->parena)
+    {
+      _H_ASSERT(phd, !fMergedStats);
+      fMergedStats = TRUE;
+      pBin->stats.cFlushes++;
+      pBin->stats.cRequests += ptbin->stats.nRequests;
+      ptbin->stats.nRequests = 0;
+    }
+    nDeferred = 0;
+    for (i = 0; i < nFlush; i++)
+    {
+      pv = ptbin->ppvAvail[i];
+      _H_ASSERT(phd, pv);
+      pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);
+      if (pChunk->parena == pArena)
+	_HeapArenaDAllocBinLocked(phd, pArena, pChunk, pv,
+				  _HeapArenaMapPGet(phd, pChunk, ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS));
+      else
+	ptbin->ppvAvail[nDeferred++] = pv;  /* belongs to another arena, stash it for a later pass */
+    }
+    IMutex_Unlock(pBin->pmtxLock);
+  }
+
+  if (!fMergedStats)
+  { /* the flush loop didn't hit this thread's arena, so merge the stats manually */
+    pBin = &(ptcache->parena->aBins[ndxBin]);
+    IMutex_Lock(pBin->pmtxLock);
+    pBin->stats.cFlushes++;
+    pBin->stats.cRequests += ptbin->stats.nRequests;
+    ptbin->stats.nRequests = 0;
+    IMutex_Unlock(pBin->pmtxLock);
+  }
+
+  tbin_compact(ptbin, nRem);
 }
 
+/*
+ * Flushes objects from a large-object thread cache bin back to their arenas.  Each arena lock is taken once
+ * per pass, and all objects belonging to that arena are freed under it; objects belonging to other arenas are
+ * pushed onto those arenas' remote-free stacks instead.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptbin = Pointer to the thread cache bin to be flushed.
+ * - ndxBin = Index of the bin to be flushed.
+ * - nRem = Number of objects to remain in the bin after the flush.
+ * - ptcache = Pointer to the thread cache.
+ *
+ * Returns:
+ * Nothing.
+ */
 void _HeapTCacheBinFlushLarge(PHEAPDATA phd, PTCACHEBIN ptbin, SIZE_T ndxBin, UINT32 nRem, PTCACHE ptcache)
 {
-  /* TODO */
+  PVOID pv;                   /* pointer to object being flushed */
+  register UINT32 i;          /* loop counter */
+  UINT32 nFlush;              /* number of objects to flush on this pass */
+  UINT32 nDeferred;           /* number of objects deferred to a later pass */
+  BOOL fMergedStats = FALSE;  /* have we merged the stats yet? */
+  PARENACHUNK pChunk;         /* pointer to chunk containing object */
+  PARENA pArena;              /* pointer to arena being flushed to */
+
+  _H_ASSERT(phd, ndxBin < phd->nHBins);
+  _H_ASSERT(phd, nRem <= ptbin->nCached);
+
+  for (nFlush = ptbin->nCached - nRem; nFlush > 0; nFlush = nDeferred)
+  {
+    pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, ptbin->ppvAvail[0]);
+    pArena = pChunk->parena;
+    if ((pArena != ptcache->parena) && (pArena->nThreads > 0))
+    {
+      nDeferred = tbin_flush_remote(phd, ptbin, nFlush, pArena);
+      continue;
+    }
+    /* Lock the arena associated with the first object. */
+    IMutex_Lock(pArena->pmtxLock);
+    if (pArena == ptcache->parena)
+    {
+      fMergedStats = TRUE;
+      pArena->stats.cLargeRequests += ptbin->stats.nRequests;
+      pArena->stats.amls[ndxBin - NBINS].nRequests += ptbin->stats.nRequests;
+      ptbin->stats.nRequests = 0;
+    }
+    nDeferred = 0;
+    for (i = 0; i < nFlush; i++)
+    {
+      pv = ptbin->ppvAvail[i];
+      _H_ASSERT(phd, pv);
+      pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);
+      if (pChunk->parena == pArena)
+	_HeapArenaDAllocLargeLocked(phd, pArena, pChunk, pv);
+      else
+	ptbin->ppvAvail[nDeferred++] = pv;  /* belongs to another arena, stash it for a later pass */
+    }
+    IMutex_Unlock(pArena->pmtxLock);
+  }
+
+  if (!fMergedStats)
+  { /* the flush loop didn't hit this thread's arena, so merge the stats manually */
+    pArena = ptcache->parena;
+    IMutex_Lock(pArena->pmtxLock);
+    pArena->stats.cLargeRequests += ptbin->stats.nRequests;
+    pArena->stats.amls[ndxBin - NBINS].nRequests += ptbin->stats.nRequests;
+    ptbin->stats.nRequests = 0;
+    IMutex_Unlock(pArena->pmtxLock);
+  }
+
+  tbin_compact(ptbin, nRem);
 }
 
+/*
+ * Flushes every object in a thread cache back to its arena, leaving all bins empty.  Must be called by the
+ * thread that owns the cache.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the thread cache.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapTCacheDrain(PHEAPDATA phd, PTCACHE ptcache)
+{
+  PTCACHEBIN ptbin;     /* pointer to thread cache bin */
+  register UINT32 i;    /* loop counter */
+
+  ptcache->fDrainRequested = FALSE;
+  for (i = 0; i < phd->nHBins; i++)
+  {
+    ptbin = &(ptcache->aBins[i]);
+    if (i < NBINS)
+      _HeapTCacheBinFlushSmall(phd, ptbin, i, 0, ptcache);
+    else
+      _HeapTCacheBinFlushLarge(phd, ptbin, i, 0, ptcache);
+    ptbin->nLowWatermark = 0;
+  }
+}
+
+/*
+ * Asks every thread cache associated with an arena to drain itself.  A thread cache can only be flushed safely
+ * by its owner, so each one is flagged and drains at its owner's next incremental GC event.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena.
+ * - ptcacheExcept = Pointer to a thread cache not to flag (the caller's own, which it drains directly), or NULL.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapTCacheRequestDrain(PHEAPDATA phd, PARENA pArena, PTCACHE ptcacheExcept)
+{
+  PTCACHE ptcache;    /* pointer to thread cache */
+
+  IMutex_Lock(pArena->pmtxLock);
+  dlistListForEach(ptcache, &(pArena->dlistTCache), link)
+  {
+    if (ptcache != ptcacheExcept)
+      ptcache->fDrainRequested = TRUE;
+  }
+  IMutex_Unlock(pArena->pmtxLock);
+}
+
+/*
+ * Associates a thread cache with an arena, linking it into the arena's list of thread caches.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the thread cache.
+ * - pArena = Pointer to the arena.
+ *
+ * Returns:
+ * Nothing.
+ */
 void _HeapTCacheArenaAssociate(PHEAPDATA phd, PTCACHE ptcache, PARENA pArena)
 {
-  /* TODO */
+  IMutex_Lock(pArena->pmtxLock);
+  dlistNodeInit(ptcache, link);
+  dlistListInsertLast(&(pArena->dlistTCache), ptcache, link);
+  IMutex_Unlock(pArena->pmtxLock);
+  ptcache->parena = pArena;
 }
 
+/*
+ * Dissociates a thread cache from its arena, unlinking it from the arena's list of thread caches and merging
+ * its statistics into the arena.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the thread cache.
+ *
+ * Returns:
+ * Nothing.
+ */
 void _HeapTCacheArenaDisassociate(PHEAPDATA phd, PTCACHE ptcache)
 {
-  /* TODO */
+  PARENA pArena = ptcache->parena;   /* pointer to the arena */
+
+  IMutex_Lock(pArena->pmtxLock);
+  dlistListRemove(&(pArena->dlistTCache), ptcache, link);
+  _HeapTCacheStatsMerge(phd, ptcache, pArena);
+  IMutex_Unlock(pArena->pmtxLock);
 }
 
+/*
+ * Creates a new thread cache for the current thread.  The thread cache and its bins' stacks are allocated in one
+ * block from the arena.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pArena = Pointer to the arena the thread cache will be associated with.
+ *
+ * Returns:
+ * - NULL = The thread cache could not be created.
+ * - Other = Pointer to the new thread cache.
+ */
 PTCACHE _HeapTCacheCreate(PHEAPDATA phd, PARENA pArena)
 {
-  return NULL; /* TODO */
+  PTCACHE ptcache;      /* pointer to new thread cache */
+  SIZE_T sz;            /* size of thread cache block */
+  SIZE_T ofsStack;      /* offset of next bin's stack */
+  register UINT32 i;    /* loop counter */
+
+  sz = OFFSETOF(TCACHE, aBins) + (phd->nHBins * sizeof(TCACHEBIN));
+  sz = (sz + sizeof(PVOID) - 1) & ~(sizeof(PVOID) - 1);   /* naturally align the pointer stacks */
+  ofsStack = sz;
+  sz += phd->nStackElems * sizeof(PVOID);
+  sz = SYS_CACHELINE_CEILING(sz);   /* avoid false cache line sharing */
+
+  ptcache = (PTCACHE)_HeapArenaMalloc(phd, pArena, sz, TRUE, FALSE);
+  if (!ptcache)
+    return NULL;
+
+  _HeapTCacheArenaAssociate(phd, ptcache, pArena);
+  for (i = 0; i < phd->nHBins; i++)
+  {
+    ptcache->aBins[i].cbitFill = 1;
+    ptcache->aBins[i].ppvAvail = (PPVOID)(((UINT_PTR)ptcache) + ofsStack);
+    ofsStack += phd->ptcbi[i].nCachedMax * sizeof(PVOID);
+  }
+
+  IThreadLocal_Set(phd->pthrlTCache, ptcache);
+  return ptcache;
 }
 
+/*
+ * Destroys a thread cache.  Every cached object is returned to its arena, the cache's statistics and profiling
+ * byte count are merged into its arena, and the cache's own memory is freed.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the thread cache to be destroyed.
+ *
+ * Returns:
+ * Nothing.
+ */
 void _HeapTCacheDestroy(PHEAPDATA phd, PTCACHE ptcache)
 {
-  /* TODO */
+  PARENA pArena = ptcache->parena;   /* pointer to the arena */
+  PARENACHUNK pChunk;                /* pointer to chunk containing the thread cache */
+
+  _HeapTCacheArenaDisassociate(phd, ptcache);
+  _HeapTCacheDrain(phd, ptcache);
+
+  if (ptcache->cbProfAccum > 0)
+    _HeapArenaProfAccum(phd, pArena, ptcache->cbProfAccum);
+
+  pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, ptcache);
+  _HeapArenaDAlloc(phd, pChunk->parena, pChunk, ptcache, FALSE);
 }
 
+/*
+ * Merges a thread cache's request counts into an arena's statistics, and resets them in the thread cache.
+ * Assumes the arena mutex is locked.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - ptcache = Pointer to the thread cache whose statistics are to be merged.
+ * - pArena = Pointer to the arena to merge the statistics into.
+ *
+ * Returns:
+ * Nothing.
+ */
 void _HeapTCacheStatsMerge(PHEAPDATA phd, PTCACHE ptcache, PARENA pArena)
 {
-  /* TODO */
+  register UINT32 i;            /* loop counter */
+  PARENABIN pBin;               /* pointer to arena bin */
+  PTCACHEBIN ptbin;             /* pointer to thread cache bin */
+  PMALLOCLARGESTATS plstats;    /* pointer to large statistics */
+
+  for (i = 0; i < NBINS; i++)
+  {
+    pBin = &(pArena->aBins[i]);
+    ptbin = &(ptcache->aBins[i]);
+    IMutex_Lock(pBin->pmtxLock);
+    pBin->stats.cRequests += ptbin->stats.nRequests;
+    IMutex_Unlock(pBin->pmtxLock);
+    ptbin->stats.nRequests = 0;
+  }
+
+  for (; i < phd->nHBins; i++)
+  {
+    plstats = &(pArena->stats.amls[i - NBINS]);
+    ptbin = &(ptcache->aBins[i]);
+    pArena->stats.cLargeRequests += ptbin->stats.nRequests;
+    plstats->nRequests += ptbin->stats.nRequests;
+    ptbin->stats.nRequests = 0;
+  }
 }
 
+/*
+ * Called when a thread exits, to destroy its thread cache.  The thread-local value is left in the purgatory state
+ * afterwards, so that cleanup functions running later in the thread's exit cannot re-create the cache.
+ *
+ * Parameters:
+ * - pvContents = Contents of the thread-local thread cache pointer for the exiting thread.
+ * - pvArg = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Nothing.
+ */
 static void tcacheCleanup(PVOID pvContents, PVOID pvArg)
 {
-  /*
-  PHEAPDATA phd = (PHEAPDATA)pvArg;
-  PTCACHE ptcache = (PTCACHE)pvContents;
-  */
-  /* TODO */
+  PHEAPDATA phd = (PHEAPDATA)pvArg;         /* pointer to HEAPDATA block */
+  PTCACHE ptcache = (PTCACHE)pvContents;    /* pointer to thread cache */
+
+  if (ptcache == TCACHE_STATE_REINCARNATED)
+  { /* another cleanup function allocated after we were called; go back to purgatory to get called again */
+    IThreadLocal_Set(phd->pthrlTCache, (PVOID)TCACHE_STATE_PURGATORY);
+  }
+  else if (ptcache > TCACHE_STATE_MAX)
+  {
+    _HeapTCacheDestroy(phd, ptcache);
+    IThreadLocal_Set(phd->pthrlTCache, (PVOID)TCACHE_STATE_PURGATORY);
+  }
+  /* if disabled, or already in purgatory, do nothing, so that we won't be called again */
 }
 
 HRESULT _HeapTCacheSetup(PHEAPDATA phd, IThreadLocalFactory *pthrlf)
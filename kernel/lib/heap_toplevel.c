@@ -35,6 +35,7 @@
 #include <comrogue/compiler_macros.h>
 #include <comrogue/types.h>
 #include <comrogue/scode.h>
+#include <comrogue/intlib.h>
 #include <comrogue/str.h>
 #include <comrogue/objhelp.h>
 #include <comrogue/stdobj.h>
@@ -46,25 +47,425 @@
 #include "enumgeneric.h"
 
 #define PHDFLAGS_DELETING        0x80000000           /* deleting the heap */
-#define PHDFLAGS_PROFILE_ACTIVE  0x40000000           /* profile is active */
 
 #define PHDFLAGS_INIT (PHDFLAGS_REDZONE|PHDFLAGS_JUNKFILL|PHDFLAGS_ZEROFILL|PHDFLAGS_NOTCACHE|PHDFLAGS_PROFILE)
 
+/* Profile hooks; each costs only a test of the flags word when profiling is off. */
+#define PROF_MALLOC(phd, pv, pvSite) \
+  do { if (((phd)->uiFlags & PHDFLAGS_PROFILE_ACTIVE) && (pv)) _HeapProfMalloc(phd, pv, pvSite); } while (0)
+#define PROF_FREE(phd, pv) \
+  do { if ((phd)->uiFlags & PHDFLAGS_PROFILE) _HeapProfFree(phd, pv); } while (0)
+
 /*------------------------------
  * Top-level internal functions
  *------------------------------
  */
 
+/*
+ * Binds the current thread to an arena.  The thread is given the least-loaded arena, or a newly-created one if an
+ * arena slot is still empty and all the existing arenas have threads bound to them.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * Pointer to the arena the current thread is now bound to.
+ */
 PARENA _HeapChooseArenaHard(PHEAPDATA phd)
 {
-  return NULL; /* TODO */
+  PARENA rc;              /* return from this function */
+  register UINT32 i;      /* loop counter */
+  UINT32 ndxChoose = 0;   /* index of chosen arena */
+  UINT32 ndxFirstNull;    /* index of first empty arena slot */
+
+  IMutex_Lock(phd->pmtxArenas);
+  _H_ASSERT(phd, phd->aparenas[0]);
+  if (phd->cArenas > 1)
+  {
+    ndxFirstNull = phd->cArenas;
+    for (i = 1; i < phd->cArenas; i++)
+    {
+      if (phd->aparenas[i])
+      { /* choose the first arena with the lowest number of threads */
+	if (phd->aparenas[i]->nThreads < phd->aparenas[ndxChoose]->nThreads)
+	  ndxChoose = i;
+      }
+      else if (ndxFirstNull == phd->cArenas)
+	ndxFirstNull = i;  /* remember the first empty slot */
+    }
+
+    if ((phd->aparenas[ndxChoose]->nThreads == 0) || (ndxFirstNull == phd->cArenas))
+      rc = phd->aparenas[ndxChoose];   /* use an unloaded arena, or the least-loaded one */
+    else
+    { /* create a new arena */
+      rc = _HeapArenasExtend(phd, ndxFirstNull);
+      if (!rc)
+      {
+	_HeapDbgWrite(phd, "Error initializing arena\n");
+	rc = phd->aparenas[0];
+      }
+    }
+  }
+  else
+    rc = phd->aparenas[0];
+  rc->nThreads++;
+  IMutex_Unlock(phd->pmtxArenas);
+
+  IThreadLocal_Set(phd->pthrlArena, rc);
+  _HeapArenaRemoteDrain(phd, rc);  /* frees pushed while the arena had no threads may still be waiting */
+  return rc;
 }
 
+/*
+ * Chooses the arena to be used for an allocation.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - parena = Pointer to the arena requested by the caller, or NULL to use the current thread's arena.
+ *
+ * Returns:
+ * Pointer to the arena to be used.
+ */
 PARENA _HeapChooseArena(PHEAPDATA phd, PARENA parena)
 {
   if (parena)
     return parena;
-  return NULL; /* TODO */
+  IThreadLocal_Get(phd->pthrlArena, (PPVOID)(&parena));
+  if (!parena)
+    parena = _HeapChooseArenaHard(phd);
+  return parena;
+}
+
+/*
+ * Allocates a block of memory, dispatching it to an arena or the huge allocator depending on its size.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - sz = Size of the block to allocate, in bytes.  Must be non-zero.
+ * - fZero = If TRUE, the returned block will be zero-filled.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the new memory block.
+ */
+PVOID _HeapMalloc(PHEAPDATA phd, SIZE_T sz, BOOL fZero)
+{
+  _H_ASSERT(phd, sz != 0);
+  if (sz <= phd->szArenaMaxClass)
+    return _HeapArenaMalloc(phd, NULL, sz, fZero, TRUE);
+  return _HeapHugeMalloc(phd, sz, fZero);
+}
+
+/*
+ * Allocates a number of memory blocks of the same size.  Small blocks are taken from the arena bin for their
+ * size class under a single acquisition of the bin mutex; larger blocks are allocated one at a time.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - sz = Size of each memory block to allocate, in bytes.  Must be non-zero.
+ * - n = Number of blocks to allocate.
+ * - ppv = Pointer to an array of n pointers that receives the new blocks.
+ *
+ * Returns:
+ * The number of blocks actually allocated, which will be less than n only if memory ran out.  The new blocks
+ * are stored in the first elements of ppv.
+ */
+UINT32 _HeapMallocBatch(PHEAPDATA phd, SIZE_T sz, UINT32 n, PPVOID ppv)
+{
+  register UINT32 i;   /* loop counter */
+
+  _H_ASSERT(phd, sz != 0);
+  if (sz <= SMALL_MAXCLASS)
+    return _HeapArenaMallocSmallBatch(phd, _HeapChooseArena(phd, NULL), sz, n, ppv);
+  for (i = 0; i < n; i++)
+  {
+    if (!(ppv[i] = _HeapMalloc(phd, sz, FALSE)))
+      break;
+  }
+  return i;
+}
+
+/*
+ * Computes the usable size that will result from allocating a block of memory with a specified size and
+ * alignment.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - sz = Size of the block to allocate, in bytes.
+ * - szAlignment = Alignment of the block; must be a power of 2.
+ *
+ * Returns:
+ * - 0 = The size and alignment overflow the address space.
+ * - Other = The usable size of the block.
+ */
+SIZE_T _HeapSA2U(PHEAPDATA phd, SIZE_T sz, SIZE_T szAlignment)
+{
+  SIZE_T rc;         /* return from this function */
+  SIZE_T szRun;      /* size of the over-sized run needed to guarantee the alignment */
+
+  _H_ASSERT(phd, (szAlignment != 0) && (((szAlignment - 1) & szAlignment) == 0));
+
+  /*
+   * Round the size up to a multiple of the alignment.  Small size classes that are multiples of the alignment
+   * are naturally aligned, as are all page-sized allocations, so page alignment or less can be had that way.
+   */
+  rc = ALIGNMENT_CEILING(sz, szAlignment - 1);
+  if (rc < sz)
+    return 0;   /* maximal alignment plus size greater than that alignment */
+  if ((rc <= phd->szArenaMaxClass) && (szAlignment <= SYS_PAGE_SIZE))
+  {
+    if (rc <= SMALL_MAXCLASS)
+      return phd->aArenaBinInfo[SMALL_SIZE2BIN(rc)].cbRegions;
+    return SYS_PAGE_CEILING(rc);
+  }
+
+  /* We can't achieve subpage alignment beyond this point, so round the alignment up to a page. */
+  szAlignment = SYS_PAGE_CEILING(szAlignment);
+  rc = SYS_PAGE_CEILING(sz);
+  if ((rc < sz) || (rc + szAlignment < rc))
+    return 0;   /* overflow */
+
+  /*
+   * Calculate the size of the over-sized run that _HeapArenaPalloc() would need in order to guarantee the
+   * alignment.  If it wouldn't fit within a chunk, round up to a huge allocation size.
+   */
+  szRun = rc + szAlignment - SYS_PAGE_SIZE;
+  if (szRun <= phd->szArenaMaxClass)
+    return rc;
+  return CHUNK_CEILING(phd, rc);
+}
+
+/*
+ * Allocates a block of memory with a specified alignment, dispatching it to an arena or the huge allocator
+ * depending on its size and alignment.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - sz = Usable size of the block to allocate, as returned by _HeapSA2U().  Must be non-zero.
+ * - szAlignment = Alignment of the block; must be a power of 2.
+ * - fZero = If TRUE, the returned block will be zero-filled.
+ * - fTryTCache = If TRUE, try to allocate the block from the thread cache.
+ *
+ * Returns:
+ * - NULL = The allocation failed.
+ * - Other = Pointer to the new memory block.
+ */
+PVOID _HeapPalloc(PHEAPDATA phd, SIZE_T sz, SIZE_T szAlignment, BOOL fZero, BOOL fTryTCache)
+{
+  PVOID rc;    /* return from this function */
+
+  _H_ASSERT(phd, sz != 0);
+  _H_ASSERT(phd, sz == _HeapSA2U(phd, sz, szAlignment));
+
+  if ((sz <= phd->szArenaMaxClass) && (szAlignment <= SYS_PAGE_SIZE))
+    rc = _HeapArenaMalloc(phd, NULL, sz, fZero, fTryTCache);
+  else if (sz <= phd->szArenaMaxClass)
+    rc = _HeapArenaPalloc(phd, _HeapChooseArena(phd, NULL), sz, szAlignment, fZero);
+  else if (szAlignment <= phd->szChunk)
+    rc = _HeapHugeMalloc(phd, sz, fZero);
+  else
+    rc = _HeapHugePalloc(phd, sz, szAlignment, fZero);
+
+  _H_ASSERT(phd, ALIGNMENT_ADDR2BASE(rc, szAlignment - 1) == rc);
+  return rc;
+}
+
+/*
+ * Returns the usable size of an allocated block of memory.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the memory block.
+ * - fDemote = If TRUE, a small allocation promoted to a page for profiling reports the size of the page.
+ *
+ * Returns:
+ * The usable size of the memory block, in bytes.
+ */
+SIZE_T _HeapSAlloc(PHEAPDATA phd, PCVOID pv, BOOL fDemote)
+{
+  if (CHUNK_ADDR2BASE(phd, pv) != pv)
+    return _HeapArenaSAlloc(phd, pv, fDemote);
+  return _HeapHugeSAlloc(phd, pv);
+}
+
+/*
+ * Frees an allocated block of memory.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the memory block to be freed.
+ * - fTryTCache = If TRUE, try to return the block to the thread cache.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapDAlloc(PHEAPDATA phd, PVOID pv, BOOL fTryTCache)
+{
+  PARENACHUNK pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);  /* pointer to enclosing chunk */
+
+  if ((PVOID)pChunk != pv)
+    _HeapArenaDAlloc(phd, pChunk->parena, pChunk, pv, fTryTCache);
+  else
+    _HeapHugeDAlloc(phd, pv, TRUE);
+}
+
+/*
+ * Determines whether a pointer lies within a chunk allocated by this heap.  The chunk radix tree is read without
+ * locking, through the calling thread's lookup cache if it has a thread cache.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = The pointer to be tested.
+ *
+ * Returns:
+ * TRUE if the pointer lies within one of this heap's chunks, FALSE if not.
+ */
+static BOOL heap_owns(PHEAPDATA phd, PCVOID pv)
+{
+  UINT_PTR uiKey = (UINT_PTR)CHUNK_ADDR2BASE(phd, pv);   /* chunk base address */
+  PTCACHE ptcache = _HeapTCacheGet(phd, FALSE);          /* pointer to thread cache */
+
+  if (ptcache)
+    return MAKEBOOL(_HeapRTreeGetCached(phd, phd->prtChunks, uiKey, &(ptcache->rtcChunks)) != NULL);
+  return MAKEBOOL(_HeapRTreeGet(phd, phd->prtChunks, uiKey) != NULL);
+}
+
+/*
+ * Shrinks the heap's physical footprint as far as possible.  The calling thread's cache is drained directly;
+ * every other thread cache is asked to drain itself at its next GC event.  Then every arena purges all of its
+ * dirty pages and releases its spare chunk.  Chunks that become entirely free as the caller's cache drains are
+ * handed back through the arena's spare chunk along the way.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ *
+ * Returns:
+ * The number of bytes released to the chunk allocator.
+ */
+static SIZE_T heap_minimize(PHEAPDATA phd)
+{
+  SIZE_T rc = 0;           /* return from this function */
+  PTCACHE ptcache;         /* pointer to the thread cache */
+  PARENA pArena;           /* pointer to arena */
+  register UINT32 i;       /* loop counter */
+
+  ptcache = _HeapTCacheGet(phd, FALSE);
+  if (ptcache)
+    _HeapTCacheDrain(phd, ptcache);
+
+  for (i = 0; i < phd->cArenas; i++)
+  {
+    IMutex_Lock(phd->pmtxArenas);
+    pArena = phd->aparenas[i];
+    IMutex_Unlock(phd->pmtxArenas);
+    if (pArena)
+    {
+      _HeapTCacheRequestDrain(phd, pArena, ptcache);
+      rc += _HeapArenaMinimize(phd, pArena);
+    }
+  }
+  return rc;
+}
+
+/*
+ * Frees an allocated block of memory whose requested size is known to the caller.  The size determines whether
+ * the block is small, large, or huge, so no chunk lookup or decoding of the chunk map bits is needed to route a
+ * small or large block to the thread cache.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the memory block to be freed.
+ * - sz = Size most recently requested for the block, when it was allocated or last reallocated.  Must be
+ *        non-zero.
+ * - fTryTCache = If TRUE, try to return the block to the thread cache.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapDAllocSized(PHEAPDATA phd, PVOID pv, SIZE_T sz, BOOL fTryTCache)
+{
+  PARENACHUNK pChunk;   /* pointer to enclosing chunk */
+  PTCACHE ptcache;      /* pointer to the thread cache */
+
+  _H_ASSERT(phd, sz != 0);
+  _H_DEBUG_ASSERT(phd, heap_owns(phd, pv));
+  _H_DEBUG_ASSERT(phd, _HeapSAlloc(phd, pv, FALSE) == _HeapSA2U(phd, sz, 1));
+
+  if (sz > phd->szArenaMaxClass)
+  {
+    _HeapHugeDAlloc(phd, pv, TRUE);
+    return;
+  }
+  if (sz <= SMALL_MAXCLASS)
+  {
+    if (fTryTCache && ((ptcache = _HeapTCacheGet(phd, FALSE)) != NULL))
+    {
+      _HeapTCacheDAllocSmall(phd, ptcache, pv, SMALL_SIZE2BIN(sz));
+      return;
+    }
+    pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);
+    _HeapArenaDAllocSmall(phd, pChunk->parena, pChunk, pv, ((UINT_PTR)pv - (UINT_PTR)pChunk) >> SYS_PAGE_BITS,
+			  NULL);
+    return;
+  }
+  sz = SYS_PAGE_CEILING(sz);
+  ptcache = (fTryTCache ? _HeapTCacheGet(phd, FALSE) : NULL);
+  if (ptcache && (sz <= phd->cbTCacheMaxClass))
+    _HeapTCacheDAllocLarge(phd, ptcache, pv, sz);
+  else
+  {
+    pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);
+    _HeapArenaDAllocLarge(phd, pChunk->parena, pChunk, pv, ptcache);
+  }
+}
+
+/*
+ * Frees an array of allocated blocks of memory.  Huge blocks are freed individually; the rest are passed to
+ * the arenas, which put what fits into the thread cache and free the others grouped by run.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - n = Number of elements in the ppv array.
+ * - ppv = Pointer to an array of pointers to the blocks to be freed.  NULL elements are skipped; each other
+ *         element is set to NULL as its block is freed.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapDAllocBatch(PHEAPDATA phd, UINT32 n, PPVOID ppv)
+{
+  register UINT32 i;   /* loop counter */
+
+  for (i = 0; i < n; i++)
+  {
+    if (ppv[i] && (CHUNK_ADDR2BASE(phd, ppv[i]) == ppv[i]))
+    {
+      _HeapHugeDAlloc(phd, ppv[i], TRUE);
+      ppv[i] = NULL;
+    }
+  }
+  _HeapArenaDAllocBatch(phd, n, ppv, _HeapTCacheGet(phd, FALSE));
+}
+
+/*
+ * Reallocates a block of memory to a new size.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the memory block to be reallocated.
+ * - sz = New size of the memory block, in bytes.  Must be non-zero.
+ *
+ * Returns:
+ * - NULL = The reallocation failed.  The old block is left untouched.
+ * - Other = Pointer to the reallocated block.
+ */
+static PVOID heap_ralloc(PHEAPDATA phd, PVOID pv, SIZE_T sz)
+{
+  SIZE_T szOld = _HeapSAlloc(phd, pv, FALSE);  /* old size of the block */
+
+  if (sz <= phd->szArenaMaxClass)
+    return _HeapArenaRAlloc(phd, pv, szOld, sz, 0, 0, FALSE, TRUE, TRUE);
+  return _HeapHugeRAlloc(phd, pv, szOld, sz, 0, 0, FALSE, TRUE);
 }
 
 /*------------------------
@@ -97,6 +498,16 @@ static HRESULT malloc_QueryInterface(IUnknown *pThis, REFIID riid, PPVOID ppvObj
     *ppvObject = &(((PHEAPDATA)pThis)->cpContainerInterface);
   else if (IsEqualIID(riid, &IID_IHeapConfiguration))
     *ppvObject = &(((PHEAPDATA)pThis)->heapConfInterface);
+  else if (IsEqualIID(riid, &IID_IMallocAligned))
+    *ppvObject = &(((PHEAPDATA)pThis)->mallocAlignedInterface);
+  else if (IsEqualIID(riid, &IID_IMallocBatch))
+    *ppvObject = &(((PHEAPDATA)pThis)->mallocBatchInterface);
+  else if (IsEqualIID(riid, &IID_IMallocSized))
+    *ppvObject = &(((PHEAPDATA)pThis)->mallocSizedInterface);
+  else if (IsEqualIID(riid, &IID_IHeapStatistics))
+    *ppvObject = &(((PHEAPDATA)pThis)->heapStatsInterface);
+  else if (IsEqualIID(riid, &IID_IHeapProfile) && (((PHEAPDATA)pThis)->uiFlags & PHDFLAGS_PROFILE))
+    *ppvObject = &(((PHEAPDATA)pThis)->heapProfInterface);
   else
     return E_NOINTERFACE;
   IUnknown_AddRef((IUnknown *)(*ppvObject));
@@ -130,6 +541,7 @@ static void toplevel_shutdown(PHEAPDATA phd)
 {
     ObjHlpFixedCpTeardown(&(phd->fcpMallocSpy));
     ObjHlpFixedCpTeardown(&(phd->fcpSequentialStream));
+    IUnknown_Release(phd->pThreadLocalFactory);
     IUnknown_Release(phd->pMutexFactory);
     IUnknown_Release(phd->pChunkAllocator);
 }
@@ -154,6 +566,11 @@ static UINT32 malloc_Release(IUnknown *pThis)
   {
     phd->uiFlags |= PHDFLAGS_DELETING;
     /* Do subsystem shutdown. */
+    _HeapProfShutdown(phd);
+    _HeapStatsShutdown(phd);
+    _HeapTCacheShutdown(phd);
+    _HeapArenaShutdown(phd);
+    _HeapHugeShutdown(phd);
     _HeapChunkShutdown(phd);
     _HeapBaseShutdown(phd);
     toplevel_shutdown(phd);
@@ -166,6 +583,51 @@ static UINT32 malloc_Release(IUnknown *pThis)
   return rc;
 }
 
+/*
+ * Determines whether a block was allocated while the currently-connected IMallocSpy was connected.  Connecting
+ * or disconnecting a spy bumps the connection point's generation, which invalidates all earlier marks at once.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pBlock = Pointer to the block, as returned by the spy.  This may be offset into the actual block by less
+ *            than a page.
+ *
+ * Returns:
+ * TRUE if the block was allocated while the current spy was connected, FALSE if not.
+ */
+static BOOL isSpyedByCurrentSpy(PHEAPDATA phd, PVOID pBlock)
+{
+  PARENACHUNK pChunk;   /* pointer to enclosing chunk */
+
+  if (!pBlock || !heap_owns(phd, pBlock))
+    return FALSE;
+  pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pBlock);
+  if (((UINT_PTR)pBlock - (UINT_PTR)pChunk) >= (phd->cpgMapBias << SYS_PAGE_BITS))
+    return _HeapArenaIsSpyed(phd, pChunk, pBlock, phd->fcpMallocSpy.uiGeneration);
+  return _HeapHugeIsSpyed(phd, pChunk, phd->fcpMallocSpy.uiGeneration);  /* no arena object lies that low */
+}
+
+/*
+ * Marks or unmarks a block as allocated while the current IMallocSpy is connected.
+ *
+ * Parameters:
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the start of the actual block.
+ * - fMark = TRUE to mark the block, FALSE to unmark it.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void spy_mark(PHEAPDATA phd, PVOID pv, BOOL fMark)
+{
+  PARENACHUNK pChunk = (PARENACHUNK)CHUNK_ADDR2BASE(phd, pv);  /* pointer to enclosing chunk */
+
+  if ((PVOID)pChunk != pv)
+    _HeapArenaSpyMark(phd, pChunk, pv, phd->fcpMallocSpy.uiGeneration, fMark);
+  else
+    _HeapHugeSpyMark(phd, pv, phd->fcpMallocSpy.uiGeneration, fMark);
+}
+
 static PVOID malloc_Alloc(IMalloc *pThis, SIZE_T cb)
 {
   PHEAPDATA phd = (PHEAPDATA)pThis;  /* pointer to heap data */
@@ -183,38 +645,70 @@ static PVOID malloc_Alloc(IMalloc *pThis, SIZE_T cb)
   if (cbActual == 0)
     cbActual = 1;  /* allocate at least SOMETHING */
 
-  rc = NULL; /* TODO */
+  rc = _HeapMalloc(phd, cbActual, FALSE);
+  PROF_MALLOC(phd, rc, RETURN_ADDRESS());
 
   /* handle PostAlloc call */
   if (phd->pMallocSpy)
+  {
+    if (rc)
+      spy_mark(phd, rc, TRUE);
     rc = IMallocSpy_PostAlloc(phd->pMallocSpy, rc);
+  }
 
   return rc;
 }
 
-static BOOL isSpyedByCurrentSpy(PHEAPDATA phd, PVOID pBlock)
-{
-  return FALSE; /* TODO */
-}
-
 static PVOID malloc_Realloc(IMalloc *pThis, PVOID pv, SIZE_T cb)
 {
   PHEAPDATA phd = (PHEAPDATA)pThis;  /* pointer to heap data */
   PVOID pvActual = pv;               /* actual heap block pointer */
   SIZE_T cbActual = cb;              /* actual number of bytes requested */
   PVOID rc;                          /* return from this function */
-  BOOL fSpyed;                       /* were we allocated while currently spyed on? */
+  BOOL fSpyed = FALSE;               /* were we allocated while currently spyed on? */
 
   /* handle PreRealloc call */
   if (phd->pMallocSpy)
   {
-    fSpyed = isSpyedByCurrentSpy(phd, pv);
+    fSpyed = (pv ? isSpyedByCurrentSpy(phd, pv) : TRUE);  /* a block allocated from NULL will be spyed */
     cbActual = IMallocSpy_PreRealloc(phd->pMallocSpy, pv, cb, &pvActual, fSpyed);
     if ((cbActual == 0) && (cb != 0))
       return NULL; /* simulated memory failure */
   }
 
-  rc = NULL; /* TODO */
+  if (!pvActual)
+  { /* equivalent to Alloc, so the new block belongs to the current spy */
+    rc = _HeapMalloc(phd, intMax(cbActual, 1), FALSE);
+    PROF_MALLOC(phd, rc, RETURN_ADDRESS());
+    if (phd->pMallocSpy && rc)
+    {
+      spy_mark(phd, rc, TRUE);
+      fSpyed = TRUE;
+    }
+  }
+  else if (!heap_owns(phd, pvActual))
+    rc = NULL;  /* not our block */
+  else if (cbActual == 0)
+  { /* equivalent to Free */
+    if (fSpyed)
+      spy_mark(phd, pvActual, FALSE);
+    PROF_FREE(phd, pvActual);
+    _HeapDAlloc(phd, pvActual, TRUE);
+    rc = NULL;
+  }
+  else
+  {
+    if (fSpyed)  /* unmark first, since the old block may be freed and reused before we return */
+      spy_mark(phd, pvActual, FALSE);
+    rc = heap_ralloc(phd, pvActual, cbActual);
+    if (rc)
+    { /* the old block is only gone if the reallocation succeeded */
+      PROF_FREE(phd, pvActual);
+      PROF_MALLOC(phd, rc, RETURN_ADDRESS());
+    }
+    if (fSpyed)
+      spy_mark(phd, (rc ? rc : pvActual), TRUE);
+  }
 
   /* handle PostRealloc call */
   if (phd->pMallocSpy)
@@ -227,7 +721,7 @@ static void malloc_Free(IMalloc *pThis, PVOID pv)
 {
   PHEAPDATA phd = (PHEAPDATA)pThis;  /* pointer to heap data */
   PVOID pvActual = pv;               /* actual heap block pointer */
-  BOOL fSpyed;                       /* were we allocated while currently spyed on? */
+  BOOL fSpyed = FALSE;               /* were we allocated while currently spyed on? */
 
   if (!pv)
     return;  /* no effect if pointer is NULL */
@@ -239,8 +733,13 @@ static void malloc_Free(IMalloc *pThis, PVOID pv)
     pvActual = IMallocSpy_PreFree(phd->pMallocSpy, pv, fSpyed);
   }
 
-  /* TODO */
-  UNUSED(pvActual);
+  if (pvActual && heap_owns(phd, pvActual))
+  {
+    if (fSpyed)
+      spy_mark(phd, pvActual, FALSE);
+    PROF_FREE(phd, pvActual);
+    _HeapDAlloc(phd, pvActual, TRUE);
+  }
 
   /* handle PostFree call */
   if (phd->pMallocSpy)
@@ -251,7 +750,7 @@ static SIZE_T malloc_GetSize(IMalloc *pThis, PVOID pv)
 {
   PHEAPDATA phd = (PHEAPDATA)pThis;  /* pointer to heap data */
   PVOID pvActual = pv;               /* actual heap block pointer */
-  BOOL fSpyed;                       /* were we allocated while currently spyed on? */
+  BOOL fSpyed = FALSE;               /* were we allocated while currently spyed on? */
   SIZE_T rc;                         /* return from this function */
 
   /* handle PreGetSize call */
@@ -261,8 +760,10 @@ static SIZE_T malloc_GetSize(IMalloc *pThis, PVOID pv)
     pvActual = IMallocSpy_PreGetSize(phd->pMallocSpy, pv, fSpyed);
   }
 
-  rc = -1;  /* TODO */
-  UNUSED(pvActual);
+  if (pvActual && heap_owns(phd, pvActual))
+    rc = _HeapSAlloc(phd, pvActual, FALSE);
+  else
+    rc = -1;  /* not our block */
 
   /* handle PostGetSize call */
   if (phd->pMallocSpy)
@@ -275,7 +776,7 @@ static INT32 malloc_DidAlloc(IMalloc *pThis, PVOID pv)
 {
   PHEAPDATA phd = (PHEAPDATA)pThis;  /* pointer to heap data */
   PVOID pvActual = pv;               /* actual heap block pointer */
-  BOOL fSpyed;                       /* were we allocated while currently spyed on? */
+  BOOL fSpyed = FALSE;               /* were we allocated while currently spyed on? */
   INT32 rc;                          /* return from this function */
 
   /* handle PreDidAlloc call */
@@ -285,8 +786,10 @@ static INT32 malloc_DidAlloc(IMalloc *pThis, PVOID pv)
     pvActual = IMallocSpy_PreDidAlloc(phd->pMallocSpy, pv, fSpyed);
   }
 
-  rc = -1; /* TODO */
-  UNUSED(pvActual);
+  if (pvActual)
+    rc = (heap_owns(phd, pvActual) ? 1 : 0);
+  else
+    rc = -1;
 
   /* handle PostDidAlloc call */
   if (phd->pMallocSpy)
@@ -303,7 +806,7 @@ static void malloc_HeapMinimize(IMalloc *pThis)
   if (phd->pMallocSpy)
     IMallocSpy_PreHeapMinimize(phd->pMallocSpy);
 
-  /* TODO */
+  heap_minimize(phd);
 
   /* handle PostHeapMinimize call */
   if (phd->pMallocSpy)
@@ -581,53 +1084,857 @@ static HRESULT heapconf_SetActiveDirtyRatio(IHeapConfiguration *pThis, SSIZE_T c
   return S_OK;
 }
 
-/* The IHeapConfiguration vtable. */
-static const SEG_RODATA struct IHeapConfigurationVTable vtblHeapConfiguration =
+/*
+ * Retrieves the current fill mode of the heap.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapConfiguration interface in the heap data object.
+ * - puiFillFlags = Pointer to location to receive the fill mode, a combination of PHDFLAGS_JUNKFILL and
+ *                  PHDFLAGS_ZEROFILL.
+ *
+ * Returns:
+ * - S_OK = Fill mode returned successfully.
+ * - E_POINTER = The pointer puiFillFlags is invalid.
+ */
+static HRESULT heapconf_GetFillMode(IHeapConfiguration *pThis, UINT32 *puiFillFlags)
 {
-  .QueryInterface = heapconf_QueryInterface,
-  .AddRef = heapconf_AddRef,
-  .Release = heapconf_Release,
-  .SetAbortProc = heapconf_SetAbortProc,
-  .GetActiveDirtyRatio = heapconf_GetActiveDirtyRatio,
-  .SetActiveDirtyRatio = heapconf_SetActiveDirtyRatio
-};
+  PHEAPDATA phd = (PHEAPDATA)HeapDataPtr(pThis);  /* pointer to heap data */
+  if (!puiFillFlags)
+    return E_POINTER;
+  *puiFillFlags = phd->uiFillFlags;
+  return S_OK;
+}
 
-/*------------------------
- * Heap creation function
- *------------------------
+/*
+ * Sets the fill mode of the heap.  With PHDFLAGS_JUNKFILL, new memory is filled with junk and freed memory is
+ * overwritten with different junk; with PHDFLAGS_ZEROFILL, new memory is filled with zeroes.  Junk fill takes
+ * precedence if both are specified.  The change takes effect for subsequent allocations and frees.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapConfiguration interface in the heap data object.
+ * - uiFillFlags = The new fill mode, a combination of PHDFLAGS_JUNKFILL and PHDFLAGS_ZEROFILL, or 0 to
+ *                 turn filling off.
+ *
+ * Returns:
+ * - S_OK = Set the value successfully.
+ * - E_INVALIDARG = Invalid bits were specified in uiFillFlags.
  */
-
-#define DEFAULT_CBACTIVEDIRTYRATIO 3
+static HRESULT heapconf_SetFillMode(IHeapConfiguration *pThis, UINT32 uiFillFlags)
+{
+  PHEAPDATA phd = (PHEAPDATA)HeapDataPtr(pThis);  /* pointer to heap data */
+  if (uiFillFlags & ~PHDFLAGS_FILL)
+    return E_INVALIDARG;
+  phd->uiFillFlags = uiFillFlags;
+  return S_OK;
+}
 
 /*
- * Creates a heap implementation and returns a pointer to its IMalloc interface.
+ * Retrieves the depth of each arena's spare-chunk cache, the number of completely free chunks an arena keeps for
+ * reuse rather than returning them to the chunk allocator.
  *
  * Parameters:
- * - prhd = Pointer to a RAWHEAPDATA structure, which contains sufficient memory to hold the global data
- *          for the heap.
- * - pfnFree = Pointer to a function called as the last stage of releasing the heap, which frees the
- *             "prhd" block.  May be NULL.
- * - uiFlags = Flag bits for the heap.
- * - nChunkBits = Number of "bits" in a memory chunk that gets allocated.
- * - pChunkAllocator = Pointer to the IChunkAllocator interface used by the heap to allocate chunks of memory
- *                     for carving up by the heap.
- * - pMutexFactory = Pointer to the IMutexFactory interface used to allocate IMutex objects.
- * - ppHeap = Pointer location that will receive a pointer to the heap's IMalloc interface.
+ * - pThis = Pointer to the HeapConfiguration interface in the heap data object.
+ * - pcChunks = Pointer to location to receive the cache depth.
  *
  * Returns:
- * Standard HRESULT success/failure.
+ * - S_OK = Retrieved the value successfully.
+ * - E_POINTER = Invalid pointer for the pcChunks object.
  */
-HRESULT HeapCreate(PRAWHEAPDATA prhd, PFNRAWHEAPDATAFREE pfnFree, UINT32 uiFlags, UINT32 nChunkBits, 
-		   IChunkAllocator *pChunkAllocator, IMutexFactory *pMutexFactory, IMalloc **ppHeap)
+static HRESULT heapconf_GetSpareChunkDepth(IHeapConfiguration *pThis, UINT32 *pcChunks)
 {
-  PHEAPDATA phd;   /* pointer to actual heap data */
-  HRESULT hr;      /* HRESULT of intermediate operations */
+  PHEAPDATA phd = (PHEAPDATA)HeapDataPtr(pThis);  /* pointer to heap data */
+  if (!pcChunks)
+    return E_POINTER;
+  *pcChunks = phd->cSpareChunksMax;
+  return S_OK;
+}
 
-  if (sizeof(RAWHEAPDATA) < sizeof(HEAPDATA))
-    return MEMMGR_E_BADHEAPDATASIZE;  /* bogus size of raw heap data */
+/*
+ * Sets the depth of each arena's spare-chunk cache.  A depth of 0 returns every free chunk to the chunk allocator
+ * at once.  An arena already holding more spares than the new depth keeps them until they are reused or the heap
+ * is minimized.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapConfiguration interface in the heap data object.
+ * - cChunks = The new cache depth.
+ *
+ * Returns:
+ * - S_OK = Set the value successfully.
+ * - E_INVALIDARG = The depth is larger than the maximum the heap supports.
+ */
+static HRESULT heapconf_SetSpareChunkDepth(IHeapConfiguration *pThis, UINT32 cChunks)
+{
+  PHEAPDATA phd = (PHEAPDATA)HeapDataPtr(pThis);  /* pointer to heap data */
+  if (cChunks > MAX_SPARE_CHUNKS)
+    return E_INVALIDARG;
+  phd->cSpareChunksMax = cChunks;
+  return S_OK;
+}
+
+/*
+ * Shrinks the heap's physical footprint as far as possible, as IMalloc::HeapMinimize does, and reports how much
+ * memory was released.  Thread caches belonging to other threads are only flagged, and drain later.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapConfiguration interface in the heap data object.
+ * - pcbReleased = Pointer to location to receive the number of bytes released.  May be NULL.
+ *
+ * Returns:
+ * - S_OK = The heap was minimized.
+ */
+static HRESULT heapconf_Minimize(IHeapConfiguration *pThis, SIZE_T *pcbReleased)
+{
+  PHEAPDATA phd = (PHEAPDATA)HeapDataPtr(pThis);  /* pointer to heap data */
+  SIZE_T cb;                                      /* number of bytes released */
+
+  cb = heap_minimize(phd);
+  if (pcbReleased)
+    *pcbReleased = cb;
+  return S_OK;
+}
+
+/* The IHeapConfiguration vtable. */
+static const SEG_RODATA struct IHeapConfigurationVTable vtblHeapConfiguration =
+{
+  .QueryInterface = heapconf_QueryInterface,
+  .AddRef = heapconf_AddRef,
+  .Release = heapconf_Release,
+  .SetAbortProc = heapconf_SetAbortProc,
+  .GetActiveDirtyRatio = heapconf_GetActiveDirtyRatio,
+  .SetActiveDirtyRatio = heapconf_SetActiveDirtyRatio,
+  .GetFillMode = heapconf_GetFillMode,
+  .SetFillMode = heapconf_SetFillMode,
+  .GetSpareChunkDepth = heapconf_GetSpareChunkDepth,
+  .SetSpareChunkDepth = heapconf_SetSpareChunkDepth,
+  .Minimize = heapconf_Minimize
+};
+
+/*-------------------------------
+ * IMallocAligned implementation
+ *-------------------------------
+ */
+
+/* Quick macro to get the PHEAPDATA from the IMallocAligned pointer */
+#undef HeapDataPtr
+#define HeapDataPtr(pma)     (((PBYTE)(pma)) - OFFSETOF(HEAPDATA, mallocAlignedInterface))
+
+/*
+ * Queries for an interface on the heap object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocAligned interface in the heap data object.
+ * - riid = Reference to the IID of the interface we want to load.
+ * - ppvObject = Pointer to the location to receive the new interface pointer.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator:
+ * - S_OK = New interface pointer was returned.
+ * - E_NOINTERFACE = The object does not support this interface.
+ * - E_POINTER = The ppvObject pointer is not valid.
+ */
+static HRESULT mallocaligned_QueryInterface(IUnknown *pThis, REFIID riid, PPVOID ppvObject)
+{
+  return malloc_QueryInterface((IUnknown *)HeapDataPtr(pThis), riid, ppvObject);
+}
+
+/*
+ * Adds a reference to the heap data object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocAligned interface in the heap data object.
+ *
+ * Returns:
+ * The new reference count on the object.
+ */
+static UINT32 mallocaligned_AddRef(IUnknown *pThis)
+{
+  return malloc_AddRef((IUnknown *)HeapDataPtr(pThis));
+}
+
+/*
+ * Removes a reference from the heap data object.  The object is freed when its reference count reaches 0.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocAligned interface in the heap data object.
+ *
+ * Returns:
+ * The new reference count on the object.
+ */
+static UINT32 mallocaligned_Release(IUnknown *pThis)
+{
+  return malloc_Release((IUnknown *)HeapDataPtr(pThis));
+}
+
+/*
+ * Allocates a block of memory aligned on a specified boundary.  The block may be freed, reallocated, and sized
+ * through IMalloc like any other block; a reallocation is not guaranteed to preserve the alignment.  Since an
+ * IMallocSpy may offset the pointers it's given, aligned allocations are not passed to the spy.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocAligned interface in the heap data object.
+ * - cb = Number of bytes to allocate.
+ * - cbAlignment = Required alignment of the block, in bytes.  Must be a power of 2.
+ *
+ * Returns:
+ * - NULL = The allocation failed, or the alignment was invalid.
+ * - Other = Pointer to the new memory block.
+ */
+static PVOID mallocaligned_AllocAligned(IMallocAligned *pThis, SIZE_T cb, SIZE_T cbAlignment)
+{
+  PHEAPDATA phd = (PHEAPDATA)HeapDataPtr(pThis);   /* pointer to heap data */
+  SIZE_T cbUsable;                                 /* usable size of the block */
+  PVOID rc;                                        /* return from this function */
+
+  if ((cbAlignment == 0) || (((cbAlignment - 1) & cbAlignment) != 0))
+    return NULL;   /* alignment not a power of 2 */
+  cbUsable = _HeapSA2U(phd, intMax(cb, 1), cbAlignment);
+  if (cbUsable == 0)
+    return NULL;   /* size overflow */
+  rc = _HeapPalloc(phd, cbUsable, cbAlignment, FALSE, TRUE);
+  PROF_MALLOC(phd, rc, RETURN_ADDRESS());
+  return rc;
+}
+
+/* The IMallocAligned vtable. */
+static const SEG_RODATA struct IMallocAlignedVTable vtblMallocAligned =
+{
+  .QueryInterface = mallocaligned_QueryInterface,
+  .AddRef = mallocaligned_AddRef,
+  .Release = mallocaligned_Release,
+  .AllocAligned = mallocaligned_AllocAligned
+};
+
+/*-----------------------------
+ * IMallocBatch implementation
+ *-----------------------------
+ */
+
+/* Quick macro to get the PHEAPDATA from the IMallocBatch pointer */
+#undef HeapDataPtr
+#define HeapDataPtr(pmb)     (((PBYTE)(pmb)) - OFFSETOF(HEAPDATA, mallocBatchInterface))
+
+/*
+ * Queries for an interface on the heap object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocBatch interface in the heap data object.
+ * - riid = Reference to the IID of the interface we want to load.
+ * - ppvObject = Pointer to the location to receive the new interface pointer.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator:
+ * - S_OK = New interface pointer was returned.
+ * - E_NOINTERFACE = The object does not support this interface.
+ * - E_POINTER = The ppvObject pointer is not valid.
+ */
+static HRESULT mallocbatch_QueryInterface(IUnknown *pThis, REFIID riid, PPVOID ppvObject)
+{
+  return malloc_QueryInterface((IUnknown *)HeapDataPtr(pThis), riid, ppvObject);
+}
+
+/*
+ * Adds a reference to the heap data object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocBatch interface in the heap data object.
+ *
+ * Returns:
+ * The new reference count on the object.
+ */
+static UINT32 mallocbatch_AddRef(IUnknown *pThis)
+{
+  return malloc_AddRef((IUnknown *)HeapDataPtr(pThis));
+}
+
+/*
+ * Removes a reference from the heap data object.  The object is freed when its reference count reaches 0.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocBatch interface in the heap data object.
+ *
+ * Returns:
+ * The new reference count on the object.
+ */
+static UINT32 mallocbatch_Release(IUnknown *pThis)
+{
+  return malloc_Release((IUnknown *)HeapDataPtr(pThis));
+}
+
+/*
+ * Allocates a number of memory blocks of the same size, equivalent to calling IMalloc::Alloc that many times.
+ * Blocks of the same small size class are all taken from their arena bin under one lock acquisition.  If an
+ * IMallocSpy is registered, the blocks are allocated one at a time through IMalloc::Alloc so the spy sees each.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocBatch interface in the heap data object.
+ * - cb = Number of bytes to allocate for each block.
+ * - n = Number of blocks to allocate.
+ * - ppv = Pointer to an array of n pointers that receives the new blocks.
+ *
+ * Returns:
+ * The number of blocks actually allocated, which will be less than n only if memory ran out.  The new blocks
+ * are stored in the first elements of ppv; the remaining elements are set to NULL.
+ */
+static UINT32 mallocbatch_AllocBatch(IMallocBatch *pThis, SIZE_T cb, UINT32 n, PPVOID ppv)
+{
+  PHEAPDATA phd = (PHEAPDATA)HeapDataPtr(pThis);   /* pointer to heap data */
+  register UINT32 i;                               /* loop counter */
+  UINT32 rc;                                       /* return from this function */
+
+  if (!ppv)
+    return 0;
+  if (phd->pMallocSpy)
+  { /* go through the spy for each block */
+    for (rc = 0; rc < n; rc++)
+    {
+      if (!(ppv[rc] = malloc_Alloc((IMalloc *)phd, cb)))
+	break;
+    }
+  }
+  else
+  {
+    rc = _HeapMallocBatch(phd, intMax(cb, 1), n, ppv);
+    if (phd->uiFlags & PHDFLAGS_PROFILE_ACTIVE)
+    {
+      for (i = 0; i < rc; i++)
+	_HeapProfMalloc(phd, ppv[i], RETURN_ADDRESS());
+    }
+  }
+  for (i = rc; i < n; i++)
+    ppv[i] = NULL;
+  return rc;
+}
+
+/*
+ * Frees an array of memory blocks, equivalent to calling IMalloc::Free on each.  Blocks go to the thread cache
+ * while it has room for them; the rest are sorted by address and returned to the arenas grouped by run, so each
+ * arena bin or arena mutex is acquired once per group rather than once per block.  If an IMallocSpy is
+ * registered, the blocks are freed one at a time through IMalloc::Free.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocBatch interface in the heap data object.
+ * - n = Number of elements in the ppv array.
+ * - ppv = Pointer to an array of pointers to the blocks to be freed.  NULL elements, and elements not allocated
+ *         by this heap, are ignored.  On return, every element of the array is NULL.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void mallocbatch_FreeBatch(IMallocBatch *pThis, UINT32 n, PPVOID ppv)
+{
+  PHEAPDATA phd = (PHEAPDATA)HeapDataPtr(pThis);   /* pointer to heap data */
+  register UINT32 i;                               /* loop counter */
+
+  if (!ppv)
+    return;
+  for (i = 0; i < n; i++)
+  {
+    if (phd->pMallocSpy)
+      malloc_Free((IMalloc *)phd, ppv[i]);
+    if (phd->pMallocSpy || (ppv[i] && !heap_owns(phd, ppv[i])))
+      ppv[i] = NULL;  /* already freed, or not our block */
+    else if (ppv[i])
+      PROF_FREE(phd, ppv[i]);
+  }
+  _HeapDAllocBatch(phd, n, ppv);
+}
+
+/* The IMallocBatch vtable. */
+static const SEG_RODATA struct IMallocBatchVTable vtblMallocBatch =
+{
+  .QueryInterface = mallocbatch_QueryInterface,
+  .AddRef = mallocbatch_AddRef,
+  .Release = mallocbatch_Release,
+  .AllocBatch = mallocbatch_AllocBatch,
+  .FreeBatch = mallocbatch_FreeBatch
+};
+
+/*-----------------------------
+ * IMallocSized implementation
+ *-----------------------------
+ */
+
+/* Quick macro to get the PHEAPDATA from the IMallocSized pointer */
+#undef HeapDataPtr
+#define HeapDataPtr(pms)     (((PBYTE)(pms)) - OFFSETOF(HEAPDATA, mallocSizedInterface))
+
+/*
+ * Queries for an interface on the heap object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocSized interface in the heap data object.
+ * - riid = Reference to the IID of the interface we want to load.
+ * - ppvObject = Pointer to the location to receive the new interface pointer.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator:
+ * - S_OK = New interface pointer was returned.
+ * - E_NOINTERFACE = The object does not support this interface.
+ * - E_POINTER = The ppvObject pointer is not valid.
+ */
+static HRESULT mallocsized_QueryInterface(IUnknown *pThis, REFIID riid, PPVOID ppvObject)
+{
+  return malloc_QueryInterface((IUnknown *)HeapDataPtr(pThis), riid, ppvObject);
+}
+
+/*
+ * Adds a reference to the heap data object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocSized interface in the heap data object.
+ *
+ * Returns:
+ * The new reference count on the object.
+ */
+static UINT32 mallocsized_AddRef(IUnknown *pThis)
+{
+  return malloc_AddRef((IUnknown *)HeapDataPtr(pThis));
+}
+
+/*
+ * Removes a reference from the heap data object.  The object is freed when its reference count reaches 0.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocSized interface in the heap data object.
+ *
+ * Returns:
+ * The new reference count on the object.
+ */
+static UINT32 mallocsized_Release(IUnknown *pThis)
+{
+  return malloc_Release((IUnknown *)HeapDataPtr(pThis));
+}
+
+/*
+ * Frees a block of memory, given the size it was allocated with.  Unlike IMalloc::Free, this does not look up
+ * the block's chunk to verify that the heap owns it, and the size is used to route the block straight to the
+ * right thread cache bin or arena path.  Blocks allocated through IMallocAligned may not be freed this way.
+ * If an IMallocSpy is registered, the size is ignored and the block is freed through IMalloc::Free.
+ *
+ * Parameters:
+ * - pThis = Pointer to the MallocSized interface in the heap data object.
+ * - pv = Pointer to the memory block to be freed.  If this is NULL, the call has no effect.  Otherwise, it
+ *        must have been allocated by this heap.
+ * - cb = The number of bytes passed to IMalloc::Alloc (or IMalloc::Realloc, if the block was reallocated)
+ *        when the block was allocated.
+ *
+ * Returns:
+ * Nothing.
+ */
+static void mallocsized_FreeSized(IMallocSized *pThis, PVOID pv, SIZE_T cb)
+{
+  PHEAPDATA phd = (PHEAPDATA)HeapDataPtr(pThis);   /* pointer to heap data */
+
+  if (phd->pMallocSpy)
+    malloc_Free((IMalloc *)phd, pv);
+  else if (pv)
+  {
+    PROF_FREE(phd, pv);
+    _HeapDAllocSized(phd, pv, intMax(cb, 1), TRUE);
+  }
+}
+
+/* The IMallocSized vtable. */
+static const SEG_RODATA struct IMallocSizedVTable vtblMallocSized =
+{
+  .QueryInterface = mallocsized_QueryInterface,
+  .AddRef = mallocsized_AddRef,
+  .Release = mallocsized_Release,
+  .FreeSized = mallocsized_FreeSized
+};
+
+/*--------------------------------
+ * IHeapStatistics implementation
+ *--------------------------------
+ */
+
+/* Quick macro to get the PHEAPDATA from the IHeapStatistics pointer */
+#undef HeapDataPtr
+#define HeapDataPtr(phs)     (((PBYTE)(phs)) - OFFSETOF(HEAPDATA, heapStatsInterface))
+
+/*
+ * Queries for an interface on the heap object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapStatistics interface in the heap data object.
+ * - riid = Reference to the IID of the interface we want to load.
+ * - ppvObject = Pointer to the location to receive the new interface pointer.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator:
+ * - S_OK = New interface pointer was returned.
+ * - E_NOINTERFACE = The object does not support this interface.
+ * - E_POINTER = The ppvObject pointer is not valid.
+ */
+static HRESULT heapstats_QueryInterface(IUnknown *pThis, REFIID riid, PPVOID ppvObject)
+{
+  return malloc_QueryInterface((IUnknown *)HeapDataPtr(pThis), riid, ppvObject);
+}
+
+/*
+ * Adds a reference to the heap data object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapStatistics interface in the heap data object.
+ *
+ * Returns:
+ * The new reference count on the object.
+ */
+static UINT32 heapstats_AddRef(IUnknown *pThis)
+{
+  return malloc_AddRef((IUnknown *)HeapDataPtr(pThis));
+}
+
+/*
+ * Removes a reference from the heap data object.  The object is freed when its reference count reaches 0.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapStatistics interface in the heap data object.
+ *
+ * Returns:
+ * The new reference count on the object.
+ */
+static UINT32 heapstats_Release(IUnknown *pThis)
+{
+  return malloc_Release((IUnknown *)HeapDataPtr(pThis));
+}
+
+/*
+ * Takes a new snapshot of the heap's statistics.  The Get methods report the most recent snapshot; if none has
+ * been taken yet, the first Get call takes one.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapStatistics interface in the heap data object.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+static HRESULT heapstats_Refresh(IHeapStatistics *pThis)
+{
+  return _HeapStatsRefresh((PHEAPDATA)HeapDataPtr(pThis));
+}
+
+/*
+ * Retrieves the heap-wide statistics from the current snapshot.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapStatistics interface in the heap data object.
+ * - pStats = Pointer to the structure to receive the statistics.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+static HRESULT heapstats_GetHeapStats(IHeapStatistics *pThis, PHEAPSTATS pStats)
+{
+  if (!pStats)
+    return E_POINTER;
+  return _HeapStatsGetHeap((PHEAPDATA)HeapDataPtr(pThis), pStats);
+}
+
+/*
+ * Retrieves the statistics for one arena, or the merged totals for all arenas, from the current snapshot.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapStatistics interface in the heap data object.
+ * - ndxArena = Index of the arena, or HEAPSTATS_ALL_ARENAS for the merged totals.
+ * - pStats = Pointer to the structure to receive the statistics.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator; S_FALSE if the arena has not been created yet.
+ */
+static HRESULT heapstats_GetArenaStats(IHeapStatistics *pThis, UINT32 ndxArena, PHEAPARENASTATS pStats)
+{
+  if (!pStats)
+    return E_POINTER;
+  return _HeapStatsGetArena((PHEAPDATA)HeapDataPtr(pThis), ndxArena, pStats);
+}
+
+/*
+ * Retrieves the statistics for one small size class (bin) of an arena, or its merged totals for all arenas,
+ * from the current snapshot.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapStatistics interface in the heap data object.
+ * - ndxArena = Index of the arena, or HEAPSTATS_ALL_ARENAS for the merged totals.
+ * - ndxBin = Index of the bin.
+ * - pStats = Pointer to the structure to receive the statistics.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator; S_FALSE if the arena has not been created yet.
+ */
+static HRESULT heapstats_GetBinStats(IHeapStatistics *pThis, UINT32 ndxArena, UINT32 ndxBin, PHEAPBINSTATS pStats)
+{
+  if (!pStats)
+    return E_POINTER;
+  return _HeapStatsGetBin((PHEAPDATA)HeapDataPtr(pThis), ndxArena, ndxBin, pStats);
+}
+
+/*
+ * Retrieves the statistics for one large size class of an arena, or its merged totals for all arenas, from the
+ * current snapshot.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapStatistics interface in the heap data object.
+ * - ndxArena = Index of the arena, or HEAPSTATS_ALL_ARENAS for the merged totals.
+ * - ndxClass = Index of the large size class; class n holds runs of n + 1 pages.
+ * - pStats = Pointer to the structure to receive the statistics.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator; S_FALSE if the arena has not been created yet.
+ */
+static HRESULT heapstats_GetLargeStats(IHeapStatistics *pThis, UINT32 ndxArena, UINT32 ndxClass,
+				       PHEAPLARGESTATS pStats)
+{
+  if (!pStats)
+    return E_POINTER;
+  return _HeapStatsGetLarge((PHEAPDATA)HeapDataPtr(pThis), ndxArena, ndxClass, pStats);
+}
+
+/*
+ * Takes a new snapshot of the heap's statistics and prints it as text.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapStatistics interface in the heap data object.
+ * - pstm = Pointer to the stream to print to.  If this is NULL, the debugging output stream connected to
+ *          the heap's ISequentialStream connection point is used.
+ * - uiFlags = HEAPSTATS_PRINT_xxx flags controlling what is printed.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+static HRESULT heapstats_Print(IHeapStatistics *pThis, ISequentialStream *pstm, UINT32 uiFlags)
+{
+  return _HeapStatsPrint((PHEAPDATA)HeapDataPtr(pThis), pstm, uiFlags);
+}
+
+/* The IHeapStatistics vtable. */
+static const SEG_RODATA struct IHeapStatisticsVTable vtblHeapStatistics =
+{
+  .QueryInterface = heapstats_QueryInterface,
+  .AddRef = heapstats_AddRef,
+  .Release = heapstats_Release,
+  .Refresh = heapstats_Refresh,
+  .GetHeapStats = heapstats_GetHeapStats,
+  .GetArenaStats = heapstats_GetArenaStats,
+  .GetBinStats = heapstats_GetBinStats,
+  .GetLargeStats = heapstats_GetLargeStats,
+  .Print = heapstats_Print
+};
+
+/*-----------------------------
+ * IHeapProfile implementation
+ *-----------------------------
+ */
+
+/* Quick macro to get the PHEAPDATA from the IHeapProfile pointer */
+#undef HeapDataPtr
+#define HeapDataPtr(php)     (((PBYTE)(php)) - OFFSETOF(HEAPDATA, heapProfInterface))
+
+/*
+ * Queries for an interface on the heap object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapProfile interface in the heap data object.
+ * - riid = Reference to the IID of the interface we want to load.
+ * - ppvObject = Pointer to the location to receive the new interface pointer.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator:
+ * - S_OK = New interface pointer was returned.
+ * - E_NOINTERFACE = The object does not support this interface.
+ * - E_POINTER = The ppvObject pointer is not valid.
+ */
+static HRESULT heapprof_QueryInterface(IUnknown *pThis, REFIID riid, PPVOID ppvObject)
+{
+  return malloc_QueryInterface((IUnknown *)HeapDataPtr(pThis), riid, ppvObject);
+}
+
+/*
+ * Adds a reference to the heap data object.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapProfile interface in the heap data object.
+ *
+ * Returns:
+ * The new reference count on the object.
+ */
+static UINT32 heapprof_AddRef(IUnknown *pThis)
+{
+  return malloc_AddRef((IUnknown *)HeapDataPtr(pThis));
+}
+
+/*
+ * Removes a reference from the heap data object.  The object is freed when its reference count reaches 0.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapProfile interface in the heap data object.
+ *
+ * Returns:
+ * The new reference count on the object.
+ */
+static UINT32 heapprof_Release(IUnknown *pThis)
+{
+  return malloc_Release((IUnknown *)HeapDataPtr(pThis));
+}
+
+/*
+ * Turns allocation sampling on or off.  Blocks sampled while it was on remain in the profile until they are
+ * freed.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapProfile interface in the heap data object.
+ * - fActive = TRUE to turn sampling on, FALSE to turn it off.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+static HRESULT heapprof_SetActive(IHeapProfile *pThis, BOOL fActive)
+{
+  return _HeapProfSetActive((PHEAPDATA)HeapDataPtr(pThis), fActive);
+}
+
+/*
+ * Retrieves the sampling interval.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapProfile interface in the heap data object.
+ * - pcbInterval = Pointer to a variable to receive the number of bytes allocated between samples.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+static HRESULT heapprof_GetInterval(IHeapProfile *pThis, SIZE_T *pcbInterval)
+{
+  if (!pcbInterval)
+    return E_POINTER;
+  *pcbInterval = ((PHEAPDATA)HeapDataPtr(pThis))->cbProfInterval;
+  return S_OK;
+}
+
+/*
+ * Sets the sampling interval.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapProfile interface in the heap data object.
+ * - cbInterval = Number of bytes allocated between samples.  Must be non-zero.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+static HRESULT heapprof_SetInterval(IHeapProfile *pThis, SIZE_T cbInterval)
+{
+  return _HeapProfSetInterval((PHEAPDATA)HeapDataPtr(pThis), cbInterval);
+}
+
+/*
+ * Discards all samples taken so far and resets the profile counters.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapProfile interface in the heap data object.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+static HRESULT heapprof_Reset(IHeapProfile *pThis)
+{
+  return _HeapProfReset((PHEAPDATA)HeapDataPtr(pThis));
+}
+
+/*
+ * Retrieves the live sampled allocations aggregated by call site, heaviest sites first.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapProfile interface in the heap data object.
+ * - ndxArena = Index of the arena whose samples are reported, HEAPPROF_ARENA_HUGE for huge allocations, or
+ *              HEAPSTATS_ALL_ARENAS for all samples.
+ * - cMax = Number of elements in the aSites array.
+ * - aSites = Pointer to the array to receive the sites.
+ * - pcSites = Pointer to a variable to receive the number of sites stored in aSites.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator; S_FALSE if there were more sites than would fit in aSites.
+ */
+static HRESULT heapprof_GetSiteTable(IHeapProfile *pThis, UINT32 ndxArena, UINT32 cMax, PHEAPPROFSITE aSites,
+				     PUINT32 pcSites)
+{
+  if (!pcSites || (!aSites && (cMax > 0)))
+    return E_POINTER;
+  return _HeapProfGetSiteTable((PHEAPDATA)HeapDataPtr(pThis), ndxArena, cMax, aSites, pcSites);
+}
+
+/*
+ * Prints the live sampled allocations aggregated by call site as text.
+ *
+ * Parameters:
+ * - pThis = Pointer to the HeapProfile interface in the heap data object.
+ * - pstm = Pointer to the stream to print to.  If this is NULL, the debugging output stream connected to
+ *          the heap's ISequentialStream connection point is used.
+ * - ndxArena = Index of the arena whose samples are printed, HEAPPROF_ARENA_HUGE for huge allocations, or
+ *              HEAPSTATS_ALL_ARENAS for all samples.
+ *
+ * Returns:
+ * Standard HRESULT success/failure indicator.
+ */
+static HRESULT heapprof_Print(IHeapProfile *pThis, ISequentialStream *pstm, UINT32 ndxArena)
+{
+  return _HeapProfPrint((PHEAPDATA)HeapDataPtr(pThis), pstm, ndxArena);
+}
+
+/* The IHeapProfile vtable. */
+static const SEG_RODATA struct IHeapProfileVTable vtblHeapProfile =
+{
+  .QueryInterface = heapprof_QueryInterface,
+  .AddRef = heapprof_AddRef,
+  .Release = heapprof_Release,
+  .SetActive = heapprof_SetActive,
+  .GetInterval = heapprof_GetInterval,
+  .SetInterval = heapprof_SetInterval,
+  .Reset = heapprof_Reset,
+  .GetSiteTable = heapprof_GetSiteTable,
+  .Print = heapprof_Print
+};
+
+/*------------------------
+ * Heap creation function
+ *------------------------
+ */
+
+#define DEFAULT_CBACTIVEDIRTYRATIO 3
+#define DEFAULT_CARENAS            4
+#define DEFAULT_CSPARECHUNKS       2
+
+/*
+ * Creates a heap implementation and returns a pointer to its IMalloc interface.
+ *
+ * Parameters:
+ * - prhd = Pointer to a RAWHEAPDATA structure, which contains sufficient memory to hold the global data
+ *          for the heap.
+ * - pfnFree = Pointer to a function called as the last stage of releasing the heap, which frees the
+ *             "prhd" block.  May be NULL.
+ * - uiFlags = Flag bits for the heap.
+ * - nChunkBits = Number of "bits" in a memory chunk that gets allocated.
+ * - cArenas = Number of arenas to spread allocating threads across.  If this is 0, a default is used.
+ * - pChunkAllocator = Pointer to the IChunkAllocator interface used by the heap to allocate chunks of memory
+ *                     for carving up by the heap.
+ * - pMutexFactory = Pointer to the IMutexFactory interface used to allocate IMutex objects.
+ * - pThreadLocalFactory = Pointer to the IThreadLocalFactory interface used to allocate IThreadLocal objects.
+ * - ppHeap = Pointer location that will receive a pointer to the heap's IMalloc interface.
+ *
+ * Returns:
+ * Standard HRESULT success/failure.
+ */
+HRESULT HeapCreate(PRAWHEAPDATA prhd, PFNRAWHEAPDATAFREE pfnFree, UINT32 uiFlags, UINT32 nChunkBits,
+		   UINT32 cArenas, IChunkAllocator *pChunkAllocator, IMutexFactory *pMutexFactory,
+		   IThreadLocalFactory *pThreadLocalFactory, IMalloc **ppHeap)
+{
+  PHEAPDATA phd;   /* pointer to actual heap data */
+  HRESULT hr;      /* HRESULT of intermediate operations */
+
+  if (sizeof(RAWHEAPDATA) < sizeof(HEAPDATA))
+    return MEMMGR_E_BADHEAPDATASIZE;  /* bogus size of raw heap data */
   if (uiFlags & ~PHDFLAGS_INIT)
     return E_INVALIDARG;   /* invalid flags */
-  if (!prhd || !pChunkAllocator || !ppHeap)
+  if (!prhd || !pChunkAllocator || !pMutexFactory || !pThreadLocalFactory || !ppHeap)
     return E_POINTER;      /* invalid pointers */
 
   /* initialize heap data */
@@ -636,8 +1943,14 @@ HRESULT HeapCreate(PRAWHEAPDATA prhd, PFNRAWHEAPDATAFREE pfnFree, UINT32 uiFlags
   phd->mallocInterface.pVTable = &vtblMalloc;
   phd->cpContainerInterface.pVTable = &vtblConnectionPointContainer;
   phd->heapConfInterface.pVTable = &vtblHeapConfiguration;
+  phd->mallocAlignedInterface.pVTable = &vtblMallocAligned;
+  phd->mallocBatchInterface.pVTable = &vtblMallocBatch;
+  phd->mallocSizedInterface.pVTable = &vtblMallocSized;
+  phd->heapStatsInterface.pVTable = &vtblHeapStatistics;
+  phd->heapProfInterface.pVTable = &vtblHeapProfile;
   phd->uiRefCount = 1;
-  phd->uiFlags = uiFlags | PHDFLAGS_PROFILE_ACTIVE;
+  phd->uiFlags = uiFlags;
+  phd->uiFillFlags = uiFlags & PHDFLAGS_FILL;
   phd->pfnFreeRawHeapData = pfnFree;
   phd->nChunkBits = nChunkBits;
   phd->szChunk = 1 << nChunkBits;
@@ -646,12 +1959,17 @@ HRESULT HeapCreate(PRAWHEAPDATA prhd, PFNRAWHEAPDATAFREE pfnFree, UINT32 uiFlags
   phd->uiChunkSizeMask = phd->szChunk - 1;
   phd->cpgChunk = phd->szChunk >> SYS_PAGE_BITS;
   phd->cbActiveDirtyRatio = DEFAULT_CBACTIVEDIRTYRATIO;
+  phd->cArenas = (cArenas ? cArenas : DEFAULT_CARENAS);
+  phd->cSpareChunksMax = DEFAULT_CSPARECHUNKS;
+  phd->nTCacheMaxClassBits = LG_TCACHE_MAXCLASS_DEFAULT;
 
   /* Set up the top-level data. */
   phd->pChunkAllocator = pChunkAllocator;
   IUnknown_AddRef(phd->pChunkAllocator);
   phd->pMutexFactory = pMutexFactory;
   IUnknown_AddRef(phd->pMutexFactory);
+  phd->pThreadLocalFactory = pThreadLocalFactory;
+  IUnknown_AddRef(phd->pThreadLocalFactory);
   ObjHlpFixedCpSetup(&(phd->fcpMallocSpy), (PUNKNOWN)phd, &IID_IMallocSpy, (IUnknown **)(&(phd->pMallocSpy)), 1, NULL);
   ObjHlpFixedCpSetup(&(phd->fcpSequentialStream), (PUNKNOWN)phd, &IID_ISequentialStream,
 		     (IUnknown **)(&(phd->pDebugStream)), 1, NULL);
@@ -663,14 +1981,34 @@ HRESULT HeapCreate(PRAWHEAPDATA prhd, PFNRAWHEAPDATAFREE pfnFree, UINT32 uiFlags
   hr = _HeapChunkSetup(phd);
   if (FAILED(hr))
     goto error1;
-
-
-
+  hr = _HeapHugeSetup(phd);
+  if (FAILED(hr))
+    goto error2;
+  hr = _HeapArenaSetup(phd);
+  if (FAILED(hr))
+    goto error3;
+  hr = _HeapTCacheSetup(phd, pThreadLocalFactory);
+  if (FAILED(hr))
+    goto error4;
+  hr = _HeapStatsSetup(phd);
+  if (FAILED(hr))
+    goto error5;
+  hr = _HeapProfSetup(phd);
+  if (FAILED(hr))
+    goto error6;
 
   *ppHeap = (IMalloc *)phd;
   return S_OK;
 
-  /*error2:*/
+error6:
+  _HeapStatsShutdown(phd);
+error5:
+  _HeapTCacheShutdown(phd);
+error4:
+  _HeapArenaShutdown(phd);
+error3:
+  _HeapHugeShutdown(phd);
+error2:
   _HeapChunkShutdown(phd);
 error1:
   _HeapBaseShutdown(phd);
@@ -81,7 +81,7 @@ void _HeapDbgWrite(PHEAPDATA phd, PCSTR sz)
  */
 static HRESULT heap_printf_func(PPVOID ppvArg, PCCHAR pchData, UINT32 cbData)
 {
-  return ISequentialStream_Write(((PSEQUENTIALSTREAM)ppvArg), pchData, cbData, NULL);
+  return ISequentialStream_Write((PSEQUENTIALSTREAM)(*ppvArg), pchData, cbData, NULL);
 }
 
 /*
@@ -107,6 +107,26 @@ void _HeapPrintf(PHEAPDATA phd, PCSTR szFormat, ...)
   }
 }
 
+/*
+ * Formats data to an output stream.
+ *
+ * Parameters:
+ * - pstm = Pointer to the output stream.
+ * - szFormat = Printf-style format string.
+ * - <var> = Arguments to be substituted into the printf-style format string.
+ *
+ * Returns:
+ * Nothing.
+ */
+void _HeapStreamPrintf(ISequentialStream *pstm, PCSTR szFormat, ...)
+{
+  va_list pargs;
+
+  va_start(pargs, szFormat);
+  StrFormatV8(heap_printf_func, (PPVOID)pstm, szFormat, pargs);
+  va_end(pargs);
+}
+
 /*
  * Called when an assertion in the code fails; it prints the assertion failure to the debugging output (if set)
  * and calls the heap's abort function (if set).
@@ -128,21 +148,23 @@ void _HeapAssertFailed(PHEAPDATA phd, PCSTR szFile, INT32 nLine)
 }
 
 /*
- * Compute the smallest power of 2 greater than or equal to its argument.
+ * Fills a newly-allocated block according to the current fill mode: with junk if junk fill is on, otherwise with
+ * zeroes if zero fill is on.  Callers test phd->uiFillFlags before calling, so this costs nothing with fill off.
  *
  * Parameters:
- * - x = The value to compute.
+ * - phd = Pointer to the HEAPDATA block.
+ * - pv = Pointer to the memory to be filled.
+ * - sz = Number of bytes to be filled.
  *
  * Returns:
- * The value that is the smallest power of 2 greater than or equal to x.
+ * Nothing.
  */
-SIZE_T _HeapPow2Ceiling(SIZE_T x)
+void _HeapFillAlloc(PHEAPDATA phd, PVOID pv, SIZE_T sz)
 {
-  x--;
-  x |= (x >> 1);  /* this sequence sets all bits at or below the topmost one to 1 */
-  x |= (x >> 2);
-  x |= (x >> 4);
-  x |= (x >> 8);
-  x |= (x >> 16);
-  return ++x;     /* which ensures that this is a power of 2 */
+  UINT32 uiFill = phd->uiFillFlags;   /* snapshot of the fill mode */
+
+  if (uiFill & PHDFLAGS_JUNKFILL)
+    StrSetMem(pv, JUNK_ALLOC, sz);
+  else if (uiFill & PHDFLAGS_ZEROFILL)
+    StrSetMem(pv, 0, sz);
 }
@@ -50,3 +50,5 @@
 #include <comrogue/connpoint.h>
 #include <comrogue/stream.h>
 #include <comrogue/allocator.h>
+#include <comrogue/mutex.h>
+#include <comrogue/threadlocal.h>
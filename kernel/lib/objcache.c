@@ -0,0 +1,168 @@
+/*
+ * This file is part of the COMROGUE Operating System for Raspberry Pi
+ *
+ * Copyright (c) 2013, Eric J. Bowersox / Erbosoft Enterprises
+ * All rights reserved.
+ *
+ * This program is free for commercial and non-commercial use as long as the following conditions are
+ * adhered to.
+ *
+ * Copyright in this file remains Eric J. Bowersox and/or Erbosoft, and as such any copyright notices
+ * in the code are not to be removed.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ * 
+ * * Redistributions of source code must retain the above copyright notice, this list of conditions and
+ *   the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ *   the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * "Raspberry Pi" is a trademark of the Raspberry Pi Foundation.
+ */
+#include <comrogue/types.h>
+#include <comrogue/intlib.h>
+#include <comrogue/allocator.h>
+#include <comrogue/mutex.h>
+#include <comrogue/internals/mmu.h>
+#include <comrogue/internals/objcache.h>
+
+/*--------------------------------------------------------------------------------------------------------
+ * Typed object caches for fixed-size kernel metadata.  Each cache hands out objects of a single size,
+ * carved from slabs obtained from a caller-supplied slab allocator, and keeps its own free list of
+ * returned objects (linked through their first word).  Objects no larger than a cache line are packed so
+ * that none of them straddles a cache line boundary.  Slabs are never given back to the slab allocator.
+ *--------------------------------------------------------------------------------------------------------
+ */
+
+#define lock_cache(poc)    do { if ((poc)->pmtx) IMutex_Lock((poc)->pmtx); } while (0)
+#define unlock_cache(poc)  do { if ((poc)->pmtx) IMutex_Unlock((poc)->pmtx); } while (0)
+
+/*
+ * Standard slab allocator function, which obtains slabs from an IMalloc interface.
+ *
+ * Parameters:
+ * - pvMalloc = Pointer to the IMalloc interface to allocate slabs from.
+ * - cb = Number of bytes in the slab.
+ *
+ * Returns:
+ * - NULL = Allocation failed.
+ * - Other = Pointer to the new slab.
+ */
+PVOID ObjCacheStdSlabAlloc(PVOID pvMalloc, SIZE_T cb)
+{
+  return IMalloc_Alloc((PMALLOC)pvMalloc, cb);
+}
+
+/*
+ * Initializes an object cache.
+ *
+ * Parameters:
+ * - poc = Pointer to the object cache to be initialized.
+ * - cbObject = Size of the objects to be handed out by the cache.
+ * - cbSlab = Size of each slab to be obtained from the slab allocator.  Must be large enough to hold at least
+ *            one object after alignment to a cache line.
+ * - pfnCtor = Pointer to a constructor function to be run on each object as it is handed out by ObjCacheAlloc,
+ *             or NULL if no constructor is required.
+ * - pfnSlabAlloc = Pointer to the function used to obtain new slabs.  It is called with the cache mutex unlocked.
+ * - pvSlabArg = Argument to be passed to pfnSlabAlloc.
+ * - pmtx = Pointer to the mutex protecting the cache, or NULL if the caller serializes access to the cache.
+ *
+ * Returns:
+ * Nothing.
+ */
+void ObjCacheInit(POBJCACHE poc, SIZE_T cbObject, SIZE_T cbSlab, PFNOBJCTOR pfnCtor,
+		  PFNOBJSLABALLOC pfnSlabAlloc, PVOID pvSlabArg, IMutex *pmtx)
+{
+  if (cbObject < sizeof(PVOID))
+    cbObject = sizeof(PVOID);  /* need room for the free list link */
+  if (cbObject <= SYS_CACHELINE_SIZE)
+    cbObject = IntPow2Ceiling(cbObject);  /* power-of-2 sizes pack evenly into cache lines */
+  else
+    cbObject = (cbObject + sizeof(PVOID) - 1) & ~(sizeof(PVOID) - 1);
+  poc->cbObject = cbObject;
+  poc->cbSlab = cbSlab;
+  poc->pfnCtor = pfnCtor;
+  poc->pfnSlabAlloc = pfnSlabAlloc;
+  poc->pvSlabArg = pvSlabArg;
+  poc->pmtx = pmtx;
+  poc->pvFree = NULL;
+  poc->uiNext = poc->uiPast = 0;
+  poc->cSlabs = poc->cInUse = 0;
+}
+
+/*
+ * Allocates an object from an object cache.  Objects are taken from the cache's free list first, then carved from
+ * the current slab; a new slab is obtained only when both are exhausted.
+ *
+ * Parameters:
+ * - poc = Pointer to the object cache.
+ *
+ * Returns:
+ * - NULL = Allocation failed.
+ * - Other = Pointer to the new object, which has had the cache's constructor (if any) run on it.
+ */
+PVOID ObjCacheAlloc(POBJCACHE poc)
+{
+  PVOID rc = NULL;   /* return from this function */
+  UINT_PTR uiSlab;   /* pointer to new slab */
+
+  lock_cache(poc);
+  if (poc->pvFree)
+  { /* pull an object off the free list */
+    rc = poc->pvFree;
+    poc->pvFree = *((PPVOID)rc);
+  }
+  else if ((poc->uiNext + poc->cbObject) > poc->uiPast)
+  { /* get a new slab, without holding the lock across the call */
+    unlock_cache(poc);
+    uiSlab = (UINT_PTR)((*(poc->pfnSlabAlloc))(poc->pvSlabArg, poc->cbSlab));
+    if (!uiSlab)
+      return NULL;
+    lock_cache(poc);
+    /* Anything left in a slab another caller may have installed in the meantime is abandoned. */
+    poc->uiPast = uiSlab + poc->cbSlab;
+    poc->uiNext = SYS_CACHELINE_CEILING(uiSlab);
+    poc->cSlabs++;
+  }
+  if (!rc && ((poc->uiNext + poc->cbObject) <= poc->uiPast))
+  { /* carve an object from the current slab */
+    rc = (PVOID)(poc->uiNext);
+    poc->uiNext += poc->cbObject;
+  }
+  if (rc)
+    poc->cInUse++;
+  unlock_cache(poc);
+
+  if (rc && poc->pfnCtor)
+    (*(poc->pfnCtor))(rc);
+  return rc;
+}
+
+/*
+ * Returns an object to the free list of its object cache.
+ *
+ * Parameters:
+ * - poc = Pointer to the object cache.
+ * - pv = Pointer to the object being freed.  Must have been allocated from this cache.
+ *
+ * Returns:
+ * Nothing.
+ */
+void ObjCacheFree(POBJCACHE poc, PVOID pv)
+{
+  lock_cache(poc);
+  *((PPVOID)pv) = poc->pvFree;
+  poc->pvFree = pv;
+  poc->cInUse--;
+  unlock_cache(poc);
+}
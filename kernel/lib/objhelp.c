@@ -37,6 +37,8 @@
 #include <comrogue/allocator.h>
 #include <comrogue/stdobj.h>
 #include <comrogue/stream.h>
+#include <comrogue/mutex.h>
+#include <comrogue/threadlocal.h>
 #include <comrogue/objhelp.h>
 
 /*--------------------------------------------
@@ -93,10 +95,15 @@ HRESULT ObjHlpStandardQueryInterface_ ## iface (IUnknown *pThis, REFIID riid, PP
   return S_OK; \
 } 
 
+MAKE_BASE_QI(IChunkAllocator)
 MAKE_BASE_QI(IConnectionPoint)
 MAKE_BASE_QI(IEnumConnections)
 MAKE_BASE_QI(IMalloc)
+MAKE_BASE_QI(IMutex)
+MAKE_BASE_QI(IMutexFactory)
 MAKE_BASE_QI(ISequentialStream)
+MAKE_BASE_QI(IThreadLocal)
+MAKE_BASE_QI(IThreadLocalFactory)
 
 /*
  * "Dummy" version of AddRef/Release used for static objects.
@@ -150,6 +150,7 @@ static HRESULT fixedcp_Advise(IConnectionPoint *pThis, IUnknown *punkSink, UINT3
       pData->ppSlots[i] = punkActualSink;
       *puiCookie = (UINT32)((i + 1) ^ FIXEDCP_MASK);
       pData->ncpSize++;
+      pData->uiGeneration++;
       return S_OK;
     }
   }
@@ -184,6 +185,7 @@ static HRESULT fixedcp_Unadvise(IConnectionPoint *pThis, UINT32 uiCookie)
   IUnknown_Release(pData->ppSlots[i]);
   pData->ppSlots[i] = NULL;
   pData->ncpSize--;
+  pData->uiGeneration++;
   return S_OK;
 }
 
@@ -282,6 +284,7 @@ void ObjHlpFixedCpSetup(PFIXEDCPDATA pData, PUNKNOWN punkOuter, REFIID riidConne
   pData->ncpSize = 0;
   pData->ncpCapacity = nSlots;
   pData->pAllocator = pAllocator;
+  pData->uiGeneration = 0;
   if (pData->pAllocator)
     IUnknown_AddRef(pData->pAllocator);
   StrSetMem(ppSlots, 0, nSlots * sizeof(IUnknown *));
@@ -244,6 +244,7 @@ PVOID RbtFindPredecessor(PRBTREE ptree, TREEKEY key)
   register PVOID pCurrent;  /* pointer to current node */
   register PRBTREENODE ptn = ptree->ptnRoot; /* current node */
   register int cmp;  /* compare result */
+  PVOID pBest = NULL;  /* closest predecessor seen so far */
 
   while (ptn)
   {
@@ -253,15 +254,13 @@ PVOID RbtFindPredecessor(PRBTREE ptree, TREEKEY key)
       return pCurrent;  /* found */
     else if (cmp > 0)
     {
-      if (rbtNodeRight(ptn))
-	ptn = rbtNodeRight(ptn);
-      else
-	return pCurrent; /* found predecessor */
+      pBest = pCurrent;  /* this node precedes the key; anything closer is to the right */
+      ptn = rbtNodeRight(ptn);
     }
     else
       ptn = ptn->ptnLeft;
   }
-  return NULL; /* not found */
+  return pBest;
 }
 
 /*
@@ -281,6 +280,7 @@ PVOID RbtFindSuccessor(PRBTREE ptree, TREEKEY key)
   register PVOID pCurrent;  /* pointer to current node */
   register PRBTREENODE ptn = ptree->ptnRoot; /* current node */
   register int cmp;  /* compare result */
+  PVOID pBest = NULL;  /* closest successor seen so far */
 
   while (ptn)
   {
@@ -290,15 +290,13 @@ PVOID RbtFindSuccessor(PRBTREE ptree, TREEKEY key)
       return pCurrent;  /* found */
     else if (cmp < 0)
     {
-      if (ptn->ptnLeft)
-	ptn = ptn->ptnLeft;
-      else
-	return pCurrent;  /* found successor */
+      pBest = pCurrent;  /* this node succeeds the key; anything closer is to the left */
+      ptn = ptn->ptnLeft;
     }
     else
       ptn = rbtNodeRight(ptn);
   }
-  return NULL; /* not found */
+  return pBest;
 }
 
 /*
@@ -33,6 +33,7 @@
 #include <comrogue/allocator.h>
 #include <comrogue/internals/memmgr.h>
 #include <comrogue/internals/rbtree.h>
+#include <comrogue/internals/objcache.h>
 #include <comrogue/internals/layout.h>
 #include <comrogue/internals/mmu.h>
 #include <comrogue/internals/seg.h>
@@ -173,8 +174,11 @@ typedef struct tagALLOC_STRUC {
   PADDRTREENODE patnFound;           /* pointer to "found" tree node */
 } ALLOC_STRUC, *PALLOC_STRUC;
 
+#define ADDRTREENODE_SLAB_SIZE  1024  /* bytes per slab of address tree nodes */
+
 static RBTREE g_rbtFreeAddrs;          /* free address tree */
 static PMALLOC g_pMalloc = NULL;       /* allocator we use */
+static OBJCACHE g_ocAddrTreeNodes;     /* cache of address tree nodes */
 
 /*
  * Given a pointer to an ADDRTREENODE, returns its key value (pointer to its interval).
@@ -229,11 +233,11 @@ static PVOID get_addrtreenode_from_rbtreenode(PRBTREENODE ptn)
  * - Nothing.
  *
  * Side effects:
- * Modifies g_rbtFreeAddrs; allocates space from the g_pMalloc heap.
+ * Modifies g_rbtFreeAddrs; allocates a node from g_ocAddrTreeNodes.
  */
 static void insert_into_tree(KERNADDR kaFirst, KERNADDR kaLast)
 {
-  PADDRTREENODE pnode = IMalloc_Alloc(g_pMalloc, sizeof(ADDRTREENODE));
+  PADDRTREENODE pnode = ObjCacheAlloc(&g_ocAddrTreeNodes);
   ASSERT(pnode);
   rbtNewNode(&(pnode->rbtn));
   init_interval(&(pnode->ai), kaFirst, kaLast);
@@ -272,7 +276,7 @@ static BOOL alloc_check_space(PVOID pUnused, PADDRTREENODE pnode, PALLOC_STRUC p
  * Base address of the block of address space we got.
  *
  * Side effects:
- * May modify g_rbtFreeAddrs and free space to the g_pMalloc heap.
+ * May modify g_rbtFreeAddrs and free nodes to g_ocAddrTreeNodes.
  *
  * N.B.:
  * Running out of kernel address space should be a bug.
@@ -298,7 +302,7 @@ KERNADDR _MmAllocKernelAddr(UINT32 cpgNeeded)
   {
     /* This node is all used up by this allocation.  Remove it from the tree and free it. */
     RbtDelete(&g_rbtFreeAddrs, (TREEKEY)(&(alloc_struc.patnFound->ai)));
-    IMalloc_Free(g_pMalloc, alloc_struc.patnFound);
+    ObjCacheFree(&g_ocAddrTreeNodes, alloc_struc.patnFound);
   }
   else
   {
@@ -322,7 +326,7 @@ KERNADDR _MmAllocKernelAddr(UINT32 cpgNeeded)
  * Nothing.
  *
  * Side effects:
- * May modify g_rbtFreeAddrs and allocate or free space in the g_pMalloc heap.
+ * May modify g_rbtFreeAddrs and allocate or free nodes in g_ocAddrTreeNodes.
  */
 void _MmFreeKernelAddr(KERNADDR kaBase, UINT32 cpgToFree)
 {
@@ -339,7 +343,7 @@ void _MmFreeKernelAddr(KERNADDR kaBase, UINT32 cpgToFree)
     { /* combine predecessor, interval, and successor into one big node */
       RbtDelete(&g_rbtFreeAddrs, (TREEKEY)(&(patnPred->ai)));
       patnPred->ai.kaLast = patnSucc->ai.kaLast;
-      IMalloc_Free(g_pMalloc, patnSucc);
+      ObjCacheFree(&g_ocAddrTreeNodes, patnSucc);
     }
     else  /* combine with predecessor */
       patnPred->ai.kaLast = aiFree.kaLast;
@@ -364,6 +368,8 @@ SEG_INIT_CODE void _MmInitKernelSpace(PSTARTUP_INFO pstartup, PMALLOC pmInitHeap
 {
   g_pMalloc = pmInitHeap;
   IUnknown_AddRef(g_pMalloc);
+  ObjCacheInit(&g_ocAddrTreeNodes, sizeof(ADDRTREENODE), ADDRTREENODE_SLAB_SIZE, NULL, ObjCacheStdSlabAlloc,
+	       g_pMalloc, NULL);
   rbtInitTree(&g_rbtFreeAddrs, (PFNTREECOMPARE)interval_compare, get_interval_from_addrtreenode,
 	      get_rbtreenode_from_addrtreenode, get_addrtreenode_from_rbtreenode);
   insert_into_tree(pstartup->vmaFirstFree, VMADDR_IO_BASE);
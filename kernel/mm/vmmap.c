@@ -38,6 +38,7 @@
 #include <comrogue/internals/mmu.h>
 #include <comrogue/internals/memmgr.h>
 #include <comrogue/internals/rbtree.h>
+#include <comrogue/internals/objcache.h>
 #include <comrogue/internals/startup.h>
 #include <comrogue/internals/trace.h>
 #include "initfuncs.h"
@@ -52,7 +53,10 @@ DECLARE_THIS_FILE
  *-----------------------------------------------------------------------------------
  */
 
+#define PAGENODE_SLAB_SIZE  1024       /* bytes per slab of page nodes */
+
 static PMALLOC g_pMalloc = NULL;      /* allocator used */
+static OBJCACHE g_ocPageNodes;        /* cache of page nodes */
 static VMCTXT g_vmctxtKernel = {      /* kernel VM context */
   .pTTB = NULL,
   .pTTBAux = NULL,
@@ -722,10 +726,10 @@ static HRESULT alloc_page_table(PVMCTXT pvmctxt, PTTB pttbEntry, PTTBAUX pttbAux
 	  hr = map_pages0(pvmctxt, paNewPage, kaNewPage, 1, TTBFLAGS_KERNEL_DATA, PGTBLFLAGS_KERNEL_DATA,
 			  PGAUXFLAGS_KERNEL_DATA, MAP_DONT_ALLOC);
 	  if (SUCCEEDED(hr))
-	  { /* allocate heap memory for two nodes to describe the page tables */
-	    ppgnFree = IMalloc_Alloc(g_pMalloc, sizeof(PAGENODE));
+	  { /* allocate two nodes to describe the page tables */
+	    ppgnFree = ObjCacheAlloc(&g_ocPageNodes);
 	    if (ppgnFree)
-	      ppgn = IMalloc_Alloc(g_pMalloc, sizeof(PAGENODE));
+	      ppgn = ObjCacheAlloc(&g_ocPageNodes);
 	    if (ppgnFree && ppgn)
 	    { /* prepare the new nodes and insert them in their respective trees */
 	      rbtNewNode(&(ppgnFree->rbtn));
@@ -740,7 +744,7 @@ static HRESULT alloc_page_table(PVMCTXT pvmctxt, PTTB pttbEntry, PTTBAUX pttbAux
 	    else
 	    { /* could not allocate both, free one if was allocated */
 	      if (ppgnFree)
-		IMalloc_Free(g_pMalloc, ppgnFree);
+		ObjCacheFree(&g_ocPageNodes, ppgnFree);
 	      hr = E_OUTOFMEMORY;
 	    }
 	    if (FAILED(hr))
@@ -1112,6 +1116,7 @@ SEG_INIT_CODE void _MmInitVMMap(PSTARTUP_INFO pstartup, PMALLOC pmInitHeap)
   /* Initialize the local variables in this module. */
   g_pMalloc = pmInitHeap;
   IUnknown_AddRef(g_pMalloc);
+  ObjCacheInit(&g_ocPageNodes, sizeof(PAGENODE), PAGENODE_SLAB_SIZE, NULL, ObjCacheStdSlabAlloc, g_pMalloc, NULL);
   g_vmctxtKernel.pTTB = (PTTB)(pstartup->kaTTB);
   g_vmctxtKernel.pTTBAux = (PTTBAUX)(pstartup->kaTTBAux);
   g_vmctxtKernel.paTTB = pstartup->paTTB;
@@ -1133,7 +1138,7 @@ SEG_INIT_CODE void _MmInitVMMap(PSTARTUP_INFO pstartup, PMALLOC pmInitHeap)
 				PGTBLFLAGS_KERNEL_DATA, PGAUXFLAGS_KERNEL_DATA, MAP_DONT_ALLOC)));
 
     /* allocate node for first page table on page */
-    ppgn = IMalloc_Alloc(g_pMalloc, sizeof(PAGENODE));
+    ppgn = ObjCacheAlloc(&g_ocPageNodes);
     ASSERT(ppgn);
     rbtNewNode(&(ppgn->rbtn));
     ppgn->paPageTable = paPageTable;
@@ -1141,7 +1146,7 @@ SEG_INIT_CODE void _MmInitVMMap(PSTARTUP_INFO pstartup, PMALLOC pmInitHeap)
     RbtInsert(&(g_vmctxtKernel.rbtPageTables), ppgn);
 
     /* allocate node for second page table on page */
-    ppgn = IMalloc_Alloc(g_pMalloc, sizeof(PAGENODE));
+    ppgn = ObjCacheAlloc(&g_ocPageNodes);
     ASSERT(ppgn);
     rbtNewNode(&(ppgn->rbtn));
     ppgn->paPageTable = paPageTable + sizeof(PAGETAB);
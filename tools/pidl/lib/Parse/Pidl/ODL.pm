@@ -71,7 +71,7 @@ sub ODL2IDL
 					next;
 				}
 				my $podl = Parse::Pidl::IDL::parse_file($idl_path, $opt_incdirs);
-				if (defined(@$podl)) {
+				if (@$podl) {
 					require Parse::Pidl::Typelist;
 					my $basename = basename($idl_path, ".idl");
 